@@ -243,16 +243,7 @@ void TreeBillboardApp::UpdateScene(float dt)
 	D3D11_MAPPED_SUBRESOURCE mappedData;
 	HR(d3d_context_->Map(m_WaveVB, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedData));
 
-	auto v = (Vertex::Basic32*)mappedData.pData;
-	for (int i = 0; i < m_Wave.VertexCount(); ++i)
-	{
-		v[i].Pos = m_Wave[i];
-		v[i].Normal = m_Wave.Normal(i);
-
-		// Derive tex-coords in [0,1] from position.
-		v[i].Tex.x = 0.5f + m_Wave[i].x / m_Wave.Width();
-		v[i].Tex.y = 0.5f - m_Wave[i].z / m_Wave.Depth();
-	}
+	m_Wave.WriteVertices(mappedData.pData, sizeof(Vertex::Basic32), Waves::LayoutPositionNormalTex);
 
 	d3d_context_->Unmap(m_WaveVB, 0);
 
@@ -8,6 +8,9 @@
 #include "Vertex.h"
 #include "RenderStates.h"
 #include "Waves.h"
+#include "BVH.h"
+#include "LooseOctree.h"
+#include "Benchmark.h"
 
 #include "Camera.h"
 
@@ -18,6 +21,44 @@ struct InstanceData
 	XMFLOAT4 Color;
 };
 
+// Reads the car model shared by the demo and the headless benchmark.
+static bool LoadCarModel(std::vector<Vertex::Basic32>& vertices, std::vector<UINT>& indices)
+{
+	std::ifstream fin("Models/car.txt");
+
+	if (!fin)
+	{
+		return false;
+	}
+
+	UINT vcount = 0;
+	UINT tcount = 0;
+	std::string ignore;
+
+	fin >> ignore >> vcount;
+	fin >> ignore >> tcount;
+	fin >> ignore >> ignore >> ignore >> ignore;
+
+	vertices.resize(vcount);
+	for (UINT i = 0; i < vcount; ++i)
+	{
+		fin >> vertices[i].Pos.x >> vertices[i].Pos.y >> vertices[i].Pos.z;
+		fin >> vertices[i].Normal.x >> vertices[i].Normal.y >> vertices[i].Normal.z;
+	}
+
+	fin >> ignore;
+	fin >> ignore;
+	fin >> ignore;
+
+	indices.resize(3 * tcount);
+	for (UINT i = 0; i < tcount; ++i)
+	{
+		fin >> indices[i * 3 + 0] >> indices[i * 3 + 1] >> indices[i * 3 + 2];
+	}
+
+	return true;
+}
+
 class PickingApp : public D3DApp
 {
 public:
@@ -39,7 +80,11 @@ private:
 
 	void DrawLocalAABB(const Box& box);
 
+	void AnimateInstances(float dt);
+	void BuildSceneBVH();
+
 	void Pick(int x, int y);
+	void Select(int x0, int y0, int x1, int y1);
 
 private:
 	ID3D11Buffer* m_CarVB;
@@ -71,9 +116,37 @@ private:
 
 	std::vector<UINT> m_VisibleObjectIndices;
 
+	// Whether each instance was drawn last frame; only those can be picked.
+	std::vector<bool> m_IsInstanceVisible;
+
+	// Triangle hierarchy of the car shared by every instance.
+	MeshBVH m_CarBVH;
+
+	// World bounds of the instances for culling, picking and selection.  It
+	// is filled in instance order, so its handles are instance indices.
+	LooseOctree m_InstanceOctree;
+
+	// B culls, picks and selects through an instance BVH instead, rebuilt
+	// when the cars have moved; O goes back to the octree.
+	SceneBVH m_SceneBVH;
+	bool m_UseSceneBVH;
+	bool m_IsSceneBVHStale;
+
+	// M starts moving the cars around their grid positions, F freezes them.
+	bool m_IsAnimating;
+	float m_AnimationTime;
+	std::vector<XMFLOAT3> m_InstanceBasePositions;
+
+	// Index into m_InstancedData of the picked instance.
 	int m_PickedMesh;
 	int m_PickedTriangle;
 
+	// Shift + left drag selects every instance inside the rectangle.
+	bool m_IsSelecting;
+	POINT m_SelectionStart;
+	std::vector<UINT> m_SelectedInstances;
+	std::vector<bool> m_IsInstanceSelected;
+
 	Camera m_Camera;
 
 	POINT m_LastMousePos;
@@ -87,8 +160,13 @@ PickingApp::PickingApp(HINSTANCE hInstance)
 	, m_VisibleObjectCount(0)
 	, m_IsFrustumCullingEnabled(true)
 	, m_VisibleObjectIndices(m_InstanceNumPerDimension * m_InstanceNumPerDimension* m_InstanceNumPerDimension)
+	, m_UseSceneBVH(false)
+	, m_IsSceneBVHStale(true)
+	, m_IsAnimating(false)
+	, m_AnimationTime(0.0f)
 	, m_PickedMesh(-1)
 	, m_PickedTriangle(-1)
+	, m_IsSelecting(false)
 {
 	main_wnd_caption_ = L"Picking Demo";
 	enable_4x_msaa_ = true;
@@ -175,6 +253,28 @@ void PickingApp::UpdateScene(float dt)
 	if (GetAsyncKeyState('N') & 0x8000)
 		m_IsFrustumCullingEnabled = false;
 
+	if (GetAsyncKeyState('M') & 0x8000)
+		m_IsAnimating = true;
+
+	if (GetAsyncKeyState('F') & 0x8000)
+		m_IsAnimating = false;
+
+	if (GetAsyncKeyState('B') & 0x8000)
+		m_UseSceneBVH = true;
+
+	if (GetAsyncKeyState('O') & 0x8000)
+		m_UseSceneBVH = false;
+
+	if (m_IsAnimating)
+	{
+		AnimateInstances(dt);
+	}
+
+	if (m_UseSceneBVH && m_IsSceneBVHStale)
+	{
+		BuildSceneBVH();
+	}
+
 	
 
 	/*if (GetAsyncKeyState('2') & 0x8000)
@@ -193,24 +293,41 @@ void PickingApp::UpdateScene(float dt)
 
 	if (m_IsFrustumCullingEnabled)
 	{
-		for (int i = 0; i < m_InstancedData.size(); ++i)
+		// The full screen rectangle gives the world space view frustum.
+		Frustum frustum = m_Camera.GetSubFrustum(-1.0f, 1.0f, 1.0f, -1.0f);
+		if (m_UseSceneBVH)
+		{
+			m_SceneBVH.SelectInFrustum(frustum, m_VisibleObjectIndices);
+		}
+		else
+		{
+			m_InstanceOctree.SelectInFrustum(frustum, m_VisibleObjectIndices);
+		}
+
+		m_IsInstanceVisible.assign(m_InstancedData.size(), false);
+		for (UINT k = 0; k < m_VisibleObjectIndices.size(); ++k)
 		{
-			XMMATRIX W = XMLoadFloat4x4(&m_InstancedData[i].World);
-			m_Camera.CalLocalFrustum(W);
-			if (m_Camera.GetFrustum().IsIntersected(m_CarBox))
+			UINT i = m_VisibleObjectIndices[k];
+			m_IsInstanceVisible[i] = true;
+			data[m_VisibleObjectCount] = m_InstancedData[i];
+			if (m_IsInstanceSelected[i])
 			{
-				data[m_VisibleObjectCount] = m_InstancedData[i];
-				m_VisibleObjectIndices[m_VisibleObjectCount] = i;
-				++m_VisibleObjectCount;
+				data[m_VisibleObjectCount].Color = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
 			}
+			++m_VisibleObjectCount;
 		}
 	}
 	else  // No culling enabled, draw all objects.
 	{
+		m_IsInstanceVisible.assign(m_InstancedData.size(), true);
 		for (int i = 0; i < m_InstancedData.size(); ++i)
 		{
-
-			data[m_VisibleObjectCount++] = m_InstancedData[i];
+			data[m_VisibleObjectCount] = m_InstancedData[i];
+			if (m_IsInstanceSelected[i])
+			{
+				data[m_VisibleObjectCount].Color = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
+			}
+			++m_VisibleObjectCount;
 		}
 	}
 
@@ -220,7 +337,9 @@ void PickingApp::UpdateScene(float dt)
 	outs.precision(6);
 	outs << L"Picking Demo" <<
 		L"    " << m_VisibleObjectCount <<
-		L" objects visible out of " << m_InstancedData.size();
+		L" objects visible out of " << m_InstancedData.size() <<
+		L"    " << m_SelectedInstances.size() << L" selected" <<
+		L"    " << (m_UseSceneBVH ? L"BVH" : L"octree");
 	main_wnd_caption_ = outs.str();
 }
 
@@ -285,7 +404,7 @@ void PickingApp::DrawScene()
 		// to highlight it. 
 		d3d_context_->OMSetDepthStencilState(RenderStates::LessEqualDSS, 0);
 		
-		XMMATRIX world = XMLoadFloat4x4(&m_InstancedData[m_VisibleObjectIndices[m_PickedMesh]].World);
+		XMMATRIX world = XMLoadFloat4x4(&m_InstancedData[m_PickedMesh].World);
 		XMMATRIX worldInvTranspose = MathHelper::InverseTranspose(world);
 		XMMATRIX wvp = world * m_Camera.ViewProj();
 
@@ -311,7 +430,16 @@ void PickingApp::OnMouseDown(WPARAM btnState, int x, int y)
 {
 	if ((btnState & MK_LBUTTON) != 0)
 	{
-		Pick(x, y);
+		if ((btnState & MK_SHIFT) != 0)
+		{
+			m_IsSelecting = true;
+			m_SelectionStart.x = x;
+			m_SelectionStart.y = y;
+		}
+		else
+		{
+			Pick(x, y);
+		}
 	}
 
 	SetCapture(main_wnd_);
@@ -319,6 +447,12 @@ void PickingApp::OnMouseDown(WPARAM btnState, int x, int y)
 
 void PickingApp::OnMouseUp(WPARAM btnState, int x, int y)
 {
+	if (m_IsSelecting)
+	{
+		m_IsSelecting = false;
+		Select(m_SelectionStart.x, m_SelectionStart.y, x, y);
+	}
+
 	ReleaseCapture();
 }
 
@@ -340,32 +474,23 @@ void PickingApp::OnMouseMove(WPARAM btnState, int x, int y)
 
 void PickingApp::BuildCarGeometryBuffers()
 {
-	std::ifstream fin("Models/car.txt");
-
-	if (!fin)
+	if (!LoadCarModel(m_CarVertices, m_CarIndices))
 	{
 		MessageBox(0, L"Models/car.txt not found.", 0, 0);
 		return;
 	}
 
-	UINT vcount = 0;
-	UINT tcount = 0;
-	std::string ignore;
-
-	fin >> ignore >> vcount;
-	fin >> ignore >> tcount;
-	fin >> ignore >> ignore >> ignore >> ignore;
+	UINT vcount = m_CarVertices.size();
 
 	XMFLOAT3 vMinf3(+MathHelper::Infinity, +MathHelper::Infinity, +MathHelper::Infinity);
 	XMFLOAT3 vMaxf3(-MathHelper::Infinity, -MathHelper::Infinity, -MathHelper::Infinity);
 
 	XMVECTOR vMin = XMLoadFloat3(&vMinf3);
 	XMVECTOR vMax = XMLoadFloat3(&vMaxf3);
-	m_CarVertices.resize(vcount);
+	std::vector<XMFLOAT3> positions(vcount);
 	for (UINT i = 0; i < vcount; ++i)
 	{
-		fin >> m_CarVertices[i].Pos.x >> m_CarVertices[i].Pos.y >> m_CarVertices[i].Pos.z;
-		fin >> m_CarVertices[i].Normal.x >> m_CarVertices[i].Normal.y >> m_CarVertices[i].Normal.z;
+		positions[i] = m_CarVertices[i].Pos;
 
 		XMVECTOR P = XMLoadFloat3(&m_CarVertices[i].Pos);
 
@@ -376,17 +501,7 @@ void PickingApp::BuildCarGeometryBuffers()
 	XMStoreFloat3(&m_CarBox.center, 0.5f*(vMin + vMax));
 	XMStoreFloat3(&m_CarBox.extent, 0.5f*(vMax - vMin));
 
-	fin >> ignore;
-	fin >> ignore;
-	fin >> ignore;
-
-	m_CarIndices.resize(3 * tcount);
-	for (UINT i = 0; i < tcount; ++i)
-	{
-		fin >> m_CarIndices[i * 3 + 0] >> m_CarIndices[i * 3 + 1] >> m_CarIndices[i * 3 + 2];
-	}
-
-	fin.close();
+	m_CarBVH.Build(positions, m_CarIndices);
 
 	D3D11_BUFFER_DESC vbd;
 	vbd.Usage = D3D11_USAGE_IMMUTABLE;
@@ -490,6 +605,26 @@ void PickingApp::BuildInstancedBuffer()
 		}
 	}
 
+	//
+	// Insert the instances into the octree used for culling and picking.
+	//
+	m_InstanceOctree.Init(XMFLOAT3(0.0f, 0.0f, 0.0f), 0.5f * width + 20.0f, 4);
+	m_InstanceBasePositions.resize(m_InstancedData.size());
+	for (UINT i = 0; i < m_InstancedData.size(); ++i)
+	{
+		const XMFLOAT4X4& W = m_InstancedData[i].World;
+		m_InstanceBasePositions[i] = XMFLOAT3(W(3, 0), W(3, 1), W(3, 2));
+
+		XMFLOAT3 boundsMin, boundsMax;
+		TransformBounds(m_CarBox, XMLoadFloat4x4(&W), boundsMin, boundsMax);
+		m_InstanceOctree.Insert(boundsMin, boundsMax);
+	}
+	BuildSceneBVH();
+
+	m_SelectedInstances.clear();
+	m_IsInstanceSelected.assign(m_InstancedData.size(), false);
+	m_IsInstanceVisible.assign(m_InstancedData.size(), true);
+
 	D3D11_BUFFER_DESC vbd;
 	vbd.Usage = D3D11_USAGE_DYNAMIC;
 	vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
@@ -540,6 +675,40 @@ void PickingApp::DrawLocalAABB(const Box& box)
 	d3d_context_->RSSetState(nullptr);
 }
 
+void PickingApp::AnimateInstances(float dt)
+{
+	m_AnimationTime += dt;
+
+	for (UINT i = 0; i < m_InstancedData.size(); ++i)
+	{
+		// Each car circles its grid position at its own phase and faces along its path.
+		float t = 0.5f * m_AnimationTime + 0.7f * i;
+		const XMFLOAT3& base = m_InstanceBasePositions[i];
+
+		XMMATRIX R = XMMatrixRotationY(-t);
+		XMMATRIX T = XMMatrixTranslation(base.x + 15.0f * cosf(t), base.y + 5.0f * sinf(2.0f * t), base.z + 15.0f * sinf(t));
+		XMMATRIX W = R * T;
+		XMStoreFloat4x4(&m_InstancedData[i].World, W);
+
+		XMFLOAT3 boundsMin, boundsMax;
+		TransformBounds(m_CarBox, W, boundsMin, boundsMax);
+		m_InstanceOctree.Update(i, boundsMin, boundsMax);
+	}
+	m_IsSceneBVHStale = true;
+}
+
+void PickingApp::BuildSceneBVH()
+{
+	m_SceneBVH.Clear();
+	UINT carMesh = m_SceneBVH.AddMesh(&m_CarBVH);
+	for (UINT i = 0; i < m_InstancedData.size(); ++i)
+	{
+		m_SceneBVH.AddInstance(carMesh, m_InstancedData[i].World);
+	}
+	m_SceneBVH.Build();
+	m_IsSceneBVHStale = false;
+}
+
 void PickingApp::Pick(int x, int y)
 {
 	XMFLOAT4X4 P;
@@ -553,53 +722,588 @@ void PickingApp::Pick(int x, int y)
 	XMVECTOR rayOrigin = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
 	XMVECTOR rayDir = XMVectorSet(vx, vy, 1.0f, 0.0f);
 
-	// Tranform ray to local space of Mesh.
+	// Tranform ray to world space.
 	XMMATRIX V = m_Camera.View();
+	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(V), V);
+
+	rayOrigin = XMVector3TransformCoord(rayOrigin, invView);
+	rayDir = XMVector3Normalize(XMVector3TransformNormal(rayDir, invView));
+
+	// The octree only hands over the instances whose bounds the ray reaches;
+	// the ray is taken to their local space without renormalizing so that
+	// distances stay comparable.  Instances culled last frame were not drawn
+	// and are passed over.
+	UINT pickedTriangle = 0;
+	auto intersectCar = [&](UINT instance, float maxDist, float* pDist)
+	{
+		if (!m_IsInstanceVisible[instance])
+		{
+			return false;
+		}
+
+		XMMATRIX W = XMLoadFloat4x4(&m_InstancedData[instance].World);
+		XMMATRIX toLocal = XMMatrixInverse(&XMMatrixDeterminant(W), W);
+
+		return m_CarBVH.Intersect(XMVector3TransformCoord(rayOrigin, toLocal), XMVector3TransformNormal(rayDir, toLocal),
+			maxDist, pDist, &pickedTriangle);
+	};
 
-	float minDist = MathHelper::Infinity;
-	m_PickedMesh = -1;
-	m_PickedTriangle = -1;
+	if (m_UseSceneBVH)
+	{
+		PickResult result;
+		m_SceneBVH.Pick(rayOrigin, rayDir, &result, &m_IsInstanceVisible);
+
+		m_PickedMesh = result.Instance;
+		m_PickedTriangle = result.Triangle;
+		return;
+	}
+
+	UINT instance = 0;
+	if (m_InstanceOctree.Intersect(rayOrigin, rayDir, intersectCar, &instance, nullptr))
+	{
+		m_PickedMesh = instance;
+		m_PickedTriangle = pickedTriangle;
+	}
+	else
+	{
+		m_PickedMesh = -1;
+		m_PickedTriangle = -1;
+	}
+}
+
+void PickingApp::Select(int x0, int y0, int x1, int y1)
+{
+	m_IsInstanceSelected.assign(m_InstancedData.size(), false);
+
+	// Treat a shift click without a drag as clearing the selection.
+	if (abs(x1 - x0) < 2 || abs(y1 - y0) < 2)
+	{
+		m_SelectedInstances.clear();
+		return;
+	}
+
+	// Corners of the rectangle in normalized device coordinates.
+	float left = 2.0f * x0 / client_width_ - 1.0f;
+	float right = 2.0f * x1 / client_width_ - 1.0f;
+	float top = -2.0f * y0 / client_height_ + 1.0f;
+	float bottom = -2.0f * y1 / client_height_ + 1.0f;
+
+	m_Camera.UpdateViewMatrix();
+	Frustum frustum = m_Camera.GetSubFrustum(left, top, right, bottom);
+	if (m_UseSceneBVH)
+	{
+		m_SceneBVH.SelectInFrustum(frustum, m_SelectedInstances);
+	}
+	else
+	{
+		m_InstanceOctree.SelectInFrustum(frustum, m_SelectedInstances);
+	}
+
+	for (UINT i = 0; i < m_SelectedInstances.size(); ++i)
+	{
+		m_IsInstanceSelected[m_SelectedInstances[i]] = true;
+	}
+}
 
-	for (int i = 0; i < m_VisibleObjectCount; ++i)
+// Headless benchmark: picks against a grid of about 100k cars and compares
+// with testing every instance the way Pick used to.
+static void RunPickingBenchmark()
+{
+	std::vector<Vertex::Basic32> vertices;
+	std::vector<UINT> indices;
+	if (!LoadCarModel(vertices, indices))
 	{
-		XMMATRIX W = XMLoadFloat4x4(&m_InstancedData[m_VisibleObjectIndices[i]].World);
-		XMMATRIX WV = W * V;
-		XMMATRIX toLocal = XMMatrixInverse(&XMMatrixDeterminant(WV), WV);
+		Benchmark::Report(L"Picking: Models/car.txt not found.");
+		return;
+	}
 
-		rayOrigin = XMVector3TransformCoord(rayOrigin, toLocal);
-		rayDir = XMVector3TransformNormal(rayDir, toLocal);
-		rayDir = XMVector3Normalize(rayDir);
+	std::vector<XMFLOAT3> positions(vertices.size());
+	for (UINT i = 0; i < vertices.size(); ++i)
+	{
+		positions[i] = vertices[i].Pos;
+	}
 
-		Ray ray(rayOrigin, rayDir);
+	double start = Benchmark::Now();
+	MeshBVH carBVH;
+	carBVH.Build(positions, indices);
+	double meshBuildTime = Benchmark::Now() - start;
 
-		if (ray.IsIntersectBox(m_CarBox, nullptr))
+	const int n = 47;
+	const float spacing = 20.0f;
+	const float half = 0.5f * spacing * (n - 1);
+
+	std::vector<XMFLOAT4X4> worlds;
+	worlds.reserve(n * n * n);
+	for (int k = 0; k < n; ++k)
+	{
+		for (int i = 0; i < n; ++i)
 		{
-			for (int t = 0; t < m_CarIndices.size() / 3; ++t)
+			for (int j = 0; j < n; ++j)
 			{
-				int i0 = m_CarIndices[3 * t + 0];
-				int i1 = m_CarIndices[3 * t + 1];
-				int i2 = m_CarIndices[3 * t + 2];
-
-				XMVECTOR v0 = XMLoadFloat3(&m_CarVertices[i0].Pos);
-				XMVECTOR v1 = XMLoadFloat3(&m_CarVertices[i1].Pos);
-				XMVECTOR v2 = XMLoadFloat3(&m_CarVertices[i2].Pos);
-				float d = 0.0f;
-				if (ray.IsIntersectTriangle(v0, v1, v2, &d))
+				XMMATRIX R = XMMatrixRotationY(MathHelper::RandF(0.0f, 2.0f * MathHelper::Pi));
+				XMMATRIX T = XMMatrixTranslation(j * spacing - half, i * spacing - half, k * spacing - half);
+
+				XMFLOAT4X4 W;
+				XMStoreFloat4x4(&W, R * T);
+				worlds.push_back(W);
+			}
+		}
+	}
+
+	start = Benchmark::Now();
+	SceneBVH scene;
+	UINT carMesh = scene.AddMesh(&carBVH);
+	for (UINT i = 0; i < worlds.size(); ++i)
+	{
+		scene.AddInstance(carMesh, worlds[i]);
+	}
+	scene.Build();
+	double sceneBuildTime = Benchmark::Now() - start;
+
+	// Rays from random points around the grid towards random points inside it.
+	const int rayCount = 10000;
+	std::vector<XMFLOAT3> origins(rayCount);
+	std::vector<XMFLOAT3> dirs(rayCount);
+	for (int r = 0; r < rayCount; ++r)
+	{
+		XMVECTOR o = 2.0f * half * MathHelper::RandUnitVec3();
+		XMVECTOR target = XMVectorSet(
+			MathHelper::RandF(-half, half), MathHelper::RandF(-half, half), MathHelper::RandF(-half, half), 1.0f);
+		XMStoreFloat3(&origins[r], o);
+		XMStoreFloat3(&dirs[r], XMVector3Normalize(target - o));
+	}
+
+	int hits = 0;
+	start = Benchmark::Now();
+	for (int r = 0; r < rayCount; ++r)
+	{
+		PickResult result;
+		if (scene.Pick(XMLoadFloat3(&origins[r]), XMLoadFloat3(&dirs[r]), &result))
+		{
+			++hits;
+		}
+	}
+	double pickTime = (Benchmark::Now() - start) / rayCount;
+
+	// The old path inverts every instance matrix and tests every triangle of
+	// each instance whose box is hit, so only a few rays are timed.
+	const int bruteRayCount = 20;
+	int mismatches = 0;
+	start = Benchmark::Now();
+	for (int r = 0; r < bruteRayCount; ++r)
+	{
+		XMVECTOR o = XMLoadFloat3(&origins[r]);
+		XMVECTOR d = XMLoadFloat3(&dirs[r]);
+
+		float minDist = MathHelper::Infinity;
+		int picked = -1;
+		for (UINT i = 0; i < worlds.size(); ++i)
+		{
+			XMMATRIX W = XMLoadFloat4x4(&worlds[i]);
+			XMMATRIX toLocal = XMMatrixInverse(&XMMatrixDeterminant(W), W);
+
+			Ray ray(XMVector3TransformCoord(o, toLocal), XMVector3TransformNormal(d, toLocal));
+			if (!ray.IsIntersectBox(carBVH.GetBounds(), nullptr))
+			{
+				continue;
+			}
+
+			for (UINT t = 0; t < indices.size() / 3; ++t)
+			{
+				XMVECTOR v0 = XMLoadFloat3(&positions[indices[3 * t + 0]]);
+				XMVECTOR v1 = XMLoadFloat3(&positions[indices[3 * t + 1]]);
+				XMVECTOR v2 = XMLoadFloat3(&positions[indices[3 * t + 2]]);
+				float dist = 0.0f;
+				if (ray.IsIntersectTriangle(v0, v1, v2, &dist) && dist < minDist)
 				{
-					if (d < minDist)
-					{
-						minDist = d;
-						m_PickedMesh = i;
-						m_PickedTriangle = t;
-					}
+					minDist = dist;
+					picked = i;
 				}
 			}
 		}
+
+		PickResult result;
+		scene.Pick(o, d, &result);
+		if (result.Instance != picked)
+		{
+			++mismatches;
+		}
 	}
-	
-	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(V), V);
+	double bruteTime = (Benchmark::Now() - start) / bruteRayCount;
+
+	std::wostringstream outs;
+	outs << L"Picking: " << worlds.size() << L" instances of " << carBVH.TriangleCount() << L" triangles" <<
+		L", mesh BVH build " << meshBuildTime * 1000.0 << L" ms" <<
+		L", scene BVH build " << sceneBuildTime * 1000.0 << L" ms" <<
+		L", " << pickTime * 1000000.0 << L" us/pick (" << hits << L"/" << rayCount << L" hits)" <<
+		L", per-instance loop " << bruteTime * 1000000.0 << L" us/pick" <<
+		L", " << mismatches << L"/" << bruteRayCount << L" mismatches";
+	Benchmark::Report(outs.str());
+
+	//
+	// Rectangle selection from a camera looking at the grid from outside.
+	//
+	Camera camera;
+	camera.SetLens(0.25f * MathHelper::Pi, 800.0f / 600.0f, 1.0f, 4.0f * half);
+	camera.LookAt(XMFLOAT3(0.3f * half, 0.5f * half, -2.5f * half), XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 1.0f, 0.0f));
+	camera.UpdateViewMatrix();
+
+	std::vector<Box> worldBoxes(worlds.size());
+	for (UINT i = 0; i < worlds.size(); ++i)
+	{
+		XMFLOAT3 boundsMin, boundsMax;
+		TransformBounds(carBVH.GetBounds(), XMLoadFloat4x4(&worlds[i]), boundsMin, boundsMax);
+
+		XMVECTOR vMin = XMLoadFloat3(&boundsMin);
+		XMVECTOR vMax = XMLoadFloat3(&boundsMax);
+		XMStoreFloat3(&worldBoxes[i].center, 0.5f * (vMin + vMax));
+		XMStoreFloat3(&worldBoxes[i].extent, 0.5f * (vMax - vMin));
+	}
+
+	const float rectSizes[] = { 0.05f, 0.2f, 0.5f, 1.0f };
+	const int selectRepeats = 100;
+	std::vector<UINT> selected;
+	std::vector<SelectedTriangle> selectedTriangles;
+	for (int s = 0; s < 4; ++s)
+	{
+		float size = rectSizes[s];
+		Frustum frustum = camera.GetSubFrustum(-size, size, size, -size);
 
+		start = Benchmark::Now();
+		for (int r = 0; r < selectRepeats; ++r)
+		{
+			scene.SelectInFrustum(frustum, selected);
+		}
+		double selectTime = (Benchmark::Now() - start) / selectRepeats;
+
+		start = Benchmark::Now();
+		scene.SelectInFrustum(frustum, selected, &selectedTriangles);
+		double triangleTime = Benchmark::Now() - start;
 
+		// Reference: test the world box of every instance.
+		start = Benchmark::Now();
+		UINT bruteCount = 0;
+		for (UINT i = 0; i < worldBoxes.size(); ++i)
+		{
+			if (frustum.IsIntersected(worldBoxes[i]))
+			{
+				++bruteCount;
+			}
+		}
+		double bruteSelectTime = Benchmark::Now() - start;
+
+		outs.str(L"");
+		outs << L"Selection: rectangle " << 2.0f * size << L" NDC wide, " <<
+			selected.size() << L" instances in " << selectTime * 1000000.0 << L" us" <<
+			L", " << selectedTriangles.size() << L" triangles in " << triangleTime * 1000.0 << L" ms" <<
+			L", per-instance loop " << bruteSelectTime * 1000000.0 << L" us (" << bruteCount << L" instances)";
+		Benchmark::Report(outs.str());
+	}
+}
+
+// Headless benchmark: casts sets of rays at the car mesh one at a time and as
+// batches, on a single thread.
+static void RunRayBatchBenchmark()
+{
+	std::vector<Vertex::Basic32> vertices;
+	std::vector<UINT> indices;
+	if (!LoadCarModel(vertices, indices))
+	{
+		Benchmark::Report(L"Ray batches: Models/car.txt not found.");
+		return;
+	}
+
+	std::vector<XMFLOAT3> positions(vertices.size());
+	for (UINT i = 0; i < vertices.size(); ++i)
+	{
+		positions[i] = vertices[i].Pos;
+	}
+
+	MeshBVH carBVH;
+	carBVH.Build(positions, indices);
+
+	const Box& bounds = carBVH.GetBounds();
+	XMVECTOR center = XMLoadFloat3(&bounds.center);
+	float radius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&bounds.extent)));
+
+	const UINT rayCount = 512 * 512;
+	std::vector<BVHRayQuery> rays(rayCount);
+
+	for (UINT set = 0; set < 3; ++set)
+	{
+		const wchar_t* name = nullptr;
+		bool occlusion = false;
+		for (UINT r = 0; r < rayCount; ++r)
+		{
+			XMVECTOR o, d;
+			float maxDist = MathHelper::Infinity;
+			if (set == 0)
+			{
+				// Primary rays: a 512x512 image of the car from one eye point.
+				name = L"camera rays";
+				o = center + XMVectorSet(0.5f * radius, 0.7f * radius, -2.5f * radius, 0.0f);
+				float u = ((r % 512) + 0.5f) / 512.0f - 0.5f;
+				float v = ((r / 512) + 0.5f) / 512.0f - 0.5f;
+				XMVECTOR target = center + XMVectorSet(2.0f * radius * u, -2.0f * radius * v, 0.0f, 0.0f);
+				d = XMVector3Normalize(target - o);
+			}
+			else if (set == 1)
+			{
+				// Incoherent rays from around the car towards points inside its bounds.
+				name = L"random rays";
+				o = center + 2.0f * radius * MathHelper::RandUnitVec3();
+				XMVECTOR target = center + XMVectorSet(
+					MathHelper::RandF(-bounds.extent.x, bounds.extent.x),
+					MathHelper::RandF(-bounds.extent.y, bounds.extent.y),
+					MathHelper::RandF(-bounds.extent.z, bounds.extent.z), 0.0f);
+				d = XMVector3Normalize(target - o);
+			}
+			else
+			{
+				// Ambient occlusion rays: 64 short rays from each of 4096
+				// triangle centroids, over the hemisphere of the face.
+				name = L"occlusion rays";
+				occlusion = true;
+				UINT t = (r / 64) * 7919 % carBVH.TriangleCount();
+				XMVECTOR v0 = XMLoadFloat3(&positions[indices[3 * t + 0]]);
+				XMVECTOR v1 = XMLoadFloat3(&positions[indices[3 * t + 1]]);
+				XMVECTOR v2 = XMLoadFloat3(&positions[indices[3 * t + 2]]);
+				XMVECTOR n = XMVector3Normalize(XMVector3Cross(v1 - v0, v2 - v0));
+				o = (v0 + v1 + v2) / 3.0f + 0.001f * n;
+				d = MathHelper::RandHemisphereUnitVec3(n);
+				maxDist = 0.5f * radius;
+			}
+
+			XMStoreFloat3(&rays[r].Origin, o);
+			XMStoreFloat3(&rays[r].Direction, d);
+			rays[r].MaxDist = maxDist;
+		}
+
+		UINT mismatches = 0;
+		UINT hitCount = 0;
+		double singleTime = 0.0;
+		double batchTime = 0.0;
+		if (occlusion)
+		{
+			std::vector<BYTE> single(rayCount);
+			double start = Benchmark::Now();
+			for (UINT r = 0; r < rayCount; ++r)
+			{
+				BVHRay ray(XMLoadFloat3(&rays[r].Origin), XMLoadFloat3(&rays[r].Direction));
+				single[r] = carBVH.IsOccluded(ray, rays[r].MaxDist) ? 1 : 0;
+			}
+			singleTime = Benchmark::Now() - start;
+
+			std::vector<BYTE> batch(rayCount);
+			start = Benchmark::Now();
+			carBVH.OccludedBatch(&rays[0], rayCount, &batch[0]);
+			batchTime = Benchmark::Now() - start;
+
+			for (UINT r = 0; r < rayCount; ++r)
+			{
+				hitCount += single[r];
+				mismatches += single[r] != batch[r] ? 1 : 0;
+			}
+		}
+		else
+		{
+			std::vector<UINT> single(rayCount);
+			double start = Benchmark::Now();
+			for (UINT r = 0; r < rayCount; ++r)
+			{
+				BVHRay ray(XMLoadFloat3(&rays[r].Origin), XMLoadFloat3(&rays[r].Direction));
+				single[r] = BVHRayHit::Miss;
+				float dist;
+				carBVH.Intersect(ray, rays[r].MaxDist, &dist, &single[r]);
+			}
+			singleTime = Benchmark::Now() - start;
+
+			std::vector<BVHRayHit> batch(rayCount);
+			start = Benchmark::Now();
+			carBVH.IntersectBatch(&rays[0], rayCount, &batch[0]);
+			batchTime = Benchmark::Now() - start;
+
+			for (UINT r = 0; r < rayCount; ++r)
+			{
+				hitCount += single[r] != BVHRayHit::Miss ? 1 : 0;
+				mismatches += single[r] != batch[r].Triangle ? 1 : 0;
+			}
+		}
+
+		std::wostringstream outs;
+		outs << L"Ray batches: " << rayCount << L" " << name << L" (" << hitCount << L" hit)" <<
+			L", one at a time " << rayCount / singleTime / 1e6 << L" Mrays/s" <<
+			L", batched " << rayCount / batchTime / 1e6 << L" Mrays/s" <<
+			L", speedup " << singleTime / batchTime <<
+			L", " << mismatches << L" mismatches";
+		Benchmark::Report(outs.str());
+	}
+}
+
+// Headless benchmark: about 100k cars moving every frame, kept in a loose
+// octree that is updated in place, against rebuilding the instance BVH.
+static void RunMovingInstancesBenchmark()
+{
+	std::vector<Vertex::Basic32> vertices;
+	std::vector<UINT> indices;
+	if (!LoadCarModel(vertices, indices))
+	{
+		Benchmark::Report(L"Moving instances: Models/car.txt not found.");
+		return;
+	}
+
+	std::vector<XMFLOAT3> positions(vertices.size());
+	for (UINT i = 0; i < vertices.size(); ++i)
+	{
+		positions[i] = vertices[i].Pos;
+	}
+
+	MeshBVH carBVH;
+	carBVH.Build(positions, indices);
+	const Box& carBox = carBVH.GetBounds();
+
+	const int n = 47;
+	const float spacing = 20.0f;
+	const float half = 0.5f * spacing * (n - 1);
+	const float radius = 15.0f;
+
+	std::vector<XMFLOAT3> bases;
+	std::vector<float> phases;
+	for (int k = 0; k < n; ++k)
+	{
+		for (int i = 0; i < n; ++i)
+		{
+			for (int j = 0; j < n; ++j)
+			{
+				bases.push_back(XMFLOAT3(j * spacing - half, i * spacing - half, k * spacing - half));
+				phases.push_back(MathHelper::RandF(0.0f, 2.0f * MathHelper::Pi));
+			}
+		}
+	}
+
+	UINT count = (UINT)bases.size();
+	std::vector<XMFLOAT4X4> worlds(count);
+	std::vector<XMFLOAT3> boundsMin(count);
+	std::vector<XMFLOAT3> boundsMax(count);
+
+	auto animate = [&](float time)
+	{
+		for (UINT i = 0; i < count; ++i)
+		{
+			float t = time + phases[i];
+			XMMATRIX W = XMMatrixRotationY(-t) *
+				XMMatrixTranslation(bases[i].x + radius * cosf(t), bases[i].y, bases[i].z + radius * sinf(t));
+			XMStoreFloat4x4(&worlds[i], W);
+			TransformBounds(carBox, W, boundsMin[i], boundsMax[i]);
+		}
+	};
+
+	animate(0.0f);
+
+	double start = Benchmark::Now();
+	LooseOctree octree;
+	octree.Init(XMFLOAT3(0.0f, 0.0f, 0.0f), half + radius + spacing, 6);
+	for (UINT i = 0; i < count; ++i)
+	{
+		octree.Insert(boundsMin[i], boundsMax[i]);
+	}
+	double insertTime = Benchmark::Now() - start;
+
+	Camera camera;
+	camera.SetLens(0.25f * MathHelper::Pi, 800.0f / 600.0f, 1.0f, 4.0f * half);
+	camera.LookAt(XMFLOAT3(0.3f * half, 0.5f * half, -2.5f * half), XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 1.0f, 0.0f));
+	camera.UpdateViewMatrix();
+	Frustum frustum = camera.GetSubFrustum(-0.5f, 0.5f, 0.5f, -0.5f);
+	FrustumQuery query(frustum);
+
+	const int frameCount = 30;
+	const int picksPerFrame = 100;
+	double updateTime = 0.0;
+	double cullTime = 0.0;
+	double bruteCullTime = 0.0;
+	double pickTime = 0.0;
+	double rebuildTime = 0.0;
+	UINT visible = 0;
+	UINT cullMismatches = 0;
+	UINT hits = 0;
+	std::vector<UINT> selected;
+	for (int frame = 1; frame <= frameCount; ++frame)
+	{
+		animate(frame / 60.0f);
+
+		start = Benchmark::Now();
+		for (UINT i = 0; i < count; ++i)
+		{
+			octree.Update(i, boundsMin[i], boundsMax[i]);
+		}
+		updateTime += Benchmark::Now() - start;
+
+		start = Benchmark::Now();
+		octree.SelectInFrustum(frustum, selected);
+		cullTime += Benchmark::Now() - start;
+		visible += (UINT)selected.size();
+
+		start = Benchmark::Now();
+		UINT bruteCount = 0;
+		for (UINT i = 0; i < count; ++i)
+		{
+			if (query.ClassifyBounds(boundsMin[i], boundsMax[i]) != FrustumQuery::Outside)
+			{
+				++bruteCount;
+			}
+		}
+		bruteCullTime += Benchmark::Now() - start;
+		if (bruteCount != selected.size())
+		{
+			++cullMismatches;
+		}
+
+		start = Benchmark::Now();
+		for (int r = 0; r < picksPerFrame; ++r)
+		{
+			XMVECTOR o = 2.0f * half * MathHelper::RandUnitVec3();
+			XMVECTOR target = XMVectorSet(
+				MathHelper::RandF(-half, half), MathHelper::RandF(-half, half), MathHelper::RandF(-half, half), 1.0f);
+			XMVECTOR d = XMVector3Normalize(target - o);
+
+			UINT triangle = 0;
+			auto intersectCar = [&](UINT instance, float maxDist, float* pDist)
+			{
+				XMMATRIX W = XMLoadFloat4x4(&worlds[instance]);
+				XMMATRIX toLocal = XMMatrixInverse(&XMMatrixDeterminant(W), W);
+				return carBVH.Intersect(XMVector3TransformCoord(o, toLocal), XMVector3TransformNormal(d, toLocal),
+					maxDist, pDist, &triangle);
+			};
+
+			if (octree.Intersect(o, d, intersectCar, nullptr, nullptr))
+			{
+				++hits;
+			}
+		}
+		pickTime += Benchmark::Now() - start;
+
+		// What a static hierarchy would have to do every frame instead.
+		start = Benchmark::Now();
+		SceneBVH scene;
+		UINT carMesh = scene.AddMesh(&carBVH);
+		for (UINT i = 0; i < count; ++i)
+		{
+			scene.AddInstance(carMesh, worlds[i]);
+		}
+		scene.Build();
+		rebuildTime += Benchmark::Now() - start;
+	}
+
+	std::wostringstream outs;
+	outs << L"Moving instances: " << count << L" cars over " << frameCount << L" frames" <<
+		L", octree insert " << insertTime * 1000.0 << L" ms" <<
+		L", update " << updateTime / frameCount * 1000.0 << L" ms/frame" <<
+		L", cull " << cullTime / frameCount * 1000.0 << L" ms (" << visible / frameCount << L" visible)" <<
+		L", per-instance cull " << bruteCullTime / frameCount * 1000.0 << L" ms" <<
+		L", " << cullMismatches << L" mismatched frames" <<
+		L", " << pickTime / (frameCount * picksPerFrame) * 1000000.0 << L" us/pick (" << hits << L" hits)" <<
+		L", SceneBVH rebuild " << rebuildTime / frameCount * 1000.0 << L" ms/frame";
+	Benchmark::Report(outs.str());
 }
 
 int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPSTR lpCmdLine, _In_ int nShowCmd)
@@ -609,6 +1313,14 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+	if (Benchmark::IsRequested(lpCmdLine))
+	{
+		RunPickingBenchmark();
+		RunRayBatchBenchmark();
+		RunMovingInstancesBenchmark();
+		return 0;
+	}
+
 	PickingApp theApp(hInstance);
 
 	if (!theApp.Init())
@@ -318,6 +318,12 @@ TerrainEffect::TerrainEffect(ID3D11Device* device, const std::wstring& filename)
 	Light1FogTech = mFx->GetTechniqueByName("Light1Fog");
 	Light2FogTech = mFx->GetTechniqueByName("Light2Fog");
 	Light3FogTech = mFx->GetTechniqueByName("Light3Fog");
+	Light1LodTech = mFx->GetTechniqueByName("Light1Lod");
+	Light2LodTech = mFx->GetTechniqueByName("Light2Lod");
+	Light3LodTech = mFx->GetTechniqueByName("Light3Lod");
+	Light1LodFogTech = mFx->GetTechniqueByName("Light1LodFog");
+	Light2LodFogTech = mFx->GetTechniqueByName("Light2LodFog");
+	Light3LodFogTech = mFx->GetTechniqueByName("Light3LodFog");
 
 	ViewProj = mFx->GetVariableByName("gViewProj")->AsMatrix();
 	EyePosW = mFx->GetVariableByName("gEyePosW")->AsVector();
@@ -335,10 +341,15 @@ TerrainEffect::TerrainEffect(ID3D11Device* device, const std::wstring& filename)
 	TexelCellSpaceV = mFx->GetVariableByName("gTexelCellSpaceV")->AsScalar();
 	WorldCellSpace = mFx->GetVariableByName("gWorldCellSpace")->AsScalar();
 	WorldFrustumPlanes = mFx->GetVariableByName("gWorldFrustumPlanes")->AsVector();
+	LodGridCells = mFx->GetVariableByName("gLodGridCells")->AsScalar();
+	TerrainSize = mFx->GetVariableByName("gTerrainSize");
+	LodMorph = mFx->GetVariableByName("gLodMorph")->AsVector();
+	UseNormalMap = mFx->GetVariableByName("gUseNormalMap")->AsScalar();
 
 	LayerMapArray = mFx->GetVariableByName("gLayerMapArray")->AsShaderResource();
 	BlendMap = mFx->GetVariableByName("gBlendMap")->AsShaderResource();
 	HeightMap = mFx->GetVariableByName("gHeightMap")->AsShaderResource();
+	NormalMap = mFx->GetVariableByName("gNormalMap")->AsShaderResource();
 }
 
 TerrainEffect::~TerrainEffect()
@@ -388,10 +388,15 @@ public:
 	void SetTexelCellSpaceV(float f) { TexelCellSpaceV->SetFloat(f); }
 	void SetWorldCellSpace(float f) { WorldCellSpace->SetFloat(f); }
 	void SetWorldFrustumPlanes(XMFLOAT4 planes[6]) { WorldFrustumPlanes->SetFloatVectorArray(reinterpret_cast<float*>(planes), 0, 6); }
+	void SetLodGridCells(float f) { LodGridCells->SetFloat(f); }
+	void SetTerrainSize(const XMFLOAT2& v) { TerrainSize->SetRawValue(&v, 0, sizeof(XMFLOAT2)); }
+	void SetLodMorph(const XMFLOAT4* v, UINT count) { LodMorph->SetFloatVectorArray(reinterpret_cast<const float*>(v), 0, count); }
 
 	void SetLayerMapArray(ID3D11ShaderResourceView* tex) { LayerMapArray->SetResource(tex); }
 	void SetBlendMap(ID3D11ShaderResourceView* tex) { BlendMap->SetResource(tex); }
 	void SetHeightMap(ID3D11ShaderResourceView* tex) { HeightMap->SetResource(tex); }
+	void SetNormalMap(ID3D11ShaderResourceView* tex) { NormalMap->SetResource(tex); }
+	void SetUseNormalMap(bool b) { UseNormalMap->SetBool(b); }
 
 
 	ID3DX11EffectTechnique* Light1Tech;
@@ -401,6 +406,14 @@ public:
 	ID3DX11EffectTechnique* Light2FogTech;
 	ID3DX11EffectTechnique* Light3FogTech;
 
+	// The LOD grid instead of the tessellated patches.
+	ID3DX11EffectTechnique* Light1LodTech;
+	ID3DX11EffectTechnique* Light2LodTech;
+	ID3DX11EffectTechnique* Light3LodTech;
+	ID3DX11EffectTechnique* Light1LodFogTech;
+	ID3DX11EffectTechnique* Light2LodFogTech;
+	ID3DX11EffectTechnique* Light3LodFogTech;
+
 	ID3DX11EffectMatrixVariable* ViewProj;
 	ID3DX11EffectMatrixVariable* World;
 	ID3DX11EffectMatrixVariable* WorldInvTranspose;
@@ -419,10 +432,15 @@ public:
 	ID3DX11EffectScalarVariable* TexelCellSpaceV;
 	ID3DX11EffectScalarVariable* WorldCellSpace;
 	ID3DX11EffectVectorVariable* WorldFrustumPlanes;
+	ID3DX11EffectScalarVariable* LodGridCells;
+	ID3DX11EffectVariable* TerrainSize;
+	ID3DX11EffectVectorVariable* LodMorph;
+	ID3DX11EffectScalarVariable* UseNormalMap;
 
 	ID3DX11EffectShaderResourceVariable* LayerMapArray;
 	ID3DX11EffectShaderResourceVariable* BlendMap;
 	ID3DX11EffectShaderResourceVariable* HeightMap;
+	ID3DX11EffectShaderResourceVariable* NormalMap;
 };
 #pragma endregion
 
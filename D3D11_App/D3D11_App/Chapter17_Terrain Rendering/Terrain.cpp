@@ -3,7 +3,9 @@
 #include "DDSTextureLoader.h"
 #include "Vertex.h"
 #include "Effects.h"
-#include <DirectXPackedVector.h>
+#include "Benchmark.h"
+#include "HeightFilter.h"
+#include "PackedConvert.h"
 
 Terrain::Terrain()
 	: m_QuadPatchVB(nullptr)
@@ -11,10 +13,30 @@ Terrain::Terrain()
 	, m_HeightMapSRV(nullptr)
 	, m_LayerMapArraySRV(nullptr)
 	, m_BlendMapSRV(nullptr)
+	, m_NormalMapSRV(nullptr)
 	, m_NumPatchVertices(0)
 	, m_NumPatchQuadFaces(0)
 	, m_NumPatchVertRows(0)
 	, m_NumPatchVertCols(0)
+	, m_HeightmapStep(1)
+	, m_HeightmapTextureWidth(0)
+	, m_HeightmapTextureHeight(0)
+	, m_HalfWidth(0.0f)
+	, m_HalfDepth(0.0f)
+	, m_InvCellSpacing(0.0f)
+	, m_Collider(m_Heightmap, m_Pyramid)
+	, m_PatchLevel(0)
+	, m_VisiblePatchCount(0)
+	, m_CullTime(0.0)
+	, m_LodEnabled(true)
+	, m_LodPixelError(2.0f)
+	, m_LodGridVB(nullptr)
+	, m_LodGridIB(nullptr)
+	, m_LodInstanceVB(nullptr)
+	, m_LodInstanceCapacity(0)
+	, m_LodNodeCount(0)
+	, m_LodTriangleCount(0)
+	, m_LodSelectTime(0.0)
 {
 	XMStoreFloat4x4(&m_World, XMMatrixIdentity());
 
@@ -31,6 +53,10 @@ Terrain::~Terrain()
 	ReleaseCOM(m_HeightMapSRV);
 	ReleaseCOM(m_LayerMapArraySRV);
 	ReleaseCOM(m_BlendMapSRV);
+	ReleaseCOM(m_NormalMapSRV);
+	ReleaseCOM(m_LodGridVB);
+	ReleaseCOM(m_LodGridIB);
+	ReleaseCOM(m_LodInstanceVB);
 }
 
 float Terrain::GetWidth() const
@@ -47,23 +73,27 @@ float Terrain::GetDepth() const
 
 float Terrain::GetHeight(float x, float z) const
 {
-	// Transform from terrain local space to "cell" space.
-	float c = (x + 0.5f * GetWidth()) / m_Info.CellSpacing;
-	float d = (z - 0.5f * GetDepth()) / -m_Info.CellSpacing;
+	// Transform from terrain local space to "cell" space, staying on the terrain.
+	float c = (x + m_HalfWidth) * m_InvCellSpacing;
+	float d = (m_HalfDepth - z) * m_InvCellSpacing;
+	c = MathHelper::Clamp(c, 0.0f, (float)(m_Info.HeightmapWidth - 1));
+	d = MathHelper::Clamp(d, 0.0f, (float)(m_Info.HeightmapHeight - 1));
 
 	// Get the row and column we are in.
-	int row = (int)floorf(d);
-	int col = (int)floorf(c);
+	int row = MathHelper::Min((int)floorf(d), (int)m_Info.HeightmapHeight - 2);
+	int col = MathHelper::Min((int)floorf(c), (int)m_Info.HeightmapWidth - 2);
 
 	// Grab the heights of the cell we are in.
 	// A*--*B
 	//  |    / |
 	//  |  /   |
 	// C*--*D
-	float A = m_Heightmap[row * m_Info.HeightmapWidth + col];
-	float B = m_Heightmap[row * m_Info.HeightmapWidth + col + 1];
-	float C = m_Heightmap[(row + 1) * m_Info.HeightmapWidth + col];
-	float D = m_Heightmap[(row + 1) * m_Info.HeightmapWidth + col + 1];
+	float corners[4];
+	m_Heightmap.GetCellCorners(row, col, corners);
+	float A = corners[0];
+	float B = corners[1];
+	float C = corners[2];
+	float D = corners[3];
 
 	// Where we are relative to the cell.
 	float s = c - col;
@@ -84,6 +114,185 @@ float Terrain::GetHeight(float x, float z) const
 	}
 }
 
+void Terrain::GetHeights(const XMFLOAT2* points, UINT count, float* heights) const
+{
+	XMVECTOR one = XMVectorSplatOne();
+	TileCursor cursor = { nullptr, 0, 0 };
+	for (UINT i = 0; i < count; i += 4)
+	{
+		// The last points are padded by repeating the last one.
+		UINT n = MathHelper::Min(count - i, 4u);
+		XMFLOAT2 padded[4];
+		const XMFLOAT2* group = points + i;
+		if (n < 4)
+		{
+			for (UINT k = 0; k < 4; ++k)
+			{
+				padded[k] = points[i + MathHelper::Min(k, n - 1)];
+			}
+			group = padded;
+		}
+
+		XMVECTOR s, t;
+		XMVECTOR corners[4];
+		GatherCells(group, cursor, &s, &t, corners);
+		XMVECTOR A = corners[0];
+		XMVECTOR B = corners[1];
+		XMVECTOR C = corners[2];
+		XMVECTOR D = corners[3];
+
+		// Both triangles, in the order of operations of GetHeight so that the
+		// results match it to the bit.
+		XMVECTOR upper = A + s * (B - A) + t * (C - A);
+		XMVECTOR lower = D + (one - s) * (C - D) + (one - t) * (B - D);
+		XMVECTOR h = XMVectorSelect(lower, upper, XMVectorLessOrEqual(s + t, one));
+
+		if (n == 4)
+		{
+			XMStoreFloat4((XMFLOAT4*)(heights + i), h);
+		}
+		else
+		{
+			XMFLOAT4 last;
+			XMStoreFloat4(&last, h);
+			memcpy(heights + i, &last, n * sizeof(float));
+		}
+	}
+}
+
+void Terrain::GetNormals(const XMFLOAT2* points, UINT count, XMFLOAT3* normals) const
+{
+	XMVECTOR one = XMVectorSplatOne();
+	XMVECTOR invSpacing = XMVectorReplicate(m_InvCellSpacing);
+	TileCursor cursor = { nullptr, 0, 0 };
+	for (UINT i = 0; i < count; i += 4)
+	{
+		UINT n = MathHelper::Min(count - i, 4u);
+		XMFLOAT2 padded[4];
+		const XMFLOAT2* group = points + i;
+		if (n < 4)
+		{
+			for (UINT k = 0; k < 4; ++k)
+			{
+				padded[k] = points[i + MathHelper::Min(k, n - 1)];
+			}
+			group = padded;
+		}
+
+		XMVECTOR s, t;
+		XMVECTOR corners[4];
+		GatherCells(group, cursor, &s, &t, corners);
+		XMVECTOR A = corners[0];
+		XMVECTOR B = corners[1];
+		XMVECTOR C = corners[2];
+		XMVECTOR D = corners[3];
+
+		// Height change across a cell along the columns and down the rows:
+		// B - A and C - A on the upper triangle, D - C and D - B on the lower.
+		XMVECTOR isUpper = XMVectorLessOrEqual(s + t, one);
+		XMVECTOR hs = XMVectorSelect(D - C, B - A, isUpper);
+		XMVECTOR hq = XMVectorSelect(D - B, C - A, isUpper);
+
+		// Rows run down z, so the normal is (-dh/dx, 1, -dh/dz) with
+		// dh/dx = hs / spacing and dh/dz = -hq / spacing.
+		XMVECTOR nx = -hs * invSpacing;
+		XMVECTOR nz = hq * invSpacing;
+		XMVECTOR invLength = one / XMVectorSqrt(nx * nx + nz * nz + one);
+
+		XMFLOAT4 x, y, z;
+		XMStoreFloat4(&x, nx * invLength);
+		XMStoreFloat4(&y, invLength);
+		XMStoreFloat4(&z, nz * invLength);
+
+		const float* xs = &x.x;
+		const float* ys = &y.x;
+		const float* zs = &z.x;
+		for (UINT k = 0; k < n; ++k)
+		{
+			normals[i + k] = XMFLOAT3(xs[k], ys[k], zs[k]);
+		}
+	}
+}
+
+bool Terrain::Intersect(FXMVECTOR origin, FXMVECTOR dir, float maxDist, RayHit* hit) const
+{
+	BVHRay ray(origin, dir);
+
+	UINT top = m_Pyramid.GetLevelCount() - 1;
+	XMFLOAT3 boundsMin, boundsMax;
+	GetNodeBounds(top, 0, 0, boundsMin, boundsMax);
+
+	float entry = ray.IntersectBounds(boundsMin, boundsMax, maxDist);
+	if (entry == MathHelper::Infinity)
+	{
+		return false;
+	}
+
+	float dist = maxDist;
+	return IntersectNode(ray, top, 0, 0, entry, false, &dist, hit);
+}
+
+bool Terrain::Pick(const Camera& cam, float x, float y, float viewportWidth, float viewportHeight, RayHit* hit) const
+{
+	XMFLOAT4X4 P;
+	XMStoreFloat4x4(&P, cam.Proj());
+
+	// Picking ray in view space, then in world space.
+	float vx = (2.0f * x / viewportWidth - 1.0f) / P(0, 0);
+	float vy = (-2.0f * y / viewportHeight + 1.0f) / P(1, 1);
+
+	XMVECTOR rayOrigin = cam.GetPositionXM();
+	XMVECTOR rayDir = XMVector3Normalize(vx * cam.GetRightXM() + vy * cam.GetUpXM() + cam.GetLookXM());
+
+	// The direction is not renormalized in terrain space, so that distances
+	// stay in world units.
+	XMMATRIX W = XMLoadFloat4x4(&m_World);
+	XMVECTOR det = XMMatrixDeterminant(W);
+	XMMATRIX toLocal = XMMatrixInverse(&det, W);
+
+	return Intersect(XMVector3TransformCoord(rayOrigin, toLocal), XMVector3TransformNormal(rayDir, toLocal),
+		MathHelper::Infinity, hit);
+}
+
+bool Terrain::HasLineOfSight(const XMFLOAT3& from, const XMFLOAT3& to) const
+{
+	XMVECTOR origin = XMLoadFloat3(&from);
+	XMVECTOR dir = XMLoadFloat3(&to) - origin;
+
+	float length = XMVectorGetX(XMVector3Length(dir));
+	float margin = 0.01f * m_Info.CellSpacing / MathHelper::Max(length, 1e-20f);
+	if (2.0f * margin >= 1.0f)
+	{
+		return true;
+	}
+
+	BVHRay ray(origin + margin * dir, dir);
+
+	UINT top = m_Pyramid.GetLevelCount() - 1;
+	XMFLOAT3 boundsMin, boundsMax;
+	GetNodeBounds(top, 0, 0, boundsMin, boundsMax);
+
+	float dist = 1.0f - 2.0f * margin;
+	float entry = ray.IntersectBounds(boundsMin, boundsMax, dist);
+	if (entry == MathHelper::Infinity)
+	{
+		return true;
+	}
+
+	RayHit hit;
+	return !IntersectNode(ray, top, 0, 0, entry, true, &dist, &hit);
+}
+
+bool Terrain::Sweep(const HeightfieldSweep& sweep, HeightfieldContact* contact) const
+{
+	return m_Collider.Sweep(sweep, contact);
+}
+
+UINT Terrain::SweepBatch(const HeightfieldSweep* sweeps, UINT count, HeightfieldContact* contacts, bool* hits)
+{
+	return m_Collider.SweepBatch(sweeps, count, contacts, hits, &m_Pool);
+}
+
 XMMATRIX Terrain::GetWorld() const
 {
 	return XMLoadFloat4x4(&m_World);
@@ -94,24 +303,85 @@ void Terrain::SetWorld(CXMMATRIX M)
 	XMStoreFloat4x4(&m_World, M);
 }
 
-void Terrain::Init(ID3D11Device * device, ID3D11DeviceContext * dc, const InitInfo & initInfo)
+const TiledHeightmap& Terrain::GetHeightmap() const
 {
-	m_Info = initInfo;
+	return m_Heightmap;
+}
 
-	// Divide heightmap into patches such that each patch has CellsPerPatch.
-	m_NumPatchVertRows = (m_Info.HeightmapHeight - 1) / CellsPerPatch + 1;
-	m_NumPatchVertCols = (m_Info.HeightmapWidth - 1) / CellsPerPatch + 1;
+const HeightPyramid& Terrain::GetPyramid() const
+{
+	return m_Pyramid;
+}
 
-	m_NumPatchVertices = m_NumPatchVertRows * m_NumPatchVertCols;
-	m_NumPatchQuadFaces = (m_NumPatchVertRows - 1) * (m_NumPatchVertCols - 1);
+const HeightfieldCollider& Terrain::GetCollider() const
+{
+	return m_Collider;
+}
 
-	LoadHeightmap();
-	Smooth();
-	CalcAllPatchBoundsY();
+UINT Terrain::GetPatchCount() const
+{
+	return m_NumPatchQuadFaces;
+}
+
+UINT Terrain::GetVisiblePatchCount() const
+{
+	return m_VisiblePatchCount;
+}
+
+double Terrain::GetCullTime() const
+{
+	return m_CullTime;
+}
+
+void Terrain::SetLodEnabled(bool enabled)
+{
+	m_LodEnabled = enabled;
+}
+
+bool Terrain::IsLodEnabled() const
+{
+	return m_LodEnabled;
+}
+
+void Terrain::SetLodPixelError(float pixels)
+{
+	m_LodPixelError = pixels;
+}
+
+const std::vector<Terrain::LodInstance>& Terrain::GetLodInstances() const
+{
+	return m_LodInstances;
+}
+
+UINT Terrain::GetLodNodeCount() const
+{
+	return m_LodNodeCount;
+}
+
+UINT Terrain::GetLodTriangleCount() const
+{
+	return m_LodTriangleCount;
+}
+
+double Terrain::GetLodSelectTime() const
+{
+	return m_LodSelectTime;
+}
+
+bool Terrain::Init(ID3D11Device * device, ID3D11DeviceContext * dc, const InitInfo & initInfo)
+{
+	if (!InitHeightmap(initInfo))
+	{
+		return false;
+	}
 
 	BuildQuadPatchVB(device);
 	BuildQuadPatchIB(device);
-	BuildHeightmapSRV(device);
+	BuildHeightmapSRV(device, dc);
+	BuildLodGridBuffers(device);
+
+	m_LodInstanceCapacity = 1024;
+	BuildLodInstanceVB(device);
 
 	ID3D11Resource* texRes = nullptr;
 
@@ -122,18 +392,194 @@ void Terrain::Init(ID3D11Device * device, ID3D11DeviceContext * dc, const InitIn
 	HR(DirectX::CreateDDSTextureFromFile(device,
 		m_Info.BlendMapFilename.c_str(), &texRes, &m_BlendMapSRV));
 	ReleaseCOM(texRes);
+
+	if (!m_Info.NormalMapFilename.empty() &&
+		GetFileAttributesW(m_Info.NormalMapFilename.c_str()) != INVALID_FILE_ATTRIBUTES)
+	{
+		HR(DirectX::CreateDDSTextureFromFile(device,
+			m_Info.NormalMapFilename.c_str(), &texRes, &m_NormalMapSRV));
+		ReleaseCOM(texRes);
+	}
+
+	return true;
+}
+
+bool Terrain::InitHeightmap(const InitInfo& initInfo)
+{
+	m_Info = initInfo;
+	m_HalfWidth = 0.5f * GetWidth();
+	m_HalfDepth = 0.5f * GetDepth();
+	m_InvCellSpacing = 1.0f / m_Info.CellSpacing;
+	m_Collider.SetCellSpacing(m_Info.CellSpacing);
+
+	// Divide heightmap into patches such that each patch has CellsPerPatch.
+	m_NumPatchVertRows = (m_Info.HeightmapHeight - 1) / CellsPerPatch + 1;
+	m_NumPatchVertCols = (m_Info.HeightmapWidth - 1) / CellsPerPatch + 1;
+
+	m_NumPatchVertices = m_NumPatchVertRows * m_NumPatchVertCols;
+	m_NumPatchQuadFaces = (m_NumPatchVertRows - 1) * (m_NumPatchVertCols - 1);
+
+	m_HeightmapStep = 1;
+	while ((m_Info.HeightmapWidth - 1) / m_HeightmapStep + 1 > MaxHeightmapTextureSize ||
+		(m_Info.HeightmapHeight - 1) / m_HeightmapStep + 1 > MaxHeightmapTextureSize)
+	{
+		m_HeightmapStep *= 2;
+	}
+	m_HeightmapTextureWidth = (m_Info.HeightmapWidth - 1) / m_HeightmapStep + 1;
+	m_HeightmapTextureHeight = (m_Info.HeightmapHeight - 1) / m_HeightmapStep + 1;
+
+	const std::wstring& filename = m_Info.HeightMapFilename;
+	size_t ext = filename.find_last_of(L'.');
+	std::wstring tiledFilename = filename.substr(0, ext) + L".thm";
+
+	if (tiledFilename == filename)
+	{
+		if (!m_Heightmap.Open(filename, m_Info.HeightmapBudget))
+		{
+			MessageBox(0, L"Cannot open the tiled heightmap.", 0, 0);
+			return false;
+		}
+	}
+	else
+	{
+		// The tiled file remembers the RAW file and scale it was converted from.
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if (!GetFileAttributesExW(filename.c_str(), GetFileExInfoStandard, &attributes))
+		{
+			MessageBox(0, L"Cannot find the heightmap.", 0, 0);
+			return false;
+		}
+
+		UINT heightScaleBits;
+		memcpy(&heightScaleBits, &m_Info.HeightScale, sizeof(heightScaleBits));
+
+		UINT64 source[] =
+		{
+			((UINT64)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow,
+			((UINT64)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime,
+			heightScaleBits
+		};
+
+		// 64-bit FNV-1a.
+		UINT64 key = 14695981039346656037ull;
+		const BYTE* bytes = (const BYTE*)source;
+		for (size_t i = 0; i < sizeof(source); ++i)
+		{
+			key = (key ^ bytes[i]) * 1099511628211ull;
+		}
+
+		bool upToDate = m_Heightmap.Open(tiledFilename, m_Info.HeightmapBudget) &&
+			m_Heightmap.GetKey() == key && m_Heightmap.GetPatchCells() == CellsPerPatch;
+		if (!upToDate)
+		{
+			m_Heightmap.Close();
+			if (!ConvertHeightmap(tiledFilename, key) ||
+				!m_Heightmap.Open(tiledFilename, m_Info.HeightmapBudget))
+			{
+				MessageBox(0, L"Cannot convert the heightmap.", 0, 0);
+				return false;
+			}
+		}
+	}
+
+	if (m_Heightmap.GetWidth() != m_Info.HeightmapWidth || m_Heightmap.GetHeight() != m_Info.HeightmapHeight ||
+		m_Heightmap.GetPatchCells() != CellsPerPatch)
+	{
+		m_Heightmap.Close();
+		MessageBox(0, L"The heightmap does not match the terrain size.", 0, 0);
+		return false;
+	}
+
+	CalcAllPatchBoundsY();
+
+	m_Pyramid.Build(m_Heightmap, &m_Pool);
+	m_PatchLevel = 0;
+	while (m_Pyramid.GetNodeCells(m_PatchLevel) < CellsPerPatch)
+	{
+		++m_PatchLevel;
+	}
+	m_VisibleIndices.reserve(m_NumPatchQuadFaces * 4);
+
+	if (m_Pyramid.GetLevelCount() > MaxLodLevels)
+	{
+		m_Heightmap.Close();
+		MessageBox(0, L"The heightmap is too large for the LOD selection.", 0, 0);
+		return false;
+	}
+	CalcLodDiagonals();
+
+	return true;
+}
+
+bool Terrain::BakeMaps(const TerrainBakeSettings& settings, const std::wstring& normalPath,
+	const std::wstring& tangentPath, const std::wstring& blendPath)
+{
+	// Texels line up with those of the heightmap texture.
+	TerrainBakeSettings textureSettings = settings;
+	textureSettings.Step = m_HeightmapStep;
+	textureSettings.Tangents = settings.Tangents && !tangentPath.empty();
+
+	TerrainMaps maps;
+	return TerrainBaker::Bake(m_Heightmap, m_Info.CellSpacing, textureSettings, maps, &m_Pool) &&
+		TerrainBaker::SaveDDS(maps, normalPath, tangentPath, blendPath);
+}
+
+UINT Terrain::PageAround(const XMFLOAT3& pos, float radius)
+{
+	float c = (pos.x + m_HalfWidth) * m_InvCellSpacing;
+	float d = (m_HalfDepth - pos.z) * m_InvCellSpacing;
+
+	return m_Heightmap.PageAround(d, c, radius / m_Info.CellSpacing, &m_Pool);
 }
 
 void Terrain::Draw(ID3D11DeviceContext * dc, const Camera & cam, DirectionalLight lights[3])
 {
-	dc->IASetInputLayout(InputLayouts::Terrain);
-	dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_4_CONTROL_POINT_PATCHLIST);
+	if (m_LodEnabled)
+	{
+		D3D11_VIEWPORT viewport;
+		UINT numViewports = 1;
+		dc->RSGetViewports(&numViewports, &viewport);
+
+		SelectLod(cam, viewport.Height);
+		if (m_LodInstances.empty())
+		{
+			return;
+		}
 
-	UINT stride = sizeof(Vertex::Terrain);
-	UINT offset = 0;
+		UploadLodInstances(dc);
+
+		dc->IASetInputLayout(InputLayouts::TerrainLod);
+		dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+		UINT stride[2] = { sizeof(Vertex::TerrainLod), sizeof(LodInstance) };
+		UINT offset[2] = { 0, 0 };
+		ID3D11Buffer* vbs[2] = { m_LodGridVB, m_LodInstanceVB };
+
+		dc->IASetVertexBuffers(0, 2, vbs, stride, offset);
+		dc->IASetIndexBuffer(m_LodGridIB, DXGI_FORMAT_R16_UINT, 0);
+	}
+	else
+	{
+		CullPatches(cam);
+		if (m_VisiblePatchCount == 0)
+		{
+			return;
+		}
 
-	dc->IASetVertexBuffers(0, 1, &m_QuadPatchVB, &stride, &offset);
-	dc->IASetIndexBuffer(m_QuadPatchIB, DXGI_FORMAT_R16_UINT, 0);
+		D3D11_MAPPED_SUBRESOURCE mappedData;
+		HR(dc->Map(m_QuadPatchIB, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedData));
+		memcpy(mappedData.pData, &m_VisibleIndices[0], m_VisibleIndices.size() * sizeof(UINT));
+		dc->Unmap(m_QuadPatchIB, 0);
+
+		dc->IASetInputLayout(InputLayouts::Terrain);
+		dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_4_CONTROL_POINT_PATCHLIST);
+
+		UINT stride = sizeof(Vertex::Terrain);
+		UINT offset = 0;
+
+		dc->IASetVertexBuffers(0, 1, &m_QuadPatchVB, &stride, &offset);
+		dc->IASetIndexBuffer(m_QuadPatchIB, DXGI_FORMAT_R32_UINT, 0);
+	}
 
 	XMMATRIX viewProj = cam.ViewProj();
 	XMMATRIX world = XMLoadFloat4x4(&m_World);
@@ -154,26 +600,52 @@ void Terrain::Draw(ID3D11DeviceContext * dc, const Camera & cam, DirectionalLigh
 	Effects::TerrainFX->SetMaxDist(500.0f);
 	Effects::TerrainFX->SetMinTess(0.0f);
 	Effects::TerrainFX->SetMaxTess(6.0f);
-	Effects::TerrainFX->SetTexelCellSpaceU(1.0f / m_Info.HeightmapWidth);
-	Effects::TerrainFX->SetTexelCellSpaceV(1.0f / m_Info.HeightmapHeight);
-	Effects::TerrainFX->SetWorldCellSpace(m_Info.CellSpacing);
+	Effects::TerrainFX->SetTexelCellSpaceU(1.0f / m_HeightmapTextureWidth);
+	Effects::TerrainFX->SetTexelCellSpaceV(1.0f / m_HeightmapTextureHeight);
+	Effects::TerrainFX->SetWorldCellSpace(m_Info.CellSpacing * m_HeightmapStep);
 	Effects::TerrainFX->SetWorldFrustumPlanes(worldPlanes);
+	if (m_LodEnabled)
+	{
+		Effects::TerrainFX->SetLodGridCells((float)LodGridCells);
+		Effects::TerrainFX->SetTerrainSize(XMFLOAT2(GetWidth(), GetDepth()));
+		Effects::TerrainFX->SetLodMorph(m_LodMorph, m_Pyramid.GetLevelCount());
+	}
 
 	Effects::TerrainFX->SetLayerMapArray(m_LayerMapArraySRV);
 	Effects::TerrainFX->SetBlendMap(m_BlendMapSRV);
 	Effects::TerrainFX->SetHeightMap(m_HeightMapSRV);
+	Effects::TerrainFX->SetNormalMap(m_NormalMapSRV);
+	Effects::TerrainFX->SetUseNormalMap(m_NormalMapSRV != nullptr);
 
 	Effects::TerrainFX->SetMaterial(m_Mat);
 
-	ID3DX11EffectTechnique* tech = Effects::TerrainFX->Light1Tech;
+	ID3DX11EffectTechnique* tech = m_LodEnabled ? Effects::TerrainFX->Light1LodTech : Effects::TerrainFX->Light1Tech;
 	D3DX11_TECHNIQUE_DESC techDesc;
 	tech->GetDesc(&techDesc);
 
+	// The quarter nodes draw the top left quarter of the grid from their own corner.
+	UINT gridIndexCount = LodGridCells * LodGridCells * 6;
+	UINT quarterCount = (UINT)m_LodInstances.size() - m_LodNodeCount;
+
 	for (int i = 0; i < techDesc.Passes; ++i)
 	{
 		ID3DX11EffectPass* pass = tech->GetPassByIndex(i);
 		pass->Apply(0, dc);
-		dc->DrawIndexed(m_NumPatchQuadFaces * 4, 0, 0);
+
+		if (!m_LodEnabled)
+		{
+			dc->DrawIndexed(m_VisiblePatchCount * 4, 0, 0);
+			continue;
+		}
+
+		if (m_LodNodeCount > 0)
+		{
+			dc->DrawIndexedInstanced(gridIndexCount, m_LodNodeCount, 0, 0, 0);
+		}
+		if (quarterCount > 0)
+		{
+			dc->DrawIndexedInstanced(gridIndexCount / 4, quarterCount, 0, 0, m_LodNodeCount);
+		}
 	}
 
 	// FX sets tessellation stages, but it does not disable them.  So do that here
@@ -182,131 +654,605 @@ void Terrain::Draw(ID3D11DeviceContext * dc, const Camera & cam, DirectionalLigh
 	dc->DSSetShader(nullptr, nullptr, 0);
 }
 
-void Terrain::LoadHeightmap()
+void Terrain::CullPatches(const Camera& cam)
 {
-	// A height for each vertex
-	std::vector<unsigned char> in(m_Info.HeightmapWidth * m_Info.HeightmapHeight);
+	double start = Benchmark::Now();
+
+	m_VisibleIndices.clear();
+
+	// The same planes the hull shader culls against.  The shaders use the
+	// patch positions as world positions, so they apply as they are.
+	FrustumQuery frustum(cam.ViewProj());
+	CullNode(frustum, m_Pyramid.GetLevelCount() - 1, 0, 0);
 
-	std::ifstream fin(m_Info.HeightMapFilename, std::ios_base::binary);
+	m_VisiblePatchCount = (UINT)m_VisibleIndices.size() / 4;
+	m_CullTime = Benchmark::Now() - start;
+}
+
+void Terrain::CullNode(const FrustumQuery& frustum, UINT level, UINT x, UINT y)
+{
+	XMFLOAT3 boundsMin, boundsMax;
+	GetNodeBounds(level, x, y, boundsMin, boundsMax);
 
-	if (fin)
+	FrustumQuery::Containment c = frustum.ClassifyBounds(boundsMin, boundsMax);
+	if (c == FrustumQuery::Outside)
 	{
-		fin.read((char*)&in[0], in.size());
-		fin.close();
+		return;
 	}
 
-	// Copy the array data into a float array and scale it.
-	m_Heightmap.resize(in.size());
-	for (int i = 0; i < m_Heightmap.size(); ++i)
+	if (c == FrustumQuery::Inside || level == m_PatchLevel)
 	{
-		m_Heightmap[i] = (in[i] / 255.0f) * m_Info.HeightScale;
+		AddPatches(level, x, y);
+		return;
+	}
+
+	for (UINT cy = 2 * y; cy < 2 * y + 2 && cy < m_Pyramid.GetLevelHeight(level - 1); ++cy)
+	{
+		for (UINT cx = 2 * x; cx < 2 * x + 2 && cx < m_Pyramid.GetLevelWidth(level - 1); ++cx)
+		{
+			CullNode(frustum, level - 1, cx, cy);
+		}
 	}
 }
 
-void Terrain::Smooth()
+void Terrain::AddPatches(UINT level, UINT x, UINT y)
 {
-	std::vector<float> dest(m_Heightmap.size());
+	// Patches covered by the node, which may reach past the patch grid.
+	UINT span = 1 << (level - m_PatchLevel);
+	UINT i1 = MathHelper::Min((y + 1) * span, m_NumPatchVertRows - 1);
+	UINT j1 = MathHelper::Min((x + 1) * span, m_NumPatchVertCols - 1);
+
+	for (UINT i = y * span; i < i1; ++i)
+	{
+		for (UINT j = x * span; j < j1; ++j)
+		{
+			// Top row of 2x2 quad patch
+			m_VisibleIndices.push_back(i * m_NumPatchVertCols + j);
+			m_VisibleIndices.push_back(i * m_NumPatchVertCols + j + 1);
 
-	for (int i = 0; i < m_Info.HeightmapHeight; ++i)
+			// Bottom row of 2x2 quad patch
+			m_VisibleIndices.push_back((i + 1) * m_NumPatchVertCols + j);
+			m_VisibleIndices.push_back((i + 1) * m_NumPatchVertCols + j + 1);
+		}
+	}
+}
+
+void Terrain::GatherCells(const XMFLOAT2 points[4], TileCursor& cursor, XMVECTOR* s, XMVECTOR* t,
+	XMVECTOR corners[4]) const
+{
+	// Two points per load, split into x and z.
+	XMVECTOR p01 = XMLoadFloat4((const XMFLOAT4*)&points[0]);
+	XMVECTOR p23 = XMLoadFloat4((const XMFLOAT4*)&points[2]);
+	XMVECTOR x = XMVectorPermute<0, 2, 4, 6>(p01, p23);
+	XMVECTOR z = XMVectorPermute<1, 3, 5, 7>(p01, p23);
+
+	// Cell space, staying on the terrain, as in GetHeight.
+	XMVECTOR invSpacing = XMVectorReplicate(m_InvCellSpacing);
+	XMVECTOR c = (x + XMVectorReplicate(m_HalfWidth)) * invSpacing;
+	XMVECTOR d = (XMVectorReplicate(m_HalfDepth) - z) * invSpacing;
+	c = XMVectorClamp(c, XMVectorZero(), XMVectorReplicate((float)(m_Info.HeightmapWidth - 1)));
+	d = XMVectorClamp(d, XMVectorZero(), XMVectorReplicate((float)(m_Info.HeightmapHeight - 1)));
+
+	XMVECTOR col = XMVectorMin(XMVectorFloor(c), XMVectorReplicate((float)(m_Info.HeightmapWidth - 2)));
+	XMVECTOR row = XMVectorMin(XMVectorFloor(d), XMVectorReplicate((float)(m_Info.HeightmapHeight - 2)));
+	*s = c - col;
+	*t = d - row;
+
+	XMFLOAT4 cols, rows;
+	XMStoreFloat4(&cols, col);
+	XMStoreFloat4(&rows, row);
+
+	// Gather the corners, asking the heightmap for a tile only when a point
+	// leaves the tile of the one before.
+	const UINT tileSamples = TiledHeightmap::TileCells + 1;
+	float gathered[4][4];
+	for (UINT k = 0; k < 4; ++k)
 	{
-		for (int j = 0; j < m_Info.HeightmapWidth; ++j)
+		UINT i = (UINT)(&rows.x)[k];
+		UINT j = (UINT)(&cols.x)[k];
+		UINT ty = MathHelper::Min(i / TiledHeightmap::TileCells, m_Heightmap.GetTilesY() - 1);
+		UINT tx = MathHelper::Min(j / TiledHeightmap::TileCells, m_Heightmap.GetTilesX() - 1);
+		if (cursor.Samples == nullptr || tx != cursor.X || ty != cursor.Y)
 		{
-			dest[i * m_Info.HeightmapWidth + j] = Average(i, j);
+			cursor.Samples = m_Heightmap.GetTile(tx, ty);
+			cursor.X = tx;
+			cursor.Y = ty;
 		}
+
+		const float* src = cursor.Samples + (i - ty * TiledHeightmap::TileCells) * tileSamples + (j - tx * TiledHeightmap::TileCells);
+		gathered[0][k] = src[0];
+		gathered[1][k] = src[1];
+		gathered[2][k] = src[tileSamples];
+		gathered[3][k] = src[tileSamples + 1];
 	}
 
-	// Replace the old heightmap with the filtered one.
-	m_Heightmap = dest;
+	for (UINT corner = 0; corner < 4; ++corner)
+	{
+		corners[corner] = XMLoadFloat4((const XMFLOAT4*)gathered[corner]);
+	}
 }
 
-bool Terrain::InBounds(int i, int j)
+void Terrain::GetNodeBounds(UINT level, UINT x, UINT y, XMFLOAT3& boundsMin, XMFLOAT3& boundsMax) const
 {
-	// True if ij are valid indices; false otherwise.
-	return
-		i >= 0 && i < (int)m_Info.HeightmapHeight &&
-		j >= 0 && j < (int)m_Info.HeightmapWidth;
+	// Nodes reaching past the heightmap are clipped to it.
+	UINT nodeCells = m_Pyramid.GetNodeCells(level);
+	UINT x0 = x * nodeCells;
+	UINT y0 = y * nodeCells;
+	UINT x1 = MathHelper::Min(x0 + nodeCells, m_Info.HeightmapWidth - 1);
+	UINT y1 = MathHelper::Min(y0 + nodeCells, m_Info.HeightmapHeight - 1);
+
+	XMFLOAT2 boundsY = m_Pyramid.GetBounds(level, x, y);
+
+	// Rows go down the z axis.
+	boundsMin = XMFLOAT3(-m_HalfWidth + x0 * m_Info.CellSpacing, boundsY.x, m_HalfDepth - y1 * m_Info.CellSpacing);
+	boundsMax = XMFLOAT3(-m_HalfWidth + x1 * m_Info.CellSpacing, boundsY.y, m_HalfDepth - y0 * m_Info.CellSpacing);
 }
 
-float Terrain::Average(int i, int j)
+bool Terrain::IntersectNode(const BVHRay& ray, UINT level, UINT x, UINT y, float entry, bool anyHit,
+	float* pDist, RayHit* hit) const
 {
-	// Function computes the average height of the ij element.
-	// It averages itself with its eight neighbor pixels.  Note
-	// that if a pixel is missing neighbor, we just don't include it
-	// in the average--that is, edge pixels don't have a neighbor pixel.
-	//
-	// ----------
-	// | 1| 2| 3|
-	// ----------
-	// |4 |ij| 6|
-	// ----------
-	// | 7| 8| 9|
-	// ----------
+	if (level == 0)
+	{
+		return IntersectCells(ray, x, y, entry, pDist, hit);
+	}
+
+	// The children the ray reaches, nearest first.
+	struct Child
+	{
+		float Entry;
+		UINT X;
+		UINT Y;
+	};
+	Child children[4];
+	UINT childCount = 0;
+
+	for (UINT cy = 2 * y; cy < 2 * y + 2 && cy < m_Pyramid.GetLevelHeight(level - 1); ++cy)
+	{
+		for (UINT cx = 2 * x; cx < 2 * x + 2 && cx < m_Pyramid.GetLevelWidth(level - 1); ++cx)
+		{
+			XMFLOAT3 boundsMin, boundsMax;
+			GetNodeBounds(level - 1, cx, cy, boundsMin, boundsMax);
+
+			float childEntry = ray.IntersectBounds(boundsMin, boundsMax, *pDist);
+			if (childEntry == MathHelper::Infinity)
+			{
+				continue;
+			}
 
-	float sum = 0.0f;
-	int num = 0;
+			UINT k = childCount++;
+			for (; k > 0 && children[k - 1].Entry > childEntry; --k)
+			{
+				children[k] = children[k - 1];
+			}
+			children[k].Entry = childEntry;
+			children[k].X = cx;
+			children[k].Y = cy;
+		}
+	}
 
-	for (int m = i - 1; m <= i + 1; ++m)
+	// A hit shortens the ray for the children behind it.
+	bool found = false;
+	for (UINT k = 0; k < childCount && children[k].Entry <= *pDist; ++k)
 	{
-		for (int n = j - 1; n <= j + 1; ++n)
+		if (IntersectNode(ray, level - 1, children[k].X, children[k].Y, children[k].Entry, anyHit, pDist, hit))
 		{
-			if (InBounds(m, n))
+			found = true;
+			if (anyHit)
 			{
-				sum += m_Heightmap[m * m_Info.HeightmapWidth + n];
-				++num;
+				break;
 			}
 		}
 	}
 
-	return sum / num;
+	return found;
 }
 
-void Terrain::CalcAllPatchBoundsY()
+bool Terrain::IntersectCells(const BVHRay& ray, UINT x, UINT y, float entry, float* pDist, RayHit* hit) const
 {
-	m_PatchBoundY.resize(m_NumPatchQuadFaces);
+	// Cells of the node, clipped to the heightmap.  A node of level 0 lies
+	// inside one tile.
+	UINT nodeCells = m_Pyramid.GetNodeCells(0);
+	int col0 = (int)(x * nodeCells);
+	int row0 = (int)(y * nodeCells);
+	int col1 = MathHelper::Min(col0 + (int)nodeCells, (int)m_Info.HeightmapWidth - 1);
+	int row1 = MathHelper::Min(row0 + (int)nodeCells, (int)m_Info.HeightmapHeight - 1);
+
+	const UINT tileSamples = TiledHeightmap::TileCells + 1;
+	UINT tx = MathHelper::Min(col0 / TiledHeightmap::TileCells, m_Heightmap.GetTilesX() - 1);
+	UINT ty = MathHelper::Min(row0 / TiledHeightmap::TileCells, m_Heightmap.GetTilesY() - 1);
+	const float* tile = m_Heightmap.GetTile(tx, ty);
+	int tileCol0 = (int)(tx * TiledHeightmap::TileCells);
+	int tileRow0 = (int)(ty * TiledHeightmap::TileCells);
+
+	// The ray in cell units: columns along x and rows down z.  The reciprocal
+	// direction of the ray is never infinite.
+	float spacing = m_Info.CellSpacing;
+	float c0 = (ray.Origin.x + m_HalfWidth) / spacing;
+	float r0 = (m_HalfDepth - ray.Origin.z) / spacing;
+	float dc = ray.Direction.x / spacing;
+	float dr = -ray.Direction.z / spacing;
+	float invDc = ray.InvDirection.x * spacing;
+	float invDr = -ray.InvDirection.z * spacing;
+	int stepC = invDc > 0.0f ? 1 : -1;
+	int stepR = invDr > 0.0f ? 1 : -1;
+
+	int col = MathHelper::Clamp((int)floorf(c0 + entry * dc), col0, col1 - 1);
+	int row = MathHelper::Clamp((int)floorf(r0 + entry * dr), row0, row1 - 1);
+
+	// Points this close outside a cell still count as inside it, so that a
+	// ray through a shared edge or corner hits one of the cells.
+	const float epsilon = 1e-4f;
+
+	for (;;)
+	{
+		// Heights at the corners, in the order of GetHeight:
+		// A*--*B
+		//  |  /|
+		//  | / |
+		// C*--*D
+		const float* corners = tile + (row - tileRow0) * tileSamples + (col - tileCol0);
+		float A = corners[0];
+		float B = corners[1];
+		float C = corners[tileSamples];
+		float D = corners[tileSamples + 1];
+
+		// The ray relative to the cell, where s and q run from 0 to 1 across
+		// the columns and rows and the triangles are planes
+		// h0 + s * hs + q * hq: ABC where s + q <= 1 and DCB past it.
+		float s0 = (ray.Origin.x - (-m_HalfWidth + col * spacing)) / spacing;
+		float q0 = ((m_HalfDepth - row * spacing) - ray.Origin.z) / spacing;
+		const float planes[2][3] =
+		{
+			{ A, B - A, C - A },
+			{ B + C - D, D - C, D - B }
+		};
 
-	// For each patch
-	for (int i = 0; i < m_NumPatchVertRows - 1; ++i)
+		bool found = false;
+		for (int k = 0; k < 2; ++k)
+		{
+			float h0 = planes[k][0];
+			float hs = planes[k][1];
+			float hq = planes[k][2];
+
+			// Height of the ray above the plane, linear in t.
+			float f0 = ray.Origin.y - h0 - s0 * hs - q0 * hq;
+			float f1 = ray.Direction.y - dc * hs - dr * hq;
+			if (f1 == 0.0f)
+			{
+				continue;
+			}
+
+			float t = -f0 / f1;
+			float s = s0 + t * dc;
+			float q = q0 + t * dr;
+			bool inTriangle = k == 0 ? s + q <= 1.0f + epsilon : s + q >= 1.0f - epsilon;
+			if (t < 0.0f || t > *pDist || !inTriangle ||
+				s < -epsilon || s > 1.0f + epsilon || q < -epsilon || q > 1.0f + epsilon)
+			{
+				continue;
+			}
+
+			XMVECTOR normal = XMVector3Normalize(XMVectorSet(-hs / spacing, 1.0f, hq / spacing, 0.0f));
+			XMStoreFloat3(&hit->Position, XMLoadFloat3(&ray.Origin) + t * XMLoadFloat3(&ray.Direction));
+			XMStoreFloat3(&hit->Normal, normal);
+			hit->Distance = t;
+			hit->Row = (UINT)row;
+			hit->Col = (UINT)col;
+
+			*pDist = t;
+			found = true;
+		}
+
+		// The cells are visited front to back, so the first hit is the nearest.
+		if (found)
+		{
+			return true;
+		}
+
+		float tNextC = (col + (stepC > 0 ? 1 : 0) - c0) * invDc;
+		float tNextR = (row + (stepR > 0 ? 1 : 0) - r0) * invDr;
+		if (MathHelper::Min(tNextC, tNextR) > *pDist)
+		{
+			return false;
+		}
+
+		if (tNextC < tNextR)
+		{
+			col += stepC;
+			if (col < col0 || col >= col1)
+			{
+				return false;
+			}
+		}
+		else
+		{
+			row += stepR;
+			if (row < row0 || row >= row1)
+			{
+				return false;
+			}
+		}
+	}
+}
+
+void Terrain::CalcLodDiagonals()
+{
+	// The diagonal bounds the distance between two points of a node.
+	UINT levelCount = m_Pyramid.GetLevelCount();
+	m_LodDiagonals.resize(levelCount);
+	m_LodRanges.resize(levelCount);
+
+	for (UINT level = 0; level < levelCount; ++level)
 	{
-		for (int j = 0; j < m_NumPatchVertCols - 1; ++j)
+		float maxRange = 0.0f;
+		for (UINT y = 0; y < m_Pyramid.GetLevelHeight(level); ++y)
+		{
+			for (UINT x = 0; x < m_Pyramid.GetLevelWidth(level); ++x)
+			{
+				XMFLOAT2 boundsY = m_Pyramid.GetBounds(level, x, y);
+				maxRange = MathHelper::Max(maxRange, boundsY.y - boundsY.x);
+			}
+		}
+
+		float size = m_Pyramid.GetNodeCells(level) * m_Info.CellSpacing;
+		m_LodDiagonals[level] = sqrtf(2.0f * size * size + maxRange * maxRange);
+	}
+}
+
+// True if the box reaches within range of p.
+static bool BoundsInRange(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax, const XMFLOAT3& p, float range)
+{
+	XMVECTOR v = XMLoadFloat3(&p);
+	XMVECTOR closest = XMVectorClamp(v, XMLoadFloat3(&boundsMin), XMLoadFloat3(&boundsMax));
+
+	return XMVectorGetX(XMVector3LengthSq(v - closest)) <= range * range;
+}
+
+void Terrain::SelectLod(const Camera& cam, float viewportHeight)
+{
+	double start = Benchmark::Now();
+
+	// Pixels a world unit covers one unit in front of the camera.
+	float pixelsPerUnit = 0.5f * viewportHeight / tanf(0.5f * cam.GetFovY());
+
+	// Level l is used up to the distance from which level l + 1 shows no
+	// more than the allowed error.  The vertices of a level morph into the
+	// grid of the next level from a node diagonal past the previous range,
+	// and every range leaves another diagonal for the morph.  A node then
+	// only meets nodes one level away: on a shared edge the finer node is
+	// fully morphed and the coarser one not morphed at all.  The morph ends
+	// a little early for the heights of the texture, which are rounded.
+	UINT levelCount = m_Pyramid.GetLevelCount();
+	float prevRange = 0.0f;
+	for (UINT level = 0; level < levelCount; ++level)
+	{
+		float morphStart = prevRange + m_LodDiagonals[level];
+		if (level + 1 == levelCount)
 		{
-			CalcPatchBoundsY(i, j);
+			m_LodRanges[level] = MathHelper::Infinity;
+			m_LodMorph[level] = XMFLOAT4(morphStart, 0.0f, 0.0f, 0.0f);
+			break;
 		}
+
+		// Nodes are drawn with LodGridCells quads along a side, the grid the
+		// pyramid measures the error of.
+		float range = m_Pyramid.GetGridError(level + 1) * pixelsPerUnit / m_LodPixelError;
+		range = MathHelper::Max(range, morphStart + m_LodDiagonals[level]);
+
+		m_LodRanges[level] = range;
+		m_LodMorph[level] = XMFLOAT4(morphStart, 1.0f / (0.95f * (range - morphStart)), 0.0f, 0.0f);
+		prevRange = range;
 	}
+
+	m_LodInstances.clear();
+	m_LodQuarters.clear();
+
+	FrustumQuery frustum(cam.ViewProj());
+	SelectNode(frustum, cam.GetPosition(), levelCount - 1, 0, 0, false);
+
+	// Whole nodes first, then the quarters.
+	m_LodNodeCount = (UINT)m_LodInstances.size();
+	m_LodInstances.insert(m_LodInstances.end(), m_LodQuarters.begin(), m_LodQuarters.end());
+
+	UINT nodeTriangles = 2 * LodGridCells * LodGridCells;
+	m_LodTriangleCount = m_LodNodeCount * nodeTriangles + (UINT)m_LodQuarters.size() * nodeTriangles / 4;
+	m_LodSelectTime = Benchmark::Now() - start;
 }
 
-void Terrain::CalcPatchBoundsY(UINT i, UINT j)
+void Terrain::SelectNode(const FrustumQuery& frustum, const XMFLOAT3& eye, UINT level, UINT x, UINT y, bool inside)
 {
-	// Scan the heightmap values this patch covers and compute the min/max height.
+	XMFLOAT3 boundsMin, boundsMax;
+	GetNodeBounds(level, x, y, boundsMin, boundsMax);
 
-	int x0 = j * CellsPerPatch;
-	int x1 = (j + 1) * CellsPerPatch;
+	// The children of a node inside the frustum are inside too.
+	if (!inside)
+	{
+		FrustumQuery::Containment c = frustum.ClassifyBounds(boundsMin, boundsMax);
+		if (c == FrustumQuery::Outside)
+		{
+			return;
+		}
+		inside = c == FrustumQuery::Inside;
+	}
 
-	int y0 = i * CellsPerPatch;
-	int y1 = (i + 1) * CellsPerPatch;
+	// A node out of reach of the finer level is drawn whole.
+	if (level == 0 || !BoundsInRange(boundsMin, boundsMax, eye, m_LodRanges[level - 1]))
+	{
+		m_LodInstances.push_back(MakeLodInstance(level, x, y, level));
+		return;
+	}
 
+	// Children in reach of the finer level are selected in turn; the others
+	// are drawn as quarters of this node, at its spacing.
+	for (UINT cy = 2 * y; cy < 2 * y + 2 && cy < m_Pyramid.GetLevelHeight(level - 1); ++cy)
+	{
+		for (UINT cx = 2 * x; cx < 2 * x + 2 && cx < m_Pyramid.GetLevelWidth(level - 1); ++cx)
+		{
+			XMFLOAT3 childMin, childMax;
+			GetNodeBounds(level - 1, cx, cy, childMin, childMax);
+
+			if (BoundsInRange(childMin, childMax, eye, m_LodRanges[level - 1]))
+			{
+				SelectNode(frustum, eye, level - 1, cx, cy, inside);
+			}
+			else if (inside || frustum.ClassifyBounds(childMin, childMax) != FrustumQuery::Outside)
+			{
+				m_LodQuarters.push_back(MakeLodInstance(level - 1, cx, cy, level));
+			}
+		}
+	}
+}
+
+Terrain::LodInstance Terrain::MakeLodInstance(UINT level, UINT x, UINT y, UINT spacingLevel) const
+{
+	// Node (x, y) of a level, drawn with the grid spacing of another.
+	UINT nodeCells = m_Pyramid.GetNodeCells(level);
+
+	LodInstance instance;
+	instance.Origin.x = -m_HalfWidth + x * nodeCells * m_Info.CellSpacing;
+	instance.Origin.y = m_HalfDepth - y * nodeCells * m_Info.CellSpacing;
+	instance.Size = m_Pyramid.GetNodeCells(spacingLevel) * m_Info.CellSpacing;
+	instance.Level = (float)spacingLevel;
+
+	return instance;
+}
+
+void Terrain::UploadLodInstances(ID3D11DeviceContext* dc)
+{
+	if (m_LodInstances.size() > m_LodInstanceCapacity)
+	{
+		while (m_LodInstanceCapacity < m_LodInstances.size())
+		{
+			m_LodInstanceCapacity *= 2;
+		}
+
+		ID3D11Device* device = nullptr;
+		dc->GetDevice(&device);
+		ReleaseCOM(m_LodInstanceVB);
+		BuildLodInstanceVB(device);
+		ReleaseCOM(device);
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mappedData;
+	HR(dc->Map(m_LodInstanceVB, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedData));
+	memcpy(mappedData.pData, &m_LodInstances[0], m_LodInstances.size() * sizeof(LodInstance));
+	dc->Unmap(m_LodInstanceVB, 0);
+}
+
+bool Terrain::ConvertHeightmap(const std::wstring& tiledFilename, UINT64 key)
+{
+	MappedFile raw;
+	UINT width = m_Info.HeightmapWidth;
+	UINT height = m_Info.HeightmapHeight;
+	if (!raw.Open(m_Info.HeightMapFilename) || raw.GetSize() < (UINT64)width * height)
+	{
+		return false;
+	}
+
+	// 16-bit and float files are told apart from 8-bit ones by their size.
+	UINT64 sampleCount = (UINT64)width * height;
+	UINT sampleSize = 1;
+	if (raw.GetSize() == sampleCount * sizeof(USHORT))
+	{
+		sampleSize = sizeof(USHORT);
+	}
+	else if (raw.GetSize() == sampleCount * sizeof(float))
+	{
+		sampleSize = sizeof(float);
+	}
+
+	auto scaleRow = [&](UINT row, float* out)
+	{
+		const BYTE* in = raw.GetData() + (UINT64)row * width * sampleSize;
+		if (sampleSize == 1)
+		{
+			PackedConvert::Unorm8ToFloat(in, out, width);
+		}
+		else if (sampleSize == sizeof(USHORT))
+		{
+			PackedConvert::Unorm16ToFloat((const USHORT*)in, out, width);
+		}
+		else
+		{
+			memcpy(out, in, width * sizeof(float));
+		}
+
+		for (UINT j = 0; j < width; ++j)
+		{
+			out[j] *= m_Info.HeightScale;
+		}
+	};
+
+	// Rows are scaled and smoothed a band at a time, each band with the row
+	// on either side of it that the 3x3 average reaches.
+	const UINT bandRows = TiledHeightmap::TileCells;
+	std::vector<float> scaled((bandRows + 2) * width);
+	std::vector<float> smoothed(bandRows * width);
+	UINT bandFirstRow = 0;
+	UINT bandRowCount = 0;
+
+	// The height range of the file, which smoothing stays within, sets the
+	// step the heights are rounded to.
 	float minY = +MathHelper::Infinity;
 	float maxY = -MathHelper::Infinity;
-
-	for (int y = y0; y <= y1;  ++y)
+	for (UINT row = 0; row < height; ++row)
 	{
-		for (int x = x0; x <= x1; ++x)
+		scaleRow(row, &scaled[0]);
+		for (UINT j = 0; j < width; ++j)
 		{
-			int idx = y * m_Info.HeightmapWidth + x;
-			minY = MathHelper::Min(minY, m_Heightmap[idx]);
-			maxY = MathHelper::Max(maxY, m_Heightmap[idx]);
+			minY = MathHelper::Min(minY, scaled[j]);
+			maxY = MathHelper::Max(maxY, scaled[j]);
 		}
 	}
 
-	int patchID = i * (m_NumPatchVertCols - 1) + j;
-	m_PatchBoundY[patchID] = XMFLOAT2(minY, maxY);
+	float levels = sampleSize == sizeof(float) ? (float)((1 << 20) - 1) : 65535.0f;
+	float heightStep = maxY > minY ? (maxY - minY) / levels : 1.0f;
+
+	HeightFilter filter(HeightFilter::Box, 1);
+
+	auto readRow = [&](UINT row, float* samples)
+	{
+		if (row >= bandFirstRow + bandRowCount)
+		{
+			bandFirstRow = row;
+			bandRowCount = MathHelper::Min(bandRows, height - row);
+
+			UINT top = row > 0 ? row - 1 : 0;
+			UINT bottom = MathHelper::Min(row + bandRowCount + 1, height);
+			for (UINT r = top; r < bottom; ++r)
+			{
+				scaleRow(r, &scaled[(r - top) * width]);
+			}
+
+			filter.Apply(&scaled[0], top, width, height, bandFirstRow, bandRowCount, &smoothed[0], &m_Pool);
+		}
+
+		memcpy(samples, &smoothed[(row - bandFirstRow) * width], width * sizeof(float));
+	};
+
+	return TiledHeightmap::Write(tiledFilename, width, height, CellsPerPatch, key, readRow, minY, heightStep);
+}
+
+void Terrain::CalcAllPatchBoundsY()
+{
+	// The tiled heightmap keeps the min/max height of every patch in its
+	// index, so no tile is read for them.
+	m_PatchBoundY.resize(m_NumPatchQuadFaces);
+
+	// For each patch
+	for (UINT i = 0; i < m_NumPatchVertRows - 1; ++i)
+	{
+		for (UINT j = 0; j < m_NumPatchVertCols - 1; ++j)
+		{
+			int patchID = i * (m_NumPatchVertCols - 1) + j;
+			m_PatchBoundY[patchID] = m_Heightmap.GetPatchBounds(i, j);
+		}
+	}
 }
 
 void Terrain::BuildQuadPatchVB(ID3D11Device * device)
 {
 	std::vector<Vertex::Terrain> vertices(m_NumPatchVertices);
-	
-	float halfWidth = 0.5f * GetWidth();
-	float halfDepth = 0.5f * GetDepth();
 
 	float patchWidth = GetWidth() / (m_NumPatchVertCols - 1);
 	float patchDepth = GetDepth() / (m_NumPatchVertRows - 1);
@@ -315,10 +1261,10 @@ void Terrain::BuildQuadPatchVB(ID3D11Device * device)
 
 	for (int i = 0; i < m_NumPatchVertRows; ++i)
 	{
-		float z = halfDepth - i * patchDepth;
+		float z = m_HalfDepth - i * patchDepth;
 		for (int j = 0; j < m_NumPatchVertCols; ++j)
 		{
-			float x = -halfWidth + j * patchWidth;
+			float x = -m_HalfWidth + j * patchWidth;
 
 			vertices[i * m_NumPatchVertCols + j].Pos = XMFLOAT3(x, 0, z);
 
@@ -353,42 +1299,24 @@ void Terrain::BuildQuadPatchVB(ID3D11Device * device)
 
 void Terrain::BuildQuadPatchIB(ID3D11Device * device)
 {
-	std::vector<USHORT> indices(m_NumPatchQuadFaces * 4);	// 4 indices per quad face
-	
-	// Iterate over each quad and compute indices.
-	int idx = 0;
-	for (int i = 0; i < m_NumPatchVertRows - 1; ++i)
-	{
-		for (int j = 0; j < m_NumPatchVertCols - 1; ++j)
-		{
-			// Top row of 2x2 quad patch
-			indices[idx++] = i * m_NumPatchVertCols + j;
-			indices[idx++] = i * m_NumPatchVertCols + j + 1;
-
-			// Bottom row of 2x2 quad patch
-			indices[idx++] =( i + 1) * m_NumPatchVertCols + j;
-			indices[idx++] = (i + 1) * m_NumPatchVertCols + j + 1;
-		}
-	}
-
+	// Filled with the visible patches every frame, 4 indices per quad face.
+	// 32-bit indices, as heightmaps of 16k samples and more have over 65536 patch vertices.
 	D3D11_BUFFER_DESC ibd;
-	ibd.Usage = D3D11_USAGE_IMMUTABLE;
-	ibd.ByteWidth = sizeof(USHORT) * indices.size();
+	ibd.Usage = D3D11_USAGE_DYNAMIC;
+	ibd.ByteWidth = sizeof(UINT) * m_NumPatchQuadFaces * 4;
 	ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	ibd.CPUAccessFlags = 0;
+	ibd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
 	ibd.MiscFlags = 0;
 	ibd.StructureByteStride = 0;
 
-	D3D11_SUBRESOURCE_DATA data;
-	data.pSysMem = &indices[0];
-	HR(device->CreateBuffer(&ibd, &data, &m_QuadPatchIB));
+	HR(device->CreateBuffer(&ibd, nullptr, &m_QuadPatchIB));
 }
 
-void Terrain::BuildHeightmapSRV(ID3D11Device * device)
+void Terrain::BuildHeightmapSRV(ID3D11Device * device, ID3D11DeviceContext * dc)
 {
 	D3D11_TEXTURE2D_DESC texDesc;
-	texDesc.Width = m_Info.HeightmapWidth;
-	texDesc.Height = m_Info.HeightmapHeight;
+	texDesc.Width = m_HeightmapTextureWidth;
+	texDesc.Height = m_HeightmapTextureHeight;
 	texDesc.MipLevels = 1;
 	texDesc.ArraySize = 1;
 	texDesc.Format = DXGI_FORMAT_R16_FLOAT;
@@ -399,16 +1327,59 @@ void Terrain::BuildHeightmapSRV(ID3D11Device * device)
 	texDesc.CPUAccessFlags = 0;
 	texDesc.MiscFlags = 0;
 
-	std::vector<DirectX::PackedVector::HALF> hmap(m_Heightmap.size());
-	std::transform(m_Heightmap.begin(), m_Heightmap.end(), hmap.begin(), DirectX::PackedVector::XMConvertFloatToHalf);
+	ID3D11Texture2D* hmapTex = nullptr;
+	HR(device->CreateTexture2D(&texDesc, nullptr, &hmapTex));
 
-	D3D11_SUBRESOURCE_DATA data;
-	data.pSysMem = &hmap[0];
-	data.SysMemPitch = m_Info.HeightmapWidth * sizeof(DirectX::PackedVector::HALF);
-	data.SysMemSlicePitch = 0;
+	// Upload one tile at a time, so that the whole heightmap is never in
+	// memory.  Tiles share their border texels, which are written twice.
+	const UINT tileCells = TiledHeightmap::TileCells;
+	const UINT tileSamples = tileCells + 1;
+	std::vector<PackedConvert::HALF> hmap(tileSamples * tileSamples);
+	std::vector<float> row(tileSamples);
 
-	ID3D11Texture2D* hmapTex = nullptr;
-	HR(device->CreateTexture2D(&texDesc, &data, &hmapTex));
+	for (UINT ty = 0; ty < m_Heightmap.GetTilesY(); ++ty)
+	{
+		m_Heightmap.PageRect(0, ty, m_Heightmap.GetTilesX() - 1, ty, &m_Pool);
+
+		for (UINT tx = 0; tx < m_Heightmap.GetTilesX(); ++tx)
+		{
+			const float* tile = m_Heightmap.GetTile(tx, ty);
+
+			UINT x0 = tx * tileCells / m_HeightmapStep;
+			UINT y0 = ty * tileCells / m_HeightmapStep;
+			UINT x1 = MathHelper::Min((tx + 1) * tileCells / m_HeightmapStep, m_HeightmapTextureWidth - 1);
+			UINT y1 = MathHelper::Min((ty + 1) * tileCells / m_HeightmapStep, m_HeightmapTextureHeight - 1);
+
+			UINT texelsX = x1 - x0 + 1;
+			UINT texelsY = y1 - y0 + 1;
+			if (m_HeightmapStep == 1 && texelsX == tileSamples)
+			{
+				// Whole rows of the tile, which follow each other.
+				PackedConvert::FloatToHalf(tile, &hmap[0], texelsX * texelsY, &m_Pool);
+			}
+			else
+			{
+				for (UINT y = y0; y <= y1; ++y)
+				{
+					const float* src = tile + (y - y0) * m_HeightmapStep * tileSamples;
+					for (UINT x = 0; x < texelsX; ++x)
+					{
+						row[x] = src[x * m_HeightmapStep];
+					}
+					PackedConvert::FloatToHalf(&row[0], &hmap[(y - y0) * texelsX], texelsX);
+				}
+			}
+
+			D3D11_BOX box;
+			box.left = x0;
+			box.right = x1 + 1;
+			box.top = y0;
+			box.bottom = y1 + 1;
+			box.front = 0;
+			box.back = 1;
+			dc->UpdateSubresource(hmapTex, 0, &box, &hmap[0], texelsX * sizeof(PackedConvert::HALF), 0);
+		}
+	}
 
 	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
 	srvDesc.Format = texDesc.Format;
@@ -419,3 +1390,80 @@ void Terrain::BuildHeightmapSRV(ID3D11Device * device)
 
 	ReleaseCOM(hmapTex);
 }
+
+void Terrain::BuildLodGridBuffers(ID3D11Device* device)
+{
+	// The vertices hold their grid coordinates; the vertex shader places
+	// them with the node of the instance.
+	const UINT n = LodGridCells + 1;
+	std::vector<Vertex::TerrainLod> vertices(n * n);
+	for (UINT i = 0; i < n; ++i)
+	{
+		for (UINT j = 0; j < n; ++j)
+		{
+			vertices[i * n + j].GridPos = XMFLOAT2((float)j, (float)i);
+		}
+	}
+
+	D3D11_BUFFER_DESC vbd;
+	vbd.Usage = D3D11_USAGE_IMMUTABLE;
+	vbd.ByteWidth = sizeof(Vertex::TerrainLod) * vertices.size();
+	vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	vbd.CPUAccessFlags = 0;
+	vbd.MiscFlags = 0;
+	vbd.StructureByteStride = 0;
+
+	D3D11_SUBRESOURCE_DATA vinitData;
+	vinitData.pSysMem = &vertices[0];
+	HR(device->CreateBuffer(&vbd, &vinitData, &m_LodGridVB));
+
+	// Two triangles per quad, a quarter of the grid at a time starting with
+	// the top left one, so that the quarter nodes draw the first indices.
+	const UINT half = LodGridCells / 2;
+	std::vector<USHORT> indices;
+	indices.reserve(LodGridCells * LodGridCells * 6);
+	for (UINT q = 0; q < 4; ++q)
+	{
+		UINT i0 = (q / 2) * half;
+		UINT j0 = (q % 2) * half;
+		for (UINT i = i0; i < i0 + half; ++i)
+		{
+			for (UINT j = j0; j < j0 + half; ++j)
+			{
+				indices.push_back(i * n + j);
+				indices.push_back(i * n + j + 1);
+				indices.push_back((i + 1) * n + j);
+
+				indices.push_back((i + 1) * n + j);
+				indices.push_back(i * n + j + 1);
+				indices.push_back((i + 1) * n + j + 1);
+			}
+		}
+	}
+
+	D3D11_BUFFER_DESC ibd;
+	ibd.Usage = D3D11_USAGE_IMMUTABLE;
+	ibd.ByteWidth = sizeof(USHORT) * indices.size();
+	ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+	ibd.CPUAccessFlags = 0;
+	ibd.MiscFlags = 0;
+	ibd.StructureByteStride = 0;
+
+	D3D11_SUBRESOURCE_DATA iinitData;
+	iinitData.pSysMem = &indices[0];
+	HR(device->CreateBuffer(&ibd, &iinitData, &m_LodGridIB));
+}
+
+void Terrain::BuildLodInstanceVB(ID3D11Device* device)
+{
+	// Filled with the selected nodes every frame.
+	D3D11_BUFFER_DESC vbd;
+	vbd.Usage = D3D11_USAGE_DYNAMIC;
+	vbd.ByteWidth = sizeof(LodInstance) * m_LodInstanceCapacity;
+	vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	vbd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	vbd.MiscFlags = 0;
+	vbd.StructureByteStride = 0;
+
+	HR(device->CreateBuffer(&vbd, nullptr, &m_LodInstanceVB));
+}
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "d3dUtil.h"
-
-class Camera;
+#include "HeightPyramid.h"
+#include "HeightfieldCollider.h"
+#include "BVH.h"
+#include "TerrainBaker.h"
 
 class Terrain
 {
@@ -12,10 +14,41 @@ public:
 		std::wstring HeightMapFilename;
 		std::wstring LayerMapArrayFilename;
 		std::wstring BlendMapFilename;
+
+		// Normal map baked by BakeMaps.  Left empty, or naming a file that
+		// does not exist, the effect takes the normals from the heightmap
+		// texture per pixel.
+		std::wstring NormalMapFilename;
 		float HeightScale;
 		UINT HeightmapWidth;
 		UINT HeightmapHeight;
 		float CellSpacing;
+
+		// Bytes of heightmap tiles kept in memory.
+		UINT64 HeightmapBudget;
+	};
+
+	// A node picked by SelectLod, drawn as an instance of the LOD grid.
+	struct LodInstance
+	{
+		// x and z of the corner with the smallest x and largest z.
+		XMFLOAT2 Origin;
+
+		// Side of a node of the level; the grid spacing is Size / LodGridCells.
+		float Size;
+		float Level;
+	};
+
+	// Where a ray meets the surface, in terrain space.  The distance is in
+	// units of the ray direction and the cell is the one GetHeight reads at
+	// the point.
+	struct RayHit
+	{
+		XMFLOAT3 Position;
+		XMFLOAT3 Normal;
+		float Distance;
+		UINT Row;
+		UINT Col;
 	};
 
 public:
@@ -26,23 +59,151 @@ public:
 	float GetDepth() const;
 	float GetHeight(float x, float z) const;
 
+	/// Heights of count points (x, z) in terrain space, four at a time, the
+	/// same as GetHeight would return for each: points off the terrain are
+	/// clamped to its edge.  Points close to each other in the array share
+	/// tile lookups.
+	void GetHeights(const XMFLOAT2* points, UINT count, float* heights) const;
+
+	/// Unit normals of the triangles GetHeights interpolates at count points.
+	void GetNormals(const XMFLOAT2* points, UINT count, XMFLOAT3* normals) const;
+
+	/// Finds where a ray in terrain space first crosses the surface GetHeight
+	/// interpolates, from above or below, within maxDist.  The ray walks the
+	/// min/max pyramid front to back, skipping the nodes whose bounds it
+	/// misses, and steps through the cells of the finest nodes it reaches,
+	/// solving for the crossing of both triangles of every cell exactly.
+	bool Intersect(FXMVECTOR origin, FXMVECTOR dir, float maxDist, RayHit* hit) const;
+
+	/// Picks the surface under a point of the viewport.  The camera ray is
+	/// taken to terrain space with the world matrix and the distance of the
+	/// hit is in world units.
+	bool Pick(const Camera& cam, float x, float y, float viewportWidth, float viewportHeight, RayHit* hit) const;
+
+	/// True if the segment between two points in terrain space does not
+	/// cross the surface.  The first hit found ends the walk.  A hundredth
+	/// of a cell at either end is left out, so points on the surface can
+	/// see each other.
+	bool HasLineOfSight(const XMFLOAT3& from, const XMFLOAT3& to) const;
+
+	/// Sweeps a sphere or capsule in terrain space against the surface; see
+	/// HeightfieldCollider.
+	bool Sweep(const HeightfieldSweep& sweep, HeightfieldContact* contact) const;
+
+	/// Sweeps count bodies across the threads of the terrain's pool.  Returns
+	/// the number that touch the surface.
+	UINT SweepBatch(const HeightfieldSweep* sweeps, UINT count, HeightfieldContact* contacts, bool* hits);
+
 	XMMATRIX GetWorld() const;
 	void SetWorld(CXMMATRIX M);
 
-	void Init(ID3D11Device* device, ID3D11DeviceContext* dc, const InitInfo& initInfo);
+	bool Init(ID3D11Device* device, ID3D11DeviceContext* dc, const InitInfo& initInfo);
+
+	/// Opens the heightmap and reads the patch bounds without creating any
+	/// GPU resource; Init calls it first.  A RAW heightmap is converted to a
+	/// tiled one next to it the first time, and again whenever the RAW file
+	/// or the height scale changes.  A .thm file is opened as is.
+	///
+	/// The RAW file holds 8-bit or 16-bit unsigned samples, which span 0 to
+	/// HeightScale, or 32-bit floats, which are multiplied by HeightScale;
+	/// its size tells them apart.  The tiled file is compressed, keeping
+	/// heights to 1/65535 of the height range of the RAW file, or 1/2^20 of
+	/// it for floats.
+	bool InitHeightmap(const InitInfo& initInfo);
+
+	/// Bakes the normal, tangent and blend maps of the heightmap at the
+	/// resolution of the heightmap texture and writes them as DDS files,
+	/// skipping those with an empty path.  Needs InitHeightmap only.
+	bool BakeMaps(const TerrainBakeSettings& settings, const std::wstring& normalPath,
+		const std::wstring& tangentPath, const std::wstring& blendPath);
 
+	/// Pages in the heightmap tiles within radius of a point in terrain
+	/// space, nearest first.  Call once a frame with the camera position.
+	/// Returns the number of tiles read.
+	UINT PageAround(const XMFLOAT3& pos, float radius);
+
+	const TiledHeightmap& GetHeightmap() const;
+	const HeightPyramid& GetPyramid() const;
+	const HeightfieldCollider& GetCollider() const;
+
+	UINT GetPatchCount() const;
+
+	// Statistics of the last CullPatches; the time is in seconds.
+	UINT GetVisiblePatchCount() const;
+	double GetCullTime() const;
+
+	/// Draws the nodes SelectLod picks for the camera, or with LOD selection
+	/// off the tessellated patches CullPatches leaves.
 	void Draw(ID3D11DeviceContext* dc, const Camera& cam, DirectionalLight lights[3]);
 
+	// LOD selection is on by default.
+	void SetLodEnabled(bool enabled);
+	bool IsLodEnabled() const;
+
+	// Screen-space error in pixels SelectLod allows a level before it picks
+	// the finer one.
+	void SetLodPixelError(float pixels);
+
+	/// Walks the min/max pyramid as a quadtree and picks for every part of
+	/// the terrain in the frustum the coarsest level whose screen-space
+	/// error is within the allowed pixels, CDLOD style.  The distance at which
+	/// a level gives way to the next grows with the grid error the pyramid
+	/// measures for the next level.  Vertices morph into the grid of the next
+	/// level towards the end of their range, so that neighbouring nodes of
+	/// different levels meet without cracks.  Draw calls it; it needs no
+	/// device.
+	void SelectLod(const Camera& cam, float viewportHeight);
+
+	// Instances of the last SelectLod: the whole nodes, then the nodes of
+	// which only a quarter is drawn, at the spacing of the whole node.
+	const std::vector<LodInstance>& GetLodInstances() const;
+	UINT GetLodNodeCount() const;
+
+	// Statistics of the last SelectLod; the time is in seconds.
+	UINT GetLodTriangleCount() const;
+	double GetLodSelectTime() const;
+
+	/// Walks the min/max pyramid as a quadtree from the top, skipping nodes
+	/// outside the frustum and taking every patch of a node inside it without
+	/// further tests, and lists the indices of the visible patches.  Draw
+	/// calls it; it needs no device.
+	void CullPatches(const Camera& cam);
+
 private:
-	void LoadHeightmap();
-	void Smooth();
-	bool InBounds(int i, int j);
-	float Average(int i, int j);
+	// Converts the RAW heightmap to a tiled file, scaling it and averaging
+	// every sample with its eight neighbours on the way.  The RAW file holds
+	// 8-bit or 16-bit unsigned normalized samples or floats, told apart by
+	// its size; integer samples are scaled from [0, 1], floats as they are.
+	bool ConvertHeightmap(const std::wstring& tiledFilename, UINT64 key);
 	void CalcAllPatchBoundsY();
-	void CalcPatchBoundsY(UINT i, UINT j);
+	void CullNode(const FrustumQuery& frustum, UINT level, UINT x, UINT y);
+	void AddPatches(UINT level, UINT x, UINT y);
+
+	// The heightmap tile a batch query read last, which stays resident until
+	// the query asks for another one.
+	struct TileCursor
+	{
+		const float* Samples;
+		UINT X;
+		UINT Y;
+	};
+
+	// Position within their cells of four points, clamped to the terrain
+	// like GetHeight, and the heights at the corners of the cells in the
+	// order of GetCellCorners.
+	void GatherCells(const XMFLOAT2 points[4], TileCursor& cursor, XMVECTOR* s, XMVECTOR* t, XMVECTOR corners[4]) const;
+	void GetNodeBounds(UINT level, UINT x, UINT y, XMFLOAT3& boundsMin, XMFLOAT3& boundsMax) const;
+	bool IntersectNode(const BVHRay& ray, UINT level, UINT x, UINT y, float entry, bool anyHit, float* pDist, RayHit* hit) const;
+	bool IntersectCells(const BVHRay& ray, UINT x, UINT y, float entry, float* pDist, RayHit* hit) const;
+	void CalcLodDiagonals();
+	void SelectNode(const FrustumQuery& frustum, const XMFLOAT3& eye, UINT level, UINT x, UINT y, bool inside);
+	LodInstance MakeLodInstance(UINT level, UINT x, UINT y, UINT spacingLevel) const;
+	void UploadLodInstances(ID3D11DeviceContext* dc);
+	void BuildLodGridBuffers(ID3D11Device* device);
+	void BuildLodInstanceVB(ID3D11Device* device);
 	void BuildQuadPatchVB(ID3D11Device* device);
 	void BuildQuadPatchIB(ID3D11Device* device);
-	void BuildHeightmapSRV(ID3D11Device* device);
+	void BuildHeightmapSRV(ID3D11Device* device, ID3D11DeviceContext* dc);
 
 private:
 	// Divide heightmap into patches such that each patch has CellsPerPatch cells
@@ -50,12 +211,24 @@ private:
 	// to 64, we use all the data from the heightmap.  
 	static const int CellsPerPatch = 64;
 
+	// Largest texture side Direct3D 11 guarantees.  Bigger heightmaps are
+	// uploaded at every second (fourth, ...) sample.
+	static const UINT MaxHeightmapTextureSize = 16384;
+
+	// Quads along a side of the LOD grid.  A node of level 0 covers as many
+	// cells, so that it is drawn at the full resolution of the heightmap.
+	static const UINT LodGridCells = HeightPyramid::BaseCells;
+
+	// Size of the morph constant array of the effect.
+	static const UINT MaxLodLevels = 16;
+
 	ID3D11Buffer* m_QuadPatchVB;
 	ID3D11Buffer* m_QuadPatchIB;
 
 	ID3D11ShaderResourceView* m_HeightMapSRV;
 	ID3D11ShaderResourceView* m_LayerMapArraySRV;
 	ID3D11ShaderResourceView* m_BlendMapSRV;
+	ID3D11ShaderResourceView* m_NormalMapSRV;
 
 	InitInfo m_Info;
 
@@ -64,12 +237,65 @@ private:
 
 	UINT m_NumPatchVertRows;
 	UINT m_NumPatchVertCols;
-	
+
+	// Heightmap samples per texel of the heightmap texture.
+	UINT m_HeightmapStep;
+	UINT m_HeightmapTextureWidth;
+	UINT m_HeightmapTextureHeight;
+
+	// Half the size of the terrain and one over the cell spacing, for the
+	// height queries.
+	float m_HalfWidth;
+	float m_HalfDepth;
+	float m_InvCellSpacing;
+
 	XMFLOAT4X4 m_World;
 
 	Material m_Mat;
 
 	// Record the min height value, and max height value in each patch
 	std::vector<XMFLOAT2> m_PatchBoundY;
-	std::vector<float> m_Heightmap;
+
+	// GetHeight pages tiles in, so the cache changes behind const queries.
+	mutable TiledHeightmap m_Heightmap;
+
+	// Decodes heightmap tiles and smooths the heightmaps converted.
+	ThreadPool m_Pool;
+
+	HeightPyramid m_Pyramid;
+
+	HeightfieldCollider m_Collider;
+
+	// Pyramid level whose nodes are the patches.
+	UINT m_PatchLevel;
+
+	// Four indices per visible patch, copied into the dynamic index buffer.
+	std::vector<UINT> m_VisibleIndices;
+	UINT m_VisiblePatchCount;
+	double m_CullTime;
+
+	bool m_LodEnabled;
+	float m_LodPixelError;
+
+	// The LOD grid, with the indices of its top left quarter first, and the
+	// instances of a frame.
+	ID3D11Buffer* m_LodGridVB;
+	ID3D11Buffer* m_LodGridIB;
+	ID3D11Buffer* m_LodInstanceVB;
+	UINT m_LodInstanceCapacity;
+
+	// Bounding box diagonal of a node of every level.
+	std::vector<float> m_LodDiagonals;
+
+	// Per level of the last SelectLod, the distance up to which the level is
+	// used and the morph constants: the distance morphing starts at and one
+	// over the distance it takes.
+	std::vector<float> m_LodRanges;
+	XMFLOAT4 m_LodMorph[MaxLodLevels];
+
+	std::vector<LodInstance> m_LodInstances;
+	std::vector<LodInstance> m_LodQuarters;
+	UINT m_LodNodeCount;
+	UINT m_LodTriangleCount;
+	double m_LodSelectTime;
 };
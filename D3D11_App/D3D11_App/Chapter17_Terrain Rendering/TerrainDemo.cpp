@@ -9,8 +9,12 @@
 #include "RenderStates.h"
 #include "Sky.h"
 #include "Terrain.h"
+#include "Benchmark.h"
+#include "HeightFilter.h"
+#include "PackedConvert.h"
 
 #include "Camera.h"
+#include <sstream>
 
 class TerrainApp : public D3DApp
 {
@@ -27,6 +31,11 @@ public:
 	void OnMouseUp(WPARAM btnState, int x, int y);
 	void OnMouseMove(WPARAM btnState, int x, int y);
 
+private:
+	// Moves the camera of walk mode, standing on a capsule, from eye by move,
+	// sliding along the terrain where it runs into it.
+	XMFLOAT3 MoveWalker(const XMFLOAT3& eye, const XMFLOAT3& move) const;
+
 private:
 	Sky* m_Skys[3];
 	Sky* m_CurrentSky;
@@ -39,6 +48,10 @@ private:
 
 	bool m_IsWalkCamMode;
 
+	// Surface point under the last right click.
+	bool m_HasPick;
+	Terrain::RayHit m_Pick;
+
 	POINT m_LastMousePos;
 };
 
@@ -46,6 +59,7 @@ TerrainApp::TerrainApp(HINSTANCE hInstance)
 	: D3DApp(hInstance)
 	, m_CurrentSky(nullptr)
 	, m_IsWalkCamMode(false)
+	, m_HasPick(false)
 {
 	main_wnd_caption_ = L"Terrain Demo";
 
@@ -99,12 +113,17 @@ bool TerrainApp::Init()
 	tii.HeightMapFilename = L"Textures/terrain.raw";
 	tii.LayerMapArrayFilename = L"Textures/LayerArray5.dds";
 	tii.BlendMapFilename = L"Textures/blend.dds";
+	tii.NormalMapFilename = L"Textures/terrainNormals.dds";
 	tii.HeightScale = 50.0f;
 	tii.HeightmapWidth = 2049;
 	tii.HeightmapHeight = 2049;
 	tii.CellSpacing = 0.5f;
+	tii.HeightmapBudget = 64 * 1024 * 1024;
 
-	m_Terrain.Init(d3d_device_, d3d_context_, tii);
+	if (!m_Terrain.Init(d3d_device_, d3d_context_, tii))
+	{
+		return false;
+	}
 
 	return true;
 }
@@ -133,6 +152,8 @@ void TerrainApp::UpdateScene(float dt)
 	//
 	// Control the camera.
 	//
+	XMFLOAT3 lastCamPos = m_Camera.GetPosition();
+
 	if (GetAsyncKeyState('W') & 0x8000)
 		m_Camera.Walk(20.0f * dt);
 
@@ -153,15 +174,101 @@ void TerrainApp::UpdateScene(float dt)
 	if (GetAsyncKeyState('E') & 0x8000)
 		m_IsWalkCamMode = false;
 
+	//
+	// LOD selection or the tessellated patches
+	//
+	if (GetAsyncKeyState('L') & 0x8000)
+		m_Terrain.SetLodEnabled(true);
+	if (GetAsyncKeyState('P') & 0x8000)
+		m_Terrain.SetLodEnabled(false);
+
+	//
+	// Keep the heightmap around the camera resident.
+	//
+	m_Terrain.PageAround(m_Camera.GetPosition(), 500.0f);
+
+	std::wostringstream outs;
+	outs.precision(3);
+	if (m_Terrain.IsLodEnabled())
+	{
+		outs << L"Terrain Demo" <<
+			L"    " << m_Terrain.GetLodInstances().size() << L" LOD nodes" <<
+			L"    " << m_Terrain.GetLodTriangleCount() << L" triangles" <<
+			L"    select " << m_Terrain.GetLodSelectTime() * 1000.0 << L" ms";
+	}
+	else
+	{
+		outs << L"Terrain Demo" <<
+			L"    " << m_Terrain.GetVisiblePatchCount() << L"/" << m_Terrain.GetPatchCount() << L" patches" <<
+			L"    cull " << m_Terrain.GetCullTime() * 1000.0 << L" ms";
+	}
+	if (m_HasPick)
+	{
+		outs << L"    picked (" << m_Pick.Position.x << L", " << m_Pick.Position.y << L", " << m_Pick.Position.z <<
+			L") cell " << m_Pick.Row << L"," << m_Pick.Col;
+	}
+	main_wnd_caption_ = outs.str();
+
 	// 
-	// Clamp camera to terrain surface in walk mode.
+	// Walk on the terrain surface in walk mode, falling where there is
+	// nothing underfoot.
 	//
 	if (m_IsWalkCamMode)
 	{
 		XMFLOAT3 camPos = m_Camera.GetPosition();
-		float y = m_Terrain.GetHeight(camPos.x, camPos.z);
-		m_Camera.SetPosition(camPos.x, y + 2, camPos.z);
+		XMFLOAT3 move(camPos.x - lastCamPos.x, -30.0f * dt, camPos.z - lastCamPos.z);
+		camPos = MoveWalker(lastCamPos, move);
+		m_Camera.SetPosition(camPos.x, camPos.y, camPos.z);
+	}
+}
+
+// One step of collide and slide: moves the body up to the contact, out of the
+// surface if it starts in it, and leaves in Move what is left of the move with
+// the part into the surface taken out.
+static void SlideBody(HeightfieldSweep& body, bool hit, const HeightfieldContact& contact)
+{
+	// Gap left between the body and the surface.
+	const float skin = 0.01f;
+
+	XMVECTOR center = XMLoadFloat3(&body.Center);
+	XMVECTOR move = XMLoadFloat3(&body.Move);
+	if (hit)
+	{
+		XMVECTOR n = XMLoadFloat3(&contact.Normal);
+		center += contact.Time * move + (contact.Depth + skin) * n;
+		move *= 1.0f - contact.Time;
+		move -= MathHelper::Min(XMVectorGetX(XMVector3Dot(move, n)), 0.0f) * n;
+	}
+	else
+	{
+		center += move;
+		move = XMVectorZero();
+	}
+	XMStoreFloat3(&body.Center, center);
+	XMStoreFloat3(&body.Move, move);
+}
+
+XMFLOAT3 TerrainApp::MoveWalker(const XMFLOAT3& eye, const XMFLOAT3& move) const
+{
+	// The feet are 2 units below the eye, where the old walk mode kept them.
+	HeightfieldSweep body;
+	body.Center = XMFLOAT3(eye.x, eye.y - 1.0f, eye.z);
+	body.HalfAxis = XMFLOAT3(0.0f, 0.5f, 0.0f);
+	body.Move = move;
+	body.Radius = 0.5f;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		HeightfieldContact contact;
+		bool hit = m_Terrain.Sweep(body, &contact);
+		SlideBody(body, hit, contact);
+		if (!hit)
+		{
+			break;
+		}
 	}
+
+	return XMFLOAT3(body.Center.x, body.Center.y + 1.0f, body.Center.z);
 }
 
 void TerrainApp::DrawScene()
@@ -192,6 +299,12 @@ void TerrainApp::OnMouseDown(WPARAM btnState, int x, int y)
 	m_LastMousePos.x = x;
 	m_LastMousePos.y = y;
 
+	if ((btnState & MK_RBUTTON) != 0)
+	{
+		m_Camera.UpdateViewMatrix();
+		m_HasPick = m_Terrain.Pick(m_Camera, (float)x, (float)y, (float)client_width_, (float)client_height_, &m_Pick);
+	}
+
 	SetCapture(main_wnd_);
 }
 
@@ -216,6 +329,1509 @@ void TerrainApp::OnMouseMove(WPARAM btnState, int x, int y)
 	m_LastMousePos.y = y;
 }
 
+// Averages every sample of rows [firstRow, firstRow + rowCount) of a
+// heightmap with its eight neighbours the way the terrain used to, one tap
+// and one bounds test at a time.  src holds the rows from srcFirstRow on.
+static void SmoothTheOldWay(const float* src, UINT srcFirstRow, UINT width, UINT height,
+	UINT firstRow, UINT rowCount, float* dest)
+{
+	for (int i = (int)firstRow; i < (int)(firstRow + rowCount); ++i)
+	{
+		for (int j = 0; j < (int)width; ++j)
+		{
+			float sum = 0.0f;
+			int num = 0;
+			for (int m = i - 1; m <= i + 1; ++m)
+			{
+				for (int n = j - 1; n <= j + 1; ++n)
+				{
+					if (m >= 0 && m < (int)height && n >= 0 && n < (int)width)
+					{
+						sum += src[(size_t)(m - srcFirstRow) * width + n];
+						++num;
+					}
+				}
+			}
+			dest[(size_t)(i - firstRow) * width + j] = sum / num;
+		}
+	}
+}
+
+// The terrain the old way: the whole RAW file read, scaled and smoothed into
+// one resident array.
+static bool LoadResidentHeightmap(const Terrain::InitInfo& info, std::vector<float>& heightmap)
+{
+	UINT width = info.HeightmapWidth;
+	UINT height = info.HeightmapHeight;
+
+	std::vector<unsigned char> in(width * height);
+	std::ifstream fin(info.HeightMapFilename, std::ios_base::binary);
+	if (!fin.read((char*)&in[0], in.size()))
+	{
+		return false;
+	}
+
+	std::vector<float> scaled(in.size());
+	for (UINT i = 0; i < in.size(); ++i)
+	{
+		scaled[i] = (in[i] / 255.0f) * info.HeightScale;
+	}
+
+	heightmap.resize(in.size());
+	SmoothTheOldWay(&scaled[0], 0, width, height, 0, height, &heightmap[0]);
+
+	return true;
+}
+
+static float GetResidentHeight(const Terrain::InitInfo& info, const std::vector<float>& heightmap, float x, float z)
+{
+	float c = (x + 0.5f * (info.HeightmapWidth - 1) * info.CellSpacing) / info.CellSpacing;
+	float d = (z - 0.5f * (info.HeightmapHeight - 1) * info.CellSpacing) / -info.CellSpacing;
+
+	int row = (int)floorf(d);
+	int col = (int)floorf(c);
+
+	float A = heightmap[row * info.HeightmapWidth + col];
+	float B = heightmap[row * info.HeightmapWidth + col + 1];
+	float C = heightmap[(row + 1) * info.HeightmapWidth + col];
+	float D = heightmap[(row + 1) * info.HeightmapWidth + col + 1];
+
+	float s = c - col;
+	float t = d - row;
+	if (s + t <= 1.0f)
+	{
+		return A + s * (B - A) + t * (C - A);
+	}
+	return D + (1.0f - s) * (C - D) + (1.0f - t) * (B - D);
+}
+
+// Writes a size x size tiled heightmap of rolling hills with ridges and
+// bumps, a sum of separable waves, for the benchmarks of large maps.  The
+// heights lie between 14 and 66; compressed maps keep them to 1/65535 of that.
+static bool WriteSyntheticHeightmap(const std::wstring& path, UINT size, bool compressed = false)
+{
+	std::vector<XMFLOAT3> columnWaves(size);
+	for (UINT j = 0; j < size; ++j)
+	{
+		columnWaves[j] = XMFLOAT3(sinf(0.0021f * j), sinf(0.031f * j), cosf(0.23f * j));
+	}
+
+	auto readRow = [&](UINT row, float* samples)
+	{
+		float hills = 20.0f * cosf(0.0017f * row);
+		float ridges = 5.0f * cosf(0.029f * row);
+		float bumps = sinf(0.19f * row);
+		for (UINT j = 0; j < size; ++j)
+		{
+			samples[j] = 40.0f + hills * columnWaves[j].x + ridges * columnWaves[j].y + bumps * columnWaves[j].z;
+		}
+	};
+
+	return compressed ?
+		TiledHeightmap::Write(path, size, size, 64, 0, readRow, 14.0f, 52.0f / 65535.0f) :
+		TiledHeightmap::Write(path, size, size, 64, 0, readRow);
+}
+
+static void RunHeightmapStreamingBenchmark()
+{
+	//
+	// The demo terrain: converting the RAW file once, opening the tiled file
+	// afterwards and querying it against the resident heightmap.
+	//
+	Terrain::InitInfo info;
+	info.HeightMapFilename = L"Textures/terrain.raw";
+	info.HeightScale = 50.0f;
+	info.HeightmapWidth = 2049;
+	info.HeightmapHeight = 2049;
+	info.CellSpacing = 0.5f;
+	info.HeightmapBudget = 32 * 1024 * 1024;
+
+	double start = Benchmark::Now();
+	std::vector<float> resident;
+	if (!LoadResidentHeightmap(info, resident))
+	{
+		Benchmark::Report(L"Heightmap streaming: Textures/terrain.raw not found.");
+		return;
+	}
+	double residentLoadTime = Benchmark::Now() - start;
+
+	DeleteFileW(L"Textures/terrain.thm");
+
+	start = Benchmark::Now();
+	Terrain* terrain = new Terrain();
+	bool converted = terrain->InitHeightmap(info);
+	double convertTime = Benchmark::Now() - start;
+	delete terrain;
+
+	start = Benchmark::Now();
+	terrain = new Terrain();
+	bool opened = converted && terrain->InitHeightmap(info);
+	double openTime = Benchmark::Now() - start;
+
+	if (!opened)
+	{
+		delete terrain;
+		Benchmark::Report(L"Heightmap streaming: converting Textures/terrain.raw failed.");
+		return;
+	}
+
+	const int queryCount = 1000000;
+	float halfWidth = 0.5f * terrain->GetWidth() - 1.0f;
+	float halfDepth = 0.5f * terrain->GetDepth() - 1.0f;
+	std::vector<XMFLOAT2> points(queryCount);
+	for (int i = 0; i < queryCount; ++i)
+	{
+		points[i] = XMFLOAT2(MathHelper::RandF(-halfWidth, halfWidth), MathHelper::RandF(-halfDepth, halfDepth));
+	}
+
+	double sum = 0.0;
+	start = Benchmark::Now();
+	for (int i = 0; i < queryCount; ++i)
+	{
+		sum += GetResidentHeight(info, resident, points[i].x, points[i].y);
+	}
+	double residentQueryTime = (Benchmark::Now() - start) / queryCount;
+
+	start = Benchmark::Now();
+	for (int i = 0; i < queryCount; ++i)
+	{
+		sum += terrain->GetHeight(points[i].x, points[i].y);
+	}
+	double tiledQueryTime = (Benchmark::Now() - start) / queryCount;
+
+	// The tiled file rounds the heights to its step.
+	const TiledHeightmap& heightmap = terrain->GetHeightmap();
+	float tolerance = 0.5f * heightmap.GetHeightStep() + 1e-5f * info.HeightScale;
+	float maxError = 0.0f;
+	int mismatches = 0;
+	for (int i = 0; i < queryCount; ++i)
+	{
+		float error = fabsf(terrain->GetHeight(points[i].x, points[i].y) - GetResidentHeight(info, resident, points[i].x, points[i].y));
+		maxError = MathHelper::Max(maxError, error);
+		if (error > tolerance)
+		{
+			++mismatches;
+		}
+	}
+
+	std::wostringstream outs;
+	outs << L"Heightmap streaming: " << info.HeightmapWidth << L"x" << info.HeightmapHeight <<
+		L", resident load " << residentLoadTime * 1000.0 << L" ms" <<
+		L", convert " << convertTime * 1000.0 << L" ms, open " << openTime * 1000.0 << L" ms" <<
+		L", random GetHeight " << residentQueryTime * 1e9 << L" ns resident vs " << tiledQueryTime * 1e9 << L" ns tiled" <<
+		L" (" << heightmap.GetResidentTileCount() << L"/" << heightmap.GetTilesX() * heightmap.GetTilesY() << L" tiles resident, " <<
+		heightmap.GetPageInCount() << L" page-ins)" <<
+		L", " << mismatches << L"/" << queryCount << L" mismatches (max error " << maxError << L" for a step of " <<
+		heightmap.GetHeightStep() << L"), mean height " << sum / (2 * queryCount);
+	Benchmark::Report(outs.str());
+	delete terrain;
+
+	//
+	// A 16k x 16k heightmap, written straight to a tiled file, flown over with
+	// the camera paging tiles in around it.
+	//
+	const UINT size = 16385;
+	const std::wstring path = L"HeightmapBenchmark.thm";
+
+	start = Benchmark::Now();
+	bool written = WriteSyntheticHeightmap(path, size);
+	double writeTime = Benchmark::Now() - start;
+
+	Terrain::InitInfo bigInfo;
+	bigInfo.HeightMapFilename = path;
+	bigInfo.HeightScale = 1.0f;
+	bigInfo.HeightmapWidth = size;
+	bigInfo.HeightmapHeight = size;
+	bigInfo.CellSpacing = 0.5f;
+	bigInfo.HeightmapBudget = 64 * 1024 * 1024;
+
+	start = Benchmark::Now();
+	terrain = new Terrain();
+	opened = written && terrain->InitHeightmap(bigInfo);
+	openTime = Benchmark::Now() - start;
+
+	if (!opened)
+	{
+		delete terrain;
+		DeleteFileW(path.c_str());
+		Benchmark::Report(L"Heightmap streaming: writing the 16k heightmap failed.");
+		return;
+	}
+
+	// Fly diagonally across the map at 60 m/s for 60 s of frames, walking a
+	// thousand agents around the camera every frame.
+	const int frameCount = 3600;
+	const int agentCount = 1000;
+	const float radius = 500.0f;
+	float halfSize = 0.5f * terrain->GetWidth();
+	double pageTime = 0.0;
+	double queryTime = 0.0;
+	UINT maxPageIns = 0;
+	sum = 0.0;
+	for (int frame = 0; frame < frameCount; ++frame)
+	{
+		float t = (float)frame / (frameCount - 1);
+		XMFLOAT3 camPos(-0.9f * halfSize + 1.8f * halfSize * t, 0.0f, 0.9f * halfSize - 1.8f * halfSize * t);
+
+		start = Benchmark::Now();
+		UINT pageIns = terrain->PageAround(camPos, radius);
+		pageTime += Benchmark::Now() - start;
+		maxPageIns = MathHelper::Max(maxPageIns, pageIns);
+
+		start = Benchmark::Now();
+		for (int i = 0; i < agentCount; ++i)
+		{
+			sum += terrain->GetHeight(camPos.x + MathHelper::RandF(-radius, radius), camPos.z + MathHelper::RandF(-radius, radius));
+		}
+		queryTime += Benchmark::Now() - start;
+	}
+
+	const TiledHeightmap& bigHeightmap = terrain->GetHeightmap();
+	UINT64 tileBytes = (UINT64)(TiledHeightmap::TileCells + 1) * (TiledHeightmap::TileCells + 1) * sizeof(float);
+	outs.str(L"");
+	outs << L"Heightmap streaming: " << size << L"x" << size <<
+		L", write " << writeTime << L" s, open " << openTime * 1000.0 << L" ms" <<
+		L", " << frameCount << L" frames: page " << pageTime / frameCount * 1000.0 << L" ms/frame" <<
+		L", " << agentCount << L" GetHeight " << queryTime / frameCount * 1000.0 << L" ms/frame" <<
+		L", " << bigHeightmap.GetPageInCount() << L" page-ins (at most " << maxPageIns << L" a frame)" <<
+		L", " << bigHeightmap.GetResidentTileCount() * tileBytes / (1024 * 1024) << L" MB resident vs " <<
+		(UINT64)size * size * sizeof(float) / (1024 * 1024) << L" MB for the whole map" <<
+		L", mean height " << sum / ((double)frameCount * agentCount);
+	Benchmark::Report(outs.str());
+
+	delete terrain;
+	DeleteFileW(path.c_str());
+}
+
+static void RunPatchCullingBenchmark()
+{
+	const UINT sizes[] = { 2049, 16385 };
+	const std::wstring path = L"CullingBenchmark.thm";
+
+	for (UINT size : sizes)
+	{
+		if (!WriteSyntheticHeightmap(path, size))
+		{
+			Benchmark::Report(L"Patch culling: writing the heightmap failed.");
+			return;
+		}
+
+		Terrain::InitInfo info;
+		info.HeightMapFilename = path;
+		info.HeightScale = 1.0f;
+		info.HeightmapWidth = size;
+		info.HeightmapHeight = size;
+		info.CellSpacing = 0.5f;
+		info.HeightmapBudget = 64 * 1024 * 1024;
+
+		Terrain* terrain = new Terrain();
+		if (!terrain->InitHeightmap(info))
+		{
+			delete terrain;
+			DeleteFileW(path.c_str());
+			Benchmark::Report(L"Patch culling: opening the heightmap failed.");
+			return;
+		}
+
+		// The pyramid again on its own, from a cold cache.
+		TiledHeightmap heightmap;
+		heightmap.Open(path, info.HeightmapBudget);
+		HeightPyramid pyramid;
+		double start = Benchmark::Now();
+		pyramid.Build(heightmap);
+		double buildTime = Benchmark::Now() - start;
+
+		// The patch level of the pyramid must match the bounds the converter
+		// stored for every patch.
+		UINT patchLevel = 0;
+		while (pyramid.GetNodeCells(patchLevel) < heightmap.GetPatchCells())
+		{
+			++patchLevel;
+		}
+
+		int boundsMismatches = 0;
+		for (UINT i = 0; i < heightmap.GetPatchesY(); ++i)
+		{
+			for (UINT j = 0; j < heightmap.GetPatchesX(); ++j)
+			{
+				XMFLOAT2 a = pyramid.GetBounds(patchLevel, j, i);
+				XMFLOAT2 b = heightmap.GetPatchBounds(i, j);
+				if (a.x != b.x || a.y != b.y)
+				{
+					++boundsMismatches;
+				}
+			}
+		}
+
+		// Circle the middle of the map looking outwards and slightly down,
+		// against a test of every patch.
+		Camera cam;
+		cam.SetLens(0.25f * MathHelper::Pi, 16.0f / 9.0f, 1.0f, 1000.0f);
+
+		const int frameCount = 360;
+		float halfSize = 0.5f * terrain->GetWidth();
+		float orbit = 0.25f * halfSize;
+		float patchSize = heightmap.GetPatchCells() * info.CellSpacing;
+
+		double cullTime = 0.0;
+		double bruteTime = 0.0;
+		UINT64 visiblePatches = 0;
+		int frameMismatches = 0;
+		for (int frame = 0; frame < frameCount; ++frame)
+		{
+			float angle = 2.0f * MathHelper::Pi * frame / frameCount;
+			XMFLOAT3 pos(orbit * cosf(angle), 80.0f, orbit * sinf(angle));
+			XMFLOAT3 target(pos.x + cosf(angle), pos.y - 0.3f, pos.z + sinf(angle));
+			cam.LookAt(pos, target, XMFLOAT3(0.0f, 1.0f, 0.0f));
+			cam.UpdateViewMatrix();
+
+			terrain->CullPatches(cam);
+			cullTime += terrain->GetCullTime();
+			visiblePatches += terrain->GetVisiblePatchCount();
+
+			start = Benchmark::Now();
+			FrustumQuery frustum(cam.ViewProj());
+			UINT bruteVisible = 0;
+			for (UINT i = 0; i < heightmap.GetPatchesY(); ++i)
+			{
+				for (UINT j = 0; j < heightmap.GetPatchesX(); ++j)
+				{
+					XMFLOAT2 boundsY = heightmap.GetPatchBounds(i, j);
+					XMFLOAT3 boundsMin(-halfSize + j * patchSize, boundsY.x, halfSize - (i + 1) * patchSize);
+					XMFLOAT3 boundsMax(-halfSize + (j + 1) * patchSize, boundsY.y, halfSize - i * patchSize);
+					if (frustum.ClassifyBounds(boundsMin, boundsMax) != FrustumQuery::Outside)
+					{
+						++bruteVisible;
+					}
+				}
+			}
+			bruteTime += Benchmark::Now() - start;
+
+			if (bruteVisible != terrain->GetVisiblePatchCount())
+			{
+				++frameMismatches;
+			}
+		}
+
+		std::wostringstream outs;
+		outs << L"Patch culling: " << size << L"x" << size <<
+			L", " << pyramid.GetLevelCount() << L" level pyramid built in " << buildTime * 1000.0 << L" ms (" <<
+			(double)size * size / buildTime / 1e6 << L" Msamples/s), " << boundsMismatches << L" bounds mismatches" <<
+			L", quadtree cull " << cullTime / frameCount * 1000.0 << L" ms/frame" <<
+			L", " << visiblePatches / frameCount << L"/" << terrain->GetPatchCount() << L" patches submitted" <<
+			L", per-patch loop " << bruteTime / frameCount * 1000.0 << L" ms/frame" <<
+			L", " << frameMismatches << L"/" << frameCount << L" frames differ";
+		Benchmark::Report(outs.str());
+
+		delete terrain;
+		heightmap.Close();
+		DeleteFileW(path.c_str());
+	}
+}
+
+// Triangles of a tessellated patch at a distance from the camera, from the
+// tessellation factor the hull shader computes with the constants
+// Terrain::Draw sets.
+static float EstimatePatchTriangles(float distance)
+{
+	float s = MathHelper::Clamp((distance - 20.0f) / (500.0f - 20.0f), 0.0f, 1.0f);
+	float tess = powf(2.0f, 6.0f - 6.0f * s);
+
+	// fractional_even partitioning rounds up to an even factor.
+	tess = 2.0f * ceilf(0.5f * tess);
+	return 2.0f * tess * tess;
+}
+
+static void RunLodSelectionBenchmark()
+{
+	const UINT sizes[] = { 2049, 16385 };
+	const std::wstring path = L"LodBenchmark.thm";
+
+	for (UINT size : sizes)
+	{
+		if (!WriteSyntheticHeightmap(path, size))
+		{
+			Benchmark::Report(L"LOD selection: writing the heightmap failed.");
+			return;
+		}
+
+		Terrain::InitInfo info;
+		info.HeightMapFilename = path;
+		info.HeightScale = 1.0f;
+		info.HeightmapWidth = size;
+		info.HeightmapHeight = size;
+		info.CellSpacing = 0.5f;
+		info.HeightmapBudget = 64 * 1024 * 1024;
+
+		Terrain* terrain = new Terrain();
+		if (!terrain->InitHeightmap(info))
+		{
+			delete terrain;
+			DeleteFileW(path.c_str());
+			Benchmark::Report(L"LOD selection: opening the heightmap failed.");
+			return;
+		}
+
+		// The orbit of the culling benchmark on a 1080p viewport, against the
+		// patches left by the frustum, fully tessellated to the resolution of
+		// the heightmap or tessellated by distance.
+		Camera cam;
+		cam.SetLens(0.25f * MathHelper::Pi, 16.0f / 9.0f, 1.0f, 1000.0f);
+		const float viewportHeight = 1080.0f;
+
+		const TiledHeightmap& heightmap = terrain->GetHeightmap();
+		const int frameCount = 360;
+		float halfSize = 0.5f * terrain->GetWidth();
+		float orbit = 0.25f * halfSize;
+		float patchSize = heightmap.GetPatchCells() * info.CellSpacing;
+
+		double selectTime = 0.0;
+		UINT64 nodes = 0;
+		UINT64 quarters = 0;
+		UINT64 triangles = 0;
+		UINT64 patches = 0;
+		double tessellatedTriangles = 0.0;
+		for (int frame = 0; frame < frameCount; ++frame)
+		{
+			float angle = 2.0f * MathHelper::Pi * frame / frameCount;
+			XMFLOAT3 pos(orbit * cosf(angle), 80.0f, orbit * sinf(angle));
+			XMFLOAT3 target(pos.x + cosf(angle), pos.y - 0.3f, pos.z + sinf(angle));
+			cam.LookAt(pos, target, XMFLOAT3(0.0f, 1.0f, 0.0f));
+			cam.UpdateViewMatrix();
+
+			terrain->SelectLod(cam, viewportHeight);
+			selectTime += terrain->GetLodSelectTime();
+			nodes += terrain->GetLodNodeCount();
+			quarters += terrain->GetLodInstances().size() - terrain->GetLodNodeCount();
+			triangles += terrain->GetLodTriangleCount();
+
+			FrustumQuery frustum(cam.ViewProj());
+			XMVECTOR eye = XMLoadFloat3(&pos);
+			for (UINT i = 0; i < heightmap.GetPatchesY(); ++i)
+			{
+				for (UINT j = 0; j < heightmap.GetPatchesX(); ++j)
+				{
+					XMFLOAT2 boundsY = heightmap.GetPatchBounds(i, j);
+					XMFLOAT3 boundsMin(-halfSize + j * patchSize, boundsY.x, halfSize - (i + 1) * patchSize);
+					XMFLOAT3 boundsMax(-halfSize + (j + 1) * patchSize, boundsY.y, halfSize - i * patchSize);
+					if (frustum.ClassifyBounds(boundsMin, boundsMax) != FrustumQuery::Outside)
+					{
+						XMVECTOR center = 0.5f * (XMLoadFloat3(&boundsMin) + XMLoadFloat3(&boundsMax));
+						tessellatedTriangles += EstimatePatchTriangles(XMVectorGetX(XMVector3Length(center - eye)));
+						++patches;
+					}
+				}
+			}
+		}
+
+		std::wostringstream outs;
+		outs << L"LOD selection: " << size << L"x" << size <<
+			L", select " << selectTime / frameCount * 1000.0 << L" ms/frame" <<
+			L", " << (nodes + quarters) / frameCount << L" instances (" << nodes / frameCount << L" whole, " <<
+			quarters / frameCount << L" quarter nodes), " << triangles / frameCount << L" triangles/frame" <<
+			L" vs " << patches / frameCount << L" patches, " <<
+			patches / frameCount * 2 * heightmap.GetPatchCells() * heightmap.GetPatchCells() << L" triangles/frame at full resolution" <<
+			L" (about " << (UINT64)(tessellatedTriangles / frameCount) << L" tessellated by distance)";
+		Benchmark::Report(outs.str());
+
+		delete terrain;
+		DeleteFileW(path.c_str());
+	}
+}
+
+static void RunSmoothingBenchmark()
+{
+	// Maps are smoothed in bands of rows, the way the RAW conversion does,
+	// so that a 16k x 16k map needs no more than a few bands in memory.
+	const UINT sizes[] = { 1024, 4096, 16384 };
+	const UINT bandRows = 256;
+
+	ThreadPool pool;
+	HeightFilter box(HeightFilter::Box, 1);
+	HeightFilter gaussian(HeightFilter::Gaussian, 2, 1.0f);
+	HeightFilter median(HeightFilter::Median, 1);
+
+	for (UINT size : sizes)
+	{
+		std::vector<XMFLOAT3> columnWaves(size);
+		for (UINT j = 0; j < size; ++j)
+		{
+			columnWaves[j] = XMFLOAT3(sinf(0.0021f * j), sinf(0.031f * j), cosf(0.23f * j));
+		}
+
+		std::vector<float> src((size_t)(bandRows + 4) * size);
+		std::vector<float> oldBand((size_t)bandRows * size);
+		std::vector<float> newBand((size_t)bandRows * size);
+
+		double oldTime = 0.0;
+		double singleTime = 0.0;
+		double boxTime = 0.0;
+		double gaussianTime = 0.0;
+		double medianTime = 0.0;
+		UINT64 mismatches = 0;
+		for (UINT row = 0; row < size; row += bandRows)
+		{
+			// The band and the rows the widest filter reaches around it.
+			UINT rowCount = MathHelper::Min(bandRows, size - row);
+			UINT top = row > 2 ? row - 2 : 0;
+			UINT bottom = MathHelper::Min(row + rowCount + 2, size);
+			for (UINT r = top; r < bottom; ++r)
+			{
+				float hills = 20.0f * cosf(0.0017f * r);
+				float ridges = 5.0f * cosf(0.029f * r);
+				float bumps = sinf(0.19f * r);
+				float* out = &src[(size_t)(r - top) * size];
+				for (UINT j = 0; j < size; ++j)
+				{
+					// Quantized to 8 bits like the RAW heightmaps.
+					float h = 40.0f + hills * columnWaves[j].x + ridges * columnWaves[j].y + bumps * columnWaves[j].z;
+					out[j] = floorf(h * (255.0f / 70.0f)) / 255.0f * 70.0f;
+				}
+			}
+
+			double start = Benchmark::Now();
+			SmoothTheOldWay(&src[0], top, size, size, row, rowCount, &oldBand[0]);
+			oldTime += Benchmark::Now() - start;
+
+			start = Benchmark::Now();
+			box.Apply(&src[0], top, size, size, row, rowCount, &newBand[0], nullptr);
+			singleTime += Benchmark::Now() - start;
+
+			start = Benchmark::Now();
+			box.Apply(&src[0], top, size, size, row, rowCount, &newBand[0], &pool);
+			boxTime += Benchmark::Now() - start;
+
+			for (size_t i = 0; i < (size_t)rowCount * size; ++i)
+			{
+				if (newBand[i] != oldBand[i])
+				{
+					++mismatches;
+				}
+			}
+
+			start = Benchmark::Now();
+			gaussian.Apply(&src[0], top, size, size, row, rowCount, &newBand[0], &pool);
+			gaussianTime += Benchmark::Now() - start;
+
+			start = Benchmark::Now();
+			median.Apply(&src[0], top, size, size, row, rowCount, &newBand[0], &pool);
+			medianTime += Benchmark::Now() - start;
+		}
+
+		std::wostringstream outs;
+		outs << L"Heightmap smoothing: " << size << L"x" << size <<
+			L", 3x3 average " << oldTime * 1000.0 << L" ms the old way, " <<
+			singleTime * 1000.0 << L" ms SIMD on 1 thread (" << oldTime / singleTime << L"x), " <<
+			boxTime * 1000.0 << L" ms on " << pool.ThreadCount() << L" threads (" << oldTime / boxTime << L"x), " <<
+			mismatches << L" samples differ; 5x5 Gaussian " << gaussianTime * 1000.0 << L" ms, " <<
+			L"3x3 median " << medianTime * 1000.0 << L" ms";
+		Benchmark::Report(outs.str());
+	}
+}
+
+// The ray cast without the pyramid: every cell under the ray from where it
+// enters the heightmap, with the corner heights read through GetHeight and
+// the two triangles of a cell solved like Terrain::Intersect does.
+static bool IntersectCellByCell(Terrain& terrain, const Terrain::InitInfo& info,
+	const XMFLOAT3& origin, const XMFLOAT3& dir, float* pDist)
+{
+	float spacing = info.CellSpacing;
+	float halfWidth = 0.5f * terrain.GetWidth();
+	float halfDepth = 0.5f * terrain.GetDepth();
+	int cols = (int)info.HeightmapWidth - 1;
+	int rows = (int)info.HeightmapHeight - 1;
+
+	// The ray in cell units, clipped to the heightmap.
+	float c0 = (origin.x + halfWidth) / spacing;
+	float r0 = (halfDepth - origin.z) / spacing;
+	float dc = dir.x / spacing;
+	float dr = -dir.z / spacing;
+	float invDc = 1.0f / (dc != 0.0f ? dc : 1e-20f);
+	float invDr = 1.0f / (dr != 0.0f ? dr : 1e-20f);
+
+	float tc0 = (0.0f - c0) * invDc, tc1 = (cols - c0) * invDc;
+	float tr0 = (0.0f - r0) * invDr, tr1 = (rows - r0) * invDr;
+	float tIn = MathHelper::Max(MathHelper::Max(MathHelper::Min(tc0, tc1), MathHelper::Min(tr0, tr1)), 0.0f);
+	float tOut = MathHelper::Min(MathHelper::Max(tc0, tc1), MathHelper::Max(tr0, tr1));
+	if (tIn > tOut)
+	{
+		return false;
+	}
+
+	int col = MathHelper::Clamp((int)floorf(c0 + tIn * dc), 0, cols - 1);
+	int row = MathHelper::Clamp((int)floorf(r0 + tIn * dr), 0, rows - 1);
+	int stepC = invDc > 0.0f ? 1 : -1;
+	int stepR = invDr > 0.0f ? 1 : -1;
+	const float epsilon = 1e-4f;
+
+	for (;;)
+	{
+		float x = -halfWidth + col * spacing;
+		float z = halfDepth - row * spacing;
+		float A = terrain.GetHeight(x, z);
+		float B = terrain.GetHeight(x + spacing, z);
+		float C = terrain.GetHeight(x, z - spacing);
+		float D = terrain.GetHeight(x + spacing, z - spacing);
+
+		float s0 = (origin.x - x) / spacing;
+		float q0 = (z - origin.z) / spacing;
+		const float planes[2][3] = { { A, B - A, C - A }, { B + C - D, D - C, D - B } };
+
+		float nearest = MathHelper::Infinity;
+		for (int k = 0; k < 2; ++k)
+		{
+			float f0 = origin.y - planes[k][0] - s0 * planes[k][1] - q0 * planes[k][2];
+			float f1 = dir.y - dc * planes[k][1] - dr * planes[k][2];
+			if (f1 == 0.0f)
+			{
+				continue;
+			}
+
+			float t = -f0 / f1;
+			float s = s0 + t * dc;
+			float q = q0 + t * dr;
+			bool inTriangle = k == 0 ? s + q <= 1.0f + epsilon : s + q >= 1.0f - epsilon;
+			if (t >= 0.0f && inTriangle && s >= -epsilon && s <= 1.0f + epsilon && q >= -epsilon && q <= 1.0f + epsilon)
+			{
+				nearest = MathHelper::Min(nearest, t);
+			}
+		}
+
+		if (nearest < MathHelper::Infinity)
+		{
+			*pDist = nearest;
+			return true;
+		}
+
+		float tNextC = (col + (stepC > 0 ? 1 : 0) - c0) * invDc;
+		float tNextR = (row + (stepR > 0 ? 1 : 0) - r0) * invDr;
+		if (tNextC < tNextR)
+		{
+			col += stepC;
+			if (col < 0 || col >= cols)
+			{
+				return false;
+			}
+		}
+		else
+		{
+			row += stepR;
+			if (row < 0 || row >= rows)
+			{
+				return false;
+			}
+		}
+	}
+}
+
+static void RunRayCastBenchmark()
+{
+	const UINT sizes[] = { 2049, 16385 };
+	const std::wstring path = L"RayCastBenchmark.thm";
+
+	for (UINT size : sizes)
+	{
+		if (!WriteSyntheticHeightmap(path, size))
+		{
+			Benchmark::Report(L"Terrain ray casts: writing the heightmap failed.");
+			return;
+		}
+
+		Terrain::InitInfo info;
+		info.HeightMapFilename = path;
+		info.HeightScale = 1.0f;
+		info.HeightmapWidth = size;
+		info.HeightmapHeight = size;
+		info.CellSpacing = 0.5f;
+		info.HeightmapBudget = 2048ull * 1024 * 1024;
+
+		Terrain* terrain = new Terrain();
+		if (!terrain->InitHeightmap(info))
+		{
+			delete terrain;
+			DeleteFileW(path.c_str());
+			Benchmark::Report(L"Terrain ray casts: opening the heightmap failed.");
+			return;
+		}
+
+		// Rays from above the hills looking down at 5 to 45 degrees, the
+		// shallow ones running for hundreds of cells, the way a camera picks.
+		const int rayCount = 100000;
+		float halfSize = 0.5f * terrain->GetWidth();
+		std::vector<XMFLOAT3> origins(rayCount);
+		std::vector<XMFLOAT3> dirs(rayCount);
+		for (int i = 0; i < rayCount; ++i)
+		{
+			origins[i] = XMFLOAT3(MathHelper::RandF(-0.5f, 0.5f) * halfSize, MathHelper::RandF(70.0f, 120.0f),
+				MathHelper::RandF(-0.5f, 0.5f) * halfSize);
+
+			float heading = MathHelper::RandF(0.0f, 2.0f * MathHelper::Pi);
+			float pitch = XMConvertToRadians(MathHelper::RandF(5.0f, 45.0f));
+			dirs[i] = XMFLOAT3(cosf(pitch) * cosf(heading), -sinf(pitch), cosf(pitch) * sinf(heading));
+		}
+
+		// Warm the tile cache, then time the casts.
+		Terrain::RayHit hit;
+		for (int i = 0; i < rayCount; ++i)
+		{
+			terrain->Intersect(XMLoadFloat3(&origins[i]), XMLoadFloat3(&dirs[i]), MathHelper::Infinity, &hit);
+		}
+
+		std::vector<float> dists(rayCount);
+		double start = Benchmark::Now();
+		for (int i = 0; i < rayCount; ++i)
+		{
+			bool found = terrain->Intersect(XMLoadFloat3(&origins[i]), XMLoadFloat3(&dirs[i]), MathHelper::Infinity, &hit);
+			dists[i] = found ? hit.Distance : MathHelper::Infinity;
+		}
+		double castTime = (Benchmark::Now() - start) / rayCount;
+
+		double meanDist = 0.0;
+		int hits = 0;
+		for (int i = 0; i < rayCount; ++i)
+		{
+			if (dists[i] < MathHelper::Infinity)
+			{
+				meanDist += dists[i];
+				++hits;
+			}
+		}
+		meanDist /= MathHelper::Max(hits, 1);
+
+		const int referenceCount = 2000;
+		int mismatches = 0;
+		start = Benchmark::Now();
+		for (int i = 0; i < referenceCount; ++i)
+		{
+			float dist = MathHelper::Infinity;
+			IntersectCellByCell(*terrain, info, origins[i], dirs[i], &dist);
+			if (fabsf(dist - dists[i]) > 1e-3f * MathHelper::Max(dist, 1.0f) && dist != dists[i])
+			{
+				++mismatches;
+			}
+		}
+		double referenceTime = (Benchmark::Now() - start) / referenceCount;
+
+		// Lines of sight between points 2 units above the surface, up to 200
+		// units apart.
+		const int losCount = 100000;
+		std::vector<XMFLOAT3> from(losCount);
+		std::vector<XMFLOAT3> to(losCount);
+		for (int i = 0; i < losCount; ++i)
+		{
+			float x = MathHelper::RandF(-0.5f, 0.5f) * halfSize;
+			float z = MathHelper::RandF(-0.5f, 0.5f) * halfSize;
+			float angle = MathHelper::RandF(0.0f, 2.0f * MathHelper::Pi);
+			float range = MathHelper::RandF(0.0f, 200.0f);
+			from[i] = XMFLOAT3(x, terrain->GetHeight(x, z) + 2.0f, z);
+
+			x += range * cosf(angle);
+			z += range * sinf(angle);
+			to[i] = XMFLOAT3(x, terrain->GetHeight(x, z) + 2.0f, z);
+		}
+
+		int visible = 0;
+		start = Benchmark::Now();
+		for (int i = 0; i < losCount; ++i)
+		{
+			if (terrain->HasLineOfSight(from[i], to[i]))
+			{
+				++visible;
+			}
+		}
+		double losTime = (Benchmark::Now() - start) / losCount;
+
+		std::wostringstream outs;
+		outs << L"Terrain ray casts: " << size << L"x" << size <<
+			L", " << 1.0 / castTime << L" rays/s through the pyramid vs " << 1.0 / referenceTime <<
+			L" cell by cell (" << referenceTime / castTime << L"x), " << hits * 100.0 / rayCount << L"% hit at a mean " <<
+			meanDist << L" units, " << mismatches << L"/" << referenceCount << L" mismatches; " <<
+			1.0 / losTime << L" line of sight queries/s, " << visible * 100.0 / losCount << L"% visible";
+		Benchmark::Report(outs.str());
+
+		delete terrain;
+		DeleteFileW(path.c_str());
+	}
+}
+
+static void RunHeightQueryBenchmark()
+{
+	const UINT sizes[] = { 2049, 16385 };
+	const std::wstring path = L"HeightQueryBenchmark.thm";
+
+	for (UINT size : sizes)
+	{
+		if (!WriteSyntheticHeightmap(path, size))
+		{
+			Benchmark::Report(L"Height queries: writing the heightmap failed.");
+			return;
+		}
+
+		Terrain::InitInfo info;
+		info.HeightMapFilename = path;
+		info.HeightScale = 1.0f;
+		info.HeightmapWidth = size;
+		info.HeightmapHeight = size;
+		info.CellSpacing = 0.5f;
+		info.HeightmapBudget = 1536ull * 1024 * 1024;
+
+		Terrain* terrain = new Terrain();
+		if (!terrain->InitHeightmap(info))
+		{
+			delete terrain;
+			DeleteFileW(path.c_str());
+			Benchmark::Report(L"Height queries: opening the heightmap failed.");
+			return;
+		}
+
+		// Objects scattered over the whole map, a little of it off the edge,
+		// and agents walking in a crowd, in the order they were spawned.
+		const UINT queryCount = 1 << 20;
+		float halfWidth = 0.55f * terrain->GetWidth();
+		float halfDepth = 0.55f * terrain->GetDepth();
+		std::vector<XMFLOAT2> scattered(queryCount);
+		std::vector<XMFLOAT2> crowd(queryCount);
+		for (UINT i = 0; i < queryCount; ++i)
+		{
+			scattered[i] = XMFLOAT2(MathHelper::RandF(-halfWidth, halfWidth), MathHelper::RandF(-halfDepth, halfDepth));
+
+			UINT row = i / 1024;
+			UINT col = i % 1024;
+			crowd[i] = XMFLOAT2(-100.0f + 0.2f * col + MathHelper::RandF(0.0f, 0.1f), 100.0f - 0.2f * row);
+		}
+
+		std::vector<float> heights(queryCount);
+		std::vector<XMFLOAT3> normals(queryCount);
+
+		const std::vector<XMFLOAT2>* sets[] = { &scattered, &crowd };
+		const wchar_t* names[] = { L"scattered", L"crowd" };
+
+		std::wostringstream outs;
+		outs << L"Height queries: " << size << L"x" << size;
+		for (int set = 0; set < 2; ++set)
+		{
+			const std::vector<XMFLOAT2>& points = *sets[set];
+
+			// Page the tiles in first.
+			terrain->GetHeights(&points[0], queryCount, &heights[0]);
+
+			double sum = 0.0;
+			double start = Benchmark::Now();
+			for (UINT i = 0; i < queryCount; ++i)
+			{
+				sum += terrain->GetHeight(points[i].x, points[i].y);
+			}
+			double scalarTime = Benchmark::Now() - start;
+
+			start = Benchmark::Now();
+			terrain->GetHeights(&points[0], queryCount, &heights[0]);
+			double batchTime = Benchmark::Now() - start;
+
+			start = Benchmark::Now();
+			terrain->GetNormals(&points[0], queryCount, &normals[0]);
+			double normalTime = Benchmark::Now() - start;
+
+			UINT mismatches = 0;
+			for (UINT i = 0; i < queryCount; ++i)
+			{
+				if (heights[i] != terrain->GetHeight(points[i].x, points[i].y))
+				{
+					++mismatches;
+				}
+			}
+
+			outs << L", " << names[set] << L": GetHeight " << queryCount / scalarTime / 1e6 << L"M/s, GetHeights " <<
+				queryCount / batchTime / 1e6 << L"M/s (" << scalarTime / batchTime << L"x, " << mismatches <<
+				L" mismatches), GetNormals " << queryCount / normalTime / 1e6 << L"M/s";
+		}
+		Benchmark::Report(outs.str());
+
+		delete terrain;
+		DeleteFileW(path.c_str());
+	}
+}
+
+// Reads every tile of a heightmap row by row, decoding a row of tiles at a
+// time across the threads of the pool if there is one.  Returns the seconds
+// taken.
+static double PageEveryTile(TiledHeightmap& heightmap, ThreadPool* pool)
+{
+	double start = Benchmark::Now();
+	for (UINT ty = 0; ty < heightmap.GetTilesY(); ++ty)
+	{
+		heightmap.PageRect(0, ty, heightmap.GetTilesX() - 1, ty, pool);
+	}
+	return Benchmark::Now() - start;
+}
+
+static void RunHeightmapFormatBenchmark()
+{
+	//
+	// The synthetic hills saved as 8-bit, 16-bit and float RAW files,
+	// converted by the terrain and read back against the heights they were
+	// made from, smoothed the same way.
+	//
+	{
+		const UINT size = 2049;
+		const float heightScale = 50.0f;
+
+		std::vector<float> unit(size * size);
+		for (UINT i = 0; i < size; ++i)
+		{
+			for (UINT j = 0; j < size; ++j)
+			{
+				float h = 40.0f + 20.0f * cosf(0.0017f * i) * sinf(0.0021f * j) +
+					5.0f * cosf(0.029f * i) * sinf(0.031f * j) + sinf(0.19f * i) * cosf(0.23f * j);
+				unit[i * size + j] = (h - 14.0f) / 52.0f;
+			}
+		}
+
+		std::vector<float> exact(unit.size());
+		for (UINT i = 0; i < unit.size(); ++i)
+		{
+			exact[i] = unit[i] * heightScale;
+		}
+		std::vector<float> expected(exact.size());
+		HeightFilter(HeightFilter::Box, 1).Apply(&exact[0], size, size, &expected[0], nullptr);
+
+		const UINT sampleSizes[] = { 1, 2, 4 };
+		const wchar_t* names[] = { L"8-bit", L"16-bit", L"float" };
+
+		std::wostringstream outs;
+		outs << L"Heightmap formats: " << size << L"x" << size << L" RAW";
+		for (int f = 0; f < 3; ++f)
+		{
+			const std::wstring rawPath = L"FormatBenchmark.raw";
+			const std::wstring tiledPath = L"FormatBenchmark.thm";
+
+			std::vector<BYTE> raw(unit.size() * sampleSizes[f]);
+			for (UINT i = 0; i < unit.size(); ++i)
+			{
+				if (sampleSizes[f] == 1)
+				{
+					raw[i] = (BYTE)(unit[i] * 255.0f + 0.5f);
+				}
+				else if (sampleSizes[f] == 2)
+				{
+					USHORT sample = (USHORT)(unit[i] * 65535.0f + 0.5f);
+					memcpy(&raw[i * 2], &sample, sizeof(sample));
+				}
+				else
+				{
+					memcpy(&raw[i * 4], &unit[i], sizeof(float));
+				}
+			}
+
+			std::ofstream fout(rawPath, std::ios_base::binary);
+			fout.write((const char*)&raw[0], raw.size());
+			fout.close();
+			DeleteFileW(tiledPath.c_str());
+
+			Terrain::InitInfo info;
+			info.HeightMapFilename = rawPath;
+			info.HeightScale = heightScale;
+			info.HeightmapWidth = size;
+			info.HeightmapHeight = size;
+			info.CellSpacing = 0.5f;
+			info.HeightmapBudget = 256 * 1024 * 1024;
+
+			double start = Benchmark::Now();
+			Terrain* terrain = new Terrain();
+			bool converted = terrain->InitHeightmap(info);
+			double convertTime = Benchmark::Now() - start;
+			if (!converted)
+			{
+				delete terrain;
+				outs << L", " << names[f] << L": converting failed";
+				continue;
+			}
+
+			// Every sample, read at its vertex.
+			float maxError = 0.0f;
+			std::vector<XMFLOAT2> points(size);
+			std::vector<float> heights(size);
+			for (UINT i = 0; i < size; ++i)
+			{
+				for (UINT j = 0; j < size; ++j)
+				{
+					points[j] = XMFLOAT2(-0.5f * terrain->GetWidth() + j * info.CellSpacing, 0.5f * terrain->GetDepth() - i * info.CellSpacing);
+				}
+				terrain->GetHeights(&points[0], size, &heights[0]);
+				for (UINT j = 0; j < size; ++j)
+				{
+					maxError = MathHelper::Max(maxError, fabsf(heights[j] - expected[i * size + j]));
+				}
+			}
+
+			outs << L", " << names[f] << L": convert " << convertTime * 1000.0 << L" ms, " <<
+				terrain->GetHeightmap().GetFileSize() / 1024 << L" KB tiled, max error " << maxError;
+
+			delete terrain;
+			DeleteFileW(tiledPath.c_str());
+			DeleteFileW(rawPath.c_str());
+		}
+		Benchmark::Report(outs.str());
+	}
+
+	//
+	// Float and compressed tiles of the same maps: size on disk, time to read
+	// every tile, and every compressed sample checked against the float one
+	// rounded to the step.
+	//
+	const UINT sizes[] = { 4097, 16385 };
+	for (int s = 0; s < 2; ++s)
+	{
+		const UINT size = sizes[s];
+		const std::wstring floatPath = L"FormatBenchmarkFloat.thm";
+		const std::wstring compressedPath = L"FormatBenchmarkCompressed.thm";
+
+		double start = Benchmark::Now();
+		bool written = WriteSyntheticHeightmap(floatPath, size);
+		double floatWriteTime = Benchmark::Now() - start;
+
+		start = Benchmark::Now();
+		written = written && WriteSyntheticHeightmap(compressedPath, size, true);
+		double compressedWriteTime = Benchmark::Now() - start;
+
+		// Room for two rows of tiles.
+		UINT64 tileBytes = (UINT64)(TiledHeightmap::TileCells + 1) * (TiledHeightmap::TileCells + 1) * sizeof(float);
+		UINT64 budget = 2 * ((size - 2) / TiledHeightmap::TileCells + 1) * tileBytes;
+
+		TiledHeightmap floats;
+		TiledHeightmap compressed;
+		if (!written || !floats.Open(floatPath, budget) || !compressed.Open(compressedPath, budget))
+		{
+			floats.Close();
+			compressed.Close();
+			DeleteFileW(floatPath.c_str());
+			DeleteFileW(compressedPath.c_str());
+			Benchmark::Report(L"Heightmap formats: writing the heightmaps failed.");
+			return;
+		}
+
+		double floatReadTime = PageEveryTile(floats, nullptr);
+		double decodeTime = PageEveryTile(compressed, nullptr);
+
+		ThreadPool pool;
+		compressed.Close();
+		compressed.Open(compressedPath, budget);
+		double parallelDecodeTime = PageEveryTile(compressed, &pool);
+
+		// The round trip: the float tiles hold the heights as written, the
+		// compressed ones the same heights rounded to the step.
+		float base = compressed.GetHeightBase();
+		float step = compressed.GetHeightStep();
+		const UINT tileSamples = TiledHeightmap::TileCells + 1;
+		UINT64 mismatches = 0;
+		float maxError = 0.0f;
+		for (UINT ty = 0; ty < floats.GetTilesY(); ++ty)
+		{
+			floats.PageRect(0, ty, floats.GetTilesX() - 1, ty, nullptr);
+			compressed.PageRect(0, ty, compressed.GetTilesX() - 1, ty, &pool);
+			for (UINT tx = 0; tx < floats.GetTilesX(); ++tx)
+			{
+				const float* src = floats.GetTile(tx, ty);
+				const float* decoded = compressed.GetTile(tx, ty);
+				for (UINT i = 0; i < tileSamples * tileSamples; ++i)
+				{
+					double steps = floor(((double)src[i] - base) / step + 0.5);
+					float rounded = base + (float)(int)steps * step;
+					if (decoded[i] != rounded)
+					{
+						++mismatches;
+					}
+					maxError = MathHelper::Max(maxError, fabsf(decoded[i] - src[i]));
+				}
+			}
+		}
+
+		double samples = (double)size * size;
+		std::wostringstream outs;
+		outs << L"Heightmap formats: " << size << L"x" << size <<
+			L", float tiles " << floats.GetFileSize() / (1024 * 1024) << L" MB written in " << floatWriteTime << L" s" <<
+			L", compressed " << compressed.GetFileSize() / (1024 * 1024) << L" MB (" <<
+			(double)floats.GetTileDataSize() / compressed.GetTileDataSize() << L"x smaller, " <<
+			compressed.GetTileDataSize() * 8.0 / ((double)floats.GetTilesX() * floats.GetTilesY() * tileSamples * tileSamples) <<
+			L" bits a sample) written in " << compressedWriteTime << L" s" <<
+			L", reading every tile: float " << floatReadTime * 1000.0 << L" ms, compressed " << decodeTime * 1000.0 <<
+			L" ms (" << samples / decodeTime / 1e6 << L"M samples/s), on " << pool.ThreadCount() << L" threads " <<
+			parallelDecodeTime * 1000.0 << L" ms" <<
+			L", round trip " << mismatches << L" mismatches, max error " << maxError << L" for a step of " << step;
+		Benchmark::Report(outs.str());
+
+		floats.Close();
+		compressed.Close();
+		DeleteFileW(floatPath.c_str());
+		DeleteFileW(compressedPath.c_str());
+	}
+}
+
+// Largest difference, in units of the last place, between the bytes of two
+// texels.
+static int TexelDifference(UINT a, UINT b, bool isSigned)
+{
+	int maxDiff = 0;
+	for (UINT k = 0; k < 4; ++k)
+	{
+		int x = isSigned ? (int)(signed char)(a >> (8 * k)) : (int)((a >> (8 * k)) & 0xff);
+		int y = isSigned ? (int)(signed char)(b >> (8 * k)) : (int)((b >> (8 * k)) & 0xff);
+		maxDiff = MathHelper::Max(maxDiff, abs(x - y));
+	}
+	return maxDiff;
+}
+
+// The normal and blend texels of texel (i, j) worked out one at a time from
+// GetSample, the way the effect works out normals per pixel.
+static void BakeTexelReference(TiledHeightmap& heightmap, float cellSpacing, const TerrainBakeSettings& settings,
+	float minHeight, float invHeightRange, UINT i, UINT j, UINT* normal, UINT* blend)
+{
+	int step = (int)settings.Step;
+	int r = (int)i * step;
+	int c = (int)j * step;
+	float d = cellSpacing * step;
+
+	// GetSample clamps to the heightmap.
+	float hx = heightmap.GetSample(r, MathHelper::Min(c + step, (int)heightmap.GetWidth() - 1)) - heightmap.GetSample(r, c - step);
+	float hz = heightmap.GetSample(MathHelper::Min(r + step, (int)heightmap.GetHeight() - 1), c) - heightmap.GetSample(r - step, c);
+	XMVECTOR tangent = XMVector3Normalize(XMVectorSet(2.0f * d, hx, 0.0f, 0.0f));
+	XMVECTOR bitan = XMVector3Normalize(XMVectorSet(0.0f, hz, -2.0f * d, 0.0f));
+	XMFLOAT4 n;
+	XMStoreFloat4(&n, XMVector3Normalize(XMVector3Cross(tangent, bitan)));
+	n.w = 0.0f;
+	PackedConvert::FloatToSnorm8(&n.x, (signed char*)normal, 4);
+
+	float height = (heightmap.GetSample(r, c) - minHeight) * invHeightRange;
+	float slope = 1.0f - n.y;
+	float weights[4];
+	for (UINT k = 0; k < 4; ++k)
+	{
+		const TerrainBlendLayer& layer = settings.BlendLayers[k];
+		float inHeight = MathHelper::Min(height - layer.MinHeight, layer.MaxHeight - height) / MathHelper::Max(layer.HeightFade, 1e-6f);
+		float inSlope = MathHelper::Min(slope - layer.MinSlope, layer.MaxSlope - slope) / MathHelper::Max(layer.SlopeFade, 1e-6f);
+		weights[k] = MathHelper::Clamp(1.0f + inHeight, 0.0f, 1.0f) * MathHelper::Clamp(1.0f + inSlope, 0.0f, 1.0f);
+	}
+	PackedConvert::FloatToUnorm8(weights, (BYTE*)blend, 4);
+}
+
+static void RunTerrainBakeBenchmark()
+{
+	//
+	// The demo terrain, at the size of its heightmap texture.
+	//
+	Terrain::InitInfo info;
+	info.HeightMapFilename = L"Textures/terrain.raw";
+	info.HeightScale = 50.0f;
+	info.HeightmapWidth = 2049;
+	info.HeightmapHeight = 2049;
+	info.CellSpacing = 0.5f;
+	info.HeightmapBudget = 64 * 1024 * 1024;
+
+	Terrain* terrain = new Terrain();
+	if (terrain->InitHeightmap(info))
+	{
+		double start = Benchmark::Now();
+		bool baked = terrain->BakeMaps(TerrainBakeSettings(), L"BakeBenchmarkNormals.dds",
+			L"BakeBenchmarkTangents.dds", L"BakeBenchmarkBlend.dds");
+		double bakeTime = Benchmark::Now() - start;
+
+		std::wostringstream outs;
+		outs << L"Terrain bake: 2049x2049 demo terrain, normal, tangent and blend maps " <<
+			(baked ? L"baked and written in " : L"failed after ") << bakeTime * 1000.0 << L" ms";
+		Benchmark::Report(outs.str());
+
+		DeleteFileW(L"BakeBenchmarkNormals.dds");
+		DeleteFileW(L"BakeBenchmarkTangents.dds");
+		DeleteFileW(L"BakeBenchmarkBlend.dds");
+	}
+	else
+	{
+		Benchmark::Report(L"Terrain bake: Textures/terrain.raw not found.");
+	}
+	delete terrain;
+
+	//
+	// Large maps, at the step the terrain would upload them at, on one thread
+	// and on the pool, checked against texels worked out one at a time.
+	//
+	const UINT sizes[] = { 4097, 16385 };
+	const std::wstring path = L"BakeBenchmark.thm";
+	ThreadPool pool;
+
+	for (UINT size : sizes)
+	{
+		if (!WriteSyntheticHeightmap(path, size))
+		{
+			Benchmark::Report(L"Terrain bake: writing the heightmap failed.");
+			return;
+		}
+
+		TiledHeightmap heightmap;
+		if (!heightmap.Open(path, 64 * 1024 * 1024))
+		{
+			DeleteFileW(path.c_str());
+			Benchmark::Report(L"Terrain bake: opening the heightmap failed.");
+			return;
+		}
+
+		TerrainBakeSettings settings;
+		settings.Step = size > 16384 ? 2 : 1;
+		const float cellSpacing = 0.5f;
+
+		TerrainMaps maps;
+		double start = Benchmark::Now();
+		TerrainBaker::Bake(heightmap, cellSpacing, settings, maps);
+		double serialTime = Benchmark::Now() - start;
+
+		start = Benchmark::Now();
+		TerrainBaker::Bake(heightmap, cellSpacing, settings, maps, &pool);
+		double poolTime = Benchmark::Now() - start;
+
+		start = Benchmark::Now();
+		bool saved = TerrainBaker::SaveDDS(maps, L"BakeBenchmarkNormals.dds", L"BakeBenchmarkTangents.dds",
+			L"BakeBenchmarkBlend.dds");
+		double saveTime = Benchmark::Now() - start;
+		DeleteFileW(L"BakeBenchmarkNormals.dds");
+		DeleteFileW(L"BakeBenchmarkTangents.dds");
+		DeleteFileW(L"BakeBenchmarkBlend.dds");
+
+		float minHeight = MathHelper::Infinity;
+		float maxHeight = -MathHelper::Infinity;
+		for (UINT ty = 0; ty < heightmap.GetTilesY(); ++ty)
+		{
+			for (UINT tx = 0; tx < heightmap.GetTilesX(); ++tx)
+			{
+				XMFLOAT2 bounds = heightmap.GetTileBounds(tx, ty);
+				minHeight = MathHelper::Min(minHeight, bounds.x);
+				maxHeight = MathHelper::Max(maxHeight, bounds.y);
+			}
+		}
+
+		// Random texels, and the edges, where the neighbours are clamped.
+		const UINT checkCount = 100000;
+		UINT mismatches = 0;
+		int maxNormalDiff = 0;
+		int maxBlendDiff = 0;
+		for (UINT n = 0; n < checkCount; ++n)
+		{
+			UINT i = n % 4 == 0 ? (n / 4) % 2 * (maps.Height - 1) : rand() % maps.Height;
+			UINT j = n % 4 == 1 ? (n / 4) % 2 * (maps.Width - 1) : rand() % maps.Width;
+			UINT normal;
+			UINT blend;
+			BakeTexelReference(heightmap, cellSpacing, settings, minHeight, 1.0f / (maxHeight - minHeight), i, j, &normal, &blend);
+
+			int normalDiff = TexelDifference(normal, maps.Normals[i * maps.Width + j], true);
+			int blendDiff = TexelDifference(blend, maps.Blend[i * maps.Width + j], false);
+			maxNormalDiff = MathHelper::Max(maxNormalDiff, normalDiff);
+			maxBlendDiff = MathHelper::Max(maxBlendDiff, blendDiff);
+			mismatches += normalDiff > 1 || blendDiff > 1;
+		}
+
+		double texels = (double)maps.Width * maps.Height;
+		std::wostringstream outs;
+		outs << L"Terrain bake: " << size << L"x" << size << L" at step " << settings.Step << L", " << maps.Width << L"x" <<
+			maps.Height << L" texels, bake " << serialTime << L" s (" << texels / serialTime / 1e6 << L"M texels/s), on " <<
+			pool.ThreadCount() << L" threads " << poolTime << L" s (" << texels / poolTime / 1e6 << L"M texels/s), DDS " <<
+			(saved ? L"written in " : L"failed after ") << saveTime << L" s, " << mismatches << L"/" << checkCount <<
+			L" texels off by more than one step (max " << maxNormalDiff << L" normal, " << maxBlendDiff << L" blend)";
+		Benchmark::Report(outs.str());
+
+		heightmap.Close();
+		DeleteFileW(path.c_str());
+	}
+}
+
+// Walks a crowd of bodies frameCount frames, three rounds of collide and
+// slide a frame, sweeping every round one body at a time, as a batch on the
+// calling thread, or as a batch across the terrain's pool.  Returns the
+// seconds taken and adds the contacts met to contactCount.
+static double WalkCrowd(Terrain& terrain, std::vector<HeightfieldSweep>& bodies, const std::vector<XMFLOAT3>& moves,
+	UINT frameCount, int mode, UINT64* contactCount)
+{
+	const UINT count = (UINT)bodies.size();
+	std::vector<HeightfieldContact> contacts(count);
+	bool* hits = new bool[count];
+
+	double start = Benchmark::Now();
+	for (UINT frame = 0; frame < frameCount; ++frame)
+	{
+		for (UINT i = 0; i < count; ++i)
+		{
+			bodies[i].Move = moves[i];
+		}
+
+		for (int round = 0; round < 3; ++round)
+		{
+			if (mode == 0)
+			{
+				for (UINT i = 0; i < count; ++i)
+				{
+					hits[i] = terrain.Sweep(bodies[i], &contacts[i]);
+				}
+			}
+			else if (mode == 1)
+			{
+				terrain.GetCollider().SweepBatch(&bodies[0], count, &contacts[0], hits);
+			}
+			else
+			{
+				terrain.SweepBatch(&bodies[0], count, &contacts[0], hits);
+			}
+
+			for (UINT i = 0; i < count; ++i)
+			{
+				*contactCount += hits[i];
+				SlideBody(bodies[i], hits[i], contacts[i]);
+			}
+		}
+	}
+	double time = Benchmark::Now() - start;
+
+	delete[] hits;
+	return time;
+}
+
+static void RunHeightfieldCollisionBenchmark()
+{
+	const UINT size = 4097;
+	const std::wstring path = L"CollisionBenchmark.thm";
+	if (!WriteSyntheticHeightmap(path, size))
+	{
+		Benchmark::Report(L"Heightfield collision: writing the heightmap failed.");
+		return;
+	}
+
+	Terrain::InitInfo info;
+	info.HeightMapFilename = path;
+	info.HeightScale = 1.0f;
+	info.HeightmapWidth = size;
+	info.HeightmapHeight = size;
+	info.CellSpacing = 0.5f;
+	info.HeightmapBudget = 64 * 1024 * 1024;
+
+	Terrain* terrain = new Terrain();
+	if (!terrain->InitHeightmap(info))
+	{
+		delete terrain;
+		DeleteFileW(path.c_str());
+		Benchmark::Report(L"Heightfield collision: opening the heightmap failed.");
+		return;
+	}
+
+	// Spheres, upright capsules and tilted capsules, dropped from a little
+	// above the ground over the middle of the map and walking across it at 60
+	// frames a second.
+	const UINT agentCount = 10000;
+	const UINT frameCount = 300;
+	const float dt = 1.0f / 60.0f;
+	std::vector<HeightfieldSweep> start(agentCount);
+	std::vector<XMFLOAT3> moves(agentCount);
+	for (UINT i = 0; i < agentCount; ++i)
+	{
+		float x = MathHelper::RandF(-400.0f, 400.0f);
+		float z = MathHelper::RandF(-400.0f, 400.0f);
+		float heading = MathHelper::RandF(0.0f, 2.0f * MathHelper::Pi);
+		float speed = MathHelper::RandF(2.0f, 6.0f);
+
+		HeightfieldSweep& body = start[i];
+		switch (i % 3)
+		{
+		case 0:
+			body.HalfAxis = XMFLOAT3(0.0f, 0.0f, 0.0f);
+			body.Radius = 0.5f;
+			break;
+		case 1:
+			body.HalfAxis = XMFLOAT3(0.0f, 0.5f, 0.0f);
+			body.Radius = 0.4f;
+			break;
+		default:
+			body.HalfAxis = XMFLOAT3(0.6f * cosf(heading), 0.2f, 0.6f * sinf(heading));
+			body.Radius = 0.3f;
+			break;
+		}
+		body.Center = XMFLOAT3(x, terrain->GetHeight(x, z) + fabsf(body.HalfAxis.y) + body.Radius + 1.0f, z);
+		moves[i] = XMFLOAT3(speed * dt * cosf(heading), -30.0f * dt, speed * dt * sinf(heading));
+	}
+
+	std::vector<HeightfieldSweep> serial = start;
+	std::vector<HeightfieldSweep> batch = start;
+	std::vector<HeightfieldSweep> pooled = start;
+	UINT64 contacts[3] = { 0, 0, 0 };
+	double serialTime = WalkCrowd(*terrain, serial, moves, frameCount, 0, &contacts[0]);
+	double batchTime = WalkCrowd(*terrain, batch, moves, frameCount, 1, &contacts[1]);
+	double pooledTime = WalkCrowd(*terrain, pooled, moves, frameCount, 2, &contacts[2]);
+
+	// Every way of sweeping meets the same contacts and leaves the bodies in
+	// the same places, standing on the ground rather than under it.
+	UINT mismatches = (contacts[1] != contacts[0]) + (contacts[2] != contacts[0]);
+	UINT fallen = 0;
+	float maxDepth = 0.0f;
+	for (UINT i = 0; i < agentCount; ++i)
+	{
+		const HeightfieldSweep& body = serial[i];
+		if (memcmp(&body.Center, &batch[i].Center, sizeof(XMFLOAT3)) != 0 ||
+			memcmp(&body.Center, &pooled[i].Center, sizeof(XMFLOAT3)) != 0)
+		{
+			++mismatches;
+		}
+
+		float sign = body.HalfAxis.y > 0.0f ? -1.0f : 1.0f;
+		XMFLOAT3 low(body.Center.x + sign * body.HalfAxis.x, body.Center.y + sign * body.HalfAxis.y,
+			body.Center.z + sign * body.HalfAxis.z);
+		if (low.y - body.Radius < terrain->GetHeight(low.x, low.z) - 0.05f)
+		{
+			++fallen;
+		}
+
+		HeightfieldSweep rest = body;
+		rest.Move = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		HeightfieldContact contact;
+		if (terrain->Sweep(rest, &contact))
+		{
+			maxDepth = MathHelper::Max(maxDepth, contact.Depth);
+		}
+	}
+
+	double sweeps = 3.0 * agentCount * frameCount;
+	std::wostringstream outs;
+	outs << L"Heightfield collision: " << agentCount << L" agents on " << size << L"x" << size << L", " << frameCount <<
+		L" frames of 3 sweeps each, one at a time " << serialTime * 1000.0 / frameCount << L" ms/frame (" <<
+		sweeps / serialTime / 1e6 << L"M sweeps/s), batch " << batchTime * 1000.0 / frameCount << L" ms/frame, on " <<
+		ThreadPool::HardwareThreadCount() << L" threads " << pooledTime * 1000.0 / frameCount << L" ms/frame (" <<
+		sweeps / pooledTime / 1e6 << L"M sweeps/s), " << contacts[0] << L" contacts, " << mismatches <<
+		L" mismatches, " << fallen << L" fallen through, max depth left " << maxDepth;
+	Benchmark::Report(outs.str());
+
+	delete terrain;
+	DeleteFileW(path.c_str());
+}
+
+// Bakes the normal, tangent and blend maps of the demo terrain next to its
+// heightmap; the demo picks the normal map up on its next start.
+static bool BakeDemoTerrainMaps()
+{
+	Terrain::InitInfo info;
+	info.HeightMapFilename = L"Textures/terrain.raw";
+	info.HeightScale = 50.0f;
+	info.HeightmapWidth = 2049;
+	info.HeightmapHeight = 2049;
+	info.CellSpacing = 0.5f;
+	info.HeightmapBudget = 64 * 1024 * 1024;
+
+	Terrain* terrain = new Terrain();
+	double start = Benchmark::Now();
+	bool baked = terrain->InitHeightmap(info) &&
+		terrain->BakeMaps(TerrainBakeSettings(), L"Textures/terrainNormals.dds", L"Textures/terrainTangents.dds",
+			L"Textures/terrainBlend.dds");
+	double bakeTime = Benchmark::Now() - start;
+	delete terrain;
+
+	std::wostringstream outs;
+	outs << L"Terrain bake: Textures/terrain.raw " << (baked ? L"baked in " : L"failed after ") << bakeTime << L" s";
+	Benchmark::Report(outs.str());
+
+	return baked;
+}
+
 int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPSTR lpCmdLine, _In_ int nShowCmd)
 {
 	// Enable run-time memory check for debug builds.
@@ -223,6 +1839,25 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+	if (Benchmark::IsRequested(lpCmdLine))
+	{
+		RunHeightmapStreamingBenchmark();
+		RunPatchCullingBenchmark();
+		RunLodSelectionBenchmark();
+		RunSmoothingBenchmark();
+		RunRayCastBenchmark();
+		RunHeightQueryBenchmark();
+		RunHeightmapFormatBenchmark();
+		RunTerrainBakeBenchmark();
+		RunHeightfieldCollisionBenchmark();
+		return 0;
+	}
+
+	if (lpCmdLine != nullptr && strstr(lpCmdLine, "-bake") != nullptr)
+	{
+		return BakeDemoTerrainMaps() ? 0 : 1;
+	}
+
 	TerrainApp theApp(hInstance);
 
 	if (!theApp.Init())
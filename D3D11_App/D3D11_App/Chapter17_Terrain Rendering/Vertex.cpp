@@ -36,6 +36,12 @@ const D3D11_INPUT_ELEMENT_DESC InputLayoutDesc::Terrain[3] =
 	{ "TEXCOORD",  1, DXGI_FORMAT_R32G32_FLOAT, 0, 20, D3D11_INPUT_PER_VERTEX_DATA, 0 }
 };
 
+const D3D11_INPUT_ELEMENT_DESC InputLayoutDesc::TerrainLod[2] =
+{
+	{ "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT,       0, 0, D3D11_INPUT_PER_VERTEX_DATA,   0 },
+	{ "NODE",     0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 }
+};
+
 #pragma endregion
 
 #pragma region InputLayouts
@@ -45,6 +51,7 @@ ID3D11InputLayout* InputLayouts::Basic32 = nullptr;
 ID3D11InputLayout* InputLayouts::TreePointSprite = nullptr;
 ID3D11InputLayout* InputLayouts::PosNormalTexTan = nullptr;
 ID3D11InputLayout* InputLayouts::Terrain = nullptr;
+ID3D11InputLayout* InputLayouts::TerrainLod = nullptr;
 
 void InputLayouts::InitAll(ID3D11Device* device)
 {
@@ -69,6 +76,10 @@ void InputLayouts::InitAll(ID3D11Device* device)
 	Effects::TerrainFX->Light1Tech->GetPassByIndex(0)->GetDesc(&desc);
 	HR(device->CreateInputLayout(InputLayoutDesc::Terrain, 3, desc.pIAInputSignature,
 		desc.IAInputSignatureSize, &Terrain));
+
+	Effects::TerrainFX->Light1LodTech->GetPassByIndex(0)->GetDesc(&desc);
+	HR(device->CreateInputLayout(InputLayoutDesc::TerrainLod, 2, desc.pIAInputSignature,
+		desc.IAInputSignatureSize, &TerrainLod));
 }
 
 void InputLayouts::DestroyAll()
@@ -78,6 +89,7 @@ void InputLayouts::DestroyAll()
 	ReleaseCOM(Pos);
 	ReleaseCOM(PosNormalTexTan);
 	ReleaseCOM(Terrain);
+	ReleaseCOM(TerrainLod);
 }
 
 #pragma endregion
\ No newline at end of file
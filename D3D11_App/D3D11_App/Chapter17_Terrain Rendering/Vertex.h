@@ -47,6 +47,12 @@ namespace Vertex
 		XMFLOAT2 Tex;
 		XMFLOAT2 BoundsY;
 	};
+
+	// A vertex of the terrain LOD grid, placed by the node it is drawn for.
+	struct TerrainLod
+	{
+		XMFLOAT2 GridPos;
+	};
 }
 
 class InputLayoutDesc
@@ -58,6 +64,7 @@ public:
 	static const D3D11_INPUT_ELEMENT_DESC TreePointSprite[2];
 	static const D3D11_INPUT_ELEMENT_DESC PosNormalTexTan[4];
 	static const D3D11_INPUT_ELEMENT_DESC Terrain[3];
+	static const D3D11_INPUT_ELEMENT_DESC TerrainLod[2];
 };
 
 class InputLayouts
@@ -71,4 +78,5 @@ public:
 	static ID3D11InputLayout* TreePointSprite;
 	static ID3D11InputLayout* PosNormalTexTan;
 	static ID3D11InputLayout* Terrain;
+	static ID3D11InputLayout* TerrainLod;
 };
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include "AOBakeCache.h"
+
+namespace
+{
+	const UINT CacheMagic = 0x43414f41; // "AOAC"
+
+	// Bump when the layout of the file changes.  Changes to the results of
+	// the baker bump AOBaker::Revision instead, which is part of the key.
+	const UINT CacheVersion = 1;
+
+	struct CacheHeader
+	{
+		UINT Magic;
+		UINT Version;
+		UINT64 Key;
+		UINT VertexCount;
+		UINT Reserved;
+	};
+
+	// 64-bit FNV-1a.
+	class Hasher
+	{
+	public:
+		Hasher()
+			: m_Hash(14695981039346656037ull)
+		{
+
+		}
+
+		void Add(const void* data, size_t size)
+		{
+			const BYTE* bytes = (const BYTE*)data;
+			for (size_t i = 0; i < size; ++i)
+			{
+				m_Hash ^= bytes[i];
+				m_Hash *= 1099511628211ull;
+			}
+		}
+
+		template<typename T>
+		void Add(const T& value)
+		{
+			Add(&value, sizeof(T));
+		}
+
+		UINT64 GetHash() const
+		{
+			return m_Hash;
+		}
+
+	private:
+		UINT64 m_Hash;
+	};
+}
+
+AOBakeCache::AOBakeCache()
+	: m_Access(nullptr)
+{
+
+}
+
+UINT64 AOBakeCache::ComputeKey(const std::vector<XMFLOAT3>& positions, const std::vector<UINT>& indices,
+	const AOBakeSettings& settings)
+{
+	Hasher hasher;
+	hasher.Add(CacheVersion);
+	hasher.Add(AOBaker::Revision);
+
+	// The sizes keep a vertex moving into the index data from hashing the same.
+	hasher.Add((UINT)positions.size());
+	if (!positions.empty())
+	{
+		hasher.Add(&positions[0], positions.size() * sizeof(XMFLOAT3));
+	}
+	hasher.Add((UINT)indices.size());
+	if (!indices.empty())
+	{
+		hasher.Add(&indices[0], indices.size() * sizeof(UINT));
+	}
+
+	// Field by field, so that padding never reaches the hash.
+	hasher.Add((UINT)settings.Sampling);
+	hasher.Add(settings.SampleCount);
+	hasher.Add(settings.MaxDistance);
+	hasher.Add(settings.TargetError);
+	hasher.Add(settings.SurfaceOffset);
+	hasher.Add(settings.Seed);
+
+	return hasher.GetHash();
+}
+
+bool AOBakeCache::Open(const std::wstring& path, UINT64 key, UINT vertexCount)
+{
+	Close();
+
+	if (!m_File.Open(path))
+	{
+		return false;
+	}
+
+	UINT64 expectedSize = sizeof(CacheHeader) + (UINT64)vertexCount * sizeof(float);
+	if (m_File.GetSize() != expectedSize)
+	{
+		Close();
+		return false;
+	}
+
+	const CacheHeader* header = (const CacheHeader*)m_File.GetData();
+	if (header->Magic != CacheMagic || header->Version != CacheVersion ||
+		header->Key != key || header->VertexCount != vertexCount)
+	{
+		Close();
+		return false;
+	}
+
+	m_Access = (const float*)(header + 1);
+	return true;
+}
+
+void AOBakeCache::Close()
+{
+	m_File.Close();
+	m_Access = nullptr;
+}
+
+const float* AOBakeCache::GetAccess() const
+{
+	return m_Access;
+}
+
+bool AOBakeCache::Write(const std::wstring& path, UINT64 key, const std::vector<float>& access)
+{
+	CacheHeader header;
+	header.Magic = CacheMagic;
+	header.Version = CacheVersion;
+	header.Key = key;
+	header.VertexCount = (UINT)access.size();
+	header.Reserved = 0;
+
+	std::wstring tempPath = path + L".tmp";
+	HANDLE file = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	DWORD dataSize = (DWORD)(access.size() * sizeof(float));
+	DWORD written = 0;
+	bool ok = WriteFile(file, &header, sizeof(header), &written, nullptr) && written == sizeof(header);
+	if (ok && dataSize > 0)
+	{
+		ok = WriteFile(file, &access[0], dataSize, &written, nullptr) && written == dataSize;
+	}
+	CloseHandle(file);
+
+	if (!ok || !MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileW(tempPath.c_str());
+		return false;
+	}
+
+	return true;
+}
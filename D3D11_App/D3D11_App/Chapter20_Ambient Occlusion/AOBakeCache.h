@@ -0,0 +1,35 @@
+#pragma once
+
+#include "AOBaker.h"
+#include "MappedFile.h"
+
+// Baked ambient access kept on disk between runs.  The file is keyed by a hash
+// of the mesh, the bake settings and the revision of the baker; a file written
+// for another mesh, other settings or by an older baker is ignored and baked
+// over.
+class AOBakeCache
+{
+public:
+	AOBakeCache();
+
+	/// Hashes everything the bake result depends on.  Cheap next to a bake;
+	/// it does not need the BVH.
+	static UINT64 ComputeKey(const std::vector<XMFLOAT3>& positions, const std::vector<UINT>& indices,
+		const AOBakeSettings& settings);
+
+	/// Maps the cache file and checks that it was written for key and holds
+	/// vertexCount values.  Returns false if it is missing, stale or corrupt.
+	bool Open(const std::wstring& path, UINT64 key, UINT vertexCount);
+	void Close();
+
+	// Ambient access of every vertex, valid while the cache is open.
+	const float* GetAccess() const;
+
+	// Writes the file next to path first and then moves it over, so that an
+	// interrupted write never leaves a file that looks valid.
+	static bool Write(const std::wstring& path, UINT64 key, const std::vector<float>& access);
+
+private:
+	MappedFile m_File;
+	const float* m_Access;
+};
@@ -0,0 +1,404 @@
+#include "AOBaker.h"
+
+namespace
+{
+	// Triangles per range handed to the thread pool.
+	const UINT TriangleGrainSize = 64;
+
+	// Stratified rounds cover the unit square with a grid of 2 x 4 cells.
+	const UINT RoundRows = 2;
+	const UINT RoundColumns = 4;
+	const UINT RoundSize = RoundRows * RoundColumns;
+
+	UINT HashUInt(UINT x)
+	{
+		x ^= x >> 16;
+		x *= 0x7feb352d;
+		x ^= x >> 15;
+		x *= 0x846ca68b;
+		x ^= x >> 16;
+		return x;
+	}
+
+	// Xorshift generator.  MathHelper::RandF shares the state of rand() between
+	// threads, which would make the bake depend on scheduling.
+	class AORandom
+	{
+	public:
+		explicit AORandom(UINT seed)
+			: m_State(HashUInt(seed) | 1)
+		{
+
+		}
+
+		// Returns a float in [0, 1).
+		float NextFloat()
+		{
+			m_State ^= m_State << 13;
+			m_State ^= m_State >> 17;
+			m_State ^= m_State << 5;
+			return (m_State >> 8) * (1.0f / 16777216.0f);
+		}
+
+		float NextFloat(float a, float b)
+		{
+			return a + (b - a) * NextFloat();
+		}
+
+	private:
+		UINT m_State;
+	};
+
+	// Same distribution as MathHelper::RandHemisphereUnitVec3.
+	XMVECTOR RandHemisphereUnitVec3(AORandom& random, FXMVECTOR n)
+	{
+		XMVECTOR One = XMVectorSet(1.0f, 1.0f, 1.0f, 1.0f);
+		XMVECTOR Zero = XMVectorZero();
+
+		while (true)
+		{
+			XMVECTOR v = XMVectorSet(random.NextFloat(-1.0f, 1.0f), random.NextFloat(-1.0f, 1.0f), random.NextFloat(-1.0f, 1.0f), 0.0f);
+
+			if (XMVector3Greater(XMVector3LengthSq(v), One))
+				continue;
+
+			if (XMVector3Less(XMVector3Dot(n, v), Zero))
+				continue;
+
+			return XMVector3Normalize(v);
+		}
+	}
+
+	// Cosine weighted direction around n from a point of the unit square.
+	// The tangent frame is built without branching on the normal
+	// (Duff et al., "Building an Orthonormal Basis, Revisited").
+	XMVECTOR CosineHemisphereUnitVec3(const XMFLOAT3& n, float u1, float u2)
+	{
+		float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+		float a = -1.0f / (sign + n.z);
+		float b = n.x * n.y * a;
+
+		XMVECTOR tangent = XMVectorSet(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x, 0.0f);
+		XMVECTOR bitangent = XMVectorSet(b, sign + n.y * n.y * a, -n.y, 0.0f);
+
+		float r = sqrtf(u1);
+		float phi = 2.0f * MathHelper::Pi * u2;
+
+		return (r * cosf(phi)) * tangent + (r * sinf(phi)) * bitangent +
+			sqrtf(MathHelper::Max(0.0f, 1.0f - u1)) * XMLoadFloat3(&n);
+	}
+
+	// Direction of ray s of a round around the unit normal n.
+	XMVECTOR SampleDirection(AORandom& random, const AOBakeSettings& settings, const XMFLOAT3& n, UINT s)
+	{
+		if (settings.Sampling == AOSamplingStratifiedCosine)
+		{
+			float u1 = (s / RoundColumns + random.NextFloat()) / RoundRows;
+			float u2 = (s % RoundColumns + random.NextFloat()) / RoundColumns;
+			return CosineHemisphereUnitVec3(n, u1, u2);
+		}
+
+		return RandHemisphereUnitVec3(random, XMLoadFloat3(&n));
+	}
+
+	// Every round is a complete stratified set, so the spread of the round
+	// means tells how far the running estimate can still be off.
+	bool HasConverged(const AOBakeSettings& settings, UINT rounds, float sum, float sumSq)
+	{
+		if (settings.TargetError <= 0.0f || rounds < 2)
+		{
+			return false;
+		}
+
+		// Variance of a round mean, divided by the rounds averaged so far.
+		float average = sum / rounds;
+		float variance = (sumSq - rounds * average * average) / (rounds - 1);
+		return variance <= rounds * settings.TargetError * settings.TargetError;
+	}
+
+	// A uniform bake without a target error shoots all of its rays in one
+	// round, drawing them in the order the original serial bake did.
+	UINT GetRoundSize(const AOBakeSettings& settings)
+	{
+		bool singleRound = settings.Sampling == AOSamplingUniform && settings.TargetError <= 0.0f;
+		return singleRound ? settings.SampleCount : RoundSize;
+	}
+}
+
+AOBaker::AOBaker(const std::vector<XMFLOAT3>& positions, const std::vector<UINT>& indices)
+	: m_Positions(positions)
+	, m_Indices(indices)
+{
+	m_BVH.Build(m_Positions, m_Indices);
+
+	// Counting sort of the triangle corners by vertex.
+	UINT vcount = (UINT)m_Positions.size();
+	UINT tcount = (UINT)m_Indices.size() / 3;
+
+	m_VertexFirst.assign(vcount + 1, 0);
+	for (UINT i = 0; i < 3 * tcount; ++i)
+	{
+		++m_VertexFirst[m_Indices[i] + 1];
+	}
+	for (UINT v = 0; v < vcount; ++v)
+	{
+		m_VertexFirst[v + 1] += m_VertexFirst[v];
+	}
+
+	std::vector<UINT> next(m_VertexFirst.begin(), m_VertexFirst.end() - 1);
+	m_VertexTriangles.resize(3 * tcount);
+	for (UINT i = 0; i < 3 * tcount; ++i)
+	{
+		m_VertexTriangles[next[m_Indices[i]]++] = i / 3;
+	}
+}
+
+UINT64 AOBaker::Bake(ThreadPool& pool, const AOBakeSettings& settings, std::vector<float>& access,
+	const ProgressFunc& progress) const
+{
+	UINT vcount = (UINT)m_Positions.size();
+	UINT tcount = TriangleCount();
+
+	// Every triangle writes its own slot, so no synchronization is needed.
+	std::vector<float> triangleAccess(tcount);
+
+	std::atomic<UINT64> rayCount(0);
+	std::atomic<UINT> done(0);
+	std::mutex progressMutex;
+	UINT reportedPercent = 0;
+
+	pool.ParallelFor(tcount, TriangleGrainSize, [&](UINT begin, UINT end)
+	{
+		UINT count = end - begin;
+		std::vector<XMFLOAT3> centroids(count);
+		std::vector<XMFLOAT3> normals(count);
+		std::vector<UINT> seeds(count);
+		std::vector<UINT> rays(count);
+		for (UINT t = begin; t < end; ++t)
+		{
+			XMVECTOR v0 = XMLoadFloat3(&m_Positions[m_Indices[t * 3 + 0]]);
+			XMVECTOR v1 = XMLoadFloat3(&m_Positions[m_Indices[t * 3 + 1]]);
+			XMVECTOR v2 = XMLoadFloat3(&m_Positions[m_Indices[t * 3 + 2]]);
+
+			XMStoreFloat3(&normals[t - begin], XMVector3Normalize(XMVector3Cross(v1 - v0, v2 - v0)));
+			XMStoreFloat3(&centroids[t - begin], (v0 + v1 + v2) / 3.0f);
+			seeds[t - begin] = t;
+		}
+
+		// Seeded by triangle, so the result is the same as from BakeTriangle.
+		BakePoints(&centroids[0], &normals[0], &seeds[0], count, settings, &triangleAccess[begin], &rays[0]);
+
+		UINT64 rangeRays = 0;
+		for (UINT i = 0; i < count; ++i)
+		{
+			rangeRays += rays[i];
+		}
+		rayCount += rangeRays;
+
+		if (progress)
+		{
+			UINT finished = (done += end - begin);
+			UINT percent = (UINT)((UINT64)finished * 100 / tcount);
+
+			std::lock_guard<std::mutex> lock(progressMutex);
+			if (percent > reportedPercent)
+			{
+				reportedPercent = percent;
+				progress((float)finished / tcount);
+			}
+		}
+	});
+
+	// Gather instead of scattering into the vertices, which would race.
+	access.resize(vcount);
+	pool.ParallelFor(vcount, 4096, [&](UINT begin, UINT end)
+	{
+		for (UINT v = begin; v < end; ++v)
+		{
+			UINT first = m_VertexFirst[v];
+			UINT last = m_VertexFirst[v + 1];
+			if (first == last)
+			{
+				access[v] = 1.0f;
+				continue;
+			}
+
+			float sum = 0.0f;
+			for (UINT i = first; i < last; ++i)
+			{
+				sum += triangleAccess[m_VertexTriangles[i]];
+			}
+			access[v] = sum / (last - first);
+		}
+	});
+
+	return rayCount;
+}
+
+float AOBaker::BakeTriangle(UINT triangle, const AOBakeSettings& settings, UINT* pRayCount) const
+{
+	XMVECTOR v0 = XMLoadFloat3(&m_Positions[m_Indices[triangle * 3 + 0]]);
+	XMVECTOR v1 = XMLoadFloat3(&m_Positions[m_Indices[triangle * 3 + 1]]);
+	XMVECTOR v2 = XMLoadFloat3(&m_Positions[m_Indices[triangle * 3 + 2]]);
+
+	XMVECTOR normal = XMVector3Normalize(XMVector3Cross(v1 - v0, v2 - v0));
+	XMVECTOR centroid = (v0 + v1 + v2) / 3.0f;
+
+	return BakePoint(centroid, normal, triangle, settings, pRayCount);
+}
+
+float AOBaker::BakePoint(FXMVECTOR position, FXMVECTOR normal, UINT sampleSeed, const AOBakeSettings& settings,
+	UINT* pRayCount) const
+{
+	// Offset to avoid self intersection.
+	XMVECTOR origin = position + settings.SurfaceOffset * normal;
+
+	XMFLOAT3 n;
+	XMStoreFloat3(&n, normal);
+
+	AORandom random(sampleSeed * 0x9e3779b9 ^ settings.Seed);
+	UINT roundSize = GetRoundSize(settings);
+
+	UINT rays = 0;
+	UINT unoccluded = 0;
+	UINT rounds = 0;
+	float sum = 0.0f;
+	float sumSq = 0.0f;
+	while (rays < settings.SampleCount)
+	{
+		UINT roundRays = MathHelper::Min(roundSize, settings.SampleCount - rays);
+		UINT roundUnoccluded = 0;
+		for (UINT s = 0; s < roundRays; ++s)
+		{
+			BVHRay ray(origin, SampleDirection(random, settings, n, s));
+			if (!m_BVH.IsOccluded(ray, settings.MaxDistance))
+			{
+				++roundUnoccluded;
+			}
+		}
+
+		rays += roundRays;
+		unoccluded += roundUnoccluded;
+
+		float mean = (float)roundUnoccluded / roundRays;
+		sum += mean;
+		sumSq += mean * mean;
+		++rounds;
+
+		if (HasConverged(settings, rounds, sum, sumSq))
+		{
+			break;
+		}
+	}
+
+	if (pRayCount)
+	{
+		*pRayCount = rays;
+	}
+
+	return rays > 0 ? (float)unoccluded / rays : 1.0f;
+}
+
+void AOBaker::BakePoints(const XMFLOAT3* positions, const XMFLOAT3* normals, const UINT* sampleSeeds, UINT count,
+	const AOBakeSettings& settings, float* access, UINT* rayCounts) const
+{
+	struct PointState
+	{
+		UINT Rays;
+		UINT Unoccluded;
+		UINT Rounds;
+		float Sum;
+		float SumSq;
+	};
+
+	PointState initial = { 0, 0, 0, 0.0f, 0.0f };
+	std::vector<PointState> states(count, initial);
+	std::vector<AORandom> randoms;
+	randoms.reserve(count);
+
+	std::vector<UINT> active;
+	for (UINT i = 0; i < count; ++i)
+	{
+		randoms.push_back(AORandom(sampleSeeds[i] * 0x9e3779b9 ^ settings.Seed));
+		if (settings.SampleCount > 0)
+		{
+			active.push_back(i);
+		}
+	}
+
+	UINT roundSize = GetRoundSize(settings);
+
+	// Shoot one round for every point that has not settled yet as a single
+	// batch, then update the estimates the way BakePoint does.
+	std::vector<BVHRayQuery> rays;
+	std::vector<BYTE> occluded;
+	while (!active.empty())
+	{
+		rays.clear();
+		for (UINT a = 0; a < active.size(); ++a)
+		{
+			UINT i = active[a];
+			UINT roundRays = MathHelper::Min(roundSize, settings.SampleCount - states[i].Rays);
+
+			BVHRayQuery query;
+			XMStoreFloat3(&query.Origin, XMLoadFloat3(&positions[i]) + settings.SurfaceOffset * XMLoadFloat3(&normals[i]));
+			query.MaxDist = settings.MaxDistance;
+			for (UINT s = 0; s < roundRays; ++s)
+			{
+				XMStoreFloat3(&query.Direction, SampleDirection(randoms[i], settings, normals[i], s));
+				rays.push_back(query);
+			}
+		}
+
+		occluded.resize(rays.size());
+		m_BVH.OccludedBatch(&rays[0], (UINT)rays.size(), &occluded[0]);
+
+		UINT ray = 0;
+		UINT stillActive = 0;
+		for (UINT a = 0; a < active.size(); ++a)
+		{
+			UINT i = active[a];
+			PointState& state = states[i];
+			UINT roundRays = MathHelper::Min(roundSize, settings.SampleCount - state.Rays);
+
+			UINT roundUnoccluded = 0;
+			for (UINT s = 0; s < roundRays; ++s)
+			{
+				roundUnoccluded += occluded[ray++] ? 0 : 1;
+			}
+
+			state.Rays += roundRays;
+			state.Unoccluded += roundUnoccluded;
+
+			float mean = (float)roundUnoccluded / roundRays;
+			state.Sum += mean;
+			state.SumSq += mean * mean;
+			++state.Rounds;
+
+			if (state.Rays < settings.SampleCount && !HasConverged(settings, state.Rounds, state.Sum, state.SumSq))
+			{
+				active[stillActive++] = i;
+			}
+		}
+		active.resize(stillActive);
+	}
+
+	for (UINT i = 0; i < count; ++i)
+	{
+		access[i] = states[i].Rays > 0 ? (float)states[i].Unoccluded / states[i].Rays : 1.0f;
+		if (rayCounts)
+		{
+			rayCounts[i] = states[i].Rays;
+		}
+	}
+}
+
+const Box& AOBaker::GetBounds() const
+{
+	return m_BVH.GetBounds();
+}
+
+UINT AOBaker::TriangleCount() const
+{
+	return (UINT)m_Indices.size() / 3;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "BVH.h"
+#include "ThreadPool.h"
+
+enum AOSampling
+{
+	// Directions uniform over the hemisphere, as RandHemisphereUnitVec3 draws them.
+	AOSamplingUniform,
+
+	// Cosine weighted directions, jittered within a grid of strata.
+	AOSamplingStratifiedCosine
+};
+
+struct AOBakeSettings
+{
+	AOSampling Sampling;
+
+	// Rays shot from the centroid of every triangle, or the most that may be
+	// shot when TargetError is set.
+	UINT SampleCount;
+
+	// Occluders farther away than this do not darken the triangle.
+	float MaxDistance;
+
+	// When above zero, rays are shot in rounds and a triangle stops once the
+	// standard error of its estimate drops below this.
+	float TargetError;
+
+	// Ray origins are moved this far along the face normal to avoid hitting
+	// the triangle itself.
+	float SurfaceOffset;
+
+	// Mixed with the triangle index to seed the samples of each triangle.
+	UINT Seed;
+
+	AOBakeSettings()
+		: Sampling(AOSamplingUniform)
+		, SampleCount(32)
+		, MaxDistance(MathHelper::Infinity)
+		, TargetError(0.0f)
+		, SurfaceOffset(0.001f)
+		, Seed(0)
+	{
+
+	}
+};
+
+// Bakes per vertex ambient access by shooting rays from every triangle
+// against a BVH of the mesh.  Triangles are spread over a thread pool; each
+// one draws its samples from its own generator seeded by its index, so the
+// result does not depend on the number of threads or the order they run in.
+class AOBaker
+{
+public:
+	// Receives the fraction of triangles done.  It may be called from any
+	// thread of the pool, but never by two of them at once.
+	typedef std::function<void(float)> ProgressFunc;
+
+	AOBaker(const std::vector<XMFLOAT3>& positions, const std::vector<UINT>& indices);
+
+	// Bumped whenever a change to the baker alters what Bake writes, so
+	// that access cached by an older baker is baked over: 2 with samples
+	// drawn through BakePoint, 3 with rounds traced as batches.
+	static const UINT Revision = 3;
+
+	/// Fills access with the fraction of unoccluded rays of every vertex,
+	/// averaged over the triangles that share it.  Returns the number of
+	/// rays traced.
+	UINT64 Bake(ThreadPool& pool, const AOBakeSettings& settings, std::vector<float>& access,
+		const ProgressFunc& progress = ProgressFunc()) const;
+
+	// Fraction of the rays from the triangle that escape the mesh.
+	float BakeTriangle(UINT triangle, const AOBakeSettings& settings, UINT* pRayCount = nullptr) const;
+
+	// Fraction of the rays from a point on the surface with the given unit
+	// normal that escape the mesh.  Points with the same seed draw the same
+	// directions; BakeTriangle seeds with the triangle index.
+	float BakePoint(FXMVECTOR position, FXMVECTOR normal, UINT sampleSeed, const AOBakeSettings& settings,
+		UINT* pRayCount = nullptr) const;
+
+	/// BakePoint for count points at once.  Every round of rays of all the
+	/// points still sampling is traced as one batch, which the BVH sorts into
+	/// coherent packets.  rayCounts may be null.
+	void BakePoints(const XMFLOAT3* positions, const XMFLOAT3* normals, const UINT* sampleSeeds, UINT count,
+		const AOBakeSettings& settings, float* access, UINT* rayCounts) const;
+
+	const Box& GetBounds() const;
+	UINT TriangleCount() const;
+
+private:
+	std::vector<XMFLOAT3> m_Positions;
+	std::vector<UINT> m_Indices;
+	MeshBVH m_BVH;
+
+	// The triangles around vertex v are m_VertexTriangles[m_VertexFirst[v]]
+	// up to m_VertexTriangles[m_VertexFirst[v + 1]], in increasing order so
+	// that the averages are summed the same way on every run.
+	std::vector<UINT> m_VertexFirst;
+	std::vector<UINT> m_VertexTriangles;
+};
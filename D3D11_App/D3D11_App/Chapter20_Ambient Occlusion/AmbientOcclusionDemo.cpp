@@ -10,6 +10,10 @@
 #include "Sky.h"
 #include "ShadowMap.h"
 #include "Octree.h"
+#include "AOBaker.h"
+#include "AOBakeCache.h"
+#include "LightmapBaker.h"
+#include "Benchmark.h"
 #include "Camera.h"
 
 struct BoundingSphere
@@ -19,6 +23,67 @@ struct BoundingSphere
 	float m_Radius;
 };
 
+// Reads the skull model shared by the demo and the headless benchmark.
+static bool LoadSkullModel(std::vector<Vertex::AmbientOcclusion>& vertices, std::vector<UINT>& indices)
+{
+	std::ifstream fin("Models/skull.txt");
+
+	if (!fin)
+	{
+		return false;
+	}
+
+	UINT vcount = 0;
+	UINT tcount = 0;
+	std::string ignore;
+
+	fin >> ignore >> vcount;
+	fin >> ignore >> tcount;
+	fin >> ignore >> ignore >> ignore >> ignore;
+
+	vertices.resize(vcount);
+	for (UINT i = 0; i < vcount; ++i)
+	{
+		fin >> vertices[i].Pos.x >> vertices[i].Pos.y >> vertices[i].Pos.z;
+		fin >> vertices[i].Normal.x >> vertices[i].Normal.y >> vertices[i].Normal.z;
+	}
+
+	fin >> ignore;
+	fin >> ignore;
+	fin >> ignore;
+
+	indices.resize(3 * tcount);
+	for (UINT i = 0; i < tcount; ++i)
+	{
+		fin >> indices[i * 3 + 0] >> indices[i * 3 + 1] >> indices[i * 3 + 2];
+	}
+
+	return true;
+}
+
+// Sampling used for the skull: stratified cosine weighted rounds until the
+// estimate settles, ignoring occluders beyond a quarter of the mesh diagonal.
+// Computed from the positions alone, so a cached bake can be looked up
+// without building the baker.
+static AOBakeSettings GetSkullBakeSettings(const std::vector<XMFLOAT3>& positions)
+{
+	XMVECTOR vMin = XMVectorReplicate(MathHelper::Infinity);
+	XMVECTOR vMax = XMVectorReplicate(-MathHelper::Infinity);
+	for (UINT i = 0; i < positions.size(); ++i)
+	{
+		XMVECTOR p = XMLoadFloat3(&positions[i]);
+		vMin = XMVectorMin(vMin, p);
+		vMax = XMVectorMax(vMax, p);
+	}
+
+	AOBakeSettings settings;
+	settings.Sampling = AOSamplingStratifiedCosine;
+	settings.SampleCount = 64;
+	settings.TargetError = 0.03f;
+	settings.MaxDistance = 0.25f * XMVectorGetX(XMVector3Length(vMax - vMin));
+	return settings;
+}
+
 class AmbientOcclusionApp : public D3DApp
 {
 public:
@@ -181,19 +246,103 @@ void AmbientOcclusionApp::OnMouseMove(WPARAM btnState, int x, int y)
 
 void AmbientOcclusionApp::BuildVertexAmbientOcclusion(std::vector<Vertex::AmbientOcclusion>& vertices, const std::vector<UINT>& indices)
 {
-	int vcount = vertices.size();
-	int tcount = indices.size() / 3;
+	UINT vcount = vertices.size();
 
 	std::vector<XMFLOAT3> pos(vcount);
-	for (int i = 0; i < vcount; ++i)
+	for (UINT i = 0; i < vcount; ++i)
 	{
 		pos[i] = vertices[i].Pos;
 	}
 
+	AOBakeSettings settings = GetSkullBakeSettings(pos);
+	UINT64 key = AOBakeCache::ComputeKey(pos, indices, settings);
+
+	AOBakeCache cache;
+	if (cache.Open(L"Models/skull.aocache", key, vcount))
+	{
+		const float* access = cache.GetAccess();
+		for (UINT i = 0; i < vcount; ++i)
+		{
+			vertices[i].AmbientAccess = access[i];
+		}
+		return;
+	}
+
+	AOBaker baker(pos, indices);
+	ThreadPool pool;
+
+	std::vector<float> access;
+	baker.Bake(pool, settings, access, [](float done)
+	{
+		std::wostringstream outs;
+		outs << L"Baking ambient occlusion: " << (int)(100.0f * done) << L"%\n";
+		OutputDebugStringW(outs.str().c_str());
+	});
+
+	for (UINT i = 0; i < vcount; ++i)
+	{
+		vertices[i].AmbientAccess = access[i];
+	}
+
+	// Failing to write only costs the next run another bake.
+	if (!AOBakeCache::Write(L"Models/skull.aocache", key, access))
+	{
+		OutputDebugStringW(L"Could not write Models/skull.aocache.\n");
+	}
+}
+
+void AmbientOcclusionApp::BuildSkullGeometryBuffers()
+{
+	std::vector<Vertex::AmbientOcclusion> vertices;
+	std::vector<UINT> indices;
+	if (!LoadSkullModel(vertices, indices))
+	{
+		MessageBox(0, L"Models/skull.txt not found.", 0, 0);
+		return;
+	}
+
+	UINT vcount = vertices.size();
+	m_SkullIndexCount = indices.size();
+
+	BuildVertexAmbientOcclusion(vertices, indices);
+
+	D3D11_BUFFER_DESC vbd;
+	vbd.Usage = D3D11_USAGE_IMMUTABLE;
+	vbd.ByteWidth = sizeof(Vertex::Basic32) * vcount;
+	vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	vbd.CPUAccessFlags = 0;
+	vbd.MiscFlags = 0;
+	D3D11_SUBRESOURCE_DATA vinitData;
+	vinitData.pSysMem = &vertices[0];
+	HR(d3d_device_->CreateBuffer(&vbd, &vinitData, &m_SkullVB));
+
+	//
+	// Pack the indices of all the meshes into one index buffer.
+	//
+
+	D3D11_BUFFER_DESC ibd;
+	ibd.Usage = D3D11_USAGE_IMMUTABLE;
+	ibd.ByteWidth = sizeof(UINT) * m_SkullIndexCount;
+	ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+	ibd.CPUAccessFlags = 0;
+	ibd.MiscFlags = 0;
+	D3D11_SUBRESOURCE_DATA iinitData;
+	iinitData.pSysMem = &indices[0];
+	HR(d3d_device_->CreateBuffer(&ibd, &iinitData, &m_SkullIB));
+}
+
+// The bake as it used to run: serially through the Octree, with samples
+// drawn from rand().  Kept as the reference for the benchmark.
+static void BakeReferenceAmbientOcclusion(const std::vector<XMFLOAT3>& pos, const std::vector<UINT>& indices,
+	std::vector<float>& access)
+{
+	int vcount = pos.size();
+	int tcount = indices.size() / 3;
+
 	Octree octree;
 	octree.Build(pos, indices);
 
-	// For each vertex, count how many triangles contain the vertex.
+	access.assign(vcount, 0.0f);
 	std::vector<int> vertexSharedCount(vcount);
 	for (int i = 0; i < tcount; ++i)
 	{
@@ -201,116 +350,409 @@ void AmbientOcclusionApp::BuildVertexAmbientOcclusion(std::vector<Vertex::Ambien
 		UINT i1 = indices[i * 3 + 1];
 		UINT i2 = indices[i * 3 + 2];
 
-		XMVECTOR v0 = XMLoadFloat3(&vertices[i0].Pos);
-		XMVECTOR v1 = XMLoadFloat3(&vertices[i1].Pos);
-		XMVECTOR v2 = XMLoadFloat3(&vertices[i2].Pos);
+		XMVECTOR v0 = XMLoadFloat3(&pos[i0]);
+		XMVECTOR v1 = XMLoadFloat3(&pos[i1]);
+		XMVECTOR v2 = XMLoadFloat3(&pos[i2]);
 
-		XMVECTOR edge0 = v1 - v0;
-		XMVECTOR edge1 = v2 - v0;
-
-		XMVECTOR normal = XMVector3Normalize(XMVector3Cross(edge0, edge1));
-
-		XMVECTOR centroid = (v0 + v1 + v2) / 3.0f;
-
-		// Offset to avoid self intersection.
-		centroid += 0.001f * normal;
+		XMVECTOR normal = XMVector3Normalize(XMVector3Cross(v1 - v0, v2 - v0));
+		XMVECTOR centroid = (v0 + v1 + v2) / 3.0f + 0.001f * normal;
 
 		const int numSampleRays = 32;
 		float numUnoccluded = 0;
 		for (int j = 0; j < numSampleRays; ++j)
 		{
-			XMVECTOR randomDir = MathHelper::RandHemisphereUnitVec3(normal);
-
-			// TODO: Technically we should not count intersections that are far 
-			// away as occluding the triangle, but this is OK for demo.
-			if (!octree.RayOctreeIntersect(centroid, randomDir))
+			if (!octree.RayOctreeIntersect(centroid, MathHelper::RandHemisphereUnitVec3(normal)))
 			{
 				++numUnoccluded;
 			}
 		}
 
 		float ambientAccess = numUnoccluded / numSampleRays;
-		
-		// Average with vertices that share this face.
-		vertices[i0].AmbientAccess += ambientAccess;
-		vertices[i1].AmbientAccess += ambientAccess;
-		vertices[i2].AmbientAccess += ambientAccess;
+		access[i0] += ambientAccess;
+		access[i1] += ambientAccess;
+		access[i2] += ambientAccess;
 
 		++vertexSharedCount[i0];
 		++vertexSharedCount[i1];
 		++vertexSharedCount[i2];
 	}
 
-	// Finish average by dividing by the number of samples we added.
 	for (int i = 0; i < vcount; ++i)
 	{
-		vertices[i].AmbientAccess /= vertexSharedCount[i];
+		if (vertexSharedCount[i] > 0)
+		{
+			access[i] /= vertexSharedCount[i];
+		}
 	}
 }
 
-void AmbientOcclusionApp::BuildSkullGeometryBuffers()
+// Headless benchmark: bakes the skull with the reference path and with the
+// baker on an increasing number of threads.
+static void RunAmbientOcclusionBenchmark()
 {
-	std::ifstream fin("Models/skull.txt");
-
-	if (!fin)
+	std::vector<Vertex::AmbientOcclusion> vertices;
+	std::vector<UINT> indices;
+	if (!LoadSkullModel(vertices, indices))
 	{
-		MessageBox(0, L"Models/skull.txt not found.", 0, 0);
+		Benchmark::Report(L"Ambient occlusion: Models/skull.txt not found.");
 		return;
 	}
 
-	UINT vcount = 0;
-	UINT tcount = 0;
-	std::string ignore;
-
-	fin >> ignore >> vcount;
-	fin >> ignore >> tcount;
-	fin >> ignore >> ignore >> ignore >> ignore;
+	std::vector<XMFLOAT3> pos(vertices.size());
+	for (UINT i = 0; i < vertices.size(); ++i)
+	{
+		pos[i] = vertices[i].Pos;
+	}
 
-	std::vector<Vertex::AmbientOcclusion> vertices(vcount);
-	for (UINT i = 0; i < vcount; ++i)
+	double start = Benchmark::Now();
+	std::vector<float> reference;
+	BakeReferenceAmbientOcclusion(pos, indices, reference);
+	double referenceTime = Benchmark::Now() - start;
+
+	start = Benchmark::Now();
+	AOBaker baker(pos, indices);
+	double setupTime = Benchmark::Now() - start;
+
+	std::wostringstream outs;
+	outs << L"Ambient occlusion: " << baker.TriangleCount() << L" triangles" <<
+		L", serial octree bake " << referenceTime * 1000.0 << L" ms" <<
+		L", baker setup " << setupTime * 1000.0 << L" ms";
+	Benchmark::Report(outs.str());
+
+	// The baker must match the reference within what 32 samples a triangle
+	// allow: on the skull the means agree to a few ten-thousandths and the
+	// vertices differ by about 0.02 on average.
+	const double maxMeanAccessDelta = 0.005;
+	const double maxMeanDifference = 0.04;
+
+	std::vector<float> serial;
+	double serialTime = 0.0;
+	UINT hardwareThreads = ThreadPool::HardwareThreadCount();
+	for (UINT threads = 1; ; threads = MathHelper::Min(2 * threads, hardwareThreads))
 	{
-		fin >> vertices[i].Pos.x >> vertices[i].Pos.y >> vertices[i].Pos.z;
-		fin >> vertices[i].Normal.x >> vertices[i].Normal.y >> vertices[i].Normal.z;
+		ThreadPool pool(threads);
+
+		std::vector<float> access;
+		start = Benchmark::Now();
+		baker.Bake(pool, AOBakeSettings(), access);
+		double bakeTime = Benchmark::Now() - start;
+
+		if (threads == 1)
+		{
+			serial = access;
+			serialTime = bakeTime;
+		}
+
+		// The samples are seeded per triangle, so every thread count must
+		// produce the same bits.  The reference draws other samples; it
+		// should only agree on average.
+		UINT differing = 0;
+		double meanAccess = 0.0;
+		double meanReference = 0.0;
+		double meanError = 0.0;
+		for (UINT i = 0; i < access.size(); ++i)
+		{
+			if (access[i] != serial[i])
+			{
+				++differing;
+			}
+			meanAccess += access[i];
+			meanReference += reference[i];
+			meanError += fabs(access[i] - reference[i]);
+		}
+		meanAccess /= access.size();
+		meanReference /= access.size();
+		meanError /= access.size();
+
+		bool matchesReference = fabs(meanAccess - meanReference) <= maxMeanAccessDelta &&
+			meanError <= maxMeanDifference;
+
+		outs.str(L"");
+		outs << L"Ambient occlusion: " << threads << L" threads " << bakeTime * 1000.0 << L" ms" <<
+			L" (x" << serialTime / bakeTime << L" over 1 thread, x" << referenceTime / bakeTime << L" over the octree)" <<
+			L", " << differing << L" vertices differ from 1 thread" <<
+			L", mean access " << meanAccess << L" vs " << meanReference <<
+			L", mean |difference| " << meanError <<
+			(matchesReference ? L", within tolerance of the octree" : L", MISMATCH: outside tolerance of the octree");
+		Benchmark::Report(outs.str());
+
+		if (threads == hardwareThreads)
+		{
+			break;
+		}
 	}
 
-	fin >> ignore;
-	fin >> ignore;
-	fin >> ignore;
+	//
+	// Sampling: error of each mode against 1024 rays per triangle of the same
+	// kind, and the rays the adaptive rounds save.
+	//
+	ThreadPool pool;
+	AOBakeSettings skullSettings = GetSkullBakeSettings(pos);
+
+	AOBakeSettings referenceSettings;
+	referenceSettings.SampleCount = 1024;
+	referenceSettings.MaxDistance = skullSettings.MaxDistance;
+	referenceSettings.Seed = 0x5eed;
+
+	std::vector<float> uniformReference;
+	std::vector<float> cosineReference;
+	start = Benchmark::Now();
+	baker.Bake(pool, referenceSettings, uniformReference);
+	referenceSettings.Sampling = AOSamplingStratifiedCosine;
+	baker.Bake(pool, referenceSettings, cosineReference);
+	double sampledReferenceTime = Benchmark::Now() - start;
+
+	outs.str(L"");
+	outs << L"Ambient occlusion sampling: 1024-ray references " << sampledReferenceTime * 1000.0 << L" ms" <<
+		L", max distance " << skullSettings.MaxDistance;
+	Benchmark::Report(outs.str());
+
+	struct SamplingCase
+	{
+		const wchar_t* Name;
+		AOSampling Sampling;
+		UINT SampleCount;
+		float TargetError;
+	};
 
-	m_SkullIndexCount = 3 * tcount;
-	std::vector<UINT> indices(m_SkullIndexCount);
-	for (UINT i = 0; i < tcount; ++i)
+	const SamplingCase cases[] =
 	{
-		fin >> indices[i * 3 + 0] >> indices[i * 3 + 1] >> indices[i * 3 + 2];
-	}
+		{ L"uniform, 32 rays", AOSamplingUniform, 32, 0.0f },
+		{ L"stratified cosine, 32 rays", AOSamplingStratifiedCosine, 32, 0.0f },
+		{ L"uniform, adaptive up to 64 rays", AOSamplingUniform, 64, skullSettings.TargetError },
+		{ L"stratified cosine, adaptive up to 64 rays", AOSamplingStratifiedCosine, 64, skullSettings.TargetError },
+	};
 
-	fin.close();
+	for (UINT c = 0; c < ARRAYSIZE(cases); ++c)
+	{
+		AOBakeSettings settings = skullSettings;
+		settings.Sampling = cases[c].Sampling;
+		settings.SampleCount = cases[c].SampleCount;
+		settings.TargetError = cases[c].TargetError;
+
+		std::vector<float> access;
+		start = Benchmark::Now();
+		UINT64 rays = baker.Bake(pool, settings, access);
+		double bakeTime = Benchmark::Now() - start;
+
+		const std::vector<float>& expected = cases[c].Sampling == AOSamplingUniform ? uniformReference : cosineReference;
+		double meanError = 0.0;
+		double squaredError = 0.0;
+		for (UINT i = 0; i < access.size(); ++i)
+		{
+			double error = access[i] - expected[i];
+			meanError += fabs(error);
+			squaredError += error * error;
+		}
+		meanError /= access.size();
+
+		double raysPerTriangle = (double)rays / baker.TriangleCount();
+
+		outs.str(L"");
+		outs << L"Ambient occlusion sampling: " << cases[c].Name <<
+			L", " << bakeTime * 1000.0 << L" ms" <<
+			L", " << raysPerTriangle << L" rays/triangle (" <<
+			100.0 * (1.0 - raysPerTriangle / settings.SampleCount) << L"% saved)" <<
+			L", mean |error| " << meanError <<
+			L", rms error " << sqrt(squaredError / access.size());
+		Benchmark::Report(outs.str());
+	}
 
-	BuildVertexAmbientOcclusion(vertices, indices);
+	//
+	// Ray batches: the bake traces every round of a range of triangles as one
+	// batch.  Tracing the same rays one at a time must find the same hits, so
+	// the adaptive rounds stop after the same number of rays.
+	//
+	std::vector<float> batchedAccess;
+	start = Benchmark::Now();
+	UINT64 batchedRays = baker.Bake(pool, skullSettings, batchedAccess);
+	double batchedTime = Benchmark::Now() - start;
+
+	std::vector<float> singleAccess(baker.TriangleCount());
+	std::atomic<UINT64> singleRays(0);
+	start = Benchmark::Now();
+	pool.ParallelFor(baker.TriangleCount(), 64, [&](UINT begin, UINT end)
+	{
+		UINT64 rangeRays = 0;
+		for (UINT t = begin; t < end; ++t)
+		{
+			UINT rays = 0;
+			singleAccess[t] = baker.BakeTriangle(t, skullSettings, &rays);
+			rangeRays += rays;
+		}
+		singleRays += rangeRays;
+	});
+	double singleTime = Benchmark::Now() - start;
 
-	D3D11_BUFFER_DESC vbd;
-	vbd.Usage = D3D11_USAGE_IMMUTABLE;
-	vbd.ByteWidth = sizeof(Vertex::Basic32) * vcount;
-	vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	vbd.CPUAccessFlags = 0;
-	vbd.MiscFlags = 0;
-	D3D11_SUBRESOURCE_DATA vinitData;
-	vinitData.pSysMem = &vertices[0];
-	HR(d3d_device_->CreateBuffer(&vbd, &vinitData, &m_SkullVB));
+	outs.str(L"");
+	outs << L"Ambient occlusion ray batches: one at a time " << singleRays / singleTime / 1e6 << L" Mrays/s" <<
+		L", batched " << batchedRays / batchedTime / 1e6 << L" Mrays/s" <<
+		L", speedup " << singleTime / batchedTime <<
+		L", same rays " << (singleRays == batchedRays ? L"yes" : L"NO");
+	Benchmark::Report(outs.str());
 
 	//
-	// Pack the indices of all the meshes into one index buffer.
+	// Cache: a cold start bakes and writes the file, a warm one hashes the mesh
+	// and maps it.  Changing the settings or the mesh must miss.
 	//
+	const std::wstring cachePath = L"Benchmark.aocache";
+	UINT vcount = (UINT)pos.size();
 
-	D3D11_BUFFER_DESC ibd;
-	ibd.Usage = D3D11_USAGE_IMMUTABLE;
-	ibd.ByteWidth = sizeof(UINT) * m_SkullIndexCount;
-	ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	ibd.CPUAccessFlags = 0;
-	ibd.MiscFlags = 0;
-	D3D11_SUBRESOURCE_DATA iinitData;
-	iinitData.pSysMem = &indices[0];
-	HR(d3d_device_->CreateBuffer(&ibd, &iinitData, &m_SkullIB));
+	start = Benchmark::Now();
+	UINT64 key = AOBakeCache::ComputeKey(pos, indices, skullSettings);
+	std::vector<float> bakedAccess;
+	{
+		AOBaker coldBaker(pos, indices);
+		coldBaker.Bake(pool, skullSettings, bakedAccess);
+	}
+	bool written = AOBakeCache::Write(cachePath, key, bakedAccess);
+	double coldTime = Benchmark::Now() - start;
+
+	start = Benchmark::Now();
+	std::vector<float> cachedAccess(vcount);
+	AOBakeCache cache;
+	bool hit = cache.Open(cachePath, AOBakeCache::ComputeKey(pos, indices, skullSettings), vcount);
+	if (hit)
+	{
+		memcpy(&cachedAccess[0], cache.GetAccess(), vcount * sizeof(float));
+	}
+	cache.Close();
+	double warmTime = Benchmark::Now() - start;
+
+	AOBakeSettings otherSettings = skullSettings;
+	otherSettings.Seed += 1;
+	bool settingsMiss = !cache.Open(cachePath, AOBakeCache::ComputeKey(pos, indices, otherSettings), vcount);
+	cache.Close();
+
+	std::vector<XMFLOAT3> movedPos = pos;
+	movedPos[0].x += 0.001f;
+	bool meshMiss = !cache.Open(cachePath, AOBakeCache::ComputeKey(movedPos, indices, skullSettings), vcount);
+	cache.Close();
+
+	DeleteFileW(cachePath.c_str());
+
+	outs.str(L"");
+	outs << L"Ambient occlusion cache: cold start " << coldTime * 1000.0 << L" ms" <<
+		L", warm start " << warmTime * 1000.0 << L" ms" <<
+		L", written " << (written ? L"yes" : L"NO") <<
+		L", hit " << (hit && cachedAccess == bakedAccess ? L"yes" : L"NO") <<
+		L", settings change missed " << (settingsMiss ? L"yes" : L"NO") <<
+		L", mesh change missed " << (meshMiss ? L"yes" : L"NO");
+	Benchmark::Report(outs.str());
+}
+
+static void AppendShape(const GeometryGenerator::MeshData& mesh, CXMMATRIX world,
+	std::vector<XMFLOAT3>& positions, std::vector<UINT>& indices)
+{
+	UINT base = (UINT)positions.size();
+	for (UINT i = 0; i < mesh.Vertices.size(); ++i)
+	{
+		XMFLOAT3 p;
+		XMStoreFloat3(&p, XMVector3TransformCoord(XMLoadFloat3(&mesh.Vertices[i].Position), world));
+		positions.push_back(p);
+	}
+	for (UINT i = 0; i < mesh.Indices.size(); ++i)
+	{
+		indices.push_back(base + mesh.Indices[i]);
+	}
+}
+
+// Headless benchmark: bakes the shapes of the SSAO demo into a lightmap atlas
+// on one thread and on all of them, and writes the result next to the log.
+static void RunLightmapBenchmark()
+{
+	GeometryGenerator::MeshData box;
+	GeometryGenerator::MeshData grid;
+	GeometryGenerator::MeshData sphere;
+	GeometryGenerator::MeshData cylinder;
+
+	GeometryGenerator geoGen;
+	geoGen.CreateBox(1.0f, 1.0f, 1.0f, box);
+	geoGen.CreateGrid(20.0f, 30.0f, 50, 40, grid);
+	geoGen.CreateSphere(0.5f, 20, 20, sphere);
+	geoGen.CreateCylinder(0.5f, 0.5f, 3.0f, 15, 15, cylinder);
+
+	std::vector<XMFLOAT3> pos;
+	std::vector<UINT> indices;
+	AppendShape(grid, XMMatrixIdentity(), pos, indices);
+	AppendShape(box, XMMatrixScaling(3.0f, 1.0f, 3.0f) * XMMatrixTranslation(0.0f, 0.5f, 0.0f), pos, indices);
+	for (int i = 0; i < 5; ++i)
+	{
+		AppendShape(cylinder, XMMatrixTranslation(-5.0f, 1.5f, -10.0f + i*5.0f), pos, indices);
+		AppendShape(cylinder, XMMatrixTranslation(+5.0f, 1.5f, -10.0f + i*5.0f), pos, indices);
+		AppendShape(sphere, XMMatrixTranslation(-5.0f, 3.5f, -10.0f + i*5.0f), pos, indices);
+		AppendShape(sphere, XMMatrixTranslation(+5.0f, 3.5f, -10.0f + i*5.0f), pos, indices);
+	}
+
+	double start = Benchmark::Now();
+	LightmapBaker baker(pos, indices);
+	double setupTime = Benchmark::Now() - start;
+
+	LightmapSettings lightmapSettings;
+	LightmapAtlas atlas;
+	start = Benchmark::Now();
+	bool packed = baker.BuildAtlas(lightmapSettings, atlas);
+	double atlasTime = Benchmark::Now() - start;
+
+	std::wostringstream outs;
+	outs << L"Lightmap: " << indices.size() / 3 << L" triangles" <<
+		L", " << atlas.ChartCount << L" charts" <<
+		L", " << pos.size() << L" -> " << atlas.VertexSource.size() << L" vertices" <<
+		L", " << atlas.TexelsPerUnit << L" texels/unit" <<
+		L", baker setup " << setupTime * 1000.0 << L" ms" <<
+		L", atlas " << atlasTime * 1000.0 << L" ms";
+	Benchmark::Report(outs.str());
+
+	if (!packed)
+	{
+		Benchmark::Report(L"Lightmap: the charts do not fit the atlas.");
+		return;
+	}
+
+	AOBakeSettings settings;
+	settings.Sampling = AOSamplingStratifiedCosine;
+	settings.SampleCount = 64;
+	settings.TargetError = 0.03f;
+	settings.MaxDistance = 5.0f;
+
+	std::vector<float> serial;
+	double serialTime = 0.0;
+	UINT hardwareThreads = ThreadPool::HardwareThreadCount();
+	for (UINT threads = 1; ; threads = hardwareThreads)
+	{
+		ThreadPool pool(threads);
+
+		std::vector<float> texels;
+		UINT coveredCount = 0;
+		start = Benchmark::Now();
+		UINT64 rays = baker.Bake(pool, atlas, settings, texels, &coveredCount);
+		double bakeTime = Benchmark::Now() - start;
+
+		if (threads == 1)
+		{
+			serial = texels;
+			serialTime = bakeTime;
+		}
+
+		outs.str(L"");
+		outs << L"Lightmap: " << threads << L" threads" <<
+			L", " << atlas.Width << L"x" << atlas.Height <<
+			L", " << coveredCount << L" texels covered" <<
+			L", " << bakeTime * 1000.0 << L" ms" <<
+			L", speedup " << serialTime / bakeTime <<
+			L", " << rays / bakeTime / 1e6 << L" Mrays/s" <<
+			L", matches 1 thread " << (texels == serial ? L"yes" : L"NO");
+		Benchmark::Report(outs.str());
+
+		if (threads == hardwareThreads)
+		{
+			if (!LightmapBaker::SaveDDS(L"ShapesAmbientOcclusion.dds", atlas, texels))
+			{
+				Benchmark::Report(L"Lightmap: could not write ShapesAmbientOcclusion.dds.");
+			}
+			break;
+		}
+	}
 }
 
 int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPSTR lpCmdLine, _In_ int nShowCmd)
@@ -320,6 +762,13 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+	if (Benchmark::IsRequested(lpCmdLine))
+	{
+		RunAmbientOcclusionBenchmark();
+		RunLightmapBenchmark();
+		return 0;
+	}
+
 	AmbientOcclusionApp theApp(hInstance);
 
 	if (!theApp.Init())
@@ -0,0 +1,603 @@
+#include "LightmapBaker.h"
+#include "DDSWriter.h"
+#include "PackedConvert.h"
+
+namespace
+{
+	const UINT InvalidIndex = 0xffffffff;
+
+	// Texels per side of the tiles handed to the thread pool.
+	const UINT TileSize = 16;
+
+	// Texels whose center lies within half a texel diagonal of a triangle are
+	// baked from the closest point on it, so that filtering along the chart
+	// border reads baked values rather than dilated ones.
+	const float ConservativeDistance = 0.7072f;
+
+	struct ChartEdge
+	{
+		UINT64 Key;
+		UINT Triangle;
+
+		bool operator<(const ChartEdge& rhs) const
+		{
+			return Key < rhs.Key || (Key == rhs.Key && Triangle < rhs.Triangle);
+		}
+	};
+
+	struct ChartRect
+	{
+		XMFLOAT2 Min;
+		XMFLOAT2 Max;
+		UINT X;
+		UINT Y;
+	};
+
+	UINT64 EdgeKey(UINT a, UINT b)
+	{
+		return a < b ? (UINT64)a << 32 | b : (UINT64)b << 32 | a;
+	}
+
+	UINT TexelExtent(float size, float texelsPerUnit, UINT padding)
+	{
+		return (UINT)ceilf(size * texelsPerUnit) + 1 + 2 * padding;
+	}
+
+	// Places the charts in rows, tallest first.  Returns false if they do not
+	// fit at this scale.
+	bool PackCharts(std::vector<ChartRect>& rects, const std::vector<UINT>& order, float texelsPerUnit,
+		const LightmapSettings& settings)
+	{
+		UINT x = 0;
+		UINT y = 0;
+		UINT rowHeight = 0;
+		for (UINT i = 0; i < order.size(); ++i)
+		{
+			ChartRect& rect = rects[order[i]];
+			UINT w = TexelExtent(rect.Max.x - rect.Min.x, texelsPerUnit, settings.Padding);
+			UINT h = TexelExtent(rect.Max.y - rect.Min.y, texelsPerUnit, settings.Padding);
+
+			if (x + w > settings.Width)
+			{
+				x = 0;
+				y += rowHeight;
+				rowHeight = 0;
+			}
+			if (w > settings.Width || y + h > settings.Height)
+			{
+				return false;
+			}
+
+			rect.X = x;
+			rect.Y = y;
+			x += w;
+			rowHeight = MathHelper::Max(rowHeight, h);
+		}
+		return true;
+	}
+}
+
+LightmapBaker::LightmapBaker(const std::vector<XMFLOAT3>& positions, const std::vector<UINT>& indices)
+	: m_Positions(positions)
+	, m_Indices(indices)
+	, m_AOBaker(positions, indices)
+{
+
+}
+
+UINT LightmapBaker::BuildCharts(float chartAngle, std::vector<UINT>& triangleCharts,
+	std::vector<XMFLOAT3>& chartNormals) const
+{
+	UINT vcount = (UINT)m_Positions.size();
+	UINT tcount = (UINT)m_Indices.size() / 3;
+
+	// Weld the vertices by position; the shapes split them wherever the
+	// normal or texture coordinates change, which would cut every chart
+	// along those seams.
+	std::vector<UINT> sorted(vcount);
+	for (UINT i = 0; i < vcount; ++i)
+	{
+		sorted[i] = i;
+	}
+	std::sort(sorted.begin(), sorted.end(), [this](UINT a, UINT b)
+	{
+		const XMFLOAT3& pa = m_Positions[a];
+		const XMFLOAT3& pb = m_Positions[b];
+		if (pa.x != pb.x) return pa.x < pb.x;
+		if (pa.y != pb.y) return pa.y < pb.y;
+		if (pa.z != pb.z) return pa.z < pb.z;
+		return a < b;
+	});
+
+	std::vector<UINT> welded(vcount);
+	for (UINT i = 0; i < vcount; ++i)
+	{
+		const XMFLOAT3& p = m_Positions[sorted[i]];
+		const XMFLOAT3* prev = i > 0 ? &m_Positions[sorted[i - 1]] : nullptr;
+		bool same = prev && prev->x == p.x && prev->y == p.y && prev->z == p.z;
+		welded[sorted[i]] = same ? welded[sorted[i - 1]] : sorted[i];
+	}
+
+	// Triangles sharing a welded edge are neighbours.
+	std::vector<ChartEdge> edges(3 * tcount);
+	for (UINT t = 0; t < tcount; ++t)
+	{
+		for (UINT k = 0; k < 3; ++k)
+		{
+			edges[3 * t + k].Key = EdgeKey(welded[m_Indices[3 * t + k]], welded[m_Indices[3 * t + (k + 1) % 3]]);
+			edges[3 * t + k].Triangle = t;
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	std::vector<XMFLOAT3> normals(tcount);
+	std::vector<float> areas(tcount);
+	std::vector<UINT> order(tcount);
+	for (UINT t = 0; t < tcount; ++t)
+	{
+		XMVECTOR v0 = XMLoadFloat3(&m_Positions[m_Indices[3 * t + 0]]);
+		XMVECTOR v1 = XMLoadFloat3(&m_Positions[m_Indices[3 * t + 1]]);
+		XMVECTOR v2 = XMLoadFloat3(&m_Positions[m_Indices[3 * t + 2]]);
+
+		XMVECTOR n = XMVector3Cross(v1 - v0, v2 - v0);
+		areas[t] = XMVectorGetX(XMVector3Length(n));
+
+		// Degenerate triangles cover no texels; any chart will do.
+		XMStoreFloat3(&normals[t], areas[t] > 0.0f ? n / areas[t] : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		order[t] = t;
+	}
+
+	// Seed the charts with the largest triangles left, so that the small ones
+	// join a chart rather than start their own.
+	std::stable_sort(order.begin(), order.end(), [&areas](UINT a, UINT b) { return areas[a] > areas[b]; });
+
+	float minCos = cosf(chartAngle);
+	triangleCharts.assign(tcount, InvalidIndex);
+	chartNormals.clear();
+
+	std::vector<UINT> stack;
+	for (UINT i = 0; i < tcount; ++i)
+	{
+		UINT seed = order[i];
+		if (triangleCharts[seed] != InvalidIndex)
+		{
+			continue;
+		}
+
+		UINT chart = (UINT)chartNormals.size();
+		XMVECTOR chartNormal = XMLoadFloat3(&normals[seed]);
+		chartNormals.push_back(normals[seed]);
+
+		triangleCharts[seed] = chart;
+		stack.push_back(seed);
+		while (!stack.empty())
+		{
+			UINT t = stack.back();
+			stack.pop_back();
+
+			for (UINT k = 0; k < 3; ++k)
+			{
+				ChartEdge edge;
+				edge.Key = EdgeKey(welded[m_Indices[3 * t + k]], welded[m_Indices[3 * t + (k + 1) % 3]]);
+				edge.Triangle = 0;
+
+				for (auto it = std::lower_bound(edges.begin(), edges.end(), edge); it != edges.end() && it->Key == edge.Key; ++it)
+				{
+					UINT n = it->Triangle;
+					if (triangleCharts[n] != InvalidIndex)
+					{
+						continue;
+					}
+
+					if (XMVectorGetX(XMVector3Dot(chartNormal, XMLoadFloat3(&normals[n]))) >= minCos)
+					{
+						triangleCharts[n] = chart;
+						stack.push_back(n);
+					}
+				}
+			}
+		}
+	}
+
+	return (UINT)chartNormals.size();
+}
+
+bool LightmapBaker::BuildAtlas(const LightmapSettings& settings, LightmapAtlas& atlas) const
+{
+	UINT vcount = (UINT)m_Positions.size();
+	UINT tcount = (UINT)m_Indices.size() / 3;
+
+	std::vector<UINT> triangleCharts;
+	std::vector<XMFLOAT3> chartNormals;
+	UINT chartCount = BuildCharts(settings.ChartAngle, triangleCharts, chartNormals);
+
+	atlas.Width = settings.Width;
+	atlas.Height = settings.Height;
+	atlas.Padding = settings.Padding;
+	atlas.ChartCount = chartCount;
+	atlas.VertexSource.clear();
+	atlas.VertexUV.clear();
+	atlas.Indices.resize(3 * tcount);
+
+	// Project every chart along its normal.  A vertex gets one atlas vertex in
+	// every chart that uses it; the coordinates stay in world units until the
+	// charts are packed.
+	std::vector<ChartRect> rects(chartCount);
+	for (UINT c = 0; c < chartCount; ++c)
+	{
+		rects[c].Min = XMFLOAT2(MathHelper::Infinity, MathHelper::Infinity);
+		rects[c].Max = XMFLOAT2(-MathHelper::Infinity, -MathHelper::Infinity);
+	}
+
+	// Visit the triangles chart by chart.
+	std::vector<UINT> chartFirst(chartCount + 1, 0);
+	for (UINT t = 0; t < tcount; ++t)
+	{
+		++chartFirst[triangleCharts[t] + 1];
+	}
+	for (UINT c = 0; c < chartCount; ++c)
+	{
+		chartFirst[c + 1] += chartFirst[c];
+	}
+	std::vector<UINT> chartTriangles(tcount);
+	std::vector<UINT> next(chartFirst.begin(), chartFirst.end() - 1);
+	for (UINT t = 0; t < tcount; ++t)
+	{
+		chartTriangles[next[triangleCharts[t]]++] = t;
+	}
+
+	std::vector<UINT> atlasVertexChart;
+	std::vector<UINT> vertexChart(vcount, InvalidIndex);
+	std::vector<UINT> vertexAtlas(vcount);
+	for (UINT i = 0; i < tcount; ++i)
+	{
+		UINT t = chartTriangles[i];
+		UINT c = triangleCharts[t];
+
+		XMVECTOR n = XMLoadFloat3(&chartNormals[c]);
+		XMVECTOR up = fabsf(chartNormals[c].y) < 0.99f ? XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f) : XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f);
+		XMVECTOR tangent = XMVector3Normalize(XMVector3Cross(up, n));
+		XMVECTOR bitangent = XMVector3Cross(n, tangent);
+
+		for (UINT k = 0; k < 3; ++k)
+		{
+			UINT v = m_Indices[3 * t + k];
+
+			UINT atlasVertex;
+			if (vertexChart[v] == c)
+			{
+				atlasVertex = vertexAtlas[v];
+			}
+			else
+			{
+				XMVECTOR p = XMLoadFloat3(&m_Positions[v]);
+				XMFLOAT2 uv(XMVectorGetX(XMVector3Dot(p, tangent)), XMVectorGetX(XMVector3Dot(p, bitangent)));
+
+				atlasVertex = (UINT)atlas.VertexSource.size();
+				atlas.VertexSource.push_back(v);
+				atlas.VertexUV.push_back(uv);
+				atlasVertexChart.push_back(c);
+				vertexChart[v] = c;
+				vertexAtlas[v] = atlasVertex;
+
+				rects[c].Min.x = MathHelper::Min(rects[c].Min.x, uv.x);
+				rects[c].Min.y = MathHelper::Min(rects[c].Min.y, uv.y);
+				rects[c].Max.x = MathHelper::Max(rects[c].Max.x, uv.x);
+				rects[c].Max.y = MathHelper::Max(rects[c].Max.y, uv.y);
+			}
+
+			atlas.Indices[3 * t + k] = atlasVertex;
+		}
+	}
+
+	// Find the largest scale at which the charts fit.  Their total area
+	// bounds it from above; shrink from there and then bisect.
+	std::vector<UINT> order(chartCount);
+	float totalArea = 0.0f;
+	for (UINT c = 0; c < chartCount; ++c)
+	{
+		order[c] = c;
+		totalArea += (rects[c].Max.x - rects[c].Min.x) * (rects[c].Max.y - rects[c].Min.y);
+	}
+	std::stable_sort(order.begin(), order.end(), [&rects](UINT a, UINT b)
+	{
+		return rects[a].Max.y - rects[a].Min.y > rects[b].Max.y - rects[b].Min.y;
+	});
+
+	float hi = sqrtf(settings.Width * settings.Height / MathHelper::Max(totalArea, 1e-6f));
+	float lo = hi;
+	while (lo > 1e-6f && !PackCharts(rects, order, lo, settings))
+	{
+		hi = lo;
+		lo *= 0.8f;
+	}
+	if (lo != hi)
+	{
+		for (UINT i = 0; i < 10; ++i)
+		{
+			float mid = 0.5f * (lo + hi);
+			if (PackCharts(rects, order, mid, settings))
+			{
+				lo = mid;
+			}
+			else
+			{
+				hi = mid;
+			}
+		}
+	}
+
+	atlas.TexelsPerUnit = lo;
+	if (!PackCharts(rects, order, lo, settings))
+	{
+		return false;
+	}
+
+	// Texel centers sit at half integers, so the chart starts half a texel in.
+	for (UINT i = 0; i < atlas.VertexUV.size(); ++i)
+	{
+		const ChartRect& rect = rects[atlasVertexChart[i]];
+		XMFLOAT2& uv = atlas.VertexUV[i];
+		uv.x = (rect.X + settings.Padding + 0.5f + (uv.x - rect.Min.x) * lo) / settings.Width;
+		uv.y = (rect.Y + settings.Padding + 0.5f + (uv.y - rect.Min.y) * lo) / settings.Height;
+	}
+
+	return true;
+}
+
+UINT64 LightmapBaker::Bake(ThreadPool& pool, const LightmapAtlas& atlas, const AOBakeSettings& settings,
+	std::vector<float>& texels, UINT* pCoveredCount) const
+{
+	UINT width = atlas.Width;
+	UINT height = atlas.Height;
+	UINT tcount = (UINT)atlas.Indices.size() / 3;
+
+	UINT tilesX = (width + TileSize - 1) / TileSize;
+	UINT tilesY = (height + TileSize - 1) / TileSize;
+	UINT tileCount = tilesX * tilesY;
+
+	// Bin the triangles by the tiles their texel bounds overlap, counting
+	// first so the lists can share one array.
+	std::vector<UINT> tileFirst(tileCount + 1, 0);
+	std::vector<XMINT4> triangleTiles(tcount);
+	for (UINT t = 0; t < tcount; ++t)
+	{
+		float minX = MathHelper::Infinity, minY = MathHelper::Infinity;
+		float maxX = -MathHelper::Infinity, maxY = -MathHelper::Infinity;
+		for (UINT k = 0; k < 3; ++k)
+		{
+			const XMFLOAT2& uv = atlas.VertexUV[atlas.Indices[3 * t + k]];
+			minX = MathHelper::Min(minX, uv.x * width);
+			minY = MathHelper::Min(minY, uv.y * height);
+			maxX = MathHelper::Max(maxX, uv.x * width);
+			maxY = MathHelper::Max(maxY, uv.y * height);
+		}
+
+		XMINT4& tiles = triangleTiles[t];
+		tiles.x = MathHelper::Clamp((int)((minX - 1.0f) / TileSize), 0, (int)tilesX - 1);
+		tiles.y = MathHelper::Clamp((int)((minY - 1.0f) / TileSize), 0, (int)tilesY - 1);
+		tiles.z = MathHelper::Clamp((int)((maxX + 1.0f) / TileSize), 0, (int)tilesX - 1);
+		tiles.w = MathHelper::Clamp((int)((maxY + 1.0f) / TileSize), 0, (int)tilesY - 1);
+
+		for (int y = tiles.y; y <= tiles.w; ++y)
+		{
+			for (int x = tiles.x; x <= tiles.z; ++x)
+			{
+				++tileFirst[y * tilesX + x + 1];
+			}
+		}
+	}
+	for (UINT i = 0; i < tileCount; ++i)
+	{
+		tileFirst[i + 1] += tileFirst[i];
+	}
+
+	std::vector<UINT> tileTriangles(tileFirst[tileCount]);
+	std::vector<UINT> next(tileFirst.begin(), tileFirst.end() - 1);
+	for (UINT t = 0; t < tcount; ++t)
+	{
+		const XMINT4& tiles = triangleTiles[t];
+		for (int y = tiles.y; y <= tiles.w; ++y)
+		{
+			for (int x = tiles.x; x <= tiles.z; ++x)
+			{
+				tileTriangles[next[y * tilesX + x]++] = t;
+			}
+		}
+	}
+
+	texels.assign(width * height, 1.0f);
+	std::vector<BYTE> covered(width * height, 0);
+	std::atomic<UINT64> rayCount(0);
+
+	pool.ParallelFor(tileCount, 1, [&](UINT begin, UINT end)
+	{
+		std::vector<XMFLOAT3> positions;
+		std::vector<XMFLOAT3> normals;
+		std::vector<UINT> texelIndices;
+		std::vector<float> access;
+		std::vector<UINT> rays;
+
+		UINT64 rangeRays = 0;
+		for (UINT tile = begin; tile < end; ++tile)
+		{
+			positions.clear();
+			normals.clear();
+			texelIndices.clear();
+
+			UINT x0 = (tile % tilesX) * TileSize;
+			UINT y0 = (tile / tilesX) * TileSize;
+			UINT x1 = MathHelper::Min(x0 + TileSize, width);
+			UINT y1 = MathHelper::Min(y0 + TileSize, height);
+
+			for (UINT y = y0; y < y1; ++y)
+			{
+				for (UINT x = x0; x < x1; ++x)
+				{
+					XMFLOAT2 p(x + 0.5f, y + 0.5f);
+
+					// Keep the triangle whose border is farthest inside, or
+					// least far outside, of the texel center.
+					UINT bestTriangle = InvalidIndex;
+					float bestDistance = -ConservativeDistance;
+					float bestBary[3] = { 0.0f, 0.0f, 0.0f };
+
+					for (UINT i = tileFirst[tile]; i < tileFirst[tile + 1]; ++i)
+					{
+						UINT t = tileTriangles[i];
+
+						XMFLOAT2 v[3];
+						for (UINT k = 0; k < 3; ++k)
+						{
+							const XMFLOAT2& uv = atlas.VertexUV[atlas.Indices[3 * t + k]];
+							v[k] = XMFLOAT2(uv.x * width, uv.y * height);
+						}
+
+						float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+						if (area == 0.0f)
+						{
+							continue;
+						}
+
+						// Barycentric weight k times the distance from vertex k
+						// to the opposite edge is the distance of p to that edge.
+						float bary[3];
+						float distance = MathHelper::Infinity;
+						for (UINT k = 0; k < 3; ++k)
+						{
+							const XMFLOAT2& a = v[(k + 1) % 3];
+							const XMFLOAT2& b = v[(k + 2) % 3];
+							bary[k] = ((b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x)) / area;
+
+							float edgeLength = sqrtf((b.x - a.x) * (b.x - a.x) + (b.y - a.y) * (b.y - a.y));
+							distance = MathHelper::Min(distance, bary[k] * fabsf(area) / edgeLength);
+						}
+
+						if (distance > bestDistance)
+						{
+							bestDistance = distance;
+							bestTriangle = t;
+							bestBary[0] = bary[0];
+							bestBary[1] = bary[1];
+							bestBary[2] = bary[2];
+						}
+					}
+
+					if (bestTriangle == InvalidIndex)
+					{
+						continue;
+					}
+
+					// Clamp texels just outside onto the triangle.
+					float sum = 0.0f;
+					for (UINT k = 0; k < 3; ++k)
+					{
+						bestBary[k] = MathHelper::Max(bestBary[k], 0.0f);
+						sum += bestBary[k];
+					}
+
+					XMVECTOR v0 = XMLoadFloat3(&m_Positions[m_Indices[3 * bestTriangle + 0]]);
+					XMVECTOR v1 = XMLoadFloat3(&m_Positions[m_Indices[3 * bestTriangle + 1]]);
+					XMVECTOR v2 = XMLoadFloat3(&m_Positions[m_Indices[3 * bestTriangle + 2]]);
+
+					XMFLOAT3 position;
+					XMFLOAT3 normal;
+					XMStoreFloat3(&position, (bestBary[0] * v0 + bestBary[1] * v1 + bestBary[2] * v2) / sum);
+					XMStoreFloat3(&normal, XMVector3Normalize(XMVector3Cross(v1 - v0, v2 - v0)));
+
+					positions.push_back(position);
+					normals.push_back(normal);
+					texelIndices.push_back(y * width + x);
+				}
+			}
+
+			// Trace the whole tile as one batch, seeded by texel index.
+			UINT count = (UINT)texelIndices.size();
+			if (count == 0)
+			{
+				continue;
+			}
+
+			access.resize(count);
+			rays.resize(count);
+			m_AOBaker.BakePoints(&positions[0], &normals[0], &texelIndices[0], count, settings, &access[0], &rays[0]);
+
+			for (UINT i = 0; i < count; ++i)
+			{
+				texels[texelIndices[i]] = access[i];
+				covered[texelIndices[i]] = 1;
+				rangeRays += rays[i];
+			}
+		}
+		rayCount += rangeRays;
+	});
+
+	if (pCoveredCount)
+	{
+		*pCoveredCount = 0;
+		for (UINT i = 0; i < covered.size(); ++i)
+		{
+			*pCoveredCount += covered[i];
+		}
+	}
+
+	// Grow the charts into the padding so that filtering and mipmapping at
+	// their borders do not fade to the empty texels.
+	std::vector<float> dilated;
+	std::vector<BYTE> dilatedCovered;
+	for (UINT pass = 0; pass < atlas.Padding; ++pass)
+	{
+		dilated = texels;
+		dilatedCovered = covered;
+
+		pool.ParallelFor(height, TileSize, [&](UINT begin, UINT end)
+		{
+			for (UINT y = begin; y < end; ++y)
+			{
+				for (UINT x = 0; x < width; ++x)
+				{
+					if (covered[y * width + x])
+					{
+						continue;
+					}
+
+					float sum = 0.0f;
+					UINT count = 0;
+					for (int dy = -1; dy <= 1; ++dy)
+					{
+						for (int dx = -1; dx <= 1; ++dx)
+						{
+							int nx = (int)x + dx;
+							int ny = (int)y + dy;
+							if (nx < 0 || ny < 0 || nx >= (int)width || ny >= (int)height || !covered[ny * width + nx])
+							{
+								continue;
+							}
+							sum += texels[ny * width + nx];
+							++count;
+						}
+					}
+
+					if (count > 0)
+					{
+						dilated[y * width + x] = sum / count;
+						dilatedCovered[y * width + x] = 1;
+					}
+				}
+			}
+		});
+
+		texels.swap(dilated);
+		covered.swap(dilatedCovered);
+	}
+
+	return rayCount;
+}
+
+bool LightmapBaker::SaveDDS(const std::wstring& path, const LightmapAtlas& atlas, const std::vector<float>& texels)
+{
+	std::vector<BYTE> pixels(texels.size());
+	PackedConvert::FloatToUnorm8(&texels[0], &pixels[0], (UINT)texels.size());
+
+	return DDSWriter::SaveTexture2D(path, atlas.Width, atlas.Height, DXGI_FORMAT_R8_UNORM, &pixels[0], atlas.Width);
+}
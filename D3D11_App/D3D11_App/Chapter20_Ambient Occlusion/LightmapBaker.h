@@ -0,0 +1,82 @@
+#pragma once
+
+#include "AOBaker.h"
+
+struct LightmapSettings
+{
+	// Size of the atlas in texels.
+	UINT Width;
+	UINT Height;
+
+	// Empty texels kept around every chart, so that bilinear filtering and
+	// the dilated border of one chart never reach into another.
+	UINT Padding;
+
+	// A triangle joins a chart while its normal stays within this angle, in
+	// radians, of the normal the chart is projected along.
+	float ChartAngle;
+
+	LightmapSettings()
+		: Width(512)
+		, Height(512)
+		, Padding(2)
+		, ChartAngle(0.25f * MathHelper::Pi)
+	{
+
+	}
+};
+
+// Mesh with lightmap coordinates.  Vertices on the border between two charts
+// are split, so the atlas has its own vertices and indices; the triangles keep
+// the order they had in the source mesh.
+struct LightmapAtlas
+{
+	UINT Width;
+	UINT Height;
+	UINT Padding;
+	UINT ChartCount;
+
+	// Scale from world units to texels shared by all charts.
+	float TexelsPerUnit;
+
+	// Source vertex every atlas vertex was split from, and its lightmap
+	// coordinates in [0, 1].
+	std::vector<UINT> VertexSource;
+	std::vector<XMFLOAT2> VertexUV;
+
+	std::vector<UINT> Indices;
+};
+
+// Bakes ambient access into a texture instead of the vertices.  Triangles are
+// grouped into charts of similar orientation, each chart is projected along
+// its normal and the charts are packed into an atlas at a common scale.  The
+// texels are then rasterized on the CPU and traced in tiles on a thread pool.
+class LightmapBaker
+{
+public:
+	LightmapBaker(const std::vector<XMFLOAT3>& positions, const std::vector<UINT>& indices);
+
+	/// Splits the mesh into charts and packs them into the atlas at the
+	/// largest scale that fits.  Returns false if there are too many charts
+	/// for the atlas to hold them with their padding.
+	bool BuildAtlas(const LightmapSettings& settings, LightmapAtlas& atlas) const;
+
+	/// Fills texels, row by row, with the ambient access of every texel the
+	/// atlas covers, and counts those texels in pCoveredCount.  Texels next
+	/// to a chart take the average of their covered neighbours, the rest are
+	/// left at 1.  Returns the number of rays traced.
+	UINT64 Bake(ThreadPool& pool, const LightmapAtlas& atlas, const AOBakeSettings& settings,
+		std::vector<float>& texels, UINT* pCoveredCount = nullptr) const;
+
+	// Writes the texels as an R8_UNORM texture.
+	static bool SaveDDS(const std::wstring& path, const LightmapAtlas& atlas, const std::vector<float>& texels);
+
+private:
+	// Groups the triangles into charts; returns the chart of every triangle.
+	UINT BuildCharts(float chartAngle, std::vector<UINT>& triangleCharts, std::vector<XMFLOAT3>& chartNormals) const;
+
+private:
+	std::vector<XMFLOAT3> m_Positions;
+	std::vector<UINT> m_Indices;
+	AOBaker m_AOBaker;
+};
@@ -6,12 +6,40 @@
 #include "Effects.h"
 
 Sky::Sky(ID3D11Device* device, const std::wstring& cubemapFilename, float skySphereRadius)
+	: m_TextureLoader(nullptr)
+	, m_CubeMap(0)
 {
 	ID3D11Resource* tex_res = nullptr;
 	HR(DirectX::CreateDDSTextureFromFile(device,
 		cubemapFilename.c_str(), &tex_res, &m_CubeMapSRV));
 	ReleaseCOM(tex_res);
 
+	BuildSphere(device, skySphereRadius);
+}
+
+Sky::Sky(ID3D11Device* device, TextureLoader& loader, const std::wstring& cubemapFilename, float skySphereRadius)
+	: m_CubeMapSRV(nullptr)
+	, m_TextureLoader(&loader)
+{
+	m_CubeMap = loader.Load(cubemapFilename, TextureLoader::PlaceholderCube);
+
+	BuildSphere(device, skySphereRadius);
+}
+
+Sky::~Sky()
+{
+	ReleaseCOM(m_SkyVB);
+	ReleaseCOM(m_SkyIB);
+	ReleaseCOM(m_CubeMapSRV);
+}
+
+ID3D11ShaderResourceView* Sky::GetCubeMapSRV()
+{
+	return m_TextureLoader ? m_TextureLoader->GetView(m_CubeMap) : m_CubeMapSRV;
+}
+
+void Sky::BuildSphere(ID3D11Device* device, float skySphereRadius)
+{
 	GeometryGenerator::MeshData sphere;
 	GeometryGenerator geoGen;
 	geoGen.CreateSphere(skySphereRadius, 30, 30, sphere);
@@ -50,18 +78,6 @@ Sky::Sky(ID3D11Device* device, const std::wstring& cubemapFilename, float skySph
 	HR(device->CreateBuffer(&ibd, &iData, &m_SkyIB));
 }
 
-Sky::~Sky()
-{
-	ReleaseCOM(m_SkyVB);
-	ReleaseCOM(m_SkyIB);
-	ReleaseCOM(m_CubeMapSRV);
-}
-
-ID3D11ShaderResourceView* Sky::GetCubeMapSRV()
-{
-	return m_CubeMapSRV;
-}
-
 void Sky::Draw(ID3D11DeviceContext* dc, const Camera& camera)
 {
 	XMFLOAT3 eyePos = camera.GetPosition();
@@ -69,7 +85,7 @@ void Sky::Draw(ID3D11DeviceContext* dc, const Camera& camera)
 	XMMATRIX WVP = W * camera.ViewProj();
 
 	Effects::SkyFX->SetWorldViewProj(WVP);
-	Effects::SkyFX->SetCubeMap(m_CubeMapSRV);
+	Effects::SkyFX->SetCubeMap(GetCubeMapSRV());
 
 	UINT stride = sizeof(XMFLOAT3);
 	UINT offset = 0;
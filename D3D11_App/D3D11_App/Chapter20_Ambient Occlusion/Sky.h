@@ -1,5 +1,6 @@
 #pragma once
 #include "d3dUtil.h"
+#include "TextureLoader.h"
 
 class Camera;
 
@@ -7,6 +8,10 @@ class Sky
 {
 public:
 	Sky(ID3D11Device* device, const std::wstring& cubemapFilename, float skySphereRadius);
+
+	// Leaves the cube map to the loader, which shows a placeholder until
+	// the file is loaded.
+	Sky(ID3D11Device* device, TextureLoader& loader, const std::wstring& cubemapFilename, float skySphereRadius);
 	~Sky();
 
 	ID3D11ShaderResourceView* GetCubeMapSRV();
@@ -17,11 +22,15 @@ private:
 	Sky(const Sky&);
 	Sky& operator=(const Sky&);
 
+	void BuildSphere(ID3D11Device* device, float skySphereRadius);
+
 private:
 	ID3D11Buffer* m_SkyVB;
 	ID3D11Buffer* m_SkyIB;
 
 	ID3D11ShaderResourceView* m_CubeMapSRV;
+	TextureLoader* m_TextureLoader;
+	TextureLoader::Handle m_CubeMap;
 
 	UINT m_IndexCount;
 };
\ No newline at end of file
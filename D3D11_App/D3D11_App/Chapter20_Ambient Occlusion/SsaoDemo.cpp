@@ -11,6 +11,9 @@
 #include "ShadowMap.h"
 #include "Ssao.h"
 #include "Camera.h"
+#include "TextureLoader.h"
+#include "TextureBenchmarks.h"
+#include "Benchmark.h"
 
 enum RenderOptions
 {
@@ -60,6 +63,16 @@ private:
 	ID3D11Buffer* m_ScreenQuadVB;
 	ID3D11Buffer* m_ScreenQuadIB;
 
+	// Loaded in the background; the views below are the placeholders until
+	// each texture is ready, and are refreshed every frame.
+	TextureLoader m_TextureLoader;
+	TextureLoader::Handle m_FloorTex;
+	TextureLoader::Handle m_StoneTex;
+	TextureLoader::Handle m_BrickTex;
+	TextureLoader::Handle m_FloorNormalTex;
+	TextureLoader::Handle m_StoneNormalTex;
+	TextureLoader::Handle m_BrickNormalTex;
+
 	ID3D11ShaderResourceView* m_FloorTexSRV;
 	ID3D11ShaderResourceView* m_StoneTexSRV;
 	ID3D11ShaderResourceView* m_BrickTexSRV;
@@ -71,6 +84,10 @@ private:
 	BoundingSphere m_SceneBounds;
 
 	static const int SHADOW_MAP_SIZE = 2048;
+
+	// Seconds per frame spent creating loaded textures.
+	static const float TextureBudget;
+
 	ShadowMap* m_ShadowMap;
 	XMFLOAT4X4 m_LightView;
 	XMFLOAT4X4 m_LightProj;
@@ -122,6 +139,8 @@ private:
 	POINT m_LastMousePos;
 };
 
+const float SsaoApp::TextureBudget = 0.002f;
+
 SsaoApp::SsaoApp(HINSTANCE hInstance)
 	: D3DApp(hInstance)
 	, m_ShapesVB(nullptr)
@@ -130,6 +149,12 @@ SsaoApp::SsaoApp(HINSTANCE hInstance)
 	, m_SkullIB(nullptr)
 	, m_ScreenQuadVB(nullptr)
 	, m_ScreenQuadIB(nullptr)
+	, m_FloorTex(0)
+	, m_StoneTex(0)
+	, m_BrickTex(0)
+	, m_FloorNormalTex(0)
+	, m_StoneNormalTex(0)
+	, m_BrickNormalTex(0)
 	, m_FloorTexSRV(nullptr)
 	, m_StoneTexSRV(nullptr)
 	, m_BrickTexSRV(nullptr)
@@ -223,17 +248,12 @@ SsaoApp::~SsaoApp()
 	ReleaseCOM(m_ShapesIB);
 	ReleaseCOM(m_SkullVB);
 	ReleaseCOM(m_SkullIB);
-	ReleaseCOM(m_FloorTexSRV);
-	ReleaseCOM(m_StoneTexSRV);
-	ReleaseCOM(m_BrickTexSRV);
-	ReleaseCOM(m_FloorNormalTexSRV);
-	ReleaseCOM(m_StoneNormalTexSRV);
-	ReleaseCOM(m_BrickNormalTexSRV);
 
 	for (int i = 0; i < 3; ++i)
 	{
 		SafeDelete(m_Skys[i]);
 	}
+	m_TextureLoader.Shutdown();
 
 	SafeDelete(m_ShadowMap);
 	SafeDelete(m_Ssao);
@@ -254,38 +274,25 @@ bool SsaoApp::Init()
 	InputLayouts::InitAll(d3d_device_);
 	RenderStates::InitAll(d3d_device_);
 
-	ID3D11Resource* texRes = nullptr;
-	HR(DirectX::CreateDDSTextureFromFile(d3d_device_,
-		L"Textures/floor.dds", &texRes, &m_FloorTexSRV));
-	ReleaseCOM(texRes);
-
-	HR(DirectX::CreateDDSTextureFromFile(d3d_device_,
-		L"Textures/stone.dds", &texRes, &m_StoneTexSRV));
-	ReleaseCOM(texRes);
-
-	HR(DirectX::CreateDDSTextureFromFile(d3d_device_,
-		L"Textures/bricks.dds", &texRes, &m_BrickTexSRV));
-	ReleaseCOM(texRes);
-
-	HR(DirectX::CreateDDSTextureFromFile(d3d_device_,
-		L"Textures/floor_nmap.dds", &texRes, &m_FloorNormalTexSRV));
-	ReleaseCOM(texRes);
-
-	HR(DirectX::CreateDDSTextureFromFile(d3d_device_,
-		L"Textures/stones_nmap.dds", &texRes, &m_StoneNormalTexSRV));
-	ReleaseCOM(texRes);
+	if (!m_TextureLoader.Init(d3d_device_))
+	{
+		return false;
+	}
 
-	HR(DirectX::CreateDDSTextureFromFile(d3d_device_,
-		L"Textures/bricks_nmap.dds", &texRes, &m_BrickNormalTexSRV));
-	ReleaseCOM(texRes);
+	m_FloorTex = m_TextureLoader.Load(L"Textures/floor.dds");
+	m_StoneTex = m_TextureLoader.Load(L"Textures/stone.dds");
+	m_BrickTex = m_TextureLoader.Load(L"Textures/bricks.dds");
+	m_FloorNormalTex = m_TextureLoader.Load(L"Textures/floor_nmap.dds", TextureLoader::PlaceholderNormal);
+	m_StoneNormalTex = m_TextureLoader.Load(L"Textures/stones_nmap.dds", TextureLoader::PlaceholderNormal);
+	m_BrickNormalTex = m_TextureLoader.Load(L"Textures/bricks_nmap.dds", TextureLoader::PlaceholderNormal);
 
 	BuildShapeGeometryBuffers();
 	BuildSkullGeometryBuffers();
 	BuildScreenQuadGeometryBuffers();
 
-	m_Skys[0] = new Sky(d3d_device_, L"Textures/grasscube1024.dds", 5000.f);
-	m_Skys[1] = new Sky(d3d_device_, L"Textures/snowcube1024.dds", 5000.f);
-	m_Skys[2] = new Sky(d3d_device_, L"Textures/sunsetcube1024.dds", 5000.f);
+	m_Skys[0] = new Sky(d3d_device_, m_TextureLoader, L"Textures/grasscube1024.dds", 5000.f);
+	m_Skys[1] = new Sky(d3d_device_, m_TextureLoader, L"Textures/snowcube1024.dds", 5000.f);
+	m_Skys[2] = new Sky(d3d_device_, m_TextureLoader, L"Textures/sunsetcube1024.dds", 5000.f);
 	m_CurrentSky = m_Skys[0];
 
 	m_ShadowMap = new ShadowMap(d3d_device_, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
@@ -309,6 +316,18 @@ void SsaoApp::OnResize()
 
 void SsaoApp::UpdateScene(float dt)
 {
+	//
+	// Create the textures loaded since the last frame, within the budget.
+	//
+	m_TextureLoader.Finalize(TextureBudget);
+
+	m_FloorTexSRV = m_TextureLoader.GetView(m_FloorTex);
+	m_StoneTexSRV = m_TextureLoader.GetView(m_StoneTex);
+	m_BrickTexSRV = m_TextureLoader.GetView(m_BrickTex);
+	m_FloorNormalTexSRV = m_TextureLoader.GetView(m_FloorNormalTex);
+	m_StoneNormalTexSRV = m_TextureLoader.GetView(m_StoneNormalTex);
+	m_BrickNormalTexSRV = m_TextureLoader.GetView(m_BrickNormalTex);
+
 	//
 	// Switch the sky based on key presses.
 	//
@@ -1321,6 +1340,14 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+	if (Benchmark::IsRequested(lpCmdLine))
+	{
+		TextureBenchmarks::RunPackedConvert();
+		TextureBenchmarks::RunDDSParse();
+		TextureBenchmarks::RunTextureLoading();
+		return 0;
+	}
+
 	SsaoApp theApp(hInstance);
 
 	if (!theApp.Init())
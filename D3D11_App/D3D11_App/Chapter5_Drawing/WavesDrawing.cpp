@@ -2,7 +2,11 @@
 #include "d3dx11effect.h"
 #include "GeometryGenerator.h"
 #include "MathHelper.h"
-#include "Waves.h"
+#include "WavesSimulator.h"
+#include "Ocean.h"
+#include "ThreadPool.h"
+#include "Benchmark.h"
+#include <sstream>
 
 struct Vertex
 {
@@ -29,6 +33,7 @@ private:
 	float GetHeight(float x, float z) const;
 	void BuildLandGeometryBuffers();
 	void BuildWavesGeometryBuffers();
+	void BuildGridIndexBuffer(UINT rows, UINT cols, ID3D11Buffer** buffer);
 	void BuildFX();
 	void BuildVertexLayout();
 
@@ -36,13 +41,17 @@ private:
 	ID3D11Buffer* land_vertex_buffer_;
 	ID3D11Buffer* land_index_buffer_;
 	ID3D11Buffer* waves_vertex_buffer_;
+	ID3D11Buffer* waves_color_buffer_;
 	ID3D11Buffer* waves_index_buffer_;
+	ID3D11Buffer* ocean_vertex_buffer_;
+	ID3D11Buffer* ocean_index_buffer_;
 
 	ID3DX11Effect* fx_;
 	ID3DX11EffectTechnique* technique_;
 	ID3DX11EffectMatrixVariable* fx_WVP_;
 
 	ID3D11InputLayout* input_layout_;
+	ID3D11InputLayout* waves_input_layout_;
 
 	ID3D11RasterizerState* wireframe_RS_;
 
@@ -54,7 +63,13 @@ private:
 
 	UINT grid_index_count_;
 
-	Waves waves_;
+	WavesSimulator waves_;
+
+	// Drawn in place of the waves while use_ocean_ is set; O shows the
+	// ocean and W the waves again.
+	Ocean ocean_;
+	ThreadPool pool_;
+	bool use_ocean_;
 
 	float theta_;
 	float phi_;
@@ -68,14 +83,21 @@ WavesApp::WavesApp(HINSTANCE hInstance)
 	, land_vertex_buffer_(nullptr)
 	, land_index_buffer_(nullptr)
 	, waves_vertex_buffer_(nullptr)
+	, waves_color_buffer_(nullptr)
 	, waves_index_buffer_(nullptr)
+	, ocean_vertex_buffer_(nullptr)
+	, ocean_index_buffer_(nullptr)
 	, fx_(nullptr)
 	, technique_(nullptr)
 	, fx_WVP_(nullptr)
 	, input_layout_(nullptr)
+	, waves_input_layout_(nullptr)
 	, wireframe_RS_(nullptr)
 	, grid_index_count_(0)
 	, waves_()
+	, ocean_()
+	, pool_()
+	, use_ocean_(false)
 	, theta_(1.5f * MathHelper::Pi)
 	, phi_(0.1f * MathHelper::Pi)
 	, radius_(200.0f)
@@ -97,9 +119,13 @@ WavesApp::~WavesApp()
 	ReleaseCOM(land_vertex_buffer_);
 	ReleaseCOM(land_index_buffer_);
 	ReleaseCOM(waves_vertex_buffer_);
+	ReleaseCOM(waves_color_buffer_);
 	ReleaseCOM(waves_index_buffer_);
+	ReleaseCOM(ocean_vertex_buffer_);
+	ReleaseCOM(ocean_index_buffer_);
 	ReleaseCOM(fx_);
 	ReleaseCOM(input_layout_);
+	ReleaseCOM(waves_input_layout_);
 	ReleaseCOM(wireframe_RS_);
 }
 
@@ -110,7 +136,21 @@ bool WavesApp::Init()
 		return false;
 	}
 
-	waves_.Init(200, 200, .8f, .03f, 3.25f, .4f);
+	waves_.Init(200, 200, .8f, .03f, 3.25f, .4f, true);
+
+	// A patch as wide as the land, under a moderate breeze.
+	Ocean::InitInfo ocean_info;
+	ocean_info.Size = 128;
+	ocean_info.PatchSize = 160.f;
+	ocean_info.WindSpeed = 10.f;
+	ocean_info.WindDirection = XMFLOAT2(1.f, .5f);
+	ocean_info.Spectrum = Ocean::SpectrumJONSWAP;
+	ocean_info.Amplitude = 0.f;
+	ocean_info.Fetch = 100000.f;
+	ocean_info.Choppiness = 1.f;
+	ocean_info.FoamThreshold = .5f;
+	ocean_info.Seed = 1;
+	ocean_.Init(ocean_info);
 
 	BuildLandGeometryBuffers();
 	BuildWavesGeometryBuffers();
@@ -205,23 +245,47 @@ void WavesApp::BuildLandGeometryBuffers()
 
 void WavesApp::BuildWavesGeometryBuffers()
 {
-	// Create the vertex buffer.  Note that we allocate space only, as
-	// we will be updating the data every time step of the simulation.
+	// Create the vertex buffer of positions.  Note that we allocate space
+	// only, as we will be updating the data every time step of the simulation.
 
 	D3D11_BUFFER_DESC vbd;
 	vbd.Usage = D3D11_USAGE_DYNAMIC;
-	vbd.ByteWidth = sizeof(Vertex) * waves_.VertexCount();
+	vbd.ByteWidth = sizeof(XMFLOAT3) * waves_.Solution().VertexCount();
 	vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
 	vbd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
 	vbd.MiscFlags = 0;
 	HR(d3d_device_->CreateBuffer(&vbd, nullptr, &waves_vertex_buffer_));
 
+	// The colors never change, so they go in a second stream created once
+	// rather than being written with the positions every frame.
+	std::vector<XMFLOAT4> colors(waves_.Solution().VertexCount(), XMFLOAT4(0.f, 0.f, 0.f, 1.f));
+
+	D3D11_BUFFER_DESC cbd;
+	cbd.Usage = D3D11_USAGE_IMMUTABLE;
+	cbd.ByteWidth = sizeof(XMFLOAT4) * waves_.Solution().VertexCount();
+	cbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	cbd.CPUAccessFlags = 0;
+	cbd.MiscFlags = 0;
+
+	D3D11_SUBRESOURCE_DATA cinitData;
+	cinitData.pSysMem = &colors[0];
+	HR(d3d_device_->CreateBuffer(&cbd, &cinitData, &waves_color_buffer_));
+
 	// Create the index buffer.  The index buffer is fixed, so we only 
 	// need to create and set once.
+	BuildGridIndexBuffer(waves_.Solution().RowCount(), waves_.Solution().ColumnCount(), &waves_index_buffer_);
+
+	// The ocean has a grid of its own, but as it has fewer points than the
+	// waves it shares their colors.
+	vbd.ByteWidth = sizeof(XMFLOAT3) * ocean_.VertexCount();
+	HR(d3d_device_->CreateBuffer(&vbd, nullptr, &ocean_vertex_buffer_));
 
-	std::vector<UINT> indices(3 * waves_.TriangleCount());
-	UINT rows = waves_.RowCount();
-	UINT cols = waves_.ColumnCount();
+	BuildGridIndexBuffer(ocean_.RowCount(), ocean_.ColumnCount(), &ocean_index_buffer_);
+}
+
+void WavesApp::BuildGridIndexBuffer(UINT rows, UINT cols, ID3D11Buffer** buffer)
+{
+	std::vector<UINT> indices(6 * (rows - 1) * (cols - 1));
 	int k = 0;
 	for (UINT i = 0; i < rows - 1; ++i)
 	{
@@ -248,8 +312,7 @@ void WavesApp::BuildWavesGeometryBuffers()
 
 	D3D11_SUBRESOURCE_DATA iinitData;
 	iinitData.pSysMem = &indices[0];
-	HR(d3d_device_->CreateBuffer(&ibd, &iinitData, &waves_index_buffer_));
-
+	HR(d3d_device_->CreateBuffer(&ibd, &iinitData, buffer));
 }
 
 void WavesApp::BuildFX()
@@ -285,6 +348,14 @@ void WavesApp::BuildVertexLayout()
 	technique_->GetPassByIndex(0)->GetDesc(&pass_desc);
 	HR(d3d_device_->CreateInputLayout(vertex_desc, 2, pass_desc.pIAInputSignature,
 		pass_desc.IAInputSignatureSize, &input_layout_));
+
+	// The waves take positions and colors from two streams.
+	D3D11_INPUT_ELEMENT_DESC waves_desc[] = {
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 }
+	};
+	HR(d3d_device_->CreateInputLayout(waves_desc, 2, pass_desc.pIAInputSignature,
+		pass_desc.IAInputSignatureSize, &waves_input_layout_));
 }
 
 void WavesApp::OnResize()
@@ -310,6 +381,12 @@ void WavesApp::UpdateScene(float dt)
 	XMMATRIX v = XMMatrixLookAtLH(pos, target, up);
 	XMStoreFloat4x4(&view_, v);
 
+	if (GetAsyncKeyState('O') & 0x8000)
+		use_ocean_ = true;
+
+	if (GetAsyncKeyState('W') & 0x8000)
+		use_ocean_ = false;
+
 	//
 	// Every quarter second, generate a random wave.
 	//
@@ -326,20 +403,30 @@ void WavesApp::UpdateScene(float dt)
 		waves_.Disturb(i, j, r);
 	}
 
+	// The solver steps on its own thread; this only hands dt over and picks
+	// up the newest solution.  It keeps going while the ocean is shown.
 	waves_.Update(dt);
 
+	if (use_ocean_)
+	{
+		ocean_.Update(dt, &pool_);
+
+		D3D11_MAPPED_SUBRESOURCE mapData;
+		HR(d3d_context_->Map(ocean_vertex_buffer_, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapData));
+
+		ocean_.WriteVertices(mapData.pData, sizeof(XMFLOAT3), Waves::LayoutPosition, &pool_);
+
+		d3d_context_->Unmap(ocean_vertex_buffer_, 0);
+		return;
+	}
+
 	//
 	// Update the wave vertex buffer with the new solution.
 	//
 	D3D11_MAPPED_SUBRESOURCE mapData;
 	HR(d3d_context_->Map(waves_vertex_buffer_, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapData));
 
-	Vertex* vertex = (Vertex*)mapData.pData;
-	for (int i = 0; i < waves_.VertexCount(); ++i)
-	{
-		vertex[i].Pos = waves_[i];
-		vertex[i].Color = XMFLOAT4(0.f, 0.f, 0.f, 1.f);
-	}
+	waves_.Solution().WriteVertices(mapData.pData, sizeof(XMFLOAT3), Waves::LayoutPosition);
 
 	d3d_context_->Unmap(waves_vertex_buffer_, 0);
 }
@@ -376,17 +463,22 @@ void WavesApp::DrawScene()
 		// Draw the waves.
 		d3d_context_->RSSetState(wireframe_RS_);
 
-		d3d_context_->IASetVertexBuffers(0, 1, &waves_vertex_buffer_, &stride, &offset);
-		d3d_context_->IASetIndexBuffer(waves_index_buffer_, DXGI_FORMAT_R32_UINT, 0);
+		ID3D11Buffer* waves_buffers[] = { use_ocean_ ? ocean_vertex_buffer_ : waves_vertex_buffer_, waves_color_buffer_ };
+		UINT waves_strides[] = { sizeof(XMFLOAT3), sizeof(XMFLOAT4) };
+		UINT waves_offsets[] = { 0, 0 };
+		d3d_context_->IASetInputLayout(waves_input_layout_);
+		d3d_context_->IASetVertexBuffers(0, 2, waves_buffers, waves_strides, waves_offsets);
+		d3d_context_->IASetIndexBuffer(use_ocean_ ? ocean_index_buffer_ : waves_index_buffer_, DXGI_FORMAT_R32_UINT, 0);
 
 		world = XMLoadFloat4x4(&waves_world_);
 		wvp = world * view * proj;
 		fx_WVP_->SetMatrix((float*)&wvp);
 		technique_->GetPassByIndex(p)->Apply(0, d3d_context_);
-		d3d_context_->DrawIndexed(3 * waves_.TriangleCount(), 0, 0);
+		d3d_context_->DrawIndexed(3 * (use_ocean_ ? ocean_.TriangleCount() : waves_.Solution().TriangleCount()), 0, 0);
 
 		// Restore default.
 		d3d_context_->RSSetState(0);
+		d3d_context_->IASetInputLayout(input_layout_);
 	}
 
 	HR(swap_chain_->Present(0, 0));
@@ -442,6 +534,554 @@ float WavesApp::GetHeight(float x, float z) const
 	return 0.3f * (z * sinf(0.1f * x) + x * cosf(0.1f * z));
 }
 
+// The solution of a Waves grid the way Waves used to keep it, as arrays of
+// XMFLOAT3 with the x and z of every point.
+struct OldWaves
+{
+	UINT Rows;
+	UINT Cols;
+	float K1;
+	float K2;
+	float K3;
+	float SpatialStep;
+
+	std::vector<XMFLOAT3> Prev;
+	std::vector<XMFLOAT3> Curr;
+	std::vector<XMFLOAT3> Normals;
+	std::vector<XMFLOAT3> TangentX;
+};
+
+static void InitTheOldWay(OldWaves& w, UINT rows, UINT cols, float dx, float dt, float speed, float damping)
+{
+	w.Rows = rows;
+	w.Cols = cols;
+	w.SpatialStep = dx;
+
+	float d = damping * dt + 2.f;
+	float e = (speed * speed) * (dt * dt) / (dx * dx);
+	w.K1 = (damping * dt - 2.f) / d;
+	w.K2 = (4.f - 8.f * e) / d;
+	w.K3 = (2.f * e) / d;
+
+	w.Prev.resize(rows * cols);
+	w.Curr.resize(rows * cols);
+	w.Normals.assign(rows * cols, XMFLOAT3(0.f, 1.f, 0.f));
+	w.TangentX.assign(rows * cols, XMFLOAT3(1.f, 0.f, 0.f));
+
+	float width_half = (cols - 1) * dx * .5f;
+	float depth_half = (rows - 1) * dx * .5f;
+	for (UINT i = 0; i < rows; ++i)
+	{
+		for (UINT j = 0; j < cols; ++j)
+		{
+			w.Prev[i * cols + j] = XMFLOAT3(-width_half + j * dx, 0.f, depth_half - i * dx);
+			w.Curr[i * cols + j] = w.Prev[i * cols + j];
+		}
+	}
+}
+
+// One step of Waves::Update as it used to be: the heights one point at a
+// time, then a second pass for the normals and tangents.
+static void StepTheOldWay(OldWaves& w)
+{
+	UINT cols = w.Cols;
+	for (UINT i = 1; i < w.Rows - 1; ++i)
+	{
+		for (UINT j = 1; j < cols - 1; ++j)
+		{
+			w.Prev[i*cols + j].y =
+				w.K1 * w.Prev[i*cols + j].y +
+				w.K2 * w.Curr[i*cols + j].y +
+				w.K3 * (w.Curr[(i + 1)*cols + j].y +
+					w.Curr[(i - 1)*cols + j].y +
+					w.Curr[i*cols + j + 1].y +
+					w.Curr[i*cols + j - 1].y);
+		}
+	}
+	w.Prev.swap(w.Curr);
+
+	for (UINT i = 1; i < w.Rows - 1; ++i)
+	{
+		for (UINT j = 1; j < cols - 1; ++j)
+		{
+			float left = w.Curr[i*cols + j - 1].y;
+			float right = w.Curr[i*cols + j + 1].y;
+			float top = w.Curr[(i - 1)*cols + j].y;
+			float bottom = w.Curr[(i + 1)*cols + j].y;
+
+			XMVECTOR n = XMVector3Normalize(XMVectorSet(-right + left, 2.f * w.SpatialStep, bottom - top, 0.f));
+			XMStoreFloat3(&w.Normals[i*cols + j], n);
+
+			XMVECTOR T = XMVector3Normalize(XMVectorSet(2.f * w.SpatialStep, right - left, 0.f, 0.f));
+			XMStoreFloat3(&w.TangentX[i*cols + j], T);
+		}
+	}
+}
+
+static float MaxDifference(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+	return std::max(fabsf(a.x - b.x), std::max(fabsf(a.y - b.y), fabsf(a.z - b.z)));
+}
+
+static void RunWavesBenchmark()
+{
+	const UINT sizes[] = { 200, 512, 1024, 2048 };
+	ThreadPool pool;
+
+	for (UINT size : sizes)
+	{
+		// The constants of the demo, with the same drops falling on both.
+		const float dt = .03f;
+		Waves waves;
+		OldWaves old;
+		waves.Init(size, size, .8f, dt, 3.25f, .4f);
+		InitTheOldWay(old, size, size, .8f, dt, 3.25f, .4f);
+
+		const UINT stepCount = size > 1024 ? 20 : 100;
+		double oldTime = 0.0;
+		double newTime = 0.0;
+		double poolTime = 0.0;
+		for (UINT step = 0; step < stepCount; ++step)
+		{
+			UINT i = 5 + rand() % (size - 10);
+			UINT j = 5 + rand() % (size - 10);
+			float r = MathHelper::RandF(1.f, 2.f);
+			waves.Disturb(i, j, r);
+			float mag_half = .5f * r;
+			old.Curr[i * size + j].y += r;
+			old.Curr[i * size + j + 1].y += mag_half;
+			old.Curr[i * size + j - 1].y += mag_half;
+			old.Curr[(i + 1) * size + j].y += mag_half;
+			old.Curr[(i - 1) * size + j].y += mag_half;
+
+			double start = Benchmark::Now();
+			StepTheOldWay(old);
+			oldTime += Benchmark::Now() - start;
+
+			// Alternate between one thread and the pool, which give the same
+			// solution.
+			start = Benchmark::Now();
+			waves.Update(dt, step % 2 ? &pool : nullptr);
+			(step % 2 ? poolTime : newTime) += Benchmark::Now() - start;
+		}
+
+		UINT mismatches = 0;
+		float maxDiff = 0.f;
+		for (UINT k = 0; k < waves.VertexCount(); ++k)
+		{
+			float diff = std::max(MaxDifference(waves[k], old.Curr[k]),
+				std::max(MaxDifference(waves.Normal(k), old.Normals[k]), MaxDifference(waves.TangentX(k), old.TangentX[k])));
+			maxDiff = std::max(maxDiff, diff);
+			mismatches += diff > 0.f;
+		}
+
+		double oldStep = oldTime / stepCount * 1000.0;
+		double newStep = newTime / (stepCount / 2) * 1000.0;
+		double poolStep = poolTime / (stepCount / 2) * 1000.0;
+		std::wostringstream outs;
+		outs << L"Waves: " << size << L"x" << size << L", old update " << oldStep << L" ms/step, SoA " << newStep <<
+			L" ms/step (" << oldStep / newStep << L"x), on " << pool.ThreadCount() << L" threads " << poolStep <<
+			L" ms/step (" << oldStep / poolStep << L"x), " << mismatches << L" points differ after " << stepCount <<
+			L" steps (max " << maxDiff << L")";
+		Benchmark::Report(outs.str());
+	}
+}
+
+// The vertex of the lit and textured demos.
+struct BasicVertex
+{
+	XMFLOAT3 Pos;
+	XMFLOAT3 Normal;
+	XMFLOAT2 Tex;
+};
+
+// The copy loop of the demos, one grid point at a time through the accessors.
+static void CopyTheOldWay(const Waves& waves, BasicVertex* v)
+{
+	for (UINT i = 0; i < waves.VertexCount(); ++i)
+	{
+		v[i].Pos = waves[i];
+		v[i].Normal = waves.Normal(i);
+
+		v[i].Tex.x = 0.5f + waves[i].x / waves.Width();
+		v[i].Tex.y = 0.5f - waves[i].z / waves.Depth();
+	}
+}
+
+static void RunWavesOutputBenchmark()
+{
+	const UINT sizes[] = { 200, 512, 1024, 2048 };
+	ThreadPool pool;
+
+	for (UINT size : sizes)
+	{
+		const float dt = .03f;
+		Waves waves;
+		waves.Init(size, size, .8f, dt, 3.25f, .4f);
+		for (UINT step = 0; step < 10; ++step)
+		{
+			waves.Disturb(5 + rand() % (size - 10), 5 + rand() % (size - 10), MathHelper::RandF(1.f, 2.f));
+			waves.Update(dt);
+		}
+
+		std::vector<BasicVertex> oldVertices(waves.VertexCount());
+		std::vector<BasicVertex> newVertices(waves.VertexCount());
+		std::vector<XMFLOAT3> positions(waves.VertexCount());
+
+		const UINT frameCount = size > 1024 ? 10 : 50;
+		double oldTime = 0.0;
+		double newTime = 0.0;
+		double poolTime = 0.0;
+		double positionTime = 0.0;
+		for (UINT frame = 0; frame < frameCount; ++frame)
+		{
+			double start = Benchmark::Now();
+			CopyTheOldWay(waves, &oldVertices[0]);
+			oldTime += Benchmark::Now() - start;
+
+			start = Benchmark::Now();
+			waves.WriteVertices(&newVertices[0], sizeof(BasicVertex), Waves::LayoutPositionNormalTex);
+			newTime += Benchmark::Now() - start;
+
+			start = Benchmark::Now();
+			waves.WriteVertices(&newVertices[0], sizeof(BasicVertex), Waves::LayoutPositionNormalTex, &pool);
+			poolTime += Benchmark::Now() - start;
+
+			start = Benchmark::Now();
+			waves.WriteVertices(&positions[0], sizeof(XMFLOAT3), Waves::LayoutPosition);
+			positionTime += Benchmark::Now() - start;
+		}
+
+		UINT mismatches = 0;
+		for (UINT k = 0; k < waves.VertexCount(); ++k)
+		{
+			mismatches += memcmp(&oldVertices[k], &newVertices[k], sizeof(BasicVertex)) != 0 ||
+				memcmp(&positions[k], &oldVertices[k].Pos, sizeof(XMFLOAT3)) != 0;
+		}
+
+		double oldFrame = oldTime / frameCount * 1000.0;
+		double newFrame = newTime / frameCount * 1000.0;
+		double poolFrame = poolTime / frameCount * 1000.0;
+		double positionFrame = positionTime / frameCount * 1000.0;
+		std::wostringstream outs;
+		outs << L"Waves output: " << size << L"x" << size << L", old copy " << oldFrame << L" ms/frame, written in place " <<
+			newFrame << L" ms/frame (" << oldFrame / newFrame << L"x), on " << pool.ThreadCount() << L" threads " <<
+			poolFrame << L" ms/frame (" << oldFrame / poolFrame << L"x), positions only " << positionFrame <<
+			L" ms/frame, " << mismatches << L" vertices differ";
+		Benchmark::Report(outs.str());
+	}
+}
+
+static void RunWavesDriverBenchmark()
+{
+	// Frame times of a game that mostly keeps up and now and then hitches.
+	const float frameTimes[] = { 1.f / 60.f, 1.f / 60.f, 1.f / 30.f, 1.f / 60.f, .25f, 1.f / 60.f, 1.f / 144.f };
+	const UINT frameTimeCount = ARRAYSIZE(frameTimes);
+	const UINT sizes[] = { 200, 1024 };
+	const UINT frameCount = 140;
+
+	for (UINT size : sizes)
+	{
+		const float dt = .03f;
+		double updateTime[2] = {};
+		double frameTime[2] = {};
+		UINT steps[2] = {};
+		float simulated = 0.f;
+		for (int threaded = 0; threaded < 2; ++threaded)
+		{
+			WavesSimulator waves;
+			waves.Init(size, size, .8f, dt, 3.25f, .4f, threaded != 0);
+			std::vector<XMFLOAT3> positions(size * size);
+
+			simulated = 0.f;
+			for (UINT frame = 0; frame < frameCount; ++frame)
+			{
+				float frameDt = frameTimes[frame % frameTimeCount];
+				simulated += frameDt;
+
+				// What UpdateScene does on the render thread.
+				double frameStart = Benchmark::Now();
+				if (frame % 15 == 0)
+				{
+					waves.Disturb(5 + rand() % (size - 10), 5 + rand() % (size - 10), MathHelper::RandF(1.f, 2.f));
+				}
+				waves.Update(frameDt);
+				updateTime[threaded] += Benchmark::Now() - frameStart;
+				waves.Solution().WriteVertices(&positions[0], sizeof(XMFLOAT3), Waves::LayoutPosition);
+				double elapsed = Benchmark::Now() - frameStart;
+				frameTime[threaded] += elapsed;
+
+				// The rest of the frame goes to drawing, which the worker
+				// steps alongside.
+				if (elapsed < frameDt)
+				{
+					std::this_thread::sleep_for(std::chrono::duration<double>(frameDt - elapsed));
+				}
+			}
+			waves.Shutdown();
+			steps[threaded] = waves.StepCount();
+		}
+
+		std::wostringstream outs;
+		outs << L"Waves driver: " << size << L"x" << size << L", " << frameCount << L" frames of " << simulated <<
+			L" s, " << UINT(simulated / dt) << L" steps due; on the render thread Update " <<
+			updateTime[0] / frameCount * 1000.0 << L" ms/frame, with the copy " << frameTime[0] / frameCount * 1000.0 <<
+			L" ms/frame, " << steps[0] << L" steps; on a worker Update " << updateTime[1] / frameCount * 1000.0 <<
+			L" ms/frame, with the copy " << frameTime[1] / frameCount * 1000.0 << L" ms/frame, " << steps[1] <<
+			L" steps";
+		Benchmark::Report(outs.str());
+	}
+}
+
+static void RunWavesSleepBenchmark()
+{
+	// A drop now and then on a calm sea, the same ones on both grids.
+	const UINT size = 1024;
+	const UINT stepCount = 400;
+	const UINT dropInterval = 100;
+	const float dt = .03f;
+	const float threshold = .001f;
+
+	Waves full;
+	Waves sparse;
+	full.Init(size, size, .8f, dt, 3.25f, .4f);
+	sparse.Init(size, size, .8f, dt, 3.25f, .4f);
+	sparse.SetSleepThreshold(threshold);
+
+	double fullTime = 0.0;
+	double sparseTime = 0.0;
+	double awakeTiles = 0.0;
+	for (UINT step = 0; step < stepCount; ++step)
+	{
+		if (step % dropInterval == 0)
+		{
+			UINT i = 5 + rand() % (size - 10);
+			UINT j = 5 + rand() % (size - 10);
+			float r = MathHelper::RandF(1.f, 2.f);
+			full.Disturb(i, j, r);
+			sparse.Disturb(i, j, r);
+		}
+
+		double start = Benchmark::Now();
+		full.Update(dt);
+		fullTime += Benchmark::Now() - start;
+
+		start = Benchmark::Now();
+		sparse.Update(dt);
+		sparseTime += Benchmark::Now() - start;
+
+		awakeTiles += sparse.AwakeTileCount();
+	}
+
+	float maxDiff = 0.f;
+	float maxHeight = 0.f;
+	for (UINT k = 0; k < full.VertexCount(); ++k)
+	{
+		maxDiff = std::max(maxDiff, fabsf(full[k].y - sparse[k].y));
+		maxHeight = std::max(maxHeight, fabsf(full[k].y));
+	}
+
+	double fullStep = fullTime / stepCount * 1000.0;
+	double sparseStep = sparseTime / stepCount * 1000.0;
+	std::wostringstream outs;
+	outs << L"Waves sleep: " << size << L"x" << size << L", a drop every " << dropInterval << L" steps, full sweep " <<
+		1000.0 / fullStep << L" steps/s, awake tiles only " << 1000.0 / sparseStep << L" steps/s (" <<
+		fullStep / sparseStep << L"x), " << awakeTiles / stepCount << L" tiles awake on average, largest height " <<
+		L"difference " << maxDiff << L" of " << maxHeight << L" after " << stepCount << L" steps";
+	Benchmark::Report(outs.str());
+}
+
+// The transform straight from its definition.
+static void TransformTheSlowWay(const std::vector<float>& re, const std::vector<float>& im, bool inverse,
+	std::vector<float>& outRe, std::vector<float>& outIm)
+{
+	const UINT n = (UINT)re.size();
+	const double sign = inverse ? 1.0 : -1.0;
+	for (UINT k = 0; k < n; ++k)
+	{
+		double sumRe = 0.0;
+		double sumIm = 0.0;
+		for (UINT j = 0; j < n; ++j)
+		{
+			double angle = sign * 2.0 * 3.14159265358979323846 * ((UINT64)j * k % n) / n;
+			sumRe += re[j] * cos(angle) - im[j] * sin(angle);
+			sumIm += re[j] * sin(angle) + im[j] * cos(angle);
+		}
+		outRe[k] = (float)sumRe;
+		outIm[k] = (float)sumIm;
+	}
+}
+
+static void RunOceanBenchmark()
+{
+	ThreadPool pool;
+
+	// The transforms against their definition, and two real signals
+	// transformed as one complex one against each done alone.
+	float maxError = 0.f;
+	for (UINT n = 1; n <= 256; n *= 2)
+	{
+		FFT fft;
+		fft.Init(n);
+		std::vector<float> re(n), im(n), slowRe(n), slowIm(n);
+		for (UINT j = 0; j < n; ++j)
+		{
+			re[j] = MathHelper::RandF(-1.f, 1.f);
+			im[j] = MathHelper::RandF(-1.f, 1.f);
+		}
+
+		for (int inverse = 0; inverse < 2; ++inverse)
+		{
+			TransformTheSlowWay(re, im, inverse != 0, slowRe, slowIm);
+			std::vector<float> fastRe = re, fastIm = im;
+			fft.Transform(&fastRe[0], &fastIm[0], inverse != 0);
+			for (UINT k = 0; k < n; ++k)
+			{
+				maxError = std::max(maxError, std::max(fabsf(fastRe[k] - slowRe[k]), fabsf(fastIm[k] - slowIm[k])) / n);
+			}
+		}
+
+		std::vector<float> packedRe = re, packedIm = im;
+		fft.Transform(&packedRe[0], &packedIm[0], false);
+		std::vector<float> aRe(n / 2 + 1), aIm(n / 2 + 1), bRe(n / 2 + 1), bIm(n / 2 + 1);
+		FFT::SplitReal(&packedRe[0], &packedIm[0], n, &aRe[0], &aIm[0], &bRe[0], &bIm[0]);
+		std::vector<float> zeros(n, 0.f);
+		TransformTheSlowWay(re, zeros, false, slowRe, slowIm);
+		for (UINT k = 0; k <= n / 2; ++k)
+		{
+			maxError = std::max(maxError, std::max(fabsf(aRe[k] - slowRe[k]), fabsf(aIm[k] - slowIm[k])) / n);
+		}
+		TransformTheSlowWay(im, zeros, false, slowRe, slowIm);
+		for (UINT k = 0; k <= n / 2; ++k)
+		{
+			maxError = std::max(maxError, std::max(fabsf(bRe[k] - slowRe[k]), fabsf(bIm[k] - slowIm[k])) / n);
+		}
+	}
+
+	{
+		std::wostringstream outs;
+		outs << L"FFT: sizes 1 to 256, complex and two real at once, largest error " << maxError <<
+			L" of the mean magnitude";
+		Benchmark::Report(outs.str());
+	}
+
+	// A lone wave: every point moves uphill, towards its crest, and the foam
+	// gathers on the crests rather than in the troughs.
+	{
+		Ocean::InitInfo info;
+		info.Size = 64;
+		info.PatchSize = 250.f;
+		info.WindSpeed = 12.f;
+		info.WindDirection = XMFLOAT2(1.f, .5f);
+		info.Spectrum = Ocean::SpectrumSingleWave;
+		info.Amplitude = 4.f;
+		info.Fetch = 0.f;
+		info.Choppiness = 2.5f;
+		info.FoamThreshold = .5f;
+		info.Seed = 1;
+
+		Ocean wave;
+		wave.Init(info);
+		wave.Update(0.f);
+
+		const UINT cols = wave.ColumnCount();
+		UINT downhill = 0;
+		int crest = 0;
+		int trough = 0;
+		for (UINT i = 0; i < wave.VertexCount(); ++i)
+		{
+			XMFLOAT3 p = wave[i];
+			XMFLOAT3 normal = wave.Normal(i);
+			float dx = p.x - wave.Width() * ((float)(i % cols) / (cols - 1) - .5f);
+			float dz = p.z - wave.Depth() * (.5f - (float)(i / cols) / (wave.RowCount() - 1));
+
+			// Uphill is against the level part of the normal; on the crests
+			// and in the troughs the points stay put.
+			float slope = sqrtf(normal.x * normal.x + normal.z * normal.z);
+			downhill += slope > 1e-2f && dx * normal.x + dz * normal.z > 0.f;
+			crest = p.y > wave[crest].y ? i : crest;
+			trough = p.y < wave[trough].y ? i : trough;
+		}
+
+		std::wostringstream outs;
+		outs << L"Ocean: a single wave, " << downhill << L" points displaced away from their crest, foam " <<
+			wave.Foam(crest) << L" on the crests and " << wave.Foam(trough) << L" in the troughs";
+		Benchmark::Report(outs.str());
+	}
+
+	const UINT sizes[] = { 128, 256, 512 };
+	for (UINT size : sizes)
+	{
+		Ocean::InitInfo info;
+		info.Size = size;
+		info.PatchSize = 250.f;
+		info.WindSpeed = 12.f;
+		info.WindDirection = XMFLOAT2(1.f, .5f);
+		info.Spectrum = Ocean::SpectrumJONSWAP;
+		info.Amplitude = 0.f;
+		info.Fetch = 100000.f;
+		info.Choppiness = 1.f;
+		info.FoamThreshold = .5f;
+		info.Seed = 1;
+
+		Ocean serial;
+		Ocean parallel;
+		serial.Init(info);
+		parallel.Init(info);
+
+		const UINT updateCount = size > 256 ? 10 : 40;
+		double serialTime = 0.0;
+		double poolTime = 0.0;
+		for (UINT u = 0; u < updateCount; ++u)
+		{
+			double start = Benchmark::Now();
+			serial.Update(1.f / 60.f);
+			serialTime += Benchmark::Now() - start;
+
+			start = Benchmark::Now();
+			parallel.Update(1.f / 60.f, &pool);
+			poolTime += Benchmark::Now() - start;
+		}
+
+		// Threads give the same surface, and the patch meets itself at the
+		// seams.
+		UINT mismatches = 0;
+		UINT seamMismatches = 0;
+		double sum = 0.0;
+		double sumSquares = 0.0;
+		float foam = 0.f;
+		const UINT cols = serial.ColumnCount();
+		for (UINT i = 0; i < serial.VertexCount(); ++i)
+		{
+			mismatches += MaxDifference(serial[i], parallel[i]) > 0.f || MaxDifference(serial.Normal(i), parallel.Normal(i)) > 0.f;
+			sum += serial[i].y;
+			sumSquares += serial[i].y * serial[i].y;
+			foam += serial.Foam(i);
+		}
+		for (UINT k = 0; k < cols; ++k)
+		{
+			XMFLOAT3 left = serial[k * cols];
+			XMFLOAT3 right = serial[k * cols + cols - 1];
+			XMFLOAT3 top = serial[k];
+			XMFLOAT3 bottom = serial[(cols - 1) * cols + k];
+			seamMismatches += fabsf(right.x - left.x - serial.Width()) > 1e-3f || right.y != left.y ||
+				fabsf(top.z - bottom.z - serial.Depth()) > 1e-3f || top.y != bottom.y;
+		}
+
+		double mean = sum / serial.VertexCount();
+		double deviation = sqrt(sumSquares / serial.VertexCount() - mean * mean);
+		double serialUpdate = serialTime / updateCount * 1000.0;
+		double poolUpdate = poolTime / updateCount * 1000.0;
+		std::wostringstream outs;
+		outs << L"Ocean: " << size << L"x" << size << L" JONSWAP, " << serialUpdate << L" ms/update, on " <<
+			pool.ThreadCount() << L" threads " << poolUpdate << L" ms/update (" << serialUpdate / poolUpdate <<
+			L"x), significant wave height " << 4.0 * deviation << L" m, foam on " <<
+			100.f * foam / serial.VertexCount() << L"%, " << mismatches << L" points differ between threads, " <<
+			seamMismatches << L" seam points differ";
+		Benchmark::Report(outs.str());
+	}
+}
+
 int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPSTR lpCmdLine, _In_ int nShowCmd)
 {
 	// Enable run-time memory check for debug builds.
@@ -449,6 +1089,16 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+	if (Benchmark::IsRequested(lpCmdLine))
+	{
+		RunWavesBenchmark();
+		RunWavesOutputBenchmark();
+		RunWavesDriverBenchmark();
+		RunWavesSleepBenchmark();
+		RunOceanBenchmark();
+		return 0;
+	}
+
 	WavesApp theApp(hInstance);
 
 	if (!theApp.Init())
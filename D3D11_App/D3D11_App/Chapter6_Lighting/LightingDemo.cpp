@@ -376,12 +376,7 @@ void LightingApp::UpdateScene(float dt)
 	D3D11_MAPPED_SUBRESOURCE mapData;
 	HR(d3d_context_->Map(waves_vertex_buffer_, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapData));
 
-	Vertex* vertex = (Vertex*)mapData.pData;
-	for (int i = 0; i < waves_.VertexCount(); ++i)
-	{
-		vertex[i].Pos = waves_[i];
-		vertex[i].Normal = waves_.Normal(i);
-	}
+	waves_.WriteVertices(mapData.pData, sizeof(Vertex), Waves::LayoutPositionNormal);
 
 	d3d_context_->Unmap(waves_vertex_buffer_, 0);
 
@@ -312,15 +312,7 @@ void TexturedHillsAndWavesApp::UpdateScene(float dt)
 	D3D11_MAPPED_SUBRESOURCE mapData;
 	HR(d3d_context_->Map(waves_vertex_buffer_, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapData));
 
-	Vertex::Basic32* vertex = (Vertex::Basic32*)mapData.pData;
-	for (int i = 0; i < waves_.VertexCount(); ++i)
-	{
-		vertex[i].Pos = waves_[i];
-		vertex[i].Normal = waves_.Normal(i);
-
-		vertex[i].Tex.x = 0.5f + waves_[i].x / waves_.Width();
-		vertex[i].Tex.y = 0.5f - waves_[i].z / waves_.Depth();
-	}
+	waves_.WriteVertices(mapData.pData, sizeof(Vertex::Basic32), Waves::LayoutPositionNormalTex);
 
 	d3d_context_->Unmap(waves_vertex_buffer_, 0);
 
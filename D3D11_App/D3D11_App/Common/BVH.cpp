@@ -0,0 +1,1372 @@
+#include "BVH.h"
+
+namespace
+{
+	const UINT BinCount = 12;
+	const UINT StackSize = BVHBuilder::MaxDepth + 2;
+
+	float Component(const XMFLOAT3& v, int axis)
+	{
+		return (&v.x)[axis];
+	}
+
+	float HalfArea(const XMFLOAT3& vmin, const XMFLOAT3& vmax)
+	{
+		float dx = vmax.x - vmin.x;
+		float dy = vmax.y - vmin.y;
+		float dz = vmax.z - vmin.z;
+		return dx * dy + dy * dz + dz * dx;
+	}
+
+	struct Bin
+	{
+		XMVECTOR BoundsMin;
+		XMVECTOR BoundsMax;
+		UINT Count;
+	};
+
+	struct BuildContext
+	{
+		const std::vector<XMFLOAT3>* PrimMin;
+		const std::vector<XMFLOAT3>* PrimMax;
+		std::vector<XMFLOAT3> Centroids;
+		std::vector<BVHNode>* Nodes;
+		std::vector<UINT>* Order;
+		UINT MaxLeafSize;
+	};
+
+	void ComputeNodeBounds(BuildContext& ctx, UINT nodeIndex)
+	{
+		BVHNode& node = (*ctx.Nodes)[nodeIndex];
+
+		XMVECTOR vmin = XMVectorReplicate(+MathHelper::Infinity);
+		XMVECTOR vmax = XMVectorReplicate(-MathHelper::Infinity);
+		for (UINT i = node.First; i < node.First + node.Count; ++i)
+		{
+			UINT prim = (*ctx.Order)[i];
+			vmin = XMVectorMin(vmin, XMLoadFloat3(&(*ctx.PrimMin)[prim]));
+			vmax = XMVectorMax(vmax, XMLoadFloat3(&(*ctx.PrimMax)[prim]));
+		}
+
+		XMStoreFloat3(&node.BoundsMin, vmin);
+		XMStoreFloat3(&node.BoundsMax, vmax);
+	}
+
+	void Subdivide(BuildContext& ctx, UINT nodeIndex, UINT depth)
+	{
+		BVHNode node = (*ctx.Nodes)[nodeIndex];
+		std::vector<UINT>& order = *ctx.Order;
+
+		if (node.Count <= ctx.MaxLeafSize || depth >= BVHBuilder::MaxDepth)
+		{
+			return;
+		}
+
+		// Bin the primitives by centroid along the axis of the largest centroid extent.
+		XMVECTOR cmin = XMVectorReplicate(+MathHelper::Infinity);
+		XMVECTOR cmax = XMVectorReplicate(-MathHelper::Infinity);
+		for (UINT i = node.First; i < node.First + node.Count; ++i)
+		{
+			XMVECTOR c = XMLoadFloat3(&ctx.Centroids[order[i]]);
+			cmin = XMVectorMin(cmin, c);
+			cmax = XMVectorMax(cmax, c);
+		}
+
+		XMFLOAT3 centroidMin, centroidMax;
+		XMStoreFloat3(&centroidMin, cmin);
+		XMStoreFloat3(&centroidMax, cmax);
+
+		int axis = 0;
+		float extent = centroidMax.x - centroidMin.x;
+		if (centroidMax.y - centroidMin.y > extent)
+		{
+			axis = 1;
+			extent = centroidMax.y - centroidMin.y;
+		}
+		if (centroidMax.z - centroidMin.z > extent)
+		{
+			axis = 2;
+			extent = centroidMax.z - centroidMin.z;
+		}
+
+		// All centroids coincide; there is no useful split.
+		if (extent <= 0.0f)
+		{
+			return;
+		}
+
+		float axisMin = Component(centroidMin, axis);
+		float scale = BinCount / extent;
+
+		Bin bins[BinCount];
+		for (UINT b = 0; b < BinCount; ++b)
+		{
+			bins[b].BoundsMin = XMVectorReplicate(+MathHelper::Infinity);
+			bins[b].BoundsMax = XMVectorReplicate(-MathHelper::Infinity);
+			bins[b].Count = 0;
+		}
+
+		for (UINT i = node.First; i < node.First + node.Count; ++i)
+		{
+			UINT prim = order[i];
+			UINT b = MathHelper::Min((UINT)((Component(ctx.Centroids[prim], axis) - axisMin) * scale), BinCount - 1);
+			bins[b].BoundsMin = XMVectorMin(bins[b].BoundsMin, XMLoadFloat3(&(*ctx.PrimMin)[prim]));
+			bins[b].BoundsMax = XMVectorMax(bins[b].BoundsMax, XMLoadFloat3(&(*ctx.PrimMax)[prim]));
+			++bins[b].Count;
+		}
+
+		// Sweep from the right to get the cost of every right hand side, then
+		// from the left to evaluate each of the BinCount - 1 split planes.
+		float rightArea[BinCount];
+		UINT rightCount[BinCount];
+		XMVECTOR rmin = XMVectorReplicate(+MathHelper::Infinity);
+		XMVECTOR rmax = XMVectorReplicate(-MathHelper::Infinity);
+		UINT count = 0;
+		for (UINT b = BinCount - 1; b > 0; --b)
+		{
+			rmin = XMVectorMin(rmin, bins[b].BoundsMin);
+			rmax = XMVectorMax(rmax, bins[b].BoundsMax);
+			count += bins[b].Count;
+
+			XMFLOAT3 bmin, bmax;
+			XMStoreFloat3(&bmin, rmin);
+			XMStoreFloat3(&bmax, rmax);
+			rightArea[b] = count > 0 ? HalfArea(bmin, bmax) : 0.0f;
+			rightCount[b] = count;
+		}
+
+		float bestCost = MathHelper::Infinity;
+		UINT bestSplit = 0;
+		XMVECTOR lmin = XMVectorReplicate(+MathHelper::Infinity);
+		XMVECTOR lmax = XMVectorReplicate(-MathHelper::Infinity);
+		count = 0;
+		for (UINT b = 0; b < BinCount - 1; ++b)
+		{
+			lmin = XMVectorMin(lmin, bins[b].BoundsMin);
+			lmax = XMVectorMax(lmax, bins[b].BoundsMax);
+			count += bins[b].Count;
+
+			if (count == 0 || rightCount[b + 1] == 0)
+			{
+				continue;
+			}
+
+			XMFLOAT3 bmin, bmax;
+			XMStoreFloat3(&bmin, lmin);
+			XMStoreFloat3(&bmax, lmax);
+			float cost = count * HalfArea(bmin, bmax) + rightCount[b + 1] * rightArea[b + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestSplit = b + 1;
+			}
+		}
+
+		UINT* first = &order[node.First];
+		UINT* last = first + node.Count;
+		UINT* middle = nullptr;
+
+		float leafCost = node.Count * HalfArea(node.BoundsMin, node.BoundsMax);
+		if (bestCost < MathHelper::Infinity)
+		{
+			if (bestCost >= leafCost && node.Count <= 4 * ctx.MaxLeafSize)
+			{
+				return;
+			}
+
+			middle = std::partition(first, last, [&](UINT prim)
+			{
+				UINT b = MathHelper::Min((UINT)((Component(ctx.Centroids[prim], axis) - axisMin) * scale), BinCount - 1);
+				return b < bestSplit;
+			});
+		}
+
+		// Fall back to a median split when binning could not separate the primitives.
+		if (middle == nullptr || middle == first || middle == last)
+		{
+			middle = first + node.Count / 2;
+			std::nth_element(first, middle, last, [&](UINT a, UINT b)
+			{
+				return Component(ctx.Centroids[a], axis) < Component(ctx.Centroids[b], axis);
+			});
+		}
+
+		UINT leftCount = (UINT)(middle - first);
+
+		BVHNode left;
+		left.First = node.First;
+		left.Count = leftCount;
+
+		BVHNode right;
+		right.First = node.First + leftCount;
+		right.Count = node.Count - leftCount;
+
+		UINT leftIndex = (UINT)ctx.Nodes->size();
+		ctx.Nodes->push_back(left);
+		ctx.Nodes->push_back(right);
+
+		(*ctx.Nodes)[nodeIndex].First = leftIndex;
+		(*ctx.Nodes)[nodeIndex].Count = 0;
+
+		ComputeNodeBounds(ctx, leftIndex);
+		ComputeNodeBounds(ctx, leftIndex + 1);
+
+		Subdivide(ctx, leftIndex, depth + 1);
+		Subdivide(ctx, leftIndex + 1, depth + 1);
+	}
+
+	// Rays of a batch are traced in packets of this many, one per SIMD lane.
+	const UINT PacketSize = 4;
+
+	// Cells per axis of the grid that batch ray origins are sorted by.
+	const UINT OriginCellBits = 9;
+
+	// Spreads the low 10 bits of x to every third bit.
+	UINT ExpandBits(UINT x)
+	{
+		x &= 0x3ff;
+		x = (x | x << 16) & 0x030000ff;
+		x = (x | x << 8) & 0x0300f00f;
+		x = (x | x << 4) & 0x030c30c3;
+		x = (x | x << 2) & 0x09249249;
+		return x;
+	}
+
+	// Up to four rays in structure of arrays form.  Unused lanes repeat the
+	// first ray and are never active.
+	struct RayPacket
+	{
+		XMVECTOR OriginX, OriginY, OriginZ;
+		XMVECTOR DirX, DirY, DirZ;
+		XMVECTOR InvDirX, InvDirY, InvDirZ;
+		XMVECTOR MaxDist;
+		XMVECTOR Active;
+		UINT Ray[PacketSize];
+		UINT Count;
+
+		RayPacket(const BVHRayQuery* rays, const UINT* order, UINT count)
+			: Count(count)
+		{
+			XMFLOAT4 o[3], d[3], inv[3];
+			XMFLOAT4 maxDist;
+			XMUINT4 active;
+			for (UINT lane = 0; lane < PacketSize; ++lane)
+			{
+				Ray[lane] = order[lane < count ? lane : 0];
+				const BVHRayQuery& query = rays[Ray[lane]];
+
+				// Same nudged reciprocal as the single ray path.
+				BVHRay ray(XMLoadFloat3(&query.Origin), XMLoadFloat3(&query.Direction));
+
+				(&o[0].x)[lane] = ray.Origin.x;
+				(&o[1].x)[lane] = ray.Origin.y;
+				(&o[2].x)[lane] = ray.Origin.z;
+				(&d[0].x)[lane] = ray.Direction.x;
+				(&d[1].x)[lane] = ray.Direction.y;
+				(&d[2].x)[lane] = ray.Direction.z;
+				(&inv[0].x)[lane] = ray.InvDirection.x;
+				(&inv[1].x)[lane] = ray.InvDirection.y;
+				(&inv[2].x)[lane] = ray.InvDirection.z;
+				(&maxDist.x)[lane] = query.MaxDist;
+				(&active.x)[lane] = lane < count ? 0xffffffff : 0;
+			}
+
+			OriginX = XMLoadFloat4(&o[0]);
+			OriginY = XMLoadFloat4(&o[1]);
+			OriginZ = XMLoadFloat4(&o[2]);
+			DirX = XMLoadFloat4(&d[0]);
+			DirY = XMLoadFloat4(&d[1]);
+			DirZ = XMLoadFloat4(&d[2]);
+			InvDirX = XMLoadFloat4(&inv[0]);
+			InvDirY = XMLoadFloat4(&inv[1]);
+			InvDirZ = XMLoadFloat4(&inv[2]);
+			MaxDist = XMLoadFloat4(&maxDist);
+			Active = XMLoadUInt4(&active);
+		}
+	};
+
+	bool AnyLane(FXMVECTOR mask)
+	{
+		return !XMVector4EqualInt(mask, XMVectorZero());
+	}
+
+	float MinLane(FXMVECTOR v)
+	{
+		XMFLOAT4 f;
+		XMStoreFloat4(&f, v);
+		return MathHelper::Min(MathHelper::Min(f.x, f.y), MathHelper::Min(f.z, f.w));
+	}
+
+	// Slab test of BVHRay::IntersectBounds for every lane.  Returns the mask
+	// of the lanes that reach the bounds within maxDist and the distance at
+	// which they enter, or infinity for the others.
+	XMVECTOR IntersectPacketBounds(const RayPacket& packet, const BVHNode& node, FXMVECTOR maxDist, XMVECTOR* pEntry)
+	{
+		XMVECTOR tx1 = (XMVectorReplicate(node.BoundsMin.x) - packet.OriginX) * packet.InvDirX;
+		XMVECTOR tx2 = (XMVectorReplicate(node.BoundsMax.x) - packet.OriginX) * packet.InvDirX;
+		XMVECTOR tmin = XMVectorMin(tx1, tx2);
+		XMVECTOR tmax = XMVectorMax(tx1, tx2);
+
+		XMVECTOR ty1 = (XMVectorReplicate(node.BoundsMin.y) - packet.OriginY) * packet.InvDirY;
+		XMVECTOR ty2 = (XMVectorReplicate(node.BoundsMax.y) - packet.OriginY) * packet.InvDirY;
+		tmin = XMVectorMax(tmin, XMVectorMin(ty1, ty2));
+		tmax = XMVectorMin(tmax, XMVectorMax(ty1, ty2));
+
+		XMVECTOR tz1 = (XMVectorReplicate(node.BoundsMin.z) - packet.OriginZ) * packet.InvDirZ;
+		XMVECTOR tz2 = (XMVectorReplicate(node.BoundsMax.z) - packet.OriginZ) * packet.InvDirZ;
+		tmin = XMVectorMax(tmin, XMVectorMin(tz1, tz2));
+		tmax = XMVectorMin(tmax, XMVectorMax(tz1, tz2));
+
+		tmin = XMVectorMax(tmin, XMVectorZero());
+		tmax = XMVectorMin(tmax, maxDist);
+
+		XMVECTOR mask = XMVectorLessOrEqual(tmin, tmax);
+
+		if (pEntry)
+		{
+			*pEntry = XMVectorSelect(XMVectorReplicate(MathHelper::Infinity), tmin, mask);
+		}
+
+		return mask;
+	}
+
+	// Moller-Trumbore of MeshBVH::IntersectTriangle for every lane.  Returns
+	// the mask of the lanes that hit the triangle closer than maxDist.
+	XMVECTOR IntersectPacketTriangle(const RayPacket& packet, const XMFLOAT3& v0, const XMFLOAT3& edge1,
+		const XMFLOAT3& edge2, FXMVECTOR maxDist, XMVECTOR* pDist)
+	{
+		XMVECTOR e1x = XMVectorReplicate(edge1.x);
+		XMVECTOR e1y = XMVectorReplicate(edge1.y);
+		XMVECTOR e1z = XMVectorReplicate(edge1.z);
+		XMVECTOR e2x = XMVectorReplicate(edge2.x);
+		XMVECTOR e2y = XMVectorReplicate(edge2.y);
+		XMVECTOR e2z = XMVectorReplicate(edge2.z);
+
+		// p = direction x e2
+		XMVECTOR px = packet.DirY * e2z - packet.DirZ * e2y;
+		XMVECTOR py = packet.DirZ * e2x - packet.DirX * e2z;
+		XMVECTOR pz = packet.DirX * e2y - packet.DirY * e2x;
+
+		XMVECTOR det = e1x * px + e1y * py + e1z * pz;
+		XMVECTOR mask = XMVectorGreaterOrEqual(XMVectorAbs(det), XMVectorReplicate(1e-20f));
+
+		XMVECTOR invDet = XMVectorReciprocal(det);
+
+		XMVECTOR sx = packet.OriginX - XMVectorReplicate(v0.x);
+		XMVECTOR sy = packet.OriginY - XMVectorReplicate(v0.y);
+		XMVECTOR sz = packet.OriginZ - XMVectorReplicate(v0.z);
+
+		XMVECTOR u = (sx * px + sy * py + sz * pz) * invDet;
+		mask = XMVectorAndInt(mask, XMVectorGreaterOrEqual(u, XMVectorZero()));
+		mask = XMVectorAndInt(mask, XMVectorLessOrEqual(u, XMVectorSplatOne()));
+
+		// q = s x e1
+		XMVECTOR qx = sy * e1z - sz * e1y;
+		XMVECTOR qy = sz * e1x - sx * e1z;
+		XMVECTOR qz = sx * e1y - sy * e1x;
+
+		XMVECTOR v = (packet.DirX * qx + packet.DirY * qy + packet.DirZ * qz) * invDet;
+		mask = XMVectorAndInt(mask, XMVectorGreaterOrEqual(v, XMVectorZero()));
+		mask = XMVectorAndInt(mask, XMVectorLessOrEqual(u + v, XMVectorSplatOne()));
+
+		XMVECTOR t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+		mask = XMVectorAndInt(mask, XMVectorGreaterOrEqual(t, XMVectorZero()));
+		mask = XMVectorAndInt(mask, XMVectorLess(t, maxDist));
+
+		*pDist = t;
+		return mask;
+	}
+}
+
+void TransformBounds(const Box& box, CXMMATRIX W, XMFLOAT3& outMin, XMFLOAT3& outMax)
+{
+	XMVECTOR c = XMVector3TransformCoord(XMLoadFloat3(&box.center), W);
+
+	// The world extent along each axis is the sum of the absolute
+	// projections of the three local half axes.
+	XMVECTOR e = XMVectorAbs(W.r[0]) * XMVectorReplicate(box.extent.x);
+	e += XMVectorAbs(W.r[1]) * XMVectorReplicate(box.extent.y);
+	e += XMVectorAbs(W.r[2]) * XMVectorReplicate(box.extent.z);
+
+	XMStoreFloat3(&outMin, c - e);
+	XMStoreFloat3(&outMax, c + e);
+}
+
+BVHRay::BVHRay(FXMVECTOR origin, FXMVECTOR direction)
+{
+	static const float Epsilon = 1e-20f;
+
+	XMStoreFloat3(&Origin, origin);
+	XMStoreFloat3(&Direction, direction);
+
+	// Nudge zero components so that the slab test never computes 0 * inf.
+	XMFLOAT3 d = Direction;
+	if (fabsf(d.x) < Epsilon) d.x = d.x < 0.0f ? -Epsilon : Epsilon;
+	if (fabsf(d.y) < Epsilon) d.y = d.y < 0.0f ? -Epsilon : Epsilon;
+	if (fabsf(d.z) < Epsilon) d.z = d.z < 0.0f ? -Epsilon : Epsilon;
+
+	InvDirection = XMFLOAT3(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+}
+
+float BVHRay::IntersectBounds(const BVHNode& node, float maxDist) const
+{
+	return IntersectBounds(node.BoundsMin, node.BoundsMax, maxDist);
+}
+
+float BVHRay::IntersectBounds(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax, float maxDist) const
+{
+	float tx1 = (boundsMin.x - Origin.x) * InvDirection.x;
+	float tx2 = (boundsMax.x - Origin.x) * InvDirection.x;
+	float tmin = MathHelper::Min(tx1, tx2);
+	float tmax = MathHelper::Max(tx1, tx2);
+
+	float ty1 = (boundsMin.y - Origin.y) * InvDirection.y;
+	float ty2 = (boundsMax.y - Origin.y) * InvDirection.y;
+	tmin = MathHelper::Max(tmin, MathHelper::Min(ty1, ty2));
+	tmax = MathHelper::Min(tmax, MathHelper::Max(ty1, ty2));
+
+	float tz1 = (boundsMin.z - Origin.z) * InvDirection.z;
+	float tz2 = (boundsMax.z - Origin.z) * InvDirection.z;
+	tmin = MathHelper::Max(tmin, MathHelper::Min(tz1, tz2));
+	tmax = MathHelper::Min(tmax, MathHelper::Max(tz1, tz2));
+
+	tmin = MathHelper::Max(tmin, 0.0f);
+	tmax = MathHelper::Min(tmax, maxDist);
+
+	return tmin <= tmax ? tmin : MathHelper::Infinity;
+}
+
+FrustumQuery::FrustumQuery(const Frustum& frustum)
+{
+	XMVECTOR planes[6];
+	for (int i = 0; i < 6; ++i)
+	{
+		planes[i] = frustum.m_Planes[i];
+	}
+
+	Load(planes);
+}
+
+FrustumQuery::FrustumQuery(const Frustum& frustum, CXMMATRIX world)
+{
+	// For points p_world = p_local * W a world plane becomes the local plane P * W^T.
+	XMMATRIX toLocal = XMMatrixTranspose(world);
+
+	XMVECTOR planes[6];
+	for (int i = 0; i < 6; ++i)
+	{
+		planes[i] = XMPlaneTransform(frustum.m_Planes[i], toLocal);
+	}
+
+	Load(planes);
+}
+
+FrustumQuery::FrustumQuery(CXMMATRIX viewProj)
+{
+	XMFLOAT4 p[6];
+	ExtractFrustumPlanes(p, viewProj);
+
+	XMVECTOR planes[6];
+	for (int i = 0; i < 6; ++i)
+	{
+		planes[i] = XMLoadFloat4(&p[i]);
+	}
+
+	Load(planes);
+}
+
+void FrustumQuery::Load(const XMVECTOR planes[6])
+{
+	XMFLOAT4 p[8];
+	for (int i = 0; i < 6; ++i)
+	{
+		XMStoreFloat4(&p[i], planes[i]);
+	}
+	p[6] = p[4];
+	p[7] = p[5];
+
+	for (int k = 0; k < 2; ++k)
+	{
+		const XMFLOAT4* q = &p[4 * k];
+		m_X[k] = XMVectorSet(q[0].x, q[1].x, q[2].x, q[3].x);
+		m_Y[k] = XMVectorSet(q[0].y, q[1].y, q[2].y, q[3].y);
+		m_Z[k] = XMVectorSet(q[0].z, q[1].z, q[2].z, q[3].z);
+		m_W[k] = XMVectorSet(q[0].w, q[1].w, q[2].w, q[3].w);
+	}
+}
+
+FrustumQuery::Containment FrustumQuery::ClassifyBounds(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax) const
+{
+	XMVECTOR Zero = XMVectorZero();
+
+	XMVECTOR minX = XMVectorReplicate(boundsMin.x);
+	XMVECTOR minY = XMVectorReplicate(boundsMin.y);
+	XMVECTOR minZ = XMVectorReplicate(boundsMin.z);
+	XMVECTOR maxX = XMVectorReplicate(boundsMax.x);
+	XMVECTOR maxY = XMVectorReplicate(boundsMax.y);
+	XMVECTOR maxZ = XMVectorReplicate(boundsMax.z);
+
+	bool inside = true;
+	for (int k = 0; k < 2; ++k)
+	{
+		// Per plane, the corner farthest along the normal (p) and the nearest one (n).
+		XMVECTOR selX = XMVectorGreater(m_X[k], Zero);
+		XMVECTOR selY = XMVectorGreater(m_Y[k], Zero);
+		XMVECTOR selZ = XMVectorGreater(m_Z[k], Zero);
+
+		XMVECTOR px = XMVectorSelect(minX, maxX, selX);
+		XMVECTOR py = XMVectorSelect(minY, maxY, selY);
+		XMVECTOR pz = XMVectorSelect(minZ, maxZ, selZ);
+
+		XMVECTOR distP = XMVectorMultiplyAdd(px, m_X[k], XMVectorMultiplyAdd(py, m_Y[k], XMVectorMultiplyAdd(pz, m_Z[k], m_W[k])));
+
+		// Same rule as Frustum::IsIntersected: the box is out if its p corner is
+		// not strictly in front of some plane.
+		if (!XMVector4Greater(distP, Zero))
+		{
+			return Outside;
+		}
+
+		XMVECTOR nx = XMVectorSelect(maxX, minX, selX);
+		XMVECTOR ny = XMVectorSelect(maxY, minY, selY);
+		XMVECTOR nz = XMVectorSelect(maxZ, minZ, selZ);
+
+		XMVECTOR distN = XMVectorMultiplyAdd(nx, m_X[k], XMVectorMultiplyAdd(ny, m_Y[k], XMVectorMultiplyAdd(nz, m_Z[k], m_W[k])));
+		inside = inside && XMVector4GreaterOrEqual(distN, Zero);
+	}
+
+	return inside ? Inside : Intersects;
+}
+
+bool FrustumQuery::IsTriangleOutside(FXMVECTOR v0, FXMVECTOR v1, FXMVECTOR v2) const
+{
+	XMVECTOR Zero = XMVectorZero();
+
+	for (int k = 0; k < 2; ++k)
+	{
+		XMVECTOR d0 = XMVectorMultiplyAdd(XMVectorSplatX(v0), m_X[k],
+			XMVectorMultiplyAdd(XMVectorSplatY(v0), m_Y[k], XMVectorMultiplyAdd(XMVectorSplatZ(v0), m_Z[k], m_W[k])));
+		XMVECTOR d1 = XMVectorMultiplyAdd(XMVectorSplatX(v1), m_X[k],
+			XMVectorMultiplyAdd(XMVectorSplatY(v1), m_Y[k], XMVectorMultiplyAdd(XMVectorSplatZ(v1), m_Z[k], m_W[k])));
+		XMVECTOR d2 = XMVectorMultiplyAdd(XMVectorSplatX(v2), m_X[k],
+			XMVectorMultiplyAdd(XMVectorSplatY(v2), m_Y[k], XMVectorMultiplyAdd(XMVectorSplatZ(v2), m_Z[k], m_W[k])));
+
+		XMVECTOR behind = XMVectorAndInt(XMVectorLessOrEqual(d0, Zero),
+			XMVectorAndInt(XMVectorLessOrEqual(d1, Zero), XMVectorLessOrEqual(d2, Zero)));
+
+		if (XMVector4NotEqualInt(behind, XMVectorFalseInt()))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void BVHBuilder::Build(const std::vector<XMFLOAT3>& primMin, const std::vector<XMFLOAT3>& primMax,
+	UINT maxLeafSize, std::vector<BVHNode>& nodes, std::vector<UINT>& order)
+{
+	UINT primCount = (UINT)primMin.size();
+
+	nodes.clear();
+	order.resize(primCount);
+	for (UINT i = 0; i < primCount; ++i)
+	{
+		order[i] = i;
+	}
+
+	BuildContext ctx;
+	ctx.PrimMin = &primMin;
+	ctx.PrimMax = &primMax;
+	ctx.Nodes = &nodes;
+	ctx.Order = &order;
+	ctx.MaxLeafSize = MathHelper::Max(maxLeafSize, 1u);
+
+	ctx.Centroids.resize(primCount);
+	for (UINT i = 0; i < primCount; ++i)
+	{
+		XMVECTOR c = 0.5f * (XMLoadFloat3(&primMin[i]) + XMLoadFloat3(&primMax[i]));
+		XMStoreFloat3(&ctx.Centroids[i], c);
+	}
+
+	// A binary tree with at most one primitive per leaf has 2n - 1 nodes.
+	nodes.reserve(MathHelper::Max(2 * primCount, 1u));
+
+	BVHNode root;
+	root.First = 0;
+	root.Count = primCount;
+	nodes.push_back(root);
+
+	if (primCount == 0)
+	{
+		nodes[0].BoundsMin = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		nodes[0].BoundsMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		return;
+	}
+
+	ComputeNodeBounds(ctx, 0);
+	Subdivide(ctx, 0, 0);
+}
+
+MeshBVH::MeshBVH()
+{
+
+}
+
+void MeshBVH::Build(const std::vector<XMFLOAT3>& vertices, const std::vector<UINT>& indices)
+{
+	UINT triCount = (UINT)indices.size() / 3;
+
+	std::vector<XMFLOAT3> primMin(triCount);
+	std::vector<XMFLOAT3> primMax(triCount);
+	for (UINT i = 0; i < triCount; ++i)
+	{
+		XMVECTOR v0 = XMLoadFloat3(&vertices[indices[i * 3 + 0]]);
+		XMVECTOR v1 = XMLoadFloat3(&vertices[indices[i * 3 + 1]]);
+		XMVECTOR v2 = XMLoadFloat3(&vertices[indices[i * 3 + 2]]);
+
+		XMStoreFloat3(&primMin[i], XMVectorMin(XMVectorMin(v0, v1), v2));
+		XMStoreFloat3(&primMax[i], XMVectorMax(XMVectorMax(v0, v1), v2));
+	}
+
+	std::vector<UINT> order;
+	BVHBuilder::Build(primMin, primMax, 4, m_Nodes, order);
+
+	m_Triangles.resize(triCount);
+	for (UINT i = 0; i < triCount; ++i)
+	{
+		UINT t = order[i];
+		XMVECTOR v0 = XMLoadFloat3(&vertices[indices[t * 3 + 0]]);
+		XMVECTOR v1 = XMLoadFloat3(&vertices[indices[t * 3 + 1]]);
+		XMVECTOR v2 = XMLoadFloat3(&vertices[indices[t * 3 + 2]]);
+
+		XMStoreFloat3(&m_Triangles[i].V0, v0);
+		XMStoreFloat3(&m_Triangles[i].Edge1, v1 - v0);
+		XMStoreFloat3(&m_Triangles[i].Edge2, v2 - v0);
+		m_Triangles[i].Index = t;
+	}
+
+	XMVECTOR vmin = XMLoadFloat3(&m_Nodes[0].BoundsMin);
+	XMVECTOR vmax = XMLoadFloat3(&m_Nodes[0].BoundsMax);
+	XMStoreFloat3(&m_Bounds.center, 0.5f * (vmin + vmax));
+	XMStoreFloat3(&m_Bounds.extent, 0.5f * (vmax - vmin));
+}
+
+bool MeshBVH::Intersect(FXMVECTOR rayPos, FXMVECTOR rayDir, float maxDist, float* pDist, UINT* pTriangle) const
+{
+	BVHRay ray(rayPos, rayDir);
+	return Intersect(ray, maxDist, pDist, pTriangle);
+}
+
+bool MeshBVH::Intersect(const BVHRay& ray, float maxDist, float* pDist, UINT* pTriangle) const
+{
+	if (m_Triangles.empty() || ray.IntersectBounds(m_Nodes[0], maxDist) == MathHelper::Infinity)
+	{
+		return false;
+	}
+
+	float nearest = maxDist;
+	UINT hitTriangle = 0;
+	bool hit = false;
+
+	UINT stack[StackSize];
+	UINT top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const BVHNode& node = m_Nodes[stack[--top]];
+
+		if (node.IsLeaf())
+		{
+			for (UINT i = node.First; i < node.First + node.Count; ++i)
+			{
+				float t;
+				if (IntersectTriangle(ray, m_Triangles[i], nearest, &t))
+				{
+					nearest = t;
+					hitTriangle = m_Triangles[i].Index;
+					hit = true;
+				}
+			}
+			continue;
+		}
+
+		// Visit the nearer child first so that it can shorten the ray for the other.
+		UINT nearChild = node.First;
+		UINT farChild = node.First + 1;
+		float tNear = ray.IntersectBounds(m_Nodes[nearChild], nearest);
+		float tFar = ray.IntersectBounds(m_Nodes[farChild], nearest);
+		if (tFar < tNear)
+		{
+			std::swap(nearChild, farChild);
+			std::swap(tNear, tFar);
+		}
+
+		if (tFar != MathHelper::Infinity)
+		{
+			stack[top++] = farChild;
+		}
+		if (tNear != MathHelper::Infinity)
+		{
+			stack[top++] = nearChild;
+		}
+	}
+
+	if (hit)
+	{
+		if (pDist)
+		{
+			*pDist = nearest;
+		}
+		if (pTriangle)
+		{
+			*pTriangle = hitTriangle;
+		}
+	}
+
+	return hit;
+}
+
+bool MeshBVH::IsOccluded(const BVHRay& ray, float maxDist) const
+{
+	if (m_Triangles.empty() || ray.IntersectBounds(m_Nodes[0], maxDist) == MathHelper::Infinity)
+	{
+		return false;
+	}
+
+	UINT stack[StackSize];
+	UINT top = 0;
+	stack[top++] = 0;
+
+	// Any hit will do, so there is no need to order the children.
+	while (top > 0)
+	{
+		const BVHNode& node = m_Nodes[stack[--top]];
+
+		if (node.IsLeaf())
+		{
+			for (UINT i = node.First; i < node.First + node.Count; ++i)
+			{
+				float t;
+				if (IntersectTriangle(ray, m_Triangles[i], maxDist, &t))
+				{
+					return true;
+				}
+			}
+			continue;
+		}
+
+		if (ray.IntersectBounds(m_Nodes[node.First + 1], maxDist) != MathHelper::Infinity)
+		{
+			stack[top++] = node.First + 1;
+		}
+		if (ray.IntersectBounds(m_Nodes[node.First], maxDist) != MathHelper::Infinity)
+		{
+			stack[top++] = node.First;
+		}
+	}
+
+	return false;
+}
+
+void MeshBVH::IntersectBatch(const BVHRayQuery* rays, UINT count, BVHRayHit* hits) const
+{
+	for (UINT i = 0; i < count; ++i)
+	{
+		hits[i].Distance = MathHelper::Infinity;
+		hits[i].Triangle = BVHRayHit::Miss;
+	}
+
+	if (m_Triangles.empty() || count == 0)
+	{
+		return;
+	}
+
+	std::vector<UINT> order;
+	SortBatch(rays, count, order);
+
+	// Every entry remembers which lanes reached the node when it was pushed
+	// and where they entered it.
+	struct Entry
+	{
+		XMVECTOR Mask;
+		XMVECTOR Dist;
+		UINT Node;
+	};
+
+	for (UINT first = 0; first < count; first += PacketSize)
+	{
+		RayPacket packet(rays, &order[first], MathHelper::Min(PacketSize, count - first));
+
+		XMVECTOR nearest = packet.MaxDist;
+		UINT hitTriangle[PacketSize] = { BVHRayHit::Miss, BVHRayHit::Miss, BVHRayHit::Miss, BVHRayHit::Miss };
+
+		Entry stack[StackSize];
+		UINT top = 0;
+
+		XMVECTOR rootDist;
+		XMVECTOR rootMask = XMVectorAndInt(IntersectPacketBounds(packet, m_Nodes[0], nearest, &rootDist), packet.Active);
+		if (AnyLane(rootMask))
+		{
+			stack[top].Mask = rootMask;
+			stack[top].Dist = rootDist;
+			stack[top].Node = 0;
+			++top;
+		}
+
+		while (top > 0)
+		{
+			--top;
+			const BVHNode& node = m_Nodes[stack[top].Node];
+
+			// Drop the lanes that found a closer hit since the node was pushed.
+			XMVECTOR mask = XMVectorAndInt(stack[top].Mask, XMVectorLessOrEqual(stack[top].Dist, nearest));
+			if (!AnyLane(mask))
+			{
+				continue;
+			}
+
+			if (node.IsLeaf())
+			{
+				for (UINT i = node.First; i < node.First + node.Count; ++i)
+				{
+					const Triangle& tri = m_Triangles[i];
+
+					XMVECTOR t;
+					XMVECTOR hit = XMVectorAndInt(IntersectPacketTriangle(packet, tri.V0, tri.Edge1, tri.Edge2, nearest, &t), mask);
+					if (!AnyLane(hit))
+					{
+						continue;
+					}
+
+					nearest = XMVectorSelect(nearest, t, hit);
+
+					XMUINT4 hitLanes;
+					XMStoreUInt4(&hitLanes, hit);
+					for (UINT lane = 0; lane < PacketSize; ++lane)
+					{
+						if ((&hitLanes.x)[lane])
+						{
+							hitTriangle[lane] = tri.Index;
+						}
+					}
+				}
+				continue;
+			}
+
+			// Visit the child the lanes enter first, so that its hits can
+			// shorten the rays for the other.
+			UINT nearChild = node.First;
+			UINT farChild = node.First + 1;
+			XMVECTOR nearDist, farDist;
+			XMVECTOR nearMask = XMVectorAndInt(IntersectPacketBounds(packet, m_Nodes[nearChild], nearest, &nearDist), mask);
+			XMVECTOR farMask = XMVectorAndInt(IntersectPacketBounds(packet, m_Nodes[farChild], nearest, &farDist), mask);
+			if (MinLane(XMVectorSelect(XMVectorReplicate(MathHelper::Infinity), farDist, farMask)) <
+				MinLane(XMVectorSelect(XMVectorReplicate(MathHelper::Infinity), nearDist, nearMask)))
+			{
+				std::swap(nearChild, farChild);
+				std::swap(nearMask, farMask);
+				std::swap(nearDist, farDist);
+			}
+
+			if (AnyLane(farMask))
+			{
+				stack[top].Mask = farMask;
+				stack[top].Dist = farDist;
+				stack[top].Node = farChild;
+				++top;
+			}
+			if (AnyLane(nearMask))
+			{
+				stack[top].Mask = nearMask;
+				stack[top].Dist = nearDist;
+				stack[top].Node = nearChild;
+				++top;
+			}
+		}
+
+		XMFLOAT4 dist;
+		XMStoreFloat4(&dist, nearest);
+		for (UINT lane = 0; lane < packet.Count; ++lane)
+		{
+			if (hitTriangle[lane] != BVHRayHit::Miss)
+			{
+				hits[packet.Ray[lane]].Distance = (&dist.x)[lane];
+				hits[packet.Ray[lane]].Triangle = hitTriangle[lane];
+			}
+		}
+	}
+}
+
+void MeshBVH::OccludedBatch(const BVHRayQuery* rays, UINT count, BYTE* occluded) const
+{
+	for (UINT i = 0; i < count; ++i)
+	{
+		occluded[i] = 0;
+	}
+
+	if (m_Triangles.empty() || count == 0)
+	{
+		return;
+	}
+
+	std::vector<UINT> order;
+	SortBatch(rays, count, order);
+
+	struct Entry
+	{
+		XMVECTOR Mask;
+		UINT Node;
+	};
+
+	for (UINT first = 0; first < count; first += PacketSize)
+	{
+		RayPacket packet(rays, &order[first], MathHelper::Min(PacketSize, count - first));
+
+		// Lanes drop out as soon as they hit anything.
+		XMVECTOR active = packet.Active;
+
+		Entry stack[StackSize];
+		UINT top = 0;
+
+		XMVECTOR rootMask = XMVectorAndInt(IntersectPacketBounds(packet, m_Nodes[0], packet.MaxDist, nullptr), active);
+		if (AnyLane(rootMask))
+		{
+			stack[top].Mask = rootMask;
+			stack[top].Node = 0;
+			++top;
+		}
+
+		while (top > 0)
+		{
+			--top;
+			const BVHNode& node = m_Nodes[stack[top].Node];
+			XMVECTOR mask = XMVectorAndInt(stack[top].Mask, active);
+			if (!AnyLane(mask))
+			{
+				continue;
+			}
+
+			if (node.IsLeaf())
+			{
+				for (UINT i = node.First; i < node.First + node.Count && AnyLane(mask); ++i)
+				{
+					const Triangle& tri = m_Triangles[i];
+
+					XMVECTOR t;
+					XMVECTOR hit = XMVectorAndInt(IntersectPacketTriangle(packet, tri.V0, tri.Edge1, tri.Edge2, packet.MaxDist, &t), mask);
+					active = XMVectorAndCInt(active, hit);
+					mask = XMVectorAndCInt(mask, hit);
+				}
+
+				if (!AnyLane(active))
+				{
+					break;
+				}
+				continue;
+			}
+
+			XMVECTOR leftMask = XMVectorAndInt(IntersectPacketBounds(packet, m_Nodes[node.First], packet.MaxDist, nullptr), mask);
+			XMVECTOR rightMask = XMVectorAndInt(IntersectPacketBounds(packet, m_Nodes[node.First + 1], packet.MaxDist, nullptr), mask);
+			if (AnyLane(rightMask))
+			{
+				stack[top].Mask = rightMask;
+				stack[top].Node = node.First + 1;
+				++top;
+			}
+			if (AnyLane(leftMask))
+			{
+				stack[top].Mask = leftMask;
+				stack[top].Node = node.First;
+				++top;
+			}
+		}
+
+		XMUINT4 hitLanes;
+		XMStoreUInt4(&hitLanes, XMVectorAndCInt(packet.Active, active));
+		for (UINT lane = 0; lane < packet.Count; ++lane)
+		{
+			occluded[packet.Ray[lane]] = (&hitLanes.x)[lane] ? 1 : 0;
+		}
+	}
+}
+
+void MeshBVH::SelectInFrustum(const FrustumQuery& frustum, std::vector<UINT>& triangles) const
+{
+	if (m_Triangles.empty())
+	{
+		return;
+	}
+
+	// Nodes known to be inside the frustum are pushed with this bit set so
+	// that their subtree is collected without further tests.
+	const UINT InsideBit = 0x80000000;
+
+	UINT stack[StackSize];
+	UINT top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		UINT entry = stack[--top];
+		const BVHNode& node = m_Nodes[entry & ~InsideBit];
+
+		bool inside = (entry & InsideBit) != 0;
+		if (!inside)
+		{
+			FrustumQuery::Containment c = frustum.ClassifyBounds(node.BoundsMin, node.BoundsMax);
+			if (c == FrustumQuery::Outside)
+			{
+				continue;
+			}
+			inside = c == FrustumQuery::Inside;
+		}
+
+		if (node.IsLeaf())
+		{
+			for (UINT i = node.First; i < node.First + node.Count; ++i)
+			{
+				const Triangle& tri = m_Triangles[i];
+				if (!inside)
+				{
+					XMVECTOR v0 = XMLoadFloat3(&tri.V0);
+					XMVECTOR v1 = v0 + XMLoadFloat3(&tri.Edge1);
+					XMVECTOR v2 = v0 + XMLoadFloat3(&tri.Edge2);
+					if (frustum.IsTriangleOutside(v0, v1, v2))
+					{
+						continue;
+					}
+				}
+				triangles.push_back(tri.Index);
+			}
+			continue;
+		}
+
+		UINT flag = inside ? InsideBit : 0;
+		stack[top++] = (node.First + 1) | flag;
+		stack[top++] = node.First | flag;
+	}
+}
+
+const Box& MeshBVH::GetBounds() const
+{
+	return m_Bounds;
+}
+
+UINT MeshBVH::TriangleCount() const
+{
+	return (UINT)m_Triangles.size();
+}
+
+bool MeshBVH::IntersectTriangle(const BVHRay& ray, const Triangle& tri, float maxDist, float* pDist)
+{
+	// Moller-Trumbore, accepting hits on both sides of the triangle.
+	const XMFLOAT3& d = ray.Direction;
+	const XMFLOAT3& e1 = tri.Edge1;
+	const XMFLOAT3& e2 = tri.Edge2;
+
+	// p = direction x e2
+	float px = d.y * e2.z - d.z * e2.y;
+	float py = d.z * e2.x - d.x * e2.z;
+	float pz = d.x * e2.y - d.y * e2.x;
+
+	float det = e1.x * px + e1.y * py + e1.z * pz;
+	if (fabsf(det) < 1e-20f)
+	{
+		// Parallel ray.
+		return false;
+	}
+
+	float invDet = 1.0f / det;
+
+	float sx = ray.Origin.x - tri.V0.x;
+	float sy = ray.Origin.y - tri.V0.y;
+	float sz = ray.Origin.z - tri.V0.z;
+
+	float u = (sx * px + sy * py + sz * pz) * invDet;
+	if (u < 0.0f || u > 1.0f)
+	{
+		return false;
+	}
+
+	// q = s x e1
+	float qx = sy * e1.z - sz * e1.y;
+	float qy = sz * e1.x - sx * e1.z;
+	float qz = sx * e1.y - sy * e1.x;
+
+	float v = (d.x * qx + d.y * qy + d.z * qz) * invDet;
+	if (v < 0.0f || u + v > 1.0f)
+	{
+		return false;
+	}
+
+	float t = (e2.x * qx + e2.y * qy + e2.z * qz) * invDet;
+	if (t < 0.0f || t >= maxDist)
+	{
+		return false;
+	}
+
+	*pDist = t;
+	return true;
+}
+
+void MeshBVH::SortBatch(const BVHRayQuery* rays, UINT count, std::vector<UINT>& order) const
+{
+	// Key: direction octant above the Morton code of the origin cell within
+	// the mesh bounds, above the ray index.
+	XMFLOAT3 boundsMin(m_Bounds.center.x - m_Bounds.extent.x, m_Bounds.center.y - m_Bounds.extent.y,
+		m_Bounds.center.z - m_Bounds.extent.z);
+	float cells = (float)(1u << OriginCellBits);
+	XMFLOAT3 scale(
+		cells / MathHelper::Max(2.0f * m_Bounds.extent.x, 1e-20f),
+		cells / MathHelper::Max(2.0f * m_Bounds.extent.y, 1e-20f),
+		cells / MathHelper::Max(2.0f * m_Bounds.extent.z, 1e-20f));
+
+	std::vector<UINT64> keys(count);
+	for (UINT i = 0; i < count; ++i)
+	{
+		const BVHRayQuery& ray = rays[i];
+
+		UINT octant = (ray.Direction.x < 0.0f ? 1 : 0) | (ray.Direction.y < 0.0f ? 2 : 0) | (ray.Direction.z < 0.0f ? 4 : 0);
+
+		UINT x = (UINT)MathHelper::Clamp((ray.Origin.x - boundsMin.x) * scale.x, 0.0f, cells - 1.0f);
+		UINT y = (UINT)MathHelper::Clamp((ray.Origin.y - boundsMin.y) * scale.y, 0.0f, cells - 1.0f);
+		UINT z = (UINT)MathHelper::Clamp((ray.Origin.z - boundsMin.z) * scale.z, 0.0f, cells - 1.0f);
+		UINT cell = ExpandBits(x) | ExpandBits(y) << 1 | ExpandBits(z) << 2;
+
+		keys[i] = (UINT64)(octant << (3 * OriginCellBits) | cell) << 32 | i;
+	}
+
+	std::sort(keys.begin(), keys.end());
+
+	order.resize(count);
+	for (UINT i = 0; i < count; ++i)
+	{
+		order[i] = (UINT)keys[i];
+	}
+}
+
+SceneBVH::SceneBVH()
+{
+
+}
+
+UINT SceneBVH::AddMesh(const MeshBVH* mesh)
+{
+	m_Meshes.push_back(mesh);
+	return (UINT)m_Meshes.size() - 1;
+}
+
+UINT SceneBVH::AddInstance(UINT mesh, const XMFLOAT4X4& world)
+{
+	XMMATRIX W = XMLoadFloat4x4(&world);
+	XMVECTOR det = XMMatrixDeterminant(W);
+
+	Instance instance;
+	instance.World = world;
+	XMStoreFloat4x4(&instance.InvWorld, XMMatrixInverse(&det, W));
+	TransformBounds(m_Meshes[mesh]->GetBounds(), W, instance.BoundsMin, instance.BoundsMax);
+	instance.Mesh = mesh;
+
+	m_Instances.push_back(instance);
+	return (UINT)m_Instances.size() - 1;
+}
+
+void SceneBVH::Clear()
+{
+	m_Meshes.clear();
+	m_Instances.clear();
+	m_Nodes.clear();
+	m_Order.clear();
+}
+
+void SceneBVH::Build()
+{
+	std::vector<XMFLOAT3> primMin(m_Instances.size());
+	std::vector<XMFLOAT3> primMax(m_Instances.size());
+	for (UINT i = 0; i < m_Instances.size(); ++i)
+	{
+		primMin[i] = m_Instances[i].BoundsMin;
+		primMax[i] = m_Instances[i].BoundsMax;
+	}
+
+	BVHBuilder::Build(primMin, primMax, 2, m_Nodes, m_Order);
+}
+
+bool SceneBVH::Pick(FXMVECTOR rayPos, FXMVECTOR rayDir, PickResult* result,
+	const std::vector<bool>* pickable) const
+{
+	BVHRay ray(rayPos, rayDir);
+
+	if (m_Instances.empty() || ray.IntersectBounds(m_Nodes[0], MathHelper::Infinity) == MathHelper::Infinity)
+	{
+		return false;
+	}
+
+	PickResult best;
+
+	UINT stack[StackSize];
+	UINT top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const BVHNode& node = m_Nodes[stack[--top]];
+
+		if (node.IsLeaf())
+		{
+			for (UINT i = node.First; i < node.First + node.Count; ++i)
+			{
+				UINT index = m_Order[i];
+				if (pickable && !(*pickable)[index])
+				{
+					continue;
+				}
+
+				const Instance& instance = m_Instances[index];
+
+				BVHNode bounds;
+				bounds.BoundsMin = instance.BoundsMin;
+				bounds.BoundsMax = instance.BoundsMax;
+				if (ray.IntersectBounds(bounds, best.Distance) == MathHelper::Infinity)
+				{
+					continue;
+				}
+
+				// Take the ray to the local space of the mesh.  The direction is
+				// not renormalized, so local hit distances stay comparable with
+				// the world space ones.
+				XMMATRIX toLocal = XMLoadFloat4x4(&instance.InvWorld);
+				BVHRay localRay(
+					XMVector3TransformCoord(rayPos, toLocal),
+					XMVector3TransformNormal(rayDir, toLocal));
+
+				float t;
+				UINT triangle;
+				if (m_Meshes[instance.Mesh]->Intersect(localRay, best.Distance, &t, &triangle))
+				{
+					best.Distance = t;
+					best.Instance = (int)index;
+					best.Triangle = (int)triangle;
+				}
+			}
+			continue;
+		}
+
+		UINT nearChild = node.First;
+		UINT farChild = node.First + 1;
+		float tNear = ray.IntersectBounds(m_Nodes[nearChild], best.Distance);
+		float tFar = ray.IntersectBounds(m_Nodes[farChild], best.Distance);
+		if (tFar < tNear)
+		{
+			std::swap(nearChild, farChild);
+			std::swap(tNear, tFar);
+		}
+
+		if (tFar != MathHelper::Infinity)
+		{
+			stack[top++] = farChild;
+		}
+		if (tNear != MathHelper::Infinity)
+		{
+			stack[top++] = nearChild;
+		}
+	}
+
+	if (best.Instance == -1)
+	{
+		return false;
+	}
+
+	if (result)
+	{
+		*result = best;
+	}
+	return true;
+}
+
+void SceneBVH::SelectInFrustum(const Frustum& frustum, std::vector<UINT>& instances,
+	std::vector<SelectedTriangle>* triangles) const
+{
+	instances.clear();
+	if (triangles)
+	{
+		triangles->clear();
+	}
+
+	if (m_Instances.empty())
+	{
+		return;
+	}
+
+	FrustumQuery query(frustum);
+
+	const UINT InsideBit = 0x80000000;
+
+	UINT stack[StackSize];
+	UINT top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		UINT entry = stack[--top];
+		const BVHNode& node = m_Nodes[entry & ~InsideBit];
+
+		bool inside = (entry & InsideBit) != 0;
+		if (!inside)
+		{
+			FrustumQuery::Containment c = query.ClassifyBounds(node.BoundsMin, node.BoundsMax);
+			if (c == FrustumQuery::Outside)
+			{
+				continue;
+			}
+			inside = c == FrustumQuery::Inside;
+		}
+
+		if (node.IsLeaf())
+		{
+			for (UINT i = node.First; i < node.First + node.Count; ++i)
+			{
+				UINT index = m_Order[i];
+				const Instance& instance = m_Instances[index];
+				if (!inside && query.ClassifyBounds(instance.BoundsMin, instance.BoundsMax) == FrustumQuery::Outside)
+				{
+					continue;
+				}
+				instances.push_back(index);
+			}
+			continue;
+		}
+
+		UINT flag = inside ? InsideBit : 0;
+		stack[top++] = (node.First + 1) | flag;
+		stack[top++] = node.First | flag;
+	}
+
+	if (triangles)
+	{
+		std::vector<UINT> meshTriangles;
+		for (UINT i = 0; i < instances.size(); ++i)
+		{
+			const Instance& instance = m_Instances[instances[i]];
+
+			meshTriangles.clear();
+			FrustumQuery localQuery(frustum, XMLoadFloat4x4(&instance.World));
+			m_Meshes[instance.Mesh]->SelectInFrustum(localQuery, meshTriangles);
+
+			for (UINT t = 0; t < meshTriangles.size(); ++t)
+			{
+				SelectedTriangle selected;
+				selected.Instance = instances[i];
+				selected.Triangle = meshTriangles[t];
+				triangles->push_back(selected);
+			}
+		}
+	}
+}
+
+UINT SceneBVH::InstanceCount() const
+{
+	return (UINT)m_Instances.size();
+}
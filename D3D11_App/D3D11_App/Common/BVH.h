@@ -0,0 +1,233 @@
+#pragma once
+
+#include "d3dUtil.h"
+#include "Camera.h"
+
+// A node of a flattened bounding volume hierarchy.  The two children of an
+// inner node are stored next to each other starting at First; a leaf covers
+// Count primitives starting at First.
+struct BVHNode
+{
+	XMFLOAT3 BoundsMin;
+	UINT First;
+	XMFLOAT3 BoundsMax;
+	UINT Count;
+
+	bool IsLeaf() const
+	{
+		return Count > 0;
+	}
+};
+
+// Computes the axis aligned bounds of a box transformed by W.
+void TransformBounds(const Box& box, CXMMATRIX W, XMFLOAT3& outMin, XMFLOAT3& outMax);
+
+// A ray with its reciprocal direction cached for the slab tests.  The
+// direction does not need to be normalized; all distances are measured in
+// units of the direction vector.
+struct BVHRay
+{
+	XMFLOAT3 Origin;
+	XMFLOAT3 Direction;
+	XMFLOAT3 InvDirection;
+
+	BVHRay(FXMVECTOR origin, FXMVECTOR direction);
+
+	// Returns the distance at which the ray enters the node bounds, or
+	// MathHelper::Infinity if it misses them within [0, maxDist].
+	float IntersectBounds(const BVHNode& node, float maxDist) const;
+	float IntersectBounds(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax, float maxDist) const;
+};
+
+// One ray of a batch query.  Like BVHRay, the direction does not need to be
+// normalized and distances are in units of it.
+struct BVHRayQuery
+{
+	XMFLOAT3 Origin;
+	float MaxDist;
+	XMFLOAT3 Direction;
+};
+
+// Nearest hit of a batch query.
+struct BVHRayHit
+{
+	static const UINT Miss = 0xffffffff;
+
+	// MathHelper::Infinity and Miss when the ray hits nothing.
+	float Distance;
+	UINT Triangle;
+};
+
+// The planes of a Frustum in structure of arrays form, so that a box or a
+// triangle is tested against four planes at a time.
+class FrustumQuery
+{
+public:
+	enum Containment
+	{
+		Outside,
+		Intersects,
+		Inside
+	};
+
+	FrustumQuery(const Frustum& frustum);
+
+	// The frustum taken to the local space of an object with the given world matrix.
+	FrustumQuery(const Frustum& frustum, CXMMATRIX world);
+
+	// The frustum of a view-projection matrix, in the space it transforms from.
+	explicit FrustumQuery(CXMMATRIX viewProj);
+
+	Containment ClassifyBounds(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax) const;
+
+	// Conservative: only rejects triangles lying entirely behind one plane.
+	bool IsTriangleOutside(FXMVECTOR v0, FXMVECTOR v1, FXMVECTOR v2) const;
+
+private:
+	void Load(const XMVECTOR planes[6]);
+
+private:
+	// Lanes hold planes 0-3 in the first vector and planes 4-5 (repeated) in the second.
+	XMVECTOR m_X[2];
+	XMVECTOR m_Y[2];
+	XMVECTOR m_Z[2];
+	XMVECTOR m_W[2];
+};
+
+class BVHBuilder
+{
+public:
+	/// Builds a binned SAH hierarchy over the given primitive bounds.  On return
+	/// order holds the primitive indices in the order the leaves reference them.
+	static void Build(const std::vector<XMFLOAT3>& primMin, const std::vector<XMFLOAT3>& primMax,
+		UINT maxLeafSize, std::vector<BVHNode>& nodes, std::vector<UINT>& order);
+
+	// Traversal keeps a fixed size stack, so the builder never goes deeper than this.
+	static const UINT MaxDepth = 48;
+};
+
+// Bottom level hierarchy over the triangles of a mesh in its local space.
+class MeshBVH
+{
+public:
+	MeshBVH();
+
+	void Build(const std::vector<XMFLOAT3>& vertices, const std::vector<UINT>& indices);
+
+	/// Finds the nearest triangle hit by the ray closer than maxDist.  The
+	/// triangle index refers to the index buffer passed to Build.
+	bool Intersect(FXMVECTOR rayPos, FXMVECTOR rayDir, float maxDist, float* pDist, UINT* pTriangle) const;
+	bool Intersect(const BVHRay& ray, float maxDist, float* pDist, UINT* pTriangle) const;
+
+	// Returns true as soon as any triangle is hit closer than maxDist.
+	bool IsOccluded(const BVHRay& ray, float maxDist) const;
+
+	/// Batch form of Intersect: writes the nearest hit of rays[i] to hits[i].
+	/// The rays are sorted by direction octant and origin cell and traced four
+	/// at a time, so that rays going the same way from nearby share their
+	/// node visits.  Coherent batches of a few hundred rays and more pay off.
+	void IntersectBatch(const BVHRayQuery* rays, UINT count, BVHRayHit* hits) const;
+
+	// Batch form of IsOccluded: occluded[i] is 1 if rays[i] hits any triangle.
+	void OccludedBatch(const BVHRayQuery* rays, UINT count, BYTE* occluded) const;
+
+	/// Appends the indices of the triangles that intersect the frustum, which
+	/// must be given in the local space of the mesh.
+	void SelectInFrustum(const FrustumQuery& frustum, std::vector<UINT>& triangles) const;
+
+	const Box& GetBounds() const;
+	UINT TriangleCount() const;
+
+private:
+	// Triangles are copied in leaf order so that a leaf reads contiguous memory.
+	struct Triangle
+	{
+		XMFLOAT3 V0;
+		XMFLOAT3 Edge1;
+		XMFLOAT3 Edge2;
+		UINT Index;
+	};
+
+	static bool IntersectTriangle(const BVHRay& ray, const Triangle& tri, float maxDist, float* pDist);
+
+	// Fills order with the rays of a batch in traversal order.
+	void SortBatch(const BVHRayQuery* rays, UINT count, std::vector<UINT>& order) const;
+
+private:
+	std::vector<BVHNode> m_Nodes;
+	std::vector<Triangle> m_Triangles;
+	Box m_Bounds;
+};
+
+struct PickResult
+{
+	int Instance;
+	int Triangle;
+	float Distance;
+
+	PickResult()
+		: Instance(-1)
+		, Triangle(-1)
+		, Distance(MathHelper::Infinity)
+	{
+
+	}
+};
+
+struct SelectedTriangle
+{
+	UINT Instance;
+	UINT Triangle;
+};
+
+// Two level hierarchy for picking: a top level BVH over the world bounds of
+// the instances, each of which references a shared MeshBVH.  The ray is only
+// taken into the local space of the instances whose bounds it reaches.
+class SceneBVH
+{
+public:
+	SceneBVH();
+
+	// Meshes are shared between instances and must outlive the scene.
+	UINT AddMesh(const MeshBVH* mesh);
+	UINT AddInstance(UINT mesh, const XMFLOAT4X4& world);
+
+	// Removes the meshes and the instances.
+	void Clear();
+
+	// Builds the top level hierarchy.  Call after adding the instances.
+	void Build();
+
+	/// Finds the nearest instance and triangle hit by a world space ray.  If
+	/// rayDir is normalized the result distance is in world units.  When
+	/// pickable is given, instances it marks false are skipped, so that a
+	/// culled instance cannot be picked.
+	bool Pick(FXMVECTOR rayPos, FXMVECTOR rayDir, PickResult* result,
+		const std::vector<bool>* pickable = nullptr) const;
+
+	/// Rectangle selection: fills instances with every instance whose world
+	/// bounds intersect the frustum and, if triangles is not null, lists the
+	/// triangles of those instances that intersect it too.
+	void SelectInFrustum(const Frustum& frustum, std::vector<UINT>& instances,
+		std::vector<SelectedTriangle>* triangles = nullptr) const;
+
+	UINT InstanceCount() const;
+
+private:
+	struct Instance
+	{
+		XMFLOAT4X4 World;
+		XMFLOAT4X4 InvWorld;
+		XMFLOAT3 BoundsMin;
+		XMFLOAT3 BoundsMax;
+		UINT Mesh;
+	};
+
+private:
+	std::vector<const MeshBVH*> m_Meshes;
+	std::vector<Instance> m_Instances;
+	std::vector<BVHNode> m_Nodes;
+
+	// Instance indices in leaf order.
+	std::vector<UINT> m_Order;
+};
@@ -0,0 +1,31 @@
+#include "Benchmark.h"
+#include <cstring>
+#include <fstream>
+
+bool Benchmark::IsRequested(LPSTR cmdLine)
+{
+	return cmdLine != nullptr && strstr(cmdLine, "-bench") != nullptr;
+}
+
+double Benchmark::Now()
+{
+	static double secondsPerCount = 0.0;
+	if (secondsPerCount == 0.0)
+	{
+		__int64 countsPerSecond;
+		QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSecond);
+		secondsPerCount = 1.0 / countsPerSecond;
+	}
+
+	__int64 currTime;
+	QueryPerformanceCounter((LARGE_INTEGER*)&currTime);
+	return currTime * secondsPerCount;
+}
+
+void Benchmark::Report(const std::wstring& line)
+{
+	OutputDebugStringW((line + L"\n").c_str());
+
+	std::wofstream fout("Benchmark.txt", std::ios::app);
+	fout << line << std::endl;
+}
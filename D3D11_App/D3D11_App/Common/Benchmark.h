@@ -0,0 +1,17 @@
+#pragma once
+
+#include <Windows.h>
+#include <string>
+
+// Helpers for the headless benchmark mode of the demos.  Launching a demo
+// with "-bench" on the command line runs its benchmark instead of opening
+// the window; results go to the debugger output and to Benchmark.txt.
+namespace Benchmark
+{
+	bool IsRequested(LPSTR cmdLine);
+
+	// Returns a high resolution time stamp in seconds.
+	double Now();
+
+	void Report(const std::wstring& line);
+}
@@ -205,6 +205,47 @@ const Frustum& Camera::GetFrustum() const
 	return m_Frustum;
 }
 
+Frustum Camera::GetSubFrustum(float left, float top, float right, float bottom) const
+{
+	if (left > right)
+	{
+		std::swap(left, right);
+	}
+	if (bottom > top)
+	{
+		std::swap(bottom, top);
+	}
+
+	// Slopes of the rectangle edges in view space.
+	float l = left / m_Proj(0, 0);
+	float r = right / m_Proj(0, 0);
+	float b = bottom / m_Proj(1, 1);
+	float t = top / m_Proj(1, 1);
+
+	// View space planes with their normals pointing inside.
+	Plane planes[6] =
+	{
+		Plane(0.0f, -1.0f, t, 0.0f),		// top
+		Plane(0.0f, 1.0f, -b, 0.0f),		// bottom
+		Plane(1.0f, 0.0f, -l, 0.0f),		// left
+		Plane(-1.0f, 0.0f, r, 0.0f),		// right
+		Plane(0.0f, 0.0f, 1.0f, -m_NearZ),	// near
+		Plane(0.0f, 0.0f, -1.0f, m_FarZ)	// far
+	};
+
+	// A plane transforms by the inverse transpose of the point transform,
+	// and the inverse of the view matrix is the camera's world matrix.
+	XMMATRIX toWorld = XMMatrixTranspose(View());
+
+	Frustum frustum;
+	for (int i = 0; i < 6; ++i)
+	{
+		frustum.m_Planes[i] = XMPlaneNormalize(XMPlaneTransform(planes[i], toWorld));
+	}
+
+	return frustum;
+}
+
 void Camera::SetLens(float fovY, float aspect, float zn, float zf)
 {
 	m_FovY = fovY;
@@ -78,6 +78,10 @@ public:
 
 	const Frustum& GetFrustum() const;
 
+	// Returns the world space frustum through the screen rectangle given in
+	// normalized device coordinates.  Requires an up to date view matrix.
+	Frustum GetSubFrustum(float left, float top, float right, float bottom) const;
+
 	// Set frustum.
 	void SetLens(float fovY, float aspect, float zn, float zf);
 
@@ -0,0 +1,937 @@
+#include "DDSFile.h"
+
+#ifndef MAKEFOURCC
+#define MAKEFOURCC(ch0, ch1, ch2, ch3) \
+	((UINT)(BYTE)(ch0) | ((UINT)(BYTE)(ch1) << 8) | ((UINT)(BYTE)(ch2) << 16) | ((UINT)(BYTE)(ch3) << 24))
+#endif
+
+namespace
+{
+	const UINT DDSMagic = 0x20534444; // "DDS "
+
+	// Pixel format flags.
+	const UINT DDSFourCC = 0x00000004;
+	const UINT DDSRGB = 0x00000040;
+	const UINT DDSLuminance = 0x00020000;
+	const UINT DDSAlpha = 0x00000002;
+	const UINT DDSBumpDUDV = 0x00080000;
+
+	// Header flags and caps.
+	const UINT DDSHeaderFlagsVolume = 0x00800000;
+	const UINT DDSHeight = 0x00000002;
+	const UINT DDSCubeMap = 0x00000200;
+	const UINT DDSCubeMapAllFaces = 0x0000fc00 | DDSCubeMap;
+
+	// The DX10 extension.
+	const UINT DX10MiscTextureCube = 0x4; // D3D11_RESOURCE_MISC_TEXTURECUBE
+	const UINT DX10MiscFlags2AlphaModeMask = 0x7;
+
+	// What Direct3D 11 hardware has to support; larger sizes in a file are
+	// not trusted.
+	const UINT MaxMipLevels = 15; // D3D11_REQ_MIP_LEVELS
+	const UINT MaxArraySize = 2048; // D3D11_REQ_TEXTURE1D_ARRAY_AXIS_DIMENSION, D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION
+	const UINT MaxTexture1DSize = 16384; // D3D11_REQ_TEXTURE1D_U_DIMENSION
+	const UINT MaxTexture2DSize = 16384; // D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION, D3D11_REQ_TEXTURECUBE_DIMENSION
+	const UINT MaxTexture3DSize = 2048; // D3D11_REQ_TEXTURE3D_U_V_OR_W_DIMENSION
+
+#pragma pack(push, 1)
+	struct DDSPixelFormat
+	{
+		UINT Size;
+		UINT Flags;
+		UINT FourCC;
+		UINT RGBBitCount;
+		UINT RBitMask;
+		UINT GBitMask;
+		UINT BBitMask;
+		UINT ABitMask;
+	};
+
+	struct DDSHeader
+	{
+		UINT Size;
+		UINT Flags;
+		UINT Height;
+		UINT Width;
+		UINT PitchOrLinearSize;
+		UINT Depth; // only if DDSHeaderFlagsVolume is set in Flags
+		UINT MipMapCount;
+		UINT Reserved1[11];
+		DDSPixelFormat PixelFormat;
+		UINT Caps;
+		UINT Caps2;
+		UINT Caps3;
+		UINT Caps4;
+		UINT Reserved2;
+	};
+
+	struct DDSHeaderDX10
+	{
+		DXGI_FORMAT Format;
+		UINT ResourceDimension;
+		UINT MiscFlag;
+		UINT ArraySize;
+		UINT MiscFlags2;
+	};
+#pragma pack(pop)
+
+	// Bits per pixel of a format, or 0 for formats a DDS file cannot hold.
+	UINT BitsPerPixel(DXGI_FORMAT fmt)
+	{
+		switch (fmt)
+		{
+		case DXGI_FORMAT_R32G32B32A32_TYPELESS:
+		case DXGI_FORMAT_R32G32B32A32_FLOAT:
+		case DXGI_FORMAT_R32G32B32A32_UINT:
+		case DXGI_FORMAT_R32G32B32A32_SINT:
+			return 128;
+
+		case DXGI_FORMAT_R32G32B32_TYPELESS:
+		case DXGI_FORMAT_R32G32B32_FLOAT:
+		case DXGI_FORMAT_R32G32B32_UINT:
+		case DXGI_FORMAT_R32G32B32_SINT:
+			return 96;
+
+		case DXGI_FORMAT_R16G16B16A16_TYPELESS:
+		case DXGI_FORMAT_R16G16B16A16_FLOAT:
+		case DXGI_FORMAT_R16G16B16A16_UNORM:
+		case DXGI_FORMAT_R16G16B16A16_UINT:
+		case DXGI_FORMAT_R16G16B16A16_SNORM:
+		case DXGI_FORMAT_R16G16B16A16_SINT:
+		case DXGI_FORMAT_R32G32_TYPELESS:
+		case DXGI_FORMAT_R32G32_FLOAT:
+		case DXGI_FORMAT_R32G32_UINT:
+		case DXGI_FORMAT_R32G32_SINT:
+		case DXGI_FORMAT_R32G8X24_TYPELESS:
+		case DXGI_FORMAT_D32_FLOAT_S8X24_UINT:
+		case DXGI_FORMAT_R32_FLOAT_X8X24_TYPELESS:
+		case DXGI_FORMAT_X32_TYPELESS_G8X24_UINT:
+		case DXGI_FORMAT_Y416:
+		case DXGI_FORMAT_Y210:
+		case DXGI_FORMAT_Y216:
+			return 64;
+
+		case DXGI_FORMAT_R10G10B10A2_TYPELESS:
+		case DXGI_FORMAT_R10G10B10A2_UNORM:
+		case DXGI_FORMAT_R10G10B10A2_UINT:
+		case DXGI_FORMAT_R11G11B10_FLOAT:
+		case DXGI_FORMAT_R8G8B8A8_TYPELESS:
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+		case DXGI_FORMAT_R8G8B8A8_UINT:
+		case DXGI_FORMAT_R8G8B8A8_SNORM:
+		case DXGI_FORMAT_R8G8B8A8_SINT:
+		case DXGI_FORMAT_R16G16_TYPELESS:
+		case DXGI_FORMAT_R16G16_FLOAT:
+		case DXGI_FORMAT_R16G16_UNORM:
+		case DXGI_FORMAT_R16G16_UINT:
+		case DXGI_FORMAT_R16G16_SNORM:
+		case DXGI_FORMAT_R16G16_SINT:
+		case DXGI_FORMAT_R32_TYPELESS:
+		case DXGI_FORMAT_D32_FLOAT:
+		case DXGI_FORMAT_R32_FLOAT:
+		case DXGI_FORMAT_R32_UINT:
+		case DXGI_FORMAT_R32_SINT:
+		case DXGI_FORMAT_R24G8_TYPELESS:
+		case DXGI_FORMAT_D24_UNORM_S8_UINT:
+		case DXGI_FORMAT_R24_UNORM_X8_TYPELESS:
+		case DXGI_FORMAT_X24_TYPELESS_G8_UINT:
+		case DXGI_FORMAT_R9G9B9E5_SHAREDEXP:
+		case DXGI_FORMAT_R8G8_B8G8_UNORM:
+		case DXGI_FORMAT_G8R8_G8B8_UNORM:
+		case DXGI_FORMAT_B8G8R8A8_UNORM:
+		case DXGI_FORMAT_B8G8R8X8_UNORM:
+		case DXGI_FORMAT_R10G10B10_XR_BIAS_A2_UNORM:
+		case DXGI_FORMAT_B8G8R8A8_TYPELESS:
+		case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+		case DXGI_FORMAT_B8G8R8X8_TYPELESS:
+		case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+		case DXGI_FORMAT_AYUV:
+		case DXGI_FORMAT_Y410:
+		case DXGI_FORMAT_YUY2:
+			return 32;
+
+		case DXGI_FORMAT_P010:
+		case DXGI_FORMAT_P016:
+			return 24;
+
+		case DXGI_FORMAT_R8G8_TYPELESS:
+		case DXGI_FORMAT_R8G8_UNORM:
+		case DXGI_FORMAT_R8G8_UINT:
+		case DXGI_FORMAT_R8G8_SNORM:
+		case DXGI_FORMAT_R8G8_SINT:
+		case DXGI_FORMAT_R16_TYPELESS:
+		case DXGI_FORMAT_R16_FLOAT:
+		case DXGI_FORMAT_D16_UNORM:
+		case DXGI_FORMAT_R16_UNORM:
+		case DXGI_FORMAT_R16_UINT:
+		case DXGI_FORMAT_R16_SNORM:
+		case DXGI_FORMAT_R16_SINT:
+		case DXGI_FORMAT_B5G6R5_UNORM:
+		case DXGI_FORMAT_B5G5R5A1_UNORM:
+		case DXGI_FORMAT_A8P8:
+		case DXGI_FORMAT_B4G4R4A4_UNORM:
+			return 16;
+
+		case DXGI_FORMAT_NV12:
+		case DXGI_FORMAT_420_OPAQUE:
+		case DXGI_FORMAT_NV11:
+			return 12;
+
+		case DXGI_FORMAT_R8_TYPELESS:
+		case DXGI_FORMAT_R8_UNORM:
+		case DXGI_FORMAT_R8_UINT:
+		case DXGI_FORMAT_R8_SNORM:
+		case DXGI_FORMAT_R8_SINT:
+		case DXGI_FORMAT_A8_UNORM:
+		case DXGI_FORMAT_AI44:
+		case DXGI_FORMAT_IA44:
+		case DXGI_FORMAT_P8:
+			return 8;
+
+		case DXGI_FORMAT_R1_UNORM:
+			return 1;
+
+		case DXGI_FORMAT_BC1_TYPELESS:
+		case DXGI_FORMAT_BC1_UNORM:
+		case DXGI_FORMAT_BC1_UNORM_SRGB:
+		case DXGI_FORMAT_BC4_TYPELESS:
+		case DXGI_FORMAT_BC4_UNORM:
+		case DXGI_FORMAT_BC4_SNORM:
+			return 4;
+
+		case DXGI_FORMAT_BC2_TYPELESS:
+		case DXGI_FORMAT_BC2_UNORM:
+		case DXGI_FORMAT_BC2_UNORM_SRGB:
+		case DXGI_FORMAT_BC3_TYPELESS:
+		case DXGI_FORMAT_BC3_UNORM:
+		case DXGI_FORMAT_BC3_UNORM_SRGB:
+		case DXGI_FORMAT_BC5_TYPELESS:
+		case DXGI_FORMAT_BC5_UNORM:
+		case DXGI_FORMAT_BC5_SNORM:
+		case DXGI_FORMAT_BC6H_TYPELESS:
+		case DXGI_FORMAT_BC6H_UF16:
+		case DXGI_FORMAT_BC6H_SF16:
+		case DXGI_FORMAT_BC7_TYPELESS:
+		case DXGI_FORMAT_BC7_UNORM:
+		case DXGI_FORMAT_BC7_UNORM_SRGB:
+			return 8;
+
+		default:
+			return 0;
+		}
+	}
+
+
+	// Bytes of a row and of a whole surface of a format.  Block compressed
+	// formats count rows of 4x4 blocks.
+	void GetSurfaceInfo(UINT width, UINT height, DXGI_FORMAT fmt, UINT64& numBytes, UINT64& rowBytes)
+	{
+		bool bc = false;
+		bool packed = false;
+		bool planar = false;
+		UINT64 bpe = 0;
+		switch (fmt)
+		{
+		case DXGI_FORMAT_BC1_TYPELESS:
+		case DXGI_FORMAT_BC1_UNORM:
+		case DXGI_FORMAT_BC1_UNORM_SRGB:
+		case DXGI_FORMAT_BC4_TYPELESS:
+		case DXGI_FORMAT_BC4_UNORM:
+		case DXGI_FORMAT_BC4_SNORM:
+			bc = true;
+			bpe = 8;
+			break;
+
+		case DXGI_FORMAT_BC2_TYPELESS:
+		case DXGI_FORMAT_BC2_UNORM:
+		case DXGI_FORMAT_BC2_UNORM_SRGB:
+		case DXGI_FORMAT_BC3_TYPELESS:
+		case DXGI_FORMAT_BC3_UNORM:
+		case DXGI_FORMAT_BC3_UNORM_SRGB:
+		case DXGI_FORMAT_BC5_TYPELESS:
+		case DXGI_FORMAT_BC5_UNORM:
+		case DXGI_FORMAT_BC5_SNORM:
+		case DXGI_FORMAT_BC6H_TYPELESS:
+		case DXGI_FORMAT_BC6H_UF16:
+		case DXGI_FORMAT_BC6H_SF16:
+		case DXGI_FORMAT_BC7_TYPELESS:
+		case DXGI_FORMAT_BC7_UNORM:
+		case DXGI_FORMAT_BC7_UNORM_SRGB:
+			bc = true;
+			bpe = 16;
+			break;
+
+		case DXGI_FORMAT_R8G8_B8G8_UNORM:
+		case DXGI_FORMAT_G8R8_G8B8_UNORM:
+		case DXGI_FORMAT_YUY2:
+			packed = true;
+			bpe = 4;
+			break;
+
+		case DXGI_FORMAT_Y210:
+		case DXGI_FORMAT_Y216:
+			packed = true;
+			bpe = 8;
+			break;
+
+		case DXGI_FORMAT_NV12:
+		case DXGI_FORMAT_420_OPAQUE:
+			planar = true;
+			bpe = 2;
+			break;
+
+		case DXGI_FORMAT_P010:
+		case DXGI_FORMAT_P016:
+			planar = true;
+			bpe = 4;
+			break;
+		}
+
+		if (bc)
+		{
+			UINT64 blocksWide = width > 0 ? ((UINT64)width + 3) / 4 : 0;
+			UINT64 blocksHigh = height > 0 ? ((UINT64)height + 3) / 4 : 0;
+			rowBytes = blocksWide * bpe;
+			numBytes = rowBytes * blocksHigh;
+		}
+		else if (packed)
+		{
+			rowBytes = (((UINT64)width + 1) >> 1) * bpe;
+			numBytes = rowBytes * height;
+		}
+		else if (fmt == DXGI_FORMAT_NV11)
+		{
+			// Direct3D makes this simplifying assumption, although it is
+			// larger than the 4:1:1 data.
+			rowBytes = (((UINT64)width + 3) >> 2) * 4;
+			numBytes = rowBytes * height * 2;
+		}
+		else if (planar)
+		{
+			rowBytes = (((UINT64)width + 1) >> 1) * bpe;
+			numBytes = rowBytes * height + ((rowBytes * height + 1) >> 1);
+		}
+		else
+		{
+			rowBytes = ((UINT64)width * BitsPerPixel(fmt) + 7) / 8; // round up to the nearest byte
+			numBytes = rowBytes * height;
+		}
+	}
+
+#define ISBITMASK(r, g, b, a) (ddpf.RBitMask == r && ddpf.GBitMask == g && ddpf.BBitMask == b && ddpf.ABitMask == a)
+
+	// The format of a file without the DX10 extension.
+	DXGI_FORMAT GetDXGIFormat(const DDSPixelFormat& ddpf)
+	{
+		if (ddpf.Flags & DDSRGB)
+		{
+			// Note that sRGB formats are written using the "DX10" extended header
+
+			switch (ddpf.RGBBitCount)
+			{
+			case 32:
+				if (ISBITMASK(0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000))
+				{
+					return DXGI_FORMAT_R8G8B8A8_UNORM;
+				}
+
+				if (ISBITMASK(0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000))
+				{
+					return DXGI_FORMAT_B8G8R8A8_UNORM;
+				}
+
+				if (ISBITMASK(0x00ff0000, 0x0000ff00, 0x000000ff, 0x00000000))
+				{
+					return DXGI_FORMAT_B8G8R8X8_UNORM;
+				}
+
+				// No DXGI format maps to ISBITMASK(0x000000ff,0x0000ff00,0x00ff0000,0x00000000) aka D3DFMT_X8B8G8R8
+
+				// Note that many common DDS reader/writers (including D3DX) swap the
+				// the RED/BLUE masks for 10:10:10:2 formats. We assume
+				// below that the 'backwards' header mask is being used since it is most
+				// likely written by D3DX. The more robust solution is to use the 'DX10'
+				// header extension and specify the DXGI_FORMAT_R10G10B10A2_UNORM format directly
+
+				// For 'correct' writers, this should be 0x000003ff,0x000ffc00,0x3ff00000 for RGB data
+				if (ISBITMASK(0x3ff00000, 0x000ffc00, 0x000003ff, 0xc0000000))
+				{
+					return DXGI_FORMAT_R10G10B10A2_UNORM;
+				}
+
+				// No DXGI format maps to ISBITMASK(0x000003ff,0x000ffc00,0x3ff00000,0xc0000000) aka D3DFMT_A2R10G10B10
+
+				if (ISBITMASK(0x0000ffff, 0xffff0000, 0x00000000, 0x00000000))
+				{
+					return DXGI_FORMAT_R16G16_UNORM;
+				}
+
+				if (ISBITMASK(0xffffffff, 0x00000000, 0x00000000, 0x00000000))
+				{
+					// Only 32-bit color channel format in D3D9 was R32F
+					return DXGI_FORMAT_R32_FLOAT; // D3DX writes this out as a FourCC of 114
+				}
+				break;
+
+			case 24:
+				// No 24bpp DXGI formats aka D3DFMT_R8G8B8
+				break;
+
+			case 16:
+				if (ISBITMASK(0x7c00, 0x03e0, 0x001f, 0x8000))
+				{
+					return DXGI_FORMAT_B5G5R5A1_UNORM;
+				}
+				if (ISBITMASK(0xf800, 0x07e0, 0x001f, 0x0000))
+				{
+					return DXGI_FORMAT_B5G6R5_UNORM;
+				}
+
+				// No DXGI format maps to ISBITMASK(0x7c00,0x03e0,0x001f,0x0000) aka D3DFMT_X1R5G5B5
+
+				if (ISBITMASK(0x0f00, 0x00f0, 0x000f, 0xf000))
+				{
+					return DXGI_FORMAT_B4G4R4A4_UNORM;
+				}
+
+				// No DXGI format maps to ISBITMASK(0x0f00,0x00f0,0x000f,0x0000) aka D3DFMT_X4R4G4B4
+
+				// No 3:3:2, 3:3:2:8, or paletted DXGI formats aka D3DFMT_A8R3G3B2, D3DFMT_R3G3B2, D3DFMT_P8, D3DFMT_A8P8, etc.
+				break;
+			}
+		}
+		else if (ddpf.Flags & DDSLuminance)
+		{
+			if (8 == ddpf.RGBBitCount)
+			{
+				if (ISBITMASK(0x000000ff, 0x00000000, 0x00000000, 0x00000000))
+				{
+					return DXGI_FORMAT_R8_UNORM; // D3DX10/11 writes this out as DX10 extension
+				}
+
+				// No DXGI format maps to ISBITMASK(0x0f,0x00,0x00,0xf0) aka D3DFMT_A4L4
+			}
+
+			if (16 == ddpf.RGBBitCount)
+			{
+				if (ISBITMASK(0x0000ffff, 0x00000000, 0x00000000, 0x00000000))
+				{
+					return DXGI_FORMAT_R16_UNORM; // D3DX10/11 writes this out as DX10 extension
+				}
+				if (ISBITMASK(0x000000ff, 0x00000000, 0x00000000, 0x0000ff00))
+				{
+					return DXGI_FORMAT_R8G8_UNORM; // D3DX10/11 writes this out as DX10 extension
+				}
+			}
+		}
+		else if (ddpf.Flags & DDSAlpha)
+		{
+			if (8 == ddpf.RGBBitCount)
+			{
+				return DXGI_FORMAT_A8_UNORM;
+			}
+		}
+		else if (ddpf.Flags & DDSBumpDUDV)
+		{
+			if (16 == ddpf.RGBBitCount)
+			{
+				if (ISBITMASK(0x00ff, 0xff00, 0x0000, 0x0000))
+				{
+					return DXGI_FORMAT_R8G8_SNORM; // D3DX10/11 writes this out as DX10 extension
+				}
+			}
+
+			if (32 == ddpf.RGBBitCount)
+			{
+				if (ISBITMASK(0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000))
+				{
+					return DXGI_FORMAT_R8G8B8A8_SNORM; // D3DX10/11 writes this out as DX10 extension
+				}
+				if (ISBITMASK(0x0000ffff, 0xffff0000, 0x00000000, 0x00000000))
+				{
+					return DXGI_FORMAT_R16G16_SNORM; // D3DX10/11 writes this out as DX10 extension
+				}
+
+				// No DXGI format maps to ISBITMASK(0x3ff00000, 0x000ffc00, 0x000003ff, 0xc0000000) aka D3DFMT_A2W10V10U10
+			}
+		}
+		else if (ddpf.Flags & DDSFourCC)
+		{
+			if (MAKEFOURCC('D', 'X', 'T', '1') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_BC1_UNORM;
+			}
+			if (MAKEFOURCC('D', 'X', 'T', '3') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_BC2_UNORM;
+			}
+			if (MAKEFOURCC('D', 'X', 'T', '5') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_BC3_UNORM;
+			}
+
+			// While pre-multiplied alpha isn't directly supported by the DXGI formats,
+			// they are basically the same as these BC formats so they can be mapped
+			if (MAKEFOURCC('D', 'X', 'T', '2') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_BC2_UNORM;
+			}
+			if (MAKEFOURCC('D', 'X', 'T', '4') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_BC3_UNORM;
+			}
+
+			if (MAKEFOURCC('A', 'T', 'I', '1') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_BC4_UNORM;
+			}
+			if (MAKEFOURCC('B', 'C', '4', 'U') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_BC4_UNORM;
+			}
+			if (MAKEFOURCC('B', 'C', '4', 'S') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_BC4_SNORM;
+			}
+
+			if (MAKEFOURCC('A', 'T', 'I', '2') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_BC5_UNORM;
+			}
+			if (MAKEFOURCC('B', 'C', '5', 'U') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_BC5_UNORM;
+			}
+			if (MAKEFOURCC('B', 'C', '5', 'S') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_BC5_SNORM;
+			}
+
+			// BC6H and BC7 are written using the "DX10" extended header
+
+			if (MAKEFOURCC('R', 'G', 'B', 'G') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_R8G8_B8G8_UNORM;
+			}
+			if (MAKEFOURCC('G', 'R', 'G', 'B') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_G8R8_G8B8_UNORM;
+			}
+
+			if (MAKEFOURCC('Y', 'U', 'Y', '2') == ddpf.FourCC)
+			{
+				return DXGI_FORMAT_YUY2;
+			}
+
+			// Check for D3DFORMAT enums being set here
+			switch (ddpf.FourCC)
+			{
+			case 36: // D3DFMT_A16B16G16R16
+				return DXGI_FORMAT_R16G16B16A16_UNORM;
+
+			case 110: // D3DFMT_Q16W16V16U16
+				return DXGI_FORMAT_R16G16B16A16_SNORM;
+
+			case 111: // D3DFMT_R16F
+				return DXGI_FORMAT_R16_FLOAT;
+
+			case 112: // D3DFMT_G16R16F
+				return DXGI_FORMAT_R16G16_FLOAT;
+
+			case 113: // D3DFMT_A16B16G16R16F
+				return DXGI_FORMAT_R16G16B16A16_FLOAT;
+
+			case 114: // D3DFMT_R32F
+				return DXGI_FORMAT_R32_FLOAT;
+
+			case 115: // D3DFMT_G32R32F
+				return DXGI_FORMAT_R32G32_FLOAT;
+
+			case 116: // D3DFMT_A32B32G32R32F
+				return DXGI_FORMAT_R32G32B32A32_FLOAT;
+			}
+		}
+
+		return DXGI_FORMAT_UNKNOWN;
+	}
+
+#undef ISBITMASK
+}
+
+DDSFile::DDSFile()
+	: m_Dimension(DimensionUnknown)
+	, m_Format(DXGI_FORMAT_UNKNOWN)
+	, m_Width(0)
+	, m_Height(0)
+	, m_Depth(0)
+	, m_ArraySize(0)
+	, m_MipCount(0)
+	, m_IsCubeMap(false)
+	, m_AlphaMode(AlphaModeUnknown)
+{
+
+}
+
+DDSFile::~DDSFile()
+{
+
+}
+
+HRESULT DDSFile::Open(const std::wstring& path)
+{
+	Close();
+
+	// Empty files cannot be mapped; they are no DDS files either.
+	SetLastError(ERROR_SUCCESS);
+	if (!m_File.Open(path))
+	{
+		DWORD error = GetLastError();
+		return error != ERROR_SUCCESS ? HRESULT_FROM_WIN32(error) : E_FAIL;
+	}
+
+	HRESULT hr = Read(m_File.GetData(), m_File.GetSize());
+	if (FAILED(hr))
+	{
+		Close();
+	}
+	return hr;
+}
+
+HRESULT DDSFile::Parse(const BYTE* data, UINT64 size)
+{
+	Close();
+
+	if (!data)
+	{
+		return E_INVALIDARG;
+	}
+
+	HRESULT hr = Read(data, size);
+	if (FAILED(hr))
+	{
+		Close();
+	}
+	return hr;
+}
+
+void DDSFile::Close()
+{
+	m_File.Close();
+	m_Dimension = DimensionUnknown;
+	m_Format = DXGI_FORMAT_UNKNOWN;
+	m_Width = 0;
+	m_Height = 0;
+	m_Depth = 0;
+	m_ArraySize = 0;
+	m_MipCount = 0;
+	m_IsCubeMap = false;
+	m_AlphaMode = AlphaModeUnknown;
+	m_Subresources.clear();
+}
+
+bool DDSFile::IsOpen() const
+{
+	return !m_Subresources.empty();
+}
+
+DDSFile::Dimension DDSFile::GetDimension() const
+{
+	return m_Dimension;
+}
+
+DXGI_FORMAT DDSFile::GetFormat() const
+{
+	return m_Format;
+}
+
+UINT DDSFile::GetWidth() const
+{
+	return m_Width;
+}
+
+UINT DDSFile::GetHeight() const
+{
+	return m_Height;
+}
+
+UINT DDSFile::GetDepth() const
+{
+	return m_Depth;
+}
+
+UINT DDSFile::GetArraySize() const
+{
+	return m_ArraySize;
+}
+
+UINT DDSFile::GetMipCount() const
+{
+	return m_MipCount;
+}
+
+bool DDSFile::IsCubeMap() const
+{
+	return m_IsCubeMap;
+}
+
+DDSFile::AlphaMode DDSFile::GetAlphaMode() const
+{
+	return m_AlphaMode;
+}
+
+UINT DDSFile::GetSubresourceCount() const
+{
+	return (UINT)m_Subresources.size();
+}
+
+const DDSFile::Subresource& DDSFile::GetSubresource(UINT item, UINT mip) const
+{
+	return m_Subresources[item * m_MipCount + mip];
+}
+
+const DDSFile::Subresource* DDSFile::GetSubresources() const
+{
+	return m_Subresources.empty() ? nullptr : &m_Subresources[0];
+}
+
+HRESULT DDSFile::Read(const BYTE* data, UINT64 size)
+{
+	UINT64 bitOffset = 0;
+	HRESULT hr = ParseHeader(data, size, bitOffset);
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	return LayOutSubresources(data + bitOffset, size - bitOffset);
+}
+
+HRESULT DDSFile::ParseHeader(const BYTE* data, UINT64 size, UINT64& bitOffset)
+{
+	// The magic number and the header, checked the way the texture loader
+	// always has.
+	if (size < sizeof(UINT) + sizeof(DDSHeader) || *(const UINT*)data != DDSMagic)
+	{
+		return E_FAIL;
+	}
+
+	const DDSHeader* header = (const DDSHeader*)(data + sizeof(UINT));
+	if (header->Size != sizeof(DDSHeader) || header->PixelFormat.Size != sizeof(DDSPixelFormat))
+	{
+		return E_FAIL;
+	}
+
+	const DDSHeaderDX10* dx10 = nullptr;
+	bitOffset = sizeof(UINT) + sizeof(DDSHeader);
+	if ((header->PixelFormat.Flags & DDSFourCC) && header->PixelFormat.FourCC == MAKEFOURCC('D', 'X', '1', '0'))
+	{
+		if (size < bitOffset + sizeof(DDSHeaderDX10))
+		{
+			return E_FAIL;
+		}
+
+		dx10 = (const DDSHeaderDX10*)(data + bitOffset);
+		bitOffset += sizeof(DDSHeaderDX10);
+	}
+
+	m_Width = header->Width;
+	m_Height = header->Height;
+	m_Depth = header->Depth;
+	m_ArraySize = 1;
+	m_MipCount = header->MipMapCount ? header->MipMapCount : 1;
+
+	if (dx10)
+	{
+		if (dx10->ArraySize == 0)
+		{
+			return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		}
+		if (dx10->ArraySize > MaxArraySize)
+		{
+			return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+		}
+		m_ArraySize = dx10->ArraySize;
+
+		switch (dx10->Format)
+		{
+		case DXGI_FORMAT_AI44:
+		case DXGI_FORMAT_IA44:
+		case DXGI_FORMAT_P8:
+		case DXGI_FORMAT_A8P8:
+			return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+
+		default:
+			if (BitsPerPixel(dx10->Format) == 0)
+			{
+				return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+			}
+		}
+		m_Format = dx10->Format;
+
+		switch (dx10->ResourceDimension)
+		{
+		case DimensionTexture1D:
+			// D3DX writes 1D textures with a fixed Height of 1.
+			if ((header->Flags & DDSHeight) && m_Height != 1)
+			{
+				return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+			}
+			m_Height = 1;
+			m_Depth = 1;
+			break;
+
+		case DimensionTexture2D:
+			if (dx10->MiscFlag & DX10MiscTextureCube)
+			{
+				m_ArraySize *= 6;
+				m_IsCubeMap = true;
+			}
+			m_Depth = 1;
+			break;
+
+		case DimensionTexture3D:
+			if (!(header->Flags & DDSHeaderFlagsVolume))
+			{
+				return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+			}
+			break;
+
+		default:
+			return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+		}
+		m_Dimension = (Dimension)dx10->ResourceDimension;
+
+		switch (dx10->MiscFlags2 & DX10MiscFlags2AlphaModeMask)
+		{
+		case AlphaModeStraight:
+		case AlphaModePremultiplied:
+		case AlphaModeOpaque:
+		case AlphaModeCustom:
+			m_AlphaMode = (AlphaMode)(dx10->MiscFlags2 & DX10MiscFlags2AlphaModeMask);
+			break;
+		}
+	}
+	else
+	{
+		m_Format = GetDXGIFormat(header->PixelFormat);
+		if (m_Format == DXGI_FORMAT_UNKNOWN)
+		{
+			return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+		}
+
+		if (header->Flags & DDSHeaderFlagsVolume)
+		{
+			m_Dimension = DimensionTexture3D;
+		}
+		else
+		{
+			if (header->Caps2 & DDSCubeMap)
+			{
+				// All six faces have to be there.
+				if ((header->Caps2 & DDSCubeMapAllFaces) != DDSCubeMapAllFaces)
+				{
+					return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+				}
+				m_ArraySize = 6;
+				m_IsCubeMap = true;
+			}
+
+			// There's no way for a legacy Direct3D 9 DDS to express a 1D
+			// texture.
+			m_Depth = 1;
+			m_Dimension = DimensionTexture2D;
+		}
+
+		if ((header->PixelFormat.Flags & DDSFourCC) &&
+			(header->PixelFormat.FourCC == MAKEFOURCC('D', 'X', 'T', '2') ||
+			header->PixelFormat.FourCC == MAKEFOURCC('D', 'X', 'T', '4')))
+		{
+			m_AlphaMode = AlphaModePremultiplied;
+		}
+	}
+
+	// Bound the sizes before laying anything out.
+	if (m_MipCount > MaxMipLevels || m_ArraySize > MaxArraySize)
+	{
+		return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+	}
+
+	switch (m_Dimension)
+	{
+	case DimensionTexture1D:
+		if (m_Width > MaxTexture1DSize)
+		{
+			return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+		}
+		break;
+
+	case DimensionTexture2D:
+		if (m_Width > MaxTexture2DSize || m_Height > MaxTexture2DSize)
+		{
+			return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+		}
+		break;
+
+	default:
+		if (m_ArraySize > 1 || m_Width > MaxTexture3DSize || m_Height > MaxTexture3DSize ||
+			m_Depth > MaxTexture3DSize)
+		{
+			return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+		}
+		break;
+	}
+
+	if (m_Width == 0 || m_Height == 0 || m_Depth == 0)
+	{
+		return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+	}
+
+	return S_OK;
+}
+
+HRESULT DDSFile::LayOutSubresources(const BYTE* bits, UINT64 bitSize)
+{
+	// The mips of each item follow one another, largest first, and each
+	// item follows the last.
+	m_Subresources.resize(m_ArraySize * m_MipCount);
+
+	UINT64 offset = 0;
+	UINT index = 0;
+	for (UINT item = 0; item < m_ArraySize; ++item)
+	{
+		UINT width = m_Width;
+		UINT height = m_Height;
+		UINT depth = m_Depth;
+		for (UINT mip = 0; mip < m_MipCount; ++mip)
+		{
+			UINT64 numBytes = 0;
+			UINT64 rowBytes = 0;
+			GetSurfaceInfo(width, height, m_Format, numBytes, rowBytes);
+
+			if (numBytes * depth > bitSize - offset)
+			{
+				return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+			}
+			if (numBytes > 0xffffffff)
+			{
+				return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+			}
+
+			Subresource& subresource = m_Subresources[index++];
+			subresource.Data = bits + offset;
+			subresource.RowPitch = (UINT)rowBytes;
+			subresource.SlicePitch = (UINT)numBytes;
+			subresource.Width = width;
+			subresource.Height = height;
+			subresource.Depth = depth;
+			offset += numBytes * depth;
+
+			width = width > 1 ? width >> 1 : 1;
+			height = height > 1 ? height >> 1 : 1;
+			depth = depth > 1 ? depth >> 1 : 1;
+		}
+	}
+
+	return S_OK;
+}
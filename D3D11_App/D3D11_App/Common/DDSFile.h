@@ -0,0 +1,104 @@
+#pragma once
+
+#include <Windows.h>
+#include <dxgiformat.h>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+
+// A DDS file parsed where it lies, without a device.  Open maps the file and
+// Parse reads one already in memory; either checks the header and the DX10
+// extension and lays out every subresource, pointing into the file, so the
+// pixels are never copied.  Sizes past what Direct3D 11 hardware has to
+// support are refused, whatever the file says.
+class DDSFile
+{
+public:
+	// Same values as D3D11_RESOURCE_DIMENSION.
+	enum Dimension
+	{
+		DimensionUnknown = 0,
+		DimensionTexture1D = 2,
+		DimensionTexture2D = 3,
+		DimensionTexture3D = 4
+	};
+
+	// Same values as DirectX::DDS_ALPHA_MODE.
+	enum AlphaMode
+	{
+		AlphaModeUnknown = 0,
+		AlphaModeStraight = 1,
+		AlphaModePremultiplied = 2,
+		AlphaModeOpaque = 3,
+		AlphaModeCustom = 4
+	};
+
+	// One mip level of one array item.  A volume mip holds Depth slices,
+	// SlicePitch bytes apart.
+	struct Subresource
+	{
+		const BYTE* Data;
+		UINT RowPitch;
+		UINT SlicePitch;
+		UINT Width;
+		UINT Height;
+		UINT Depth;
+	};
+
+	DDSFile();
+	~DDSFile();
+
+	/// Maps the file at path and parses it.  Returns the same errors the
+	/// DDS texture loader does: E_FAIL for a file that is not a DDS file,
+	/// ERROR_NOT_SUPPORTED and ERROR_INVALID_DATA for a header it cannot use
+	/// and ERROR_HANDLE_EOF for a file too short for its pixels.
+	HRESULT Open(const std::wstring& path);
+
+	/// Parses a DDS file in memory, which has to outlive the subresources.
+	HRESULT Parse(const BYTE* data, UINT64 size);
+	void Close();
+
+	bool IsOpen() const;
+
+	Dimension GetDimension() const;
+	DXGI_FORMAT GetFormat() const;
+	UINT GetWidth() const;
+	UINT GetHeight() const;
+	UINT GetDepth() const;
+
+	// Six items per cube of a cube map.
+	UINT GetArraySize() const;
+	UINT GetMipCount() const;
+	bool IsCubeMap() const;
+	AlphaMode GetAlphaMode() const;
+
+	// Subresources in the order of D3D11CalcSubresource: the mips of the
+	// first item, then of the next.
+	UINT GetSubresourceCount() const;
+	const Subresource& GetSubresource(UINT item, UINT mip) const;
+	const Subresource* GetSubresources() const;
+
+private:
+	DDSFile(const DDSFile& rhs);
+	DDSFile& operator=(const DDSFile& rhs);
+
+	HRESULT Read(const BYTE* data, UINT64 size);
+
+	// Checks the header and sets the description; bitOffset is where the
+	// pixels start.
+	HRESULT ParseHeader(const BYTE* data, UINT64 size, UINT64& bitOffset);
+	HRESULT LayOutSubresources(const BYTE* bits, UINT64 bitSize);
+
+private:
+	MappedFile m_File;
+	Dimension m_Dimension;
+	DXGI_FORMAT m_Format;
+	UINT m_Width;
+	UINT m_Height;
+	UINT m_Depth;
+	UINT m_ArraySize;
+	UINT m_MipCount;
+	bool m_IsCubeMap;
+	AlphaMode m_AlphaMode;
+	std::vector<Subresource> m_Subresources;
+};
@@ -23,6 +23,7 @@
 #include <d3d11_1.h>
 #include <stdint.h>
 
+class DDSFile;
 
 namespace DirectX
 {
@@ -130,4 +131,13 @@ namespace DirectX
         _Outptr_opt_ ID3D11Resource** texture,
         _Outptr_opt_ ID3D11ShaderResourceView** textureView,
         _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr);
+
+    // Version for a file already parsed, in memory or mapped, by DDSFile
+    HRESULT CreateDDSTextureFromDDSFile(
+        _In_ ID3D11Device* d3dDevice,
+        _In_ const DDSFile& dds,
+        _Outptr_opt_ ID3D11Resource** texture,
+        _Outptr_opt_ ID3D11ShaderResourceView** textureView,
+        _In_ size_t maxsize = 0,
+        _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr);
 }
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "DDSWriter.h"
+
+namespace
+{
+	const UINT DDSMagic = 0x20534444; // "DDS "
+
+	const UINT DDSHeaderFlags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x8; // CAPS | HEIGHT | WIDTH | PIXELFORMAT | PITCH
+	const UINT DDSFourCC = 0x4;
+	const UINT DDSCapsTexture = 0x1000;
+
+	// "DX10": the format follows in the extended header.
+	const UINT DX10FourCC = '0' << 24 | '1' << 16 | 'X' << 8 | 'D';
+
+#pragma pack(push, 1)
+	struct DDSPixelFormat
+	{
+		UINT Size;
+		UINT Flags;
+		UINT FourCC;
+		UINT RGBBitCount;
+		UINT RBitMask;
+		UINT GBitMask;
+		UINT BBitMask;
+		UINT ABitMask;
+	};
+
+	struct DDSHeader
+	{
+		UINT Size;
+		UINT Flags;
+		UINT Height;
+		UINT Width;
+		UINT PitchOrLinearSize;
+		UINT Depth;
+		UINT MipMapCount;
+		UINT Reserved1[11];
+		DDSPixelFormat PixelFormat;
+		UINT Caps;
+		UINT Caps2;
+		UINT Caps3;
+		UINT Caps4;
+		UINT Reserved2;
+	};
+
+	struct DDSHeaderDX10
+	{
+		UINT Format;
+		UINT ResourceDimension;
+		UINT MiscFlag;
+		UINT ArraySize;
+		UINT MiscFlags2;
+	};
+#pragma pack(pop)
+}
+
+UINT DDSWriter::GetBytesPerPixel(DXGI_FORMAT format)
+{
+	switch (format)
+	{
+	case DXGI_FORMAT_R8_UNORM:
+		return 1;
+	case DXGI_FORMAT_R8G8_UNORM:
+	case DXGI_FORMAT_R16_UNORM:
+	case DXGI_FORMAT_R16_FLOAT:
+		return 2;
+	case DXGI_FORMAT_R8G8B8A8_UNORM:
+	case DXGI_FORMAT_R8G8B8A8_SNORM:
+	case DXGI_FORMAT_R16G16_FLOAT:
+	case DXGI_FORMAT_R32_FLOAT:
+		return 4;
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+		return 8;
+	case DXGI_FORMAT_R32G32B32A32_FLOAT:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+bool DDSWriter::SaveTexture2D(const std::wstring& path, UINT width, UINT height, DXGI_FORMAT format,
+	const void* pixels, UINT rowPitch)
+{
+	UINT bytesPerPixel = GetBytesPerPixel(format);
+	if (bytesPerPixel == 0 || width == 0 || height == 0)
+	{
+		return false;
+	}
+
+	DDSHeader header;
+	ZeroMemory(&header, sizeof(header));
+	header.Size = sizeof(DDSHeader);
+	header.Flags = DDSHeaderFlags;
+	header.Height = height;
+	header.Width = width;
+	header.PitchOrLinearSize = width * bytesPerPixel;
+	header.Depth = 1;
+	header.MipMapCount = 1;
+	header.PixelFormat.Size = sizeof(DDSPixelFormat);
+	header.PixelFormat.Flags = DDSFourCC;
+	header.PixelFormat.FourCC = DX10FourCC;
+	header.Caps = DDSCapsTexture;
+
+	DDSHeaderDX10 header10;
+	ZeroMemory(&header10, sizeof(header10));
+	header10.Format = format;
+	header10.ResourceDimension = D3D11_RESOURCE_DIMENSION_TEXTURE2D;
+	header10.ArraySize = 1;
+
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	DWORD written = 0;
+	bool ok = WriteFile(file, &DDSMagic, sizeof(DDSMagic), &written, nullptr) &&
+		WriteFile(file, &header, sizeof(header), &written, nullptr) &&
+		WriteFile(file, &header10, sizeof(header10), &written, nullptr);
+
+	DWORD rowSize = width * bytesPerPixel;
+	const BYTE* row = (const BYTE*)pixels;
+	for (UINT y = 0; y < height && ok; ++y, row += rowPitch)
+	{
+		ok = WriteFile(file, row, rowSize, &written, nullptr) && written == rowSize;
+	}
+	CloseHandle(file);
+
+	return ok;
+}
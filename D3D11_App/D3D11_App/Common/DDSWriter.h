@@ -0,0 +1,15 @@
+#pragma once
+
+#include "d3dUtil.h"
+
+namespace DDSWriter
+{
+	/// Writes a single 2D image without mipmaps.  Rows of the source are
+	/// rowPitch bytes apart.  Returns false for formats without a fixed pixel
+	/// size or when the file cannot be written.
+	bool SaveTexture2D(const std::wstring& path, UINT width, UINT height, DXGI_FORMAT format,
+		const void* pixels, UINT rowPitch);
+
+	// Bytes per pixel of the uncompressed formats the writer knows, or 0.
+	UINT GetBytesPerPixel(DXGI_FORMAT format);
+}
@@ -0,0 +1,215 @@
+#include "FFT.h"
+#include "ThreadPool.h"
+#include "MathHelper.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <immintrin.h>
+
+namespace
+{
+	// Grids of fewer points are transformed on the calling thread.
+	const UINT ParallelThreshold = 1 << 14;
+
+	// Columns gathered into contiguous rows at a time.
+	const UINT ColumnBlock = 8;
+}
+
+FFT::FFT()
+	: m_Size(0)
+{
+
+}
+
+void FFT::Init(UINT size)
+{
+	assert(size > 0 && (size & (size - 1)) == 0);
+	m_Size = size;
+
+	UINT bits = 0;
+	while ((1u << bits) < size)
+	{
+		++bits;
+	}
+
+	m_BitReverse.resize(size);
+	for (UINT i = 0; i < size; ++i)
+	{
+		UINT r = 0;
+		for (UINT b = 0; b < bits; ++b)
+		{
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		}
+		m_BitReverse[i] = r;
+	}
+
+	m_TwiddleRe.resize(MathHelper::Max(size - 1, 1u));
+	m_TwiddleIm.resize(MathHelper::Max(size - 1, 1u));
+	for (UINT m = 1; m < size; m *= 2)
+	{
+		for (UINT k = 0; k < m; ++k)
+		{
+			double angle = -3.14159265358979323846 * k / m;
+			m_TwiddleRe[m - 1 + k] = (float)cos(angle);
+			m_TwiddleIm[m - 1 + k] = (float)sin(angle);
+		}
+	}
+}
+
+UINT FFT::Size() const
+{
+	return m_Size;
+}
+
+void FFT::Transform(float* re, float* im, bool inverse) const
+{
+	for (UINT i = 0; i < m_Size; ++i)
+	{
+		UINT j = m_BitReverse[i];
+		if (i < j)
+		{
+			std::swap(re[i], re[j]);
+			std::swap(im[i], im[j]);
+		}
+	}
+
+	Butterflies(re, im, inverse);
+}
+
+void FFT::Butterflies(float* re, float* im, bool inverse) const
+{
+	// The inverse takes the conjugates of the twiddles.
+	const float sign = inverse ? -1.f : 1.f;
+
+	for (UINT m = 1; m < m_Size; m *= 2)
+	{
+		const float* wr = &m_TwiddleRe[m - 1];
+		const float* wi = &m_TwiddleIm[m - 1];
+		for (UINT b = 0; b < m_Size; b += 2 * m)
+		{
+			float* ar = re + b;
+			float* ai = im + b;
+			float* cr = ar + m;
+			float* ci = ai + m;
+
+			UINT k = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+			const __m128 s = _mm_set1_ps(sign);
+			for (; k + 4 <= m; k += 4)
+			{
+				__m128 twr = _mm_loadu_ps(wr + k);
+				__m128 twi = _mm_mul_ps(_mm_loadu_ps(wi + k), s);
+				__m128 xr = _mm_loadu_ps(cr + k);
+				__m128 xi = _mm_loadu_ps(ci + k);
+				__m128 tr = _mm_sub_ps(_mm_mul_ps(twr, xr), _mm_mul_ps(twi, xi));
+				__m128 ti = _mm_add_ps(_mm_mul_ps(twr, xi), _mm_mul_ps(twi, xr));
+
+				__m128 yr = _mm_loadu_ps(ar + k);
+				__m128 yi = _mm_loadu_ps(ai + k);
+				_mm_storeu_ps(cr + k, _mm_sub_ps(yr, tr));
+				_mm_storeu_ps(ci + k, _mm_sub_ps(yi, ti));
+				_mm_storeu_ps(ar + k, _mm_add_ps(yr, tr));
+				_mm_storeu_ps(ai + k, _mm_add_ps(yi, ti));
+			}
+#endif
+			for (; k < m; ++k)
+			{
+				float twr = wr[k];
+				float twi = wi[k] * sign;
+				float tr = twr * cr[k] - twi * ci[k];
+				float ti = twr * ci[k] + twi * cr[k];
+
+				float yr = ar[k];
+				float yi = ai[k];
+				cr[k] = yr - tr;
+				ci[k] = yi - ti;
+				ar[k] = yr + tr;
+				ai[k] = yi + ti;
+			}
+		}
+	}
+}
+
+void FFT::Transform2D(float* re, float* im, bool inverse, ThreadPool* pool) const
+{
+	const UINT n = m_Size;
+
+	auto transformRows = [=](UINT begin, UINT end)
+	{
+		for (UINT i = begin; i < end; ++i)
+		{
+			Transform(re + i * n, im + i * n, inverse);
+		}
+	};
+
+	auto transformColumns = [=](UINT begin, UINT end)
+	{
+		std::vector<float> scratch(2 * ColumnBlock * n);
+		for (UINT block = begin; block < end; ++block)
+		{
+			UINT first = block * ColumnBlock;
+			TransformColumns(re, im, first, MathHelper::Min(ColumnBlock, n - first), inverse, &scratch[0]);
+		}
+	};
+
+	const UINT blockCount = (n + ColumnBlock - 1) / ColumnBlock;
+	if (pool != nullptr && pool->ThreadCount() > 1 && n * n >= ParallelThreshold)
+	{
+		pool->ParallelFor(n, ColumnBlock, transformRows);
+		pool->ParallelFor(blockCount, 1, transformColumns);
+	}
+	else
+	{
+		transformRows(0, n);
+		transformColumns(0, blockCount);
+	}
+}
+
+void FFT::TransformColumns(float* re, float* im, UINT first, UINT count, bool inverse, float* scratch) const
+{
+	// Gather the columns a few values of a grid row at a time, transform
+	// them and scatter them back.
+	const UINT n = m_Size;
+	float* scratchRe = scratch;
+	float* scratchIm = scratch + ColumnBlock * n;
+	for (UINT i = 0; i < n; ++i)
+	{
+		for (UINT c = 0; c < count; ++c)
+		{
+			scratchRe[c * n + i] = re[i * n + first + c];
+			scratchIm[c * n + i] = im[i * n + first + c];
+		}
+	}
+
+	for (UINT c = 0; c < count; ++c)
+	{
+		Transform(scratchRe + c * n, scratchIm + c * n, inverse);
+	}
+
+	for (UINT i = 0; i < n; ++i)
+	{
+		for (UINT c = 0; c < count; ++c)
+		{
+			re[i * n + first + c] = scratchRe[c * n + i];
+			im[i * n + first + c] = scratchIm[c * n + i];
+		}
+	}
+}
+
+void FFT::SplitReal(const float* re, const float* im, UINT size, float* aRe, float* aIm, float* bRe, float* bIm)
+{
+	// A[k] = (Z[k] + conj(Z[N - k])) / 2 and B[k] = (Z[k] - conj(Z[N - k])) / 2i.
+	for (UINT k = 0; k <= size / 2; ++k)
+	{
+		UINT mirror = (size - k) & (size - 1);
+		float zr = re[k];
+		float zi = im[k];
+		float cr = re[mirror];
+		float ci = im[mirror];
+
+		aRe[k] = .5f * (zr + cr);
+		aIm[k] = .5f * (zi - ci);
+		bRe[k] = .5f * (zi + ci);
+		bIm[k] = -.5f * (zr - cr);
+	}
+}
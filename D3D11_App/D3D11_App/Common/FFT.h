@@ -0,0 +1,54 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+
+class ThreadPool;
+
+// Radix-2 fast Fourier transforms of a power of two size, in place, on
+// complex values kept as separate arrays of real and imaginary parts.
+//
+// The forward transform is X[k] = sum x[n] e^(-2 pi i n k / N) and the
+// inverse uses e^(+2 pi i n k / N); neither divides by N.  Butterflies go
+// four at a time with SSE once a stage spans four or more of them.
+//
+// Two real signals transform together as one complex one, a + ib: the
+// transform of a real signal is conjugate symmetric, so the two are picked
+// apart again by SplitReal, and a conjugate symmetric pair put together this
+// way transforms back to a in the real parts and b in the imaginary ones.
+class FFT
+{
+public:
+	FFT();
+
+	void Init(UINT size);
+	UINT Size() const;
+
+	void Transform(float* re, float* im, bool inverse) const;
+
+	// Transforms a size by size grid, row by row, in every row and then in
+	// every column.  The rows, and then the columns, are split across the
+	// threads of the pool.
+	void Transform2D(float* re, float* im, bool inverse, ThreadPool* pool = nullptr) const;
+
+	// Separates the transforms A and B of two real signals from that of
+	// a + ib, one size long.  A and B only need their first size / 2 + 1
+	// values, the rest being the conjugates of those.
+	static void SplitReal(const float* re, const float* im, UINT size, float* aRe, float* aIm, float* bRe, float* bIm);
+
+private:
+	void Butterflies(float* re, float* im, bool inverse) const;
+
+	// Transforms columns [first, first + count) of the grid, gathered into
+	// contiguous rows of scratch.
+	void TransformColumns(float* re, float* im, UINT first, UINT count, bool inverse, float* scratch) const;
+
+private:
+	UINT m_Size;
+	std::vector<UINT> m_BitReverse;
+
+	// The twiddle factors of every stage, e^(-pi i k / m) for k in [0, m),
+	// one stage after another for m = 1, 2, 4, ...  A stage starts at m - 1.
+	std::vector<float> m_TwiddleRe;
+	std::vector<float> m_TwiddleIm;
+};
@@ -0,0 +1,398 @@
+#include "HeightFilter.h"
+#include "MathHelper.h"
+
+namespace
+{
+	// Rows a thread filters at a time.  The separable filters redo the rows
+	// within the radius of a band, so bands are kept well above it.
+	const UINT BandRows = 64;
+
+	XMVECTOR LoadFloat4(const float* p)
+	{
+		return XMLoadFloat4((const XMFLOAT4*)p);
+	}
+
+	void StoreFloat4(float* p, FXMVECTOR v)
+	{
+		XMStoreFloat4((XMFLOAT4*)p, v);
+	}
+
+	// Average of sample j with its neighbours in the rows given, leaving out
+	// those past the ends of the rows.  The taps are added in the order of
+	// the 3x3 loop the terrain used, row by row.
+	float AverageSample(const float* const* rows, UINT rowCount, UINT width, UINT j)
+	{
+		float sum = 0.0f;
+		int num = 0;
+		for (UINT m = 0; m < rowCount; ++m)
+		{
+			for (int n = (int)j - 1; n <= (int)j + 1; ++n)
+			{
+				if (n >= 0 && n < (int)width)
+				{
+					sum += rows[m][n];
+					++num;
+				}
+			}
+		}
+
+		return sum / num;
+	}
+
+	void CompareExchange(float& a, float& b)
+	{
+		float lo = MathHelper::Min(a, b);
+		b = MathHelper::Max(a, b);
+		a = lo;
+	}
+
+	void CompareExchange(XMVECTOR& a, XMVECTOR& b)
+	{
+		XMVECTOR lo = XMVectorMin(a, b);
+		b = XMVectorMax(a, b);
+		a = lo;
+	}
+
+	// Median of an odd count of values, sorted in place by odd-even
+	// transposition, which needs nothing but min and max and so runs on four
+	// lanes at a time as well as on one.
+	template<class T>
+	T SelectMedian(T* values, UINT count)
+	{
+		for (UINT pass = 0; pass < count; ++pass)
+		{
+			for (UINT k = pass % 2; k + 1 < count; k += 2)
+			{
+				CompareExchange(values[k], values[k + 1]);
+			}
+		}
+
+		return values[count / 2];
+	}
+
+	// Medians of the count consecutive values from every sample of a row.
+	void MedianRow(const float* in, UINT width, UINT count, float* out)
+	{
+		XMVECTOR taps[2 * HeightFilter::MaxMedianRadius + 1];
+		float scalarTaps[2 * HeightFilter::MaxMedianRadius + 1];
+
+		UINT j = 0;
+		for (; j + 4 <= width; j += 4)
+		{
+			for (UINT k = 0; k < count; ++k)
+			{
+				taps[k] = LoadFloat4(in + j + k);
+			}
+			StoreFloat4(out + j, SelectMedian(taps, count));
+		}
+
+		for (; j < width; ++j)
+		{
+			for (UINT k = 0; k < count; ++k)
+			{
+				scalarTaps[k] = in[j + k];
+			}
+			out[j] = SelectMedian(scalarTaps, count);
+		}
+	}
+}
+
+HeightFilter::HeightFilter(Type type, UINT radius, float sigma)
+	: m_Type(type)
+	, m_Radius(radius)
+{
+	if (m_Type == Median)
+	{
+		m_Radius = MathHelper::Min(m_Radius, MaxMedianRadius);
+	}
+
+	m_Weights.resize(2 * m_Radius + 1);
+	for (int k = -(int)m_Radius; k <= (int)m_Radius; ++k)
+	{
+		m_Weights[k + m_Radius] = m_Type == Gaussian ? expf(-0.5f * k * k / (sigma * sigma)) : 1.0f;
+	}
+}
+
+HeightFilter::Type HeightFilter::GetType() const
+{
+	return m_Type;
+}
+
+UINT HeightFilter::GetRadius() const
+{
+	return m_Radius;
+}
+
+void HeightFilter::Apply(const float* src, UINT srcFirstRow, UINT width, UINT height,
+	UINT firstRow, UINT rowCount, float* dest, ThreadPool* pool) const
+{
+	std::vector<float> columnNorms;
+	if (m_Type != Median)
+	{
+		columnNorms.resize(width);
+		for (UINT j = 0; j < width; ++j)
+		{
+			columnNorms[j] = CalcNorm(j, width);
+		}
+	}
+
+	Window w;
+	w.Src = src;
+	w.SrcFirstRow = srcFirstRow;
+	w.Width = width;
+	w.Height = height;
+	w.FirstRow = firstRow;
+	w.Dest = dest;
+	w.ColumnNorms = columnNorms.empty() ? nullptr : &columnNorms[0];
+
+	auto filterBand = [&](UINT begin, UINT end)
+	{
+		if (m_Type == Median)
+		{
+			FilterMedian(w, begin, end);
+		}
+		else if (m_Type == Box && m_Radius == 1)
+		{
+			FilterBox3(w, begin, end);
+		}
+		else
+		{
+			FilterSeparable(w, begin, end);
+		}
+	};
+
+	if (pool != nullptr)
+	{
+		pool->ParallelFor(rowCount, BandRows, filterBand);
+	}
+	else
+	{
+		filterBand(0, rowCount);
+	}
+}
+
+void HeightFilter::Apply(const float* src, UINT width, UINT height, float* dest, ThreadPool* pool) const
+{
+	Apply(src, 0, width, height, 0, height, dest, pool);
+}
+
+void HeightFilter::FilterBox3(const Window& w, UINT begin, UINT end) const
+{
+	for (UINT r = begin; r < end; ++r)
+	{
+		UINT i = w.FirstRow + r;
+		UINT top = i > 0 ? i - 1 : 0;
+		UINT bottom = MathHelper::Min(i + 1, w.Height - 1);
+
+		const float* rows[3];
+		UINT rowCount = 0;
+		for (UINT m = top; m <= bottom; ++m)
+		{
+			rows[rowCount++] = w.Src + (size_t)(m - w.SrcFirstRow) * w.Width;
+		}
+
+		float* out = w.Dest + (size_t)r * w.Width;
+		out[0] = AverageSample(rows, rowCount, w.Width, 0);
+
+		// Every column between the first and the last has both neighbours.
+		// The taps must be added one after the other to round like the
+		// scalar average, so four groups of columns are summed side by side
+		// to keep the adds from waiting on each other.
+		XMVECTOR num = XMVectorReplicate((float)(3 * rowCount));
+		UINT j = 1;
+		for (; j + 16 < w.Width; j += 16)
+		{
+			XMVECTOR sum[4] = { XMVectorZero(), XMVectorZero(), XMVectorZero(), XMVectorZero() };
+			for (UINT m = 0; m < rowCount; ++m)
+			{
+				for (int n = -1; n <= 1; ++n)
+				{
+					const float* p = rows[m] + j + n;
+					sum[0] = XMVectorAdd(sum[0], LoadFloat4(p));
+					sum[1] = XMVectorAdd(sum[1], LoadFloat4(p + 4));
+					sum[2] = XMVectorAdd(sum[2], LoadFloat4(p + 8));
+					sum[3] = XMVectorAdd(sum[3], LoadFloat4(p + 12));
+				}
+			}
+			for (UINT k = 0; k < 4; ++k)
+			{
+				StoreFloat4(out + j + 4 * k, XMVectorDivide(sum[k], num));
+			}
+		}
+
+		for (; j + 4 < w.Width; j += 4)
+		{
+			XMVECTOR sum = XMVectorZero();
+			for (UINT m = 0; m < rowCount; ++m)
+			{
+				sum = XMVectorAdd(sum, LoadFloat4(rows[m] + j - 1));
+				sum = XMVectorAdd(sum, LoadFloat4(rows[m] + j));
+				sum = XMVectorAdd(sum, LoadFloat4(rows[m] + j + 1));
+			}
+			StoreFloat4(out + j, XMVectorDivide(sum, num));
+		}
+
+		for (; j < w.Width; ++j)
+		{
+			out[j] = AverageSample(rows, rowCount, w.Width, j);
+		}
+	}
+}
+
+void HeightFilter::FilterSeparable(const Window& w, UINT begin, UINT end) const
+{
+	UINT first = w.FirstRow + begin;
+	UINT last = w.FirstRow + end;
+	UINT top = first > m_Radius ? first - m_Radius : 0;
+	UINT bottom = MathHelper::Min(last + m_Radius, w.Height);
+
+	// Horizontal pass over every row within the radius of the band.
+	std::vector<float> sums((size_t)(bottom - top) * w.Width);
+	for (UINT m = top; m < bottom; ++m)
+	{
+		SumRow(w.Src + (size_t)(m - w.SrcFirstRow) * w.Width, w.Width, &sums[(size_t)(m - top) * w.Width]);
+	}
+
+	const float* weights = &m_Weights[m_Radius];
+	for (UINT i = first; i < last; ++i)
+	{
+		UINT m0 = i > m_Radius ? i - m_Radius : 0;
+		UINT m1 = MathHelper::Min(i + m_Radius, w.Height - 1);
+		float rowNorm = CalcNorm(i, w.Height);
+		float* out = w.Dest + (size_t)(i - w.FirstRow) * w.Width;
+
+		UINT j = 0;
+		for (; j + 4 <= w.Width; j += 4)
+		{
+			XMVECTOR sum = XMVectorZero();
+			for (UINT m = m0; m <= m1; ++m)
+			{
+				XMVECTOR weight = XMVectorReplicate(weights[(int)m - (int)i]);
+				sum = XMVectorMultiplyAdd(LoadFloat4(&sums[(size_t)(m - top) * w.Width + j]), weight, sum);
+			}
+			XMVECTOR norm = XMVectorScale(LoadFloat4(w.ColumnNorms + j), rowNorm);
+			StoreFloat4(out + j, XMVectorMultiply(sum, norm));
+		}
+
+		for (; j < w.Width; ++j)
+		{
+			float sum = 0.0f;
+			for (UINT m = m0; m <= m1; ++m)
+			{
+				sum += weights[(int)m - (int)i] * sums[(size_t)(m - top) * w.Width + j];
+			}
+			out[j] = sum * w.ColumnNorms[j] * rowNorm;
+		}
+	}
+}
+
+void HeightFilter::FilterMedian(const Window& w, UINT begin, UINT end) const
+{
+	UINT first = w.FirstRow + begin;
+	UINT last = w.FirstRow + end;
+	UINT top = first > m_Radius ? first - m_Radius : 0;
+	UINT bottom = MathHelper::Min(last + m_Radius, w.Height);
+	UINT count = 2 * m_Radius + 1;
+
+	// Row medians of every row within the radius of the band, each row
+	// padded by repeating its end samples.
+	std::vector<float> padded(w.Width + 2 * m_Radius);
+	std::vector<float> medians((size_t)(bottom - top) * w.Width);
+	for (UINT m = top; m < bottom; ++m)
+	{
+		const float* in = w.Src + (size_t)(m - w.SrcFirstRow) * w.Width;
+		for (UINT k = 0; k < m_Radius; ++k)
+		{
+			padded[k] = in[0];
+			padded[m_Radius + w.Width + k] = in[w.Width - 1];
+		}
+		memcpy(&padded[m_Radius], in, w.Width * sizeof(float));
+
+		MedianRow(&padded[0], w.Width, count, &medians[(size_t)(m - top) * w.Width]);
+	}
+
+	XMVECTOR taps[2 * MaxMedianRadius + 1];
+	float scalarTaps[2 * MaxMedianRadius + 1];
+	const float* rows[2 * MaxMedianRadius + 1];
+	for (UINT i = first; i < last; ++i)
+	{
+		for (UINT k = 0; k < count; ++k)
+		{
+			int m = MathHelper::Clamp((int)(i + k) - (int)m_Radius, 0, (int)w.Height - 1);
+			rows[k] = &medians[(size_t)(m - top) * w.Width];
+		}
+		float* out = w.Dest + (size_t)(i - w.FirstRow) * w.Width;
+
+		UINT j = 0;
+		for (; j + 4 <= w.Width; j += 4)
+		{
+			for (UINT k = 0; k < count; ++k)
+			{
+				taps[k] = LoadFloat4(rows[k] + j);
+			}
+			StoreFloat4(out + j, SelectMedian(taps, count));
+		}
+
+		for (; j < w.Width; ++j)
+		{
+			for (UINT k = 0; k < count; ++k)
+			{
+				scalarTaps[k] = rows[k][j];
+			}
+			out[j] = SelectMedian(scalarTaps, count);
+		}
+	}
+}
+
+float HeightFilter::CalcNorm(UINT i, UINT size) const
+{
+	int k0 = -(int)MathHelper::Min(i, m_Radius);
+	int k1 = (int)MathHelper::Min(size - 1 - i, m_Radius);
+
+	float weight = 0.0f;
+	for (int k = k0; k <= k1; ++k)
+	{
+		weight += m_Weights[k + m_Radius];
+	}
+
+	return 1.0f / weight;
+}
+
+void HeightFilter::SumRow(const float* in, UINT width, float* out) const
+{
+	int radius = (int)m_Radius;
+	const float* weights = &m_Weights[m_Radius];
+
+	auto sumEdge = [&](int j)
+	{
+		float sum = 0.0f;
+		for (int k = MathHelper::Max(-radius, -j); k <= MathHelper::Min(radius, (int)width - 1 - j); ++k)
+		{
+			sum += weights[k] * in[j + k];
+		}
+		return sum;
+	};
+
+	// The interior has every tap inside the row.
+	int interiorEnd = (int)width - radius;
+	int j = 0;
+	for (; j < MathHelper::Min(radius, (int)width); ++j)
+	{
+		out[j] = sumEdge(j);
+	}
+
+	for (; j + 4 <= interiorEnd; j += 4)
+	{
+		XMVECTOR sum = XMVectorZero();
+		for (int k = -radius; k <= radius; ++k)
+		{
+			sum = XMVectorMultiplyAdd(LoadFloat4(in + j + k), XMVectorReplicate(weights[k]), sum);
+		}
+		StoreFloat4(out + j, sum);
+	}
+
+	for (; j < (int)width; ++j)
+	{
+		out[j] = sumEdge(j);
+	}
+}
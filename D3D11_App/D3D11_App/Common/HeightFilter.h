@@ -0,0 +1,87 @@
+#pragma once
+
+#include "d3dUtil.h"
+#include "ThreadPool.h"
+
+// Smoothing filters for heightmaps held in memory as rows of floats.  A
+// filter reads a window of rows of a larger heightmap, so that maps too big
+// to hold twice can be streamed through it in bands.
+//
+// The box and Gaussian filters leave out the taps past the edges of the
+// heightmap and divide by the weight of the taps left.  The box filter of
+// radius 1 adds its nine taps row by row the way the terrain always averaged
+// a sample with its neighbours, so its results match that bit for bit; the
+// other filters run as a horizontal pass and a vertical pass.  The median
+// filter takes the median of each row of taps and then the median of those,
+// which is close to the true median at a fraction of the cost; it repeats the
+// samples on the edges.
+//
+// Interiors are filtered four samples at a time and the samples near the
+// edges one at a time.  Rows are split into bands run across the threads of
+// a pool.
+class HeightFilter
+{
+public:
+	enum Type
+	{
+		Box,
+		Gaussian,
+		Median
+	};
+
+	static const UINT MaxMedianRadius = 7;
+
+	// The filter reaches radius samples to either side.  sigma is the
+	// standard deviation of the Gaussian in samples.  The median radius is
+	// limited to MaxMedianRadius.
+	HeightFilter(Type type, UINT radius, float sigma = 1.0f);
+
+	Type GetType() const;
+	UINT GetRadius() const;
+
+	/// Filters rows [firstRow, firstRow + rowCount) of a width x height
+	/// heightmap into dest, which holds rowCount rows of width samples.  src
+	/// holds consecutive rows of the heightmap starting at srcFirstRow and
+	/// must hold every row within the radius of the rows filtered.  Without
+	/// a pool the calling thread filters every row.
+	void Apply(const float* src, UINT srcFirstRow, UINT width, UINT height,
+		UINT firstRow, UINT rowCount, float* dest, ThreadPool* pool) const;
+
+	// Filters a whole heightmap.
+	void Apply(const float* src, UINT width, UINT height, float* dest, ThreadPool* pool) const;
+
+private:
+	// The heightmap and the window of it a call filters.
+	struct Window
+	{
+		const float* Src;
+		UINT SrcFirstRow;
+		UINT Width;
+		UINT Height;
+		UINT FirstRow;
+		float* Dest;
+
+		// Reciprocal of the weight of the taps of every column inside the
+		// heightmap, for the separable filters.
+		const float* ColumnNorms;
+	};
+
+	// Filter rows [begin, end) of the window, counted from its first row.
+	void FilterBox3(const Window& w, UINT begin, UINT end) const;
+	void FilterSeparable(const Window& w, UINT begin, UINT end) const;
+	void FilterMedian(const Window& w, UINT begin, UINT end) const;
+
+	// Reciprocal of the weight of the taps inside [0, size) of a filter
+	// centred on index i.
+	float CalcNorm(UINT i, UINT size) const;
+
+	// Weighted sums of the taps of every sample of a row that lie inside it.
+	void SumRow(const float* in, UINT width, float* out) const;
+
+private:
+	Type m_Type;
+	UINT m_Radius;
+
+	// 2 * radius + 1 tap weights of the box and Gaussian filters.
+	std::vector<float> m_Weights;
+};
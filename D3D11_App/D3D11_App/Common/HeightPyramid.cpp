@@ -0,0 +1,286 @@
+#include "HeightPyramid.h"
+
+namespace
+{
+	const UINT TileSamples = TiledHeightmap::TileCells + 1;
+	const UINT TileNodes = TiledHeightmap::TileCells / HeightPyramid::BaseCells;
+
+	// Levels whose grid quads fit in a tile.
+	const UINT TileGridLevels = 9;
+
+	XMVECTOR LoadFloat4(const float* p)
+	{
+		return XMLoadFloat4((const XMFLOAT4*)p);
+	}
+
+	void StoreFloat4(float* p, FXMVECTOR v)
+	{
+		XMStoreFloat4((XMFLOAT4*)p, v);
+	}
+
+	// Min and max of the BaseCells + 1 samples starting at p.
+	void ReduceSpan(const float* p, float* pMin, float* pMax)
+	{
+		XMVECTOR v0 = LoadFloat4(p);
+		XMVECTOR v1 = LoadFloat4(p + 4);
+		XMVECTOR v2 = LoadFloat4(p + 8);
+		XMVECTOR v3 = LoadFloat4(p + 12);
+		XMVECTOR last = XMVectorReplicate(p[16]);
+
+		XMVECTOR lo = XMVectorMin(XMVectorMin(XMVectorMin(v0, v1), XMVectorMin(v2, v3)), last);
+		XMVECTOR hi = XMVectorMax(XMVectorMax(XMVectorMax(v0, v1), XMVectorMax(v2, v3)), last);
+
+		lo = XMVectorMin(lo, XMVectorSwizzle<2, 3, 0, 1>(lo));
+		hi = XMVectorMax(hi, XMVectorSwizzle<2, 3, 0, 1>(hi));
+		lo = XMVectorMin(lo, XMVectorSwizzle<1, 0, 3, 2>(lo));
+		hi = XMVectorMax(hi, XMVectorSwizzle<1, 0, 3, 2>(hi));
+
+		*pMin = XMVectorGetX(lo);
+		*pMax = XMVectorGetX(hi);
+	}
+
+	// Largest distance from a sample of a grid with the given spacing,
+	// dropped as the spacing doubles, to the triangles through the samples
+	// kept.  Those are the midpoints of the horizontal and vertical edges and
+	// of the diagonals from top right to bottom left, the way the terrain
+	// LOD grid splits its quads.
+	template<class Sample>
+	float DecimationError(UINT spacing, UINT width, UINT height, const Sample& sample)
+	{
+		float error = 0.0f;
+		for (UINT y = 0; y < height; y += spacing)
+		{
+			if ((y / spacing) % 2 == 0)
+			{
+				for (UINT x = spacing; x + spacing < width; x += 2 * spacing)
+				{
+					float h = 0.5f * (sample(y, x - spacing) + sample(y, x + spacing));
+					error = MathHelper::Max(error, fabsf(sample(y, x) - h));
+				}
+			}
+			else if (y + spacing < height)
+			{
+				for (UINT x = 0; x < width; x += 2 * spacing)
+				{
+					float h = 0.5f * (sample(y - spacing, x) + sample(y + spacing, x));
+					error = MathHelper::Max(error, fabsf(sample(y, x) - h));
+				}
+				for (UINT x = spacing; x + spacing < width; x += 2 * spacing)
+				{
+					float h = 0.5f * (sample(y - spacing, x + spacing) + sample(y + spacing, x - spacing));
+					error = MathHelper::Max(error, fabsf(sample(y, x) - h));
+				}
+			}
+		}
+
+		return error;
+	}
+}
+
+HeightPyramid::HeightPyramid()
+{
+
+}
+
+void HeightPyramid::Build(TiledHeightmap& heightmap, ThreadPool* pool)
+{
+	static_assert(BaseCells == 16, "ReduceSpan reads 17 samples");
+	static_assert(1 << (TileGridLevels - 1) == TiledHeightmap::TileCells, "TileGridLevels does not match TileCells");
+
+	m_Levels.clear();
+	m_Levels.push_back(Level());
+
+	Level& base = m_Levels[0];
+	AllocateLevel(base, (heightmap.GetWidth() - 2) / BaseCells + 1, (heightmap.GetHeight() - 2) / BaseCells + 1);
+
+	// Span bounds of every sample row of a tile, then node bounds.
+	std::vector<float> spanMin(TileSamples * TileNodes);
+	std::vector<float> spanMax(TileSamples * TileNodes);
+	float nodeMin[TileNodes * TileNodes];
+	float nodeMax[TileNodes * TileNodes];
+	float tileGridErrors[TileGridLevels] = {};
+
+	for (UINT ty = 0; ty < heightmap.GetTilesY(); ++ty)
+	{
+		if (pool != nullptr)
+		{
+			heightmap.PageRect(0, ty, heightmap.GetTilesX() - 1, ty, pool);
+		}
+
+		for (UINT tx = 0; tx < heightmap.GetTilesX(); ++tx)
+		{
+			const float* tile = heightmap.GetTile(tx, ty);
+
+			for (UINT y = 0; y < TileSamples; ++y)
+			{
+				const float* row = tile + y * TileSamples;
+				for (UINT k = 0; k < TileNodes; ++k)
+				{
+					ReduceSpan(row + k * BaseCells, &spanMin[y * TileNodes + k], &spanMax[y * TileNodes + k]);
+				}
+			}
+
+			// Nodes share their border rows, so node ny reduces rows
+			// [ny * BaseCells, ny * BaseCells + BaseCells].
+			for (UINT ny = 0; ny < TileNodes; ++ny)
+			{
+				for (UINT k = 0; k < TileNodes; k += 4)
+				{
+					const float* srcMin = &spanMin[ny * BaseCells * TileNodes + k];
+					const float* srcMax = &spanMax[ny * BaseCells * TileNodes + k];
+
+					XMVECTOR lo = LoadFloat4(srcMin);
+					XMVECTOR hi = LoadFloat4(srcMax);
+					for (UINT y = 1; y <= BaseCells; ++y)
+					{
+						lo = XMVectorMin(lo, LoadFloat4(srcMin + y * TileNodes));
+						hi = XMVectorMax(hi, LoadFloat4(srcMax + y * TileNodes));
+					}
+
+					StoreFloat4(&nodeMin[ny * TileNodes + k], lo);
+					StoreFloat4(&nodeMax[ny * TileNodes + k], hi);
+				}
+			}
+
+			// The last tiles may reach past the heightmap.
+			UINT x0 = tx * TileNodes;
+			UINT y0 = ty * TileNodes;
+			UINT countX = MathHelper::Min(TileNodes, base.Width - x0);
+			UINT countY = MathHelper::Min(TileNodes, base.Height - y0);
+			for (UINT ny = 0; ny < countY; ++ny)
+			{
+				memcpy(&base.Min[(y0 + ny) * base.Stride + x0], &nodeMin[ny * TileNodes], countX * sizeof(float));
+				memcpy(&base.Max[(y0 + ny) * base.Stride + x0], &nodeMax[ny * TileNodes], countX * sizeof(float));
+			}
+
+			// Tiles start on a multiple of the spacing of every level whose
+			// quads fit in them, so those are measured tile by tile.
+			UINT samplesX = MathHelper::Min(TileSamples, heightmap.GetWidth() - tx * TiledHeightmap::TileCells);
+			UINT samplesY = MathHelper::Min(TileSamples, heightmap.GetHeight() - ty * TiledHeightmap::TileCells);
+			auto sample = [tile](UINT row, UINT col)
+			{
+				return tile[row * TileSamples + col];
+			};
+			for (UINT level = 1; level < TileGridLevels; ++level)
+			{
+				float error = DecimationError(1 << (level - 1), samplesX, samplesY, sample);
+				tileGridErrors[level] = MathHelper::Max(tileGridErrors[level], error);
+			}
+		}
+	}
+	PadLevel(base);
+
+	while (m_Levels.back().Width > 1 || m_Levels.back().Height > 1)
+	{
+		m_Levels.push_back(Level());
+
+		Level& src = m_Levels[m_Levels.size() - 2];
+		Level& dest = m_Levels.back();
+		AllocateLevel(dest, (src.Width + 1) / 2, (src.Height + 1) / 2);
+		ReduceLevel(src, dest);
+		PadLevel(dest);
+	}
+
+	// The coarser levels have few samples, read across the tiles.
+	auto sample = [&heightmap](UINT row, UINT col)
+	{
+		return heightmap.GetSample((int)row, (int)col);
+	};
+
+	m_GridErrors.assign(m_Levels.size(), 0.0f);
+	for (UINT level = 1; level < m_Levels.size(); ++level)
+	{
+		float error = level < TileGridLevels ? tileGridErrors[level] :
+			DecimationError(1 << (level - 1), heightmap.GetWidth(), heightmap.GetHeight(), sample);
+		m_GridErrors[level] = m_GridErrors[level - 1] + error;
+	}
+}
+
+UINT HeightPyramid::GetLevelCount() const
+{
+	return (UINT)m_Levels.size();
+}
+
+UINT HeightPyramid::GetLevelWidth(UINT level) const
+{
+	return m_Levels[level].Width;
+}
+
+UINT HeightPyramid::GetLevelHeight(UINT level) const
+{
+	return m_Levels[level].Height;
+}
+
+UINT HeightPyramid::GetNodeCells(UINT level) const
+{
+	return BaseCells << level;
+}
+
+XMFLOAT2 HeightPyramid::GetBounds(UINT level, UINT x, UINT y) const
+{
+	const Level& l = m_Levels[level];
+	return XMFLOAT2(l.Min[y * l.Stride + x], l.Max[y * l.Stride + x]);
+}
+
+float HeightPyramid::GetGridError(UINT level) const
+{
+	return m_GridErrors[level];
+}
+
+void HeightPyramid::AllocateLevel(Level& level, UINT width, UINT height)
+{
+	level.Width = width;
+	level.Height = height;
+	level.Stride = (width + 7) & ~7u;
+
+	UINT rows = (height + 1) & ~1u;
+	level.Min.resize(rows * level.Stride);
+	level.Max.resize(rows * level.Stride);
+}
+
+void HeightPyramid::PadLevel(Level& level)
+{
+	for (UINT y = 0; y < level.Height; ++y)
+	{
+		float* rowMin = &level.Min[y * level.Stride];
+		float* rowMax = &level.Max[y * level.Stride];
+		for (UINT x = level.Width; x < level.Stride; ++x)
+		{
+			rowMin[x] = rowMin[level.Width - 1];
+			rowMax[x] = rowMax[level.Width - 1];
+		}
+	}
+
+	if (level.Height % 2 == 1)
+	{
+		size_t last = (level.Height - 1) * level.Stride;
+		std::copy(level.Min.begin() + last, level.Min.begin() + last + level.Stride, level.Min.begin() + last + level.Stride);
+		std::copy(level.Max.begin() + last, level.Max.begin() + last + level.Stride, level.Max.begin() + last + level.Stride);
+	}
+}
+
+void HeightPyramid::ReduceLevel(const Level& src, Level& dest)
+{
+	for (UINT y = 0; y < dest.Height; ++y)
+	{
+		const float* min0 = &src.Min[2 * y * src.Stride];
+		const float* min1 = min0 + src.Stride;
+		const float* max0 = &src.Max[2 * y * src.Stride];
+		const float* max1 = max0 + src.Stride;
+
+		for (UINT x = 0; x < dest.Width; x += 4)
+		{
+			// Eight source nodes from each of the two rows make four destination nodes.
+			XMVECTOR loA = XMVectorMin(LoadFloat4(min0 + 2 * x), LoadFloat4(min1 + 2 * x));
+			XMVECTOR loB = XMVectorMin(LoadFloat4(min0 + 2 * x + 4), LoadFloat4(min1 + 2 * x + 4));
+			XMVECTOR hiA = XMVectorMax(LoadFloat4(max0 + 2 * x), LoadFloat4(max1 + 2 * x));
+			XMVECTOR hiB = XMVectorMax(LoadFloat4(max0 + 2 * x + 4), LoadFloat4(max1 + 2 * x + 4));
+
+			XMVECTOR lo = XMVectorMin(XMVectorPermute<0, 2, 4, 6>(loA, loB), XMVectorPermute<1, 3, 5, 7>(loA, loB));
+			XMVECTOR hi = XMVectorMax(XMVectorPermute<0, 2, 4, 6>(hiA, hiB), XMVectorPermute<1, 3, 5, 7>(hiA, hiB));
+
+			StoreFloat4(&dest.Min[y * dest.Stride + x], lo);
+			StoreFloat4(&dest.Max[y * dest.Stride + x], hi);
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "TiledHeightmap.h"
+
+// Min/max mip pyramid over a heightmap.  A node of level 0 covers BaseCells x
+// BaseCells cells, including the samples on its border, and every level above
+// halves the resolution until one node covers the whole map.  Nodes along the
+// right and bottom edges of a level may reach past the heightmap.
+class HeightPyramid
+{
+public:
+	static const UINT BaseCells = 16;
+
+	HeightPyramid();
+
+	/// Builds the pyramid from every tile of the heightmap, reading them one
+	/// at a time.  Level 0 is reduced from the samples and the levels above
+	/// from the level below, four nodes at a time.  The grid errors are
+	/// measured from the same tiles.  With a pool, every row of tiles is
+	/// paged in across its threads first.
+	void Build(TiledHeightmap& heightmap, ThreadPool* pool = nullptr);
+
+	UINT GetLevelCount() const;
+	UINT GetLevelWidth(UINT level) const;
+	UINT GetLevelHeight(UINT level) const;
+
+	// Side of a node of the level in cells.
+	UINT GetNodeCells(UINT level) const;
+
+	// Min and max height of node (x, y) of a level.
+	XMFLOAT2 GetBounds(UINT level, UINT x, UINT y) const;
+
+	// Vertical error of drawing the nodes of a level with a grid of BaseCells
+	// quads along a side, which keeps every 2^level-th sample: the largest
+	// distance from a sample dropped to the triangles through the samples
+	// kept, summed over the levels up to this one.  Level 0 has none.
+	float GetGridError(UINT level) const;
+
+private:
+	// Rows are padded to a multiple of 8 nodes and to an even count, with the
+	// padding repeating the last node, so that the next level can be reduced
+	// four nodes at a time without edge cases.
+	struct Level
+	{
+		UINT Width;
+		UINT Height;
+		UINT Stride;
+		std::vector<float> Min;
+		std::vector<float> Max;
+	};
+
+	void AllocateLevel(Level& level, UINT width, UINT height);
+	void PadLevel(Level& level);
+
+	void ReduceLevel(const Level& src, Level& dest);
+
+private:
+	std::vector<Level> m_Levels;
+	std::vector<float> m_GridErrors;
+};
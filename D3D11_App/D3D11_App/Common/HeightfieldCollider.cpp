@@ -0,0 +1,756 @@
+#include "HeightfieldCollider.h"
+#include "MathHelper.h"
+
+namespace
+{
+	// Sweeps of a batch a thread takes at a time.
+	const UINT BatchGrain = 64;
+
+	// Points this close outside a face, relative to its size, still count as
+	// on it, so that a sphere meeting a shared edge head on hits one face.
+	const float FaceEpsilon = 1e-5f;
+
+	// The tiles a sweep reads: paged in as the sweep goes, or looked up in a
+	// table of tiles paged in beforehand, which threads can share.
+	struct PagingTiles
+	{
+		TiledHeightmap* Heightmap;
+
+		const float* GetTile(UINT tx, UINT ty)
+		{
+			return Heightmap->GetTile(tx, ty);
+		}
+	};
+
+	struct TableTiles
+	{
+		const float* const* Table;
+		UINT TilesX;
+
+		const float* GetTile(UINT tx, UINT ty)
+		{
+			return Table[ty * TilesX + tx];
+		}
+	};
+
+	float Dot(FXMVECTOR a, FXMVECTOR b)
+	{
+		return XMVectorGetX(XMVector3Dot(a, b));
+	}
+
+	// Tests a sweep against triangles one at a time, keeping the deepest
+	// overlap at the start of the move and the earliest touch after it.
+	//
+	// The centre of the capsule c + s * w, s in [-1, 1], comes within the
+	// radius of a triangle T wherever the centre comes within it of the prism
+	// T + s * w.  A point p = q + s * w of the prism stands for the point q of
+	// the triangle, which is where the contact is.
+	class SweepTester
+	{
+	public:
+		explicit SweepTester(const HeightfieldSweep& sweep)
+			: m_Center(XMLoadFloat3(&sweep.Center))
+			, m_Move(XMLoadFloat3(&sweep.Move))
+			, m_HalfAxis(XMLoadFloat3(&sweep.HalfAxis))
+			, m_Radius(sweep.Radius)
+			, m_MoveLengthSq(Dot(m_Move, m_Move))
+			, m_AxisLength(XMVectorGetX(XMVector3Length(m_HalfAxis)))
+			, m_IsCapsule(m_AxisLength > 0.0f)
+			, m_Overlap(MathHelper::Infinity)
+			, m_Time(1.0f)
+			, m_HasTouch(false)
+		{
+			// The ends of the capsule at both ends of the move bound all of it.
+			XMVECTOR end = m_Center + m_Move;
+			m_Ends[0] = m_Center - m_HalfAxis;
+			m_Ends[1] = m_Center + m_HalfAxis;
+			m_Ends[2] = end - m_HalfAxis;
+			m_Ends[3] = end + m_HalfAxis;
+
+			m_Lowest = sweep.HalfAxis.y > 0.0f ? m_Ends[0] : m_Ends[1];
+		}
+
+		XMVECTOR GetLowestPoint() const
+		{
+			return m_Lowest;
+		}
+
+		// Triangle abc, counterclockwise seen from above.
+		void TestTriangle(FXMVECTOR a, FXMVECTOR b, FXMVECTOR c)
+		{
+			XMVECTOR n = XMVector3Normalize(XMVector3Cross(b - a, c - a));
+
+			// Nothing of the sweep comes within the radius of the plane.
+			float minDist = MathHelper::Infinity;
+			float maxDist = -MathHelper::Infinity;
+			for (int i = 0; i < 4; ++i)
+			{
+				float d = Dot(n, m_Ends[i] - a);
+				minDist = MathHelper::Min(minDist, d);
+				maxDist = MathHelper::Max(maxDist, d);
+			}
+			if (minDist > m_Radius || maxDist < -m_Radius)
+			{
+				return;
+			}
+
+			m_Normal = n;
+			m_Distance = MathHelper::Infinity;
+			m_MaxPlaneDistance = -MathHelper::Infinity;
+
+			// The prism has a top and a bottom face, the triangle moved to either
+			// end of the capsule, and a side face along every edge.  A sphere
+			// has only the triangle.  The prism of a capsule lying in the plane
+			// of the triangle is flat and has no inside.
+			float wn = Dot(m_HalfAxis, n);
+			float side = wn >= 0.0f ? 1.0f : -1.0f;
+			XMVECTOR w = side * m_HalfAxis;
+			m_Solid = m_IsCapsule && fabsf(wn) > 1e-3f * m_AxisLength;
+
+			const XMVECTOR v[3] = { a, b, c };
+			TestTriangleFace(a + w, b + w, c + w, n, side);
+			if (m_IsCapsule)
+			{
+				TestTriangleFace(a - w, b - w, c - w, -n, -side);
+			}
+
+			for (int i = 0; i < 3; ++i)
+			{
+				XMVECTOR p0 = v[i];
+				XMVECTOR p1 = v[(i + 1) % 3];
+				TestSegment(p0 + w, p1 + w, side, side);
+				if (m_IsCapsule)
+				{
+					TestSegment(p0 - w, p1 - w, -side, -side);
+					TestSegment(p0 - m_HalfAxis, p0 + m_HalfAxis, -1.0f, 1.0f);
+					TestVertex(p0 + m_HalfAxis, 1.0f);
+					TestVertex(p0 - m_HalfAxis, -1.0f);
+					TestSideFace(p0, p1, v[(i + 2) % 3]);
+				}
+				else
+				{
+					TestVertex(p0, 0.0f);
+				}
+			}
+
+			// Inside the prism the way out is through the nearest face;
+			// outside it the closest point decides.
+			if (m_Solid && m_MaxPlaneDistance <= 0.0f)
+			{
+				AddOverlap(m_MaxPlaneDistance, m_InsidePoint, m_InsideNormal);
+			}
+			else if (m_Distance < m_Radius)
+			{
+				XMVECTOR toCenter = m_Center - m_ClosestPoint;
+				XMVECTOR normal = m_Distance > 1e-6f * m_Radius ? toCenter / m_Distance : n;
+				AddOverlap(m_Distance, m_ClosestPoint - m_ClosestSigma * m_HalfAxis, normal);
+			}
+		}
+
+		// Triangle abc lies over the lowest point of the capsule at the start:
+		// if that point is under it, the capsule is in the ground.
+		void TestBuried(FXMVECTOR a, FXMVECTOR b, FXMVECTOR c)
+		{
+			XMVECTOR n = XMVector3Normalize(XMVector3Cross(b - a, c - a));
+			float d = Dot(n, m_Lowest - a);
+			if (d < 0.0f)
+			{
+				AddOverlap(d, m_Lowest - d * n, n);
+			}
+		}
+
+		bool GetContact(HeightfieldContact* contact) const
+		{
+			if (m_Overlap < m_Radius)
+			{
+				XMStoreFloat3(&contact->Position, m_OverlapPoint);
+				XMStoreFloat3(&contact->Normal, m_OverlapNormal);
+				contact->Time = 0.0f;
+				contact->Depth = m_Radius - m_Overlap;
+				return true;
+			}
+
+			if (m_HasTouch)
+			{
+				XMStoreFloat3(&contact->Position, m_TouchPoint);
+				XMStoreFloat3(&contact->Normal, m_TouchNormal);
+				contact->Time = m_Time;
+				contact->Depth = 0.0f;
+				return true;
+			}
+
+			return false;
+		}
+
+	private:
+		// The centre is distance from the prism at the start, negative inside
+		// it, and q is the point of the triangle closest to the capsule.
+		void AddOverlap(float distance, FXMVECTOR q, FXMVECTOR normal)
+		{
+			if (distance < m_Overlap)
+			{
+				m_Overlap = distance;
+				m_OverlapPoint = q;
+				m_OverlapNormal = normal;
+			}
+		}
+
+		// The sphere touches point p of the prism at time t.
+		void AddTouch(float t, FXMVECTOR p, float sigma)
+		{
+			m_Time = t;
+			m_HasTouch = true;
+			m_TouchPoint = p - sigma * m_HalfAxis;
+			m_TouchNormal = (m_Center + t * m_Move - p) / m_Radius;
+		}
+
+		void AddClosest(float distance, FXMVECTOR p, float sigma)
+		{
+			if (distance < m_Distance)
+			{
+				m_Distance = distance;
+				m_ClosestPoint = p;
+				m_ClosestSigma = sigma;
+			}
+		}
+
+		void TestVertex(FXMVECTOR p, float sigma)
+		{
+			XMVECTOR d = m_Center - p;
+			float distSq = Dot(d, d);
+			AddClosest(sqrtf(distSq), p, sigma);
+
+			// |d + t * move| = radius, entering.
+			float b = Dot(m_Move, d);
+			float c = distSq - m_Radius * m_Radius;
+			if (c < 0.0f || b >= 0.0f || m_MoveLengthSq == 0.0f)
+			{
+				return;
+			}
+
+			float disc = b * b - m_MoveLengthSq * c;
+			if (disc < 0.0f)
+			{
+				return;
+			}
+
+			float t = (-b - sqrtf(disc)) / m_MoveLengthSq;
+			if (t <= m_Time)
+			{
+				AddTouch(t, p, sigma);
+			}
+		}
+
+		// Segment from p0 to p1 standing for the triangle points p - sigma * w,
+		// with sigma going from sigma0 to sigma1.  Its ends are tested as
+		// vertices.
+		void TestSegment(FXMVECTOR p0, FXMVECTOR p1, float sigma0, float sigma1)
+		{
+			XMVECTOR e = p1 - p0;
+			float ee = Dot(e, e);
+			if (ee == 0.0f)
+			{
+				return;
+			}
+
+			XMVECTOR d = m_Center - p0;
+			float de = Dot(d, e);
+			float u = MathHelper::Clamp(de / ee, 0.0f, 1.0f);
+			XMVECTOR closest = p0 + u * e;
+			AddClosest(XMVectorGetX(XMVector3Length(m_Center - closest)), closest, sigma0 + u * (sigma1 - sigma0));
+
+			// The infinite cylinder around the segment, entering.
+			float me = Dot(m_Move, e);
+			XMVECTOR dPerp = d - (de / ee) * e;
+			XMVECTOR mPerp = m_Move - (me / ee) * e;
+			float a = Dot(mPerp, mPerp);
+			float b = Dot(mPerp, dPerp);
+			float c = Dot(dPerp, dPerp) - m_Radius * m_Radius;
+			if (c < 0.0f || b >= 0.0f || a <= 1e-12f * m_MoveLengthSq)
+			{
+				return;
+			}
+
+			float disc = b * b - a * c;
+			if (disc < 0.0f)
+			{
+				return;
+			}
+
+			float t = (-b - sqrtf(disc)) / a;
+			if (t > m_Time)
+			{
+				return;
+			}
+
+			u = (de + t * me) / ee;
+			if (u >= 0.0f && u <= 1.0f)
+			{
+				AddTouch(t, p0 + u * e, sigma0 + u * (sigma1 - sigma0));
+			}
+		}
+
+		// Face with outward normal m, planeDist from the centre, which projects
+		// onto onPlane.  The face whose plane is closest from inside is the way
+		// out of a solid prism.
+		void TestFace(FXMVECTOR m, float planeDist, bool isInside, FXMVECTOR onPlane, float sigma)
+		{
+			if (planeDist >= 0.0f && isInside)
+			{
+				AddClosest(planeDist, onPlane, sigma);
+			}
+
+			if (planeDist > m_MaxPlaneDistance)
+			{
+				m_MaxPlaneDistance = planeDist;
+				m_InsidePoint = onPlane - sigma * m_HalfAxis;
+				m_InsideNormal = m;
+			}
+		}
+
+		bool InTriangle(FXMVECTOR x, FXMVECTOR p0, FXMVECTOR p1, GXMVECTOR p2) const
+		{
+			// The vertices wind counterclockwise around the normal of the
+			// triangle, whichever way the face points.
+			XMVECTOR n = m_Normal;
+			float tolerance = -FaceEpsilon * Dot(XMVector3Cross(p1 - p0, p2 - p0), n);
+			return Dot(n, XMVector3Cross(p1 - p0, x - p0)) >= tolerance &&
+				Dot(n, XMVector3Cross(p2 - p1, x - p1)) >= tolerance &&
+				Dot(n, XMVector3Cross(p0 - p2, x - p2)) >= tolerance;
+		}
+
+		void TestTriangleFace(FXMVECTOR p0, FXMVECTOR p1, FXMVECTOR p2, GXMVECTOR m, float sigma)
+		{
+			float planeDist = Dot(m, m_Center - p0);
+			XMVECTOR onPlane = m_Center - planeDist * m;
+			TestFace(m, planeDist, InTriangle(onPlane, p0, p1, p2), onPlane, sigma);
+
+			// The plane moved out by the radius, entering from outside.
+			float mm = Dot(m_Move, m);
+			if (planeDist < m_Radius || mm >= 0.0f)
+			{
+				return;
+			}
+
+			float t = (m_Radius - planeDist) / mm;
+			if (t > m_Time)
+			{
+				return;
+			}
+
+			XMVECTOR x = m_Center + t * m_Move - m_Radius * m;
+			if (InTriangle(x, p0, p1, p2))
+			{
+				AddTouch(t, x, sigma);
+			}
+		}
+
+		// Coordinates of x in the parallelogram a + u * e + sigma * w, u in
+		// [0, 1] and sigma in [-1, 1].
+		bool InParallelogram(FXMVECTOR x, FXMVECTOR a, FXMVECTOR e, float* pSigma) const
+		{
+			XMVECTOR d = x - a;
+			float ee = Dot(e, e);
+			float ew = Dot(e, m_HalfAxis);
+			float ww = m_AxisLength * m_AxisLength;
+			float det = ee * ww - ew * ew;
+			float de = Dot(d, e);
+			float dw = Dot(d, m_HalfAxis);
+			float u = (de * ww - dw * ew) / det;
+			float sigma = (dw * ee - de * ew) / det;
+			*pSigma = MathHelper::Clamp(sigma, -1.0f, 1.0f);
+
+			return u >= -FaceEpsilon && u <= 1.0f + FaceEpsilon && sigma >= -1.0f - FaceEpsilon && sigma <= 1.0f + FaceEpsilon;
+		}
+
+		void TestParallelogram(FXMVECTOR a, FXMVECTOR e, FXMVECTOR m)
+		{
+			float planeDist = Dot(m, m_Center - a);
+			XMVECTOR onPlane = m_Center - planeDist * m;
+			float sigma;
+			bool isInside = InParallelogram(onPlane, a, e, &sigma);
+			TestFace(m, planeDist, isInside, onPlane, sigma);
+
+			float mm = Dot(m_Move, m);
+			if (planeDist < m_Radius || mm >= 0.0f)
+			{
+				return;
+			}
+
+			float t = (m_Radius - planeDist) / mm;
+			if (t > m_Time)
+			{
+				return;
+			}
+
+			XMVECTOR x = m_Center + t * m_Move - m_Radius * m;
+			if (InParallelogram(x, a, e, &sigma))
+			{
+				AddTouch(t, x, sigma);
+			}
+		}
+
+		// The side of the prism along edge p0 p1 of the triangle, whose third
+		// vertex is opposite.
+		void TestSideFace(FXMVECTOR p0, FXMVECTOR p1, FXMVECTOR opposite)
+		{
+			XMVECTOR e = p1 - p0;
+			XMVECTOR m = XMVector3Cross(e, m_HalfAxis);
+			float length = XMVectorGetX(XMVector3Length(m));
+			float edgeLength = XMVectorGetX(XMVector3Length(e));
+			if (length <= 1e-4f * edgeLength * m_AxisLength)
+			{
+				// Along the edge the side is a segment, which the edges cover.
+				return;
+			}
+			m /= length;
+
+			float s = Dot(m, opposite - p0);
+			if (!m_Solid)
+			{
+				// A flat prism has the side on both faces of its plane.
+				TestParallelogram(p0, e, m);
+				TestParallelogram(p0, e, -m);
+				return;
+			}
+			TestParallelogram(p0, e, s > 0.0f ? -m : m);
+		}
+
+	private:
+		XMVECTOR m_Center;
+		XMVECTOR m_Move;
+		XMVECTOR m_HalfAxis;
+		float m_Radius;
+		float m_MoveLengthSq;
+		float m_AxisLength;
+		bool m_IsCapsule;
+
+		XMVECTOR m_Ends[4];
+		XMVECTOR m_Lowest;
+
+		// The triangle tested: its normal, the closest point of its prism to
+		// the centre and the face whose plane is closest from inside.
+		XMVECTOR m_Normal;
+		bool m_Solid;
+		float m_Distance;
+		XMVECTOR m_ClosestPoint;
+		float m_ClosestSigma;
+		float m_MaxPlaneDistance;
+		XMVECTOR m_InsidePoint;
+		XMVECTOR m_InsideNormal;
+
+		float m_Overlap;
+		XMVECTOR m_OverlapPoint;
+		XMVECTOR m_OverlapNormal;
+
+		float m_Time;
+		bool m_HasTouch;
+		XMVECTOR m_TouchPoint;
+		XMVECTOR m_TouchNormal;
+	};
+}
+
+HeightfieldCollider::HeightfieldCollider(TiledHeightmap& heightmap, const HeightPyramid& pyramid)
+	: m_Heightmap(heightmap)
+	, m_Pyramid(pyramid)
+	, m_CellSpacing(1.0f)
+{
+}
+
+void HeightfieldCollider::SetCellSpacing(float spacing)
+{
+	m_CellSpacing = spacing;
+}
+
+bool HeightfieldCollider::Sweep(const HeightfieldSweep& sweep, HeightfieldContact* contact) const
+{
+	CellRect rect;
+	if (!GetCellRect(sweep, rect))
+	{
+		return false;
+	}
+
+	PagingTiles tiles = { &m_Heightmap };
+	return SweepCells(sweep, rect, tiles, contact);
+}
+
+bool HeightfieldCollider::SweepSphere(const XMFLOAT3& center, float radius, const XMFLOAT3& move,
+	HeightfieldContact* contact) const
+{
+	HeightfieldSweep sweep = { center, XMFLOAT3(0.0f, 0.0f, 0.0f), move, radius };
+	return Sweep(sweep, contact);
+}
+
+bool HeightfieldCollider::SweepCapsule(const XMFLOAT3& p0, const XMFLOAT3& p1, float radius, const XMFLOAT3& move,
+	HeightfieldContact* contact) const
+{
+	HeightfieldSweep sweep;
+	sweep.Center = XMFLOAT3(0.5f * (p0.x + p1.x), 0.5f * (p0.y + p1.y), 0.5f * (p0.z + p1.z));
+	sweep.HalfAxis = XMFLOAT3(0.5f * (p1.x - p0.x), 0.5f * (p1.y - p0.y), 0.5f * (p1.z - p0.z));
+	sweep.Move = move;
+	sweep.Radius = radius;
+	return Sweep(sweep, contact);
+}
+
+UINT HeightfieldCollider::SweepBatch(const HeightfieldSweep* sweeps, UINT count, HeightfieldContact* contacts,
+	bool* hits, ThreadPool* pool) const
+{
+	const UINT tilesX = m_Heightmap.GetTilesX();
+	const UINT tilesY = m_Heightmap.GetTilesY();
+	const UINT capacity = m_Heightmap.GetCacheCapacity();
+
+	std::vector<CellRect> rects(count);
+	std::vector<const float*> table(tilesX * tilesY, nullptr);
+	std::vector<bool> inGroup(tilesX * tilesY, false);
+	std::vector<UINT> groupTiles;
+	std::vector<UINT> group;
+	std::vector<UINT> alone;
+
+	// Pages in the tiles of the group in order and sweeps the group against
+	// them.  A group never holds more tiles than the cache, so paging in one
+	// of them cannot drop another before the sweeps are done.
+	auto runGroup = [&]()
+	{
+		for (UINT tile : groupTiles)
+		{
+			table[tile] = m_Heightmap.GetTile(tile % tilesX, tile / tilesX);
+		}
+
+		auto sweepRange = [&](UINT begin, UINT end)
+		{
+			TableTiles tiles = { &table[0], tilesX };
+			for (UINT k = begin; k < end; ++k)
+			{
+				UINT i = group[k];
+				hits[i] = SweepCells(sweeps[i], rects[i], tiles, &contacts[i]);
+			}
+		};
+
+		if (pool != nullptr && group.size() > BatchGrain)
+		{
+			pool->ParallelFor((UINT)group.size(), BatchGrain, sweepRange);
+		}
+		else
+		{
+			sweepRange(0, (UINT)group.size());
+		}
+
+		for (UINT tile : groupTiles)
+		{
+			table[tile] = nullptr;
+			inGroup[tile] = false;
+		}
+		groupTiles.clear();
+		group.clear();
+	};
+
+	for (UINT i = 0; i < count; ++i)
+	{
+		hits[i] = false;
+		if (!GetCellRect(sweeps[i], rects[i]))
+		{
+			continue;
+		}
+
+		const CellRect& rect = rects[i];
+		UINT tx0 = MathHelper::Min((UINT)rect.Col0 / TiledHeightmap::TileCells, tilesX - 1);
+		UINT ty0 = MathHelper::Min((UINT)rect.Row0 / TiledHeightmap::TileCells, tilesY - 1);
+		UINT tx1 = MathHelper::Min((UINT)rect.Col1 / TiledHeightmap::TileCells, tilesX - 1);
+		UINT ty1 = MathHelper::Min((UINT)rect.Row1 / TiledHeightmap::TileCells, tilesY - 1);
+		UINT tileCount = (tx1 - tx0 + 1) * (ty1 - ty0 + 1);
+		if (tileCount > capacity)
+		{
+			alone.push_back(i);
+			continue;
+		}
+
+		UINT newTiles = 0;
+		for (UINT ty = ty0; ty <= ty1; ++ty)
+		{
+			for (UINT tx = tx0; tx <= tx1; ++tx)
+			{
+				newTiles += !inGroup[ty * tilesX + tx];
+			}
+		}
+		if (groupTiles.size() + newTiles > capacity)
+		{
+			runGroup();
+		}
+
+		for (UINT ty = ty0; ty <= ty1; ++ty)
+		{
+			for (UINT tx = tx0; tx <= tx1; ++tx)
+			{
+				UINT tile = ty * tilesX + tx;
+				if (!inGroup[tile])
+				{
+					inGroup[tile] = true;
+					groupTiles.push_back(tile);
+				}
+			}
+		}
+		group.push_back(i);
+	}
+
+	if (!group.empty())
+	{
+		runGroup();
+	}
+
+	for (UINT i : alone)
+	{
+		PagingTiles tiles = { &m_Heightmap };
+		hits[i] = SweepCells(sweeps[i], rects[i], tiles, &contacts[i]);
+	}
+
+	UINT hitCount = 0;
+	for (UINT i = 0; i < count; ++i)
+	{
+		hitCount += hits[i];
+	}
+	return hitCount;
+}
+
+bool HeightfieldCollider::GetCellRect(const HeightfieldSweep& sweep, CellRect& rect) const
+{
+	if (!m_Heightmap.IsOpen())
+	{
+		return false;
+	}
+
+	// Box around the capsule at both ends of the move.
+	XMVECTOR center = XMLoadFloat3(&sweep.Center);
+	XMVECTOR halfAxis = XMVectorAbs(XMLoadFloat3(&sweep.HalfAxis));
+	XMVECTOR end = center + XMLoadFloat3(&sweep.Move);
+	XMVECTOR radius = XMVectorReplicate(sweep.Radius);
+	XMFLOAT3 boxMin;
+	XMFLOAT3 boxMax;
+	XMStoreFloat3(&boxMin, XMVectorMin(center, end) - halfAxis - radius);
+	XMStoreFloat3(&boxMax, XMVectorMax(center, end) + halfAxis + radius);
+
+	UINT width = m_Heightmap.GetWidth();
+	UINT height = m_Heightmap.GetHeight();
+	float halfWidth = 0.5f * (width - 1) * m_CellSpacing;
+	float halfDepth = 0.5f * (height - 1) * m_CellSpacing;
+	if (boxMax.x < -halfWidth || boxMin.x > halfWidth || boxMax.z < -halfDepth || boxMin.z > halfDepth)
+	{
+		return false;
+	}
+
+	// Rows go down the z axis.
+	float invSpacing = 1.0f / m_CellSpacing;
+	rect.Col0 = MathHelper::Clamp((int)floorf((boxMin.x + halfWidth) * invSpacing), 0, (int)width - 2);
+	rect.Col1 = MathHelper::Clamp((int)floorf((boxMax.x + halfWidth) * invSpacing), 0, (int)width - 2);
+	rect.Row0 = MathHelper::Clamp((int)floorf((halfDepth - boxMax.z) * invSpacing), 0, (int)height - 2);
+	rect.Row1 = MathHelper::Clamp((int)floorf((halfDepth - boxMin.z) * invSpacing), 0, (int)height - 2);
+	rect.MinY = boxMin.y;
+
+	return true;
+}
+
+template<class TileSource>
+bool HeightfieldCollider::SweepCells(const HeightfieldSweep& sweep, const CellRect& rect, TileSource& tiles,
+	HeightfieldContact* contact) const
+{
+	SweepTester tester(sweep);
+
+	float spacing = m_CellSpacing;
+	float halfWidth = 0.5f * (m_Heightmap.GetWidth() - 1) * spacing;
+	float halfDepth = 0.5f * (m_Heightmap.GetHeight() - 1) * spacing;
+
+	// The cell and triangle under the lowest point of the capsule, for the
+	// test against burial.
+	XMFLOAT3 lowest;
+	XMStoreFloat3(&lowest, tester.GetLowestPoint());
+	float lowCol = (lowest.x + halfWidth) / spacing;
+	float lowRow = (halfDepth - lowest.z) / spacing;
+	bool lowOnMap = lowCol >= 0.0f && lowRow >= 0.0f &&
+		lowCol <= (float)(m_Heightmap.GetWidth() - 1) && lowRow <= (float)(m_Heightmap.GetHeight() - 1);
+	int lowCellCol = MathHelper::Min((int)lowCol, (int)m_Heightmap.GetWidth() - 2);
+	int lowCellRow = MathHelper::Min((int)lowRow, (int)m_Heightmap.GetHeight() - 2);
+	bool lowUpper = (lowCol - lowCellCol) + (lowRow - lowCellRow) <= 1.0f;
+
+	const UINT tileSamples = TiledHeightmap::TileCells + 1;
+
+	// Walk the pyramid down to the nodes of level 0 the box reaches, skipping
+	// those wholly below it.
+	struct Node
+	{
+		UINT Level;
+		UINT X;
+		UINT Y;
+	};
+	Node stack[4 * 32];
+	UINT stackSize = 0;
+	stack[stackSize++] = { m_Pyramid.GetLevelCount() - 1, 0, 0 };
+
+	while (stackSize > 0)
+	{
+		Node node = stack[--stackSize];
+		int nodeCells = (int)m_Pyramid.GetNodeCells(node.Level);
+		int col0 = MathHelper::Max((int)node.X * nodeCells, rect.Col0);
+		int row0 = MathHelper::Max((int)node.Y * nodeCells, rect.Row0);
+		int col1 = MathHelper::Min((int)(node.X + 1) * nodeCells - 1, rect.Col1);
+		int row1 = MathHelper::Min((int)(node.Y + 1) * nodeCells - 1, rect.Row1);
+		if (col0 > col1 || row0 > row1 || m_Pyramid.GetBounds(node.Level, node.X, node.Y).y < rect.MinY)
+		{
+			continue;
+		}
+
+		if (node.Level > 0)
+		{
+			UINT level = node.Level - 1;
+			for (UINT cy = 2 * node.Y; cy < 2 * node.Y + 2 && cy < m_Pyramid.GetLevelHeight(level); ++cy)
+			{
+				for (UINT cx = 2 * node.X; cx < 2 * node.X + 2 && cx < m_Pyramid.GetLevelWidth(level); ++cx)
+				{
+					stack[stackSize++] = { level, cx, cy };
+				}
+			}
+			continue;
+		}
+
+		// A node of level 0 lies inside one tile.
+		UINT tx = MathHelper::Min((UINT)col0 / TiledHeightmap::TileCells, m_Heightmap.GetTilesX() - 1);
+		UINT ty = MathHelper::Min((UINT)row0 / TiledHeightmap::TileCells, m_Heightmap.GetTilesY() - 1);
+		const float* tile = tiles.GetTile(tx, ty);
+		int tileCol0 = (int)(tx * TiledHeightmap::TileCells);
+		int tileRow0 = (int)(ty * TiledHeightmap::TileCells);
+
+		for (int row = row0; row <= row1; ++row)
+		{
+			float z0 = halfDepth - row * spacing;
+			for (int col = col0; col <= col1; ++col)
+			{
+				// Corners in the order of GetHeight:
+				// A*--*B
+				//  |  /|
+				//  | / |
+				// C*--*D
+				const float* corners = tile + (row - tileRow0) * tileSamples + (col - tileCol0);
+				float x0 = -halfWidth + col * spacing;
+				XMVECTOR A = XMVectorSet(x0, corners[0], z0, 0.0f);
+				XMVECTOR B = XMVectorSet(x0 + spacing, corners[1], z0, 0.0f);
+				XMVECTOR C = XMVectorSet(x0, corners[tileSamples], z0 - spacing, 0.0f);
+				XMVECTOR D = XMVectorSet(x0 + spacing, corners[tileSamples + 1], z0 - spacing, 0.0f);
+
+				tester.TestTriangle(A, B, C);
+				tester.TestTriangle(D, C, B);
+
+				if (lowOnMap && row == lowCellRow && col == lowCellCol)
+				{
+					if (lowUpper)
+					{
+						tester.TestBuried(A, B, C);
+					}
+					else
+					{
+						tester.TestBuried(D, C, B);
+					}
+				}
+			}
+		}
+	}
+
+	return tester.GetContact(contact);
+}
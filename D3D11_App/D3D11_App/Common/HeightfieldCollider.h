@@ -0,0 +1,91 @@
+#pragma once
+
+#include "HeightPyramid.h"
+
+// A sphere, or a capsule whose segment runs from Center - HalfAxis to
+// Center + HalfAxis, moving by Move.  A zero HalfAxis makes a sphere and a
+// zero Move an overlap test.
+struct HeightfieldSweep
+{
+	XMFLOAT3 Center;
+	XMFLOAT3 HalfAxis;
+	XMFLOAT3 Move;
+	float Radius;
+};
+
+// Where a sweep first touches the surface.  Time is the fraction of the move
+// done at that point.  A body that starts in the surface has a Time of 0 and
+// Depth is how far it has to move along Normal to get out; otherwise Depth
+// is 0.  Position is the point of the surface touched and Normal points from
+// it towards the body.
+struct HeightfieldContact
+{
+	XMFLOAT3 Position;
+	XMFLOAT3 Normal;
+	float Time;
+	float Depth;
+};
+
+// Collision queries against the triangles of a tiled heightmap, in terrain
+// space: the heightmap centred on the origin, rows running down -z, as
+// Terrain lays it out.  The heightmap is the solid below the surface, so a
+// body under the surface is pushed out upwards however deep it is.
+//
+// A sweep takes the box around the body at both ends of the move, walks the
+// min/max pyramid down to the nodes the box overlaps, skipping those whose
+// highest point lies below it, and tests the triangles of the cells left
+// exactly.  A capsule touches a triangle wherever its centre meets the
+// triangle swept along the capsule segment, a prism; the sphere around the
+// centre is swept against the faces, edges and corners of the prism.
+//
+// Not safe to use from more than one thread at a time; a batch spreads its
+// sweeps across a pool itself.
+class HeightfieldCollider
+{
+public:
+	HeightfieldCollider(TiledHeightmap& heightmap, const HeightPyramid& pyramid);
+
+	void SetCellSpacing(float spacing);
+
+	/// Finds where a body first touches the surface along its move.  Returns
+	/// false if it never does.
+	bool Sweep(const HeightfieldSweep& sweep, HeightfieldContact* contact) const;
+
+	bool SweepSphere(const XMFLOAT3& center, float radius, const XMFLOAT3& move, HeightfieldContact* contact) const;
+	bool SweepCapsule(const XMFLOAT3& p0, const XMFLOAT3& p1, float radius, const XMFLOAT3& move,
+		HeightfieldContact* contact) const;
+
+	/// Sweeps count bodies, setting hits[i] and, for the bodies that touch,
+	/// contacts[i].  The tiles the sweeps reach are paged in on the calling
+	/// thread in groups the cache holds, and the sweeps of a group then run
+	/// across the threads of the pool.  Sweeps reaching more tiles than the
+	/// cache holds run alone afterwards.  Returns the number of hits.
+	UINT SweepBatch(const HeightfieldSweep* sweeps, UINT count, HeightfieldContact* contacts, bool* hits,
+		ThreadPool* pool = nullptr) const;
+
+private:
+	HeightfieldCollider(const HeightfieldCollider& rhs);
+	HeightfieldCollider& operator=(const HeightfieldCollider& rhs);
+
+	// Cells a sweep reaches, inclusive.  Empty when the sweep misses the
+	// heightmap.
+	struct CellRect
+	{
+		int Col0;
+		int Row0;
+		int Col1;
+		int Row1;
+		float MinY;
+	};
+
+	bool GetCellRect(const HeightfieldSweep& sweep, CellRect& rect) const;
+
+	template<class TileSource>
+	bool SweepCells(const HeightfieldSweep& sweep, const CellRect& rect, TileSource& tiles,
+		HeightfieldContact* contact) const;
+
+private:
+	TiledHeightmap& m_Heightmap;
+	const HeightPyramid& m_Pyramid;
+	float m_CellSpacing;
+};
@@ -0,0 +1,447 @@
+#include "LooseOctree.h"
+
+LooseOctree::LooseOctree()
+	: m_Center(0.0f, 0.0f, 0.0f)
+	, m_HalfSize(0.0f)
+	, m_Depth(0)
+	, m_ObjectCount(0)
+{
+
+}
+
+void LooseOctree::Init(const XMFLOAT3& center, float halfSize, UINT depth)
+{
+	m_Center = center;
+	m_HalfSize = halfSize;
+	m_Depth = depth;
+
+	// One extra offset past the last level simplifies finding the level of a cell.
+	m_LevelOffsets.resize(depth + 2);
+	m_LevelOffsets[0] = 0;
+	for (UINT d = 0; d <= depth; ++d)
+	{
+		m_LevelOffsets[d + 1] = m_LevelOffsets[d] + (1u << (3 * d));
+	}
+
+	m_Cells.resize(m_LevelOffsets[depth + 1]);
+	Clear();
+}
+
+UINT LooseOctree::Insert(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+{
+	UINT object;
+	if (!m_FreeObjects.empty())
+	{
+		object = m_FreeObjects.back();
+		m_FreeObjects.pop_back();
+	}
+	else
+	{
+		object = (UINT)m_Objects.size();
+		m_Objects.push_back(Object());
+	}
+
+	UINT cell = FindCell(boundsMin, boundsMax);
+	m_Objects[object].BoundsMin = boundsMin;
+	m_Objects[object].BoundsMax = boundsMax;
+	Link(object, cell);
+	AddToSubtreeCounts(cell);
+
+	++m_ObjectCount;
+	return object;
+}
+
+void LooseOctree::Update(UINT object, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+{
+	Object& obj = m_Objects[object];
+	obj.BoundsMin = boundsMin;
+	obj.BoundsMax = boundsMax;
+
+	// Small moves stay within the loose bounds of the current cell.
+	UINT cell = FindCell(boundsMin, boundsMax);
+	if (cell != obj.Cell)
+	{
+		UINT oldCell = obj.Cell;
+		Unlink(object);
+		Link(object, cell);
+		MoveSubtreeCounts(oldCell, cell);
+	}
+}
+
+void LooseOctree::Remove(UINT object)
+{
+	// Already removed.
+	assert(m_Objects[object].Cell != InvalidCell);
+	if (m_Objects[object].Cell == InvalidCell)
+	{
+		return;
+	}
+
+	RemoveFromSubtreeCounts(m_Objects[object].Cell);
+	Unlink(object);
+	m_Objects[object].Cell = InvalidCell;
+	m_FreeObjects.push_back(object);
+
+	--m_ObjectCount;
+}
+
+void LooseOctree::Clear()
+{
+	for (UINT i = 0; i < m_Cells.size(); ++i)
+	{
+		m_Cells[i].First = -1;
+		m_Cells[i].SubtreeCount = 0;
+	}
+
+	m_Objects.clear();
+	m_FreeObjects.clear();
+	m_ObjectCount = 0;
+}
+
+void LooseOctree::SelectInFrustum(const Frustum& frustum, std::vector<UINT>& objects) const
+{
+	objects.clear();
+	if (m_Cells.empty())
+	{
+		return;
+	}
+
+	FrustumQuery query(frustum);
+	SelectCell(query, 0, 0, 0, 0, false, objects);
+}
+
+bool LooseOctree::Intersect(FXMVECTOR rayPos, FXMVECTOR rayDir, const IntersectFunc& intersect,
+	UINT* pObject, float* pDist) const
+{
+	if (m_Cells.empty())
+	{
+		return false;
+	}
+
+	BVHRay ray(rayPos, rayDir);
+
+	UINT hitObject = InvalidCell;
+	float hitDist = MathHelper::Infinity;
+	IntersectCell(ray, intersect, 0, 0, 0, 0, &hitObject, &hitDist);
+
+	if (hitObject == InvalidCell)
+	{
+		return false;
+	}
+
+	if (pObject)
+	{
+		*pObject = hitObject;
+	}
+	if (pDist)
+	{
+		*pDist = hitDist;
+	}
+	return true;
+}
+
+UINT LooseOctree::ObjectCount() const
+{
+	return m_ObjectCount;
+}
+
+UINT LooseOctree::FindCell(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax) const
+{
+	XMFLOAT3 c(
+		0.5f * (boundsMin.x + boundsMax.x),
+		0.5f * (boundsMin.y + boundsMax.y),
+		0.5f * (boundsMin.z + boundsMax.z));
+
+	float radius = 0.5f * MathHelper::Max(boundsMax.x - boundsMin.x,
+		MathHelper::Max(boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z));
+
+	float size = 2.0f * m_HalfSize;
+	float fx = (c.x - m_Center.x + m_HalfSize) / size;
+	float fy = (c.y - m_Center.y + m_HalfSize) / size;
+	float fz = (c.z - m_Center.z + m_HalfSize) / size;
+
+	if (fx < 0.0f || fx >= 1.0f || fy < 0.0f || fy >= 1.0f || fz < 0.0f || fz >= 1.0f)
+	{
+		return 0;
+	}
+
+	// A cell of half size h holds objects of radius up to h centered in it,
+	// so pick the deepest level whose cells are still that large.
+	UINT level = 0;
+	float cellHalfSize = m_HalfSize;
+	while (level < m_Depth && 0.5f * cellHalfSize >= radius)
+	{
+		cellHalfSize *= 0.5f;
+		++level;
+	}
+
+	UINT n = 1u << level;
+	UINT x = MathHelper::Min((UINT)(fx * n), n - 1);
+	UINT y = MathHelper::Min((UINT)(fy * n), n - 1);
+	UINT z = MathHelper::Min((UINT)(fz * n), n - 1);
+
+	return CellIndex(level, x, y, z);
+}
+
+UINT LooseOctree::CellIndex(UINT level, UINT x, UINT y, UINT z) const
+{
+	UINT n = 1u << level;
+	return m_LevelOffsets[level] + x + n * (y + n * z);
+}
+
+void LooseOctree::GetCellCoords(UINT cell, UINT& level, UINT& x, UINT& y, UINT& z) const
+{
+	level = 0;
+	while (cell >= m_LevelOffsets[level + 1])
+	{
+		++level;
+	}
+
+	UINT n = 1u << level;
+	UINT local = cell - m_LevelOffsets[level];
+	x = local % n;
+	y = (local / n) % n;
+	z = local / (n * n);
+}
+
+void LooseOctree::Link(UINT object, UINT cell)
+{
+	Object& obj = m_Objects[object];
+	obj.Cell = cell;
+	obj.Prev = -1;
+	obj.Next = m_Cells[cell].First;
+	if (obj.Next >= 0)
+	{
+		m_Objects[obj.Next].Prev = (int)object;
+	}
+	m_Cells[cell].First = (int)object;
+}
+
+void LooseOctree::Unlink(UINT object)
+{
+	Object& obj = m_Objects[object];
+	UINT cell = obj.Cell;
+
+	if (obj.Prev >= 0)
+	{
+		m_Objects[obj.Prev].Next = obj.Next;
+	}
+	else
+	{
+		m_Cells[cell].First = obj.Next;
+	}
+	if (obj.Next >= 0)
+	{
+		m_Objects[obj.Next].Prev = obj.Prev;
+	}
+}
+
+void LooseOctree::AddToSubtreeCounts(UINT cell)
+{
+	UINT level, x, y, z;
+	GetCellCoords(cell, level, x, y, z);
+	while (true)
+	{
+		++m_Cells[CellIndex(level, x, y, z)].SubtreeCount;
+		if (level == 0)
+		{
+			break;
+		}
+		--level;
+		x /= 2;
+		y /= 2;
+		z /= 2;
+	}
+}
+
+void LooseOctree::RemoveFromSubtreeCounts(UINT cell)
+{
+	UINT level, x, y, z;
+	GetCellCoords(cell, level, x, y, z);
+	while (true)
+	{
+		--m_Cells[CellIndex(level, x, y, z)].SubtreeCount;
+		if (level == 0)
+		{
+			break;
+		}
+		--level;
+		x /= 2;
+		y /= 2;
+		z /= 2;
+	}
+}
+
+void LooseOctree::MoveSubtreeCounts(UINT from, UINT to)
+{
+	UINT fromLevel, fromX, fromY, fromZ;
+	UINT toLevel, toX, toY, toZ;
+	GetCellCoords(from, fromLevel, fromX, fromY, fromZ);
+	GetCellCoords(to, toLevel, toX, toY, toZ);
+
+	// Climb the deeper path to the level of the other one, then both paths
+	// together until they meet; the counts from there up don't change.
+	while (fromLevel > toLevel)
+	{
+		--m_Cells[CellIndex(fromLevel, fromX, fromY, fromZ)].SubtreeCount;
+		--fromLevel;
+		fromX /= 2;
+		fromY /= 2;
+		fromZ /= 2;
+	}
+	while (toLevel > fromLevel)
+	{
+		++m_Cells[CellIndex(toLevel, toX, toY, toZ)].SubtreeCount;
+		--toLevel;
+		toX /= 2;
+		toY /= 2;
+		toZ /= 2;
+	}
+	while (fromX != toX || fromY != toY || fromZ != toZ)
+	{
+		--m_Cells[CellIndex(fromLevel, fromX, fromY, fromZ)].SubtreeCount;
+		++m_Cells[CellIndex(toLevel, toX, toY, toZ)].SubtreeCount;
+		--fromLevel;
+		--toLevel;
+		fromX /= 2;
+		fromY /= 2;
+		fromZ /= 2;
+		toX /= 2;
+		toY /= 2;
+		toZ /= 2;
+	}
+}
+
+void LooseOctree::GetCellBounds(UINT level, UINT x, UINT y, UINT z, XMFLOAT3& boundsMin, XMFLOAT3& boundsMax) const
+{
+	float h = m_HalfSize / (1u << level);
+
+	XMFLOAT3 cellMin(
+		m_Center.x - m_HalfSize + 2.0f * h * x,
+		m_Center.y - m_HalfSize + 2.0f * h * y,
+		m_Center.z - m_HalfSize + 2.0f * h * z);
+
+	// The loose bounds extend the cell by half its size on every side.
+	boundsMin = XMFLOAT3(cellMin.x - h, cellMin.y - h, cellMin.z - h);
+	boundsMax = XMFLOAT3(cellMin.x + 3.0f * h, cellMin.y + 3.0f * h, cellMin.z + 3.0f * h);
+}
+
+void LooseOctree::SelectCell(const FrustumQuery& frustum, UINT level, UINT x, UINT y, UINT z, bool inside,
+	std::vector<UINT>& objects) const
+{
+	const Cell& cell = m_Cells[CellIndex(level, x, y, z)];
+	if (cell.SubtreeCount == 0)
+	{
+		return;
+	}
+
+	// The root also holds the objects outside the cube, so it has no bounds.
+	if (!inside && level > 0)
+	{
+		XMFLOAT3 boundsMin, boundsMax;
+		GetCellBounds(level, x, y, z, boundsMin, boundsMax);
+
+		FrustumQuery::Containment c = frustum.ClassifyBounds(boundsMin, boundsMax);
+		if (c == FrustumQuery::Outside)
+		{
+			return;
+		}
+		inside = c == FrustumQuery::Inside;
+	}
+
+	for (int i = cell.First; i >= 0; i = m_Objects[i].Next)
+	{
+		const Object& obj = m_Objects[i];
+		if (inside || frustum.ClassifyBounds(obj.BoundsMin, obj.BoundsMax) != FrustumQuery::Outside)
+		{
+			objects.push_back((UINT)i);
+		}
+	}
+
+	if (level == m_Depth)
+	{
+		return;
+	}
+
+	for (UINT k = 0; k < 8; ++k)
+	{
+		SelectCell(frustum, level + 1, 2 * x + (k & 1), 2 * y + ((k >> 1) & 1), 2 * z + (k >> 2), inside, objects);
+	}
+}
+
+void LooseOctree::IntersectCell(const BVHRay& ray, const IntersectFunc& intersect, UINT level, UINT x, UINT y, UINT z,
+	UINT* pObject, float* pDist) const
+{
+	const Cell& cell = m_Cells[CellIndex(level, x, y, z)];
+
+	for (int i = cell.First; i >= 0; i = m_Objects[i].Next)
+	{
+		const Object& obj = m_Objects[i];
+		if (ray.IntersectBounds(obj.BoundsMin, obj.BoundsMax, *pDist) == MathHelper::Infinity)
+		{
+			continue;
+		}
+
+		float dist = 0.0f;
+		if (intersect((UINT)i, *pDist, &dist) && dist < *pDist)
+		{
+			*pDist = dist;
+			*pObject = (UINT)i;
+		}
+	}
+
+	if (level == m_Depth)
+	{
+		return;
+	}
+
+	// Visit the children the ray reaches in the order it enters them, so
+	// that the closest hit found so far prunes the farther ones.
+	struct Child
+	{
+		float Dist;
+		UINT K;
+	};
+
+	Child children[8];
+	UINT childCount = 0;
+	for (UINT k = 0; k < 8; ++k)
+	{
+		UINT cx = 2 * x + (k & 1);
+		UINT cy = 2 * y + ((k >> 1) & 1);
+		UINT cz = 2 * z + (k >> 2);
+		if (m_Cells[CellIndex(level + 1, cx, cy, cz)].SubtreeCount == 0)
+		{
+			continue;
+		}
+
+		XMFLOAT3 boundsMin, boundsMax;
+		GetCellBounds(level + 1, cx, cy, cz, boundsMin, boundsMax);
+
+		float dist = ray.IntersectBounds(boundsMin, boundsMax, *pDist);
+		if (dist == MathHelper::Infinity)
+		{
+			continue;
+		}
+
+		UINT j = childCount++;
+		while (j > 0 && children[j - 1].Dist > dist)
+		{
+			children[j] = children[j - 1];
+			--j;
+		}
+		children[j].Dist = dist;
+		children[j].K = k;
+	}
+
+	for (UINT i = 0; i < childCount; ++i)
+	{
+		if (children[i].Dist >= *pDist)
+		{
+			break;
+		}
+
+		UINT k = children[i].K;
+		IntersectCell(ray, intersect, level + 1, 2 * x + (k & 1), 2 * y + ((k >> 1) & 1), 2 * z + (k >> 2), pObject, pDist);
+	}
+}
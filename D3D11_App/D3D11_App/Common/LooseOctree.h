@@ -0,0 +1,99 @@
+#pragma once
+
+#include "BVH.h"
+#include <functional>
+
+// Loose octree for objects that move every frame.  The cells of each level
+// form a regular grid and every cell bounds the objects whose center lies in
+// it with a margin of half a cell, so an object's cell follows directly from
+// its center and size.  Moving an object only relinks it when it leaves its
+// cell, which makes updates O(1) apart from a walk up the (fixed) depth.
+class LooseOctree
+{
+public:
+	// Tests the ray against an object, returning true and the distance if it
+	// hits closer than maxDist.
+	typedef std::function<bool(UINT object, float maxDist, float* pDist)> IntersectFunc;
+
+	LooseOctree();
+
+	/// Allocates the cells for a cube of the given center and half size.
+	/// Objects whose center falls outside the cube are kept in the root.
+	void Init(const XMFLOAT3& center, float halfSize, UINT depth);
+
+	// Returns the handle of the new object, used by Update and Remove.
+	UINT Insert(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax);
+	void Update(UINT object, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax);
+
+	// Removing an object twice is an error, caught by an assert and
+	// otherwise ignored.
+	void Remove(UINT object);
+	void Clear();
+
+	/// Fills objects with every object whose bounds intersect the frustum.
+	void SelectInFrustum(const Frustum& frustum, std::vector<UINT>& objects) const;
+
+	/// Finds the nearest object hit by the ray.  The cells are walked front
+	/// to back and intersect is only called for objects whose bounds the ray
+	/// reaches before the closest hit found so far.
+	bool Intersect(FXMVECTOR rayPos, FXMVECTOR rayDir, const IntersectFunc& intersect,
+		UINT* pObject, float* pDist) const;
+
+	UINT ObjectCount() const;
+
+private:
+	struct Cell
+	{
+		// Head of the list of objects linked to the cell, or -1.
+		int First;
+
+		// Number of objects in the cell and all of its descendants.
+		UINT SubtreeCount;
+	};
+
+	struct Object
+	{
+		XMFLOAT3 BoundsMin;
+		UINT Cell;
+		XMFLOAT3 BoundsMax;
+		int Next;
+		int Prev;
+	};
+
+	UINT FindCell(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax) const;
+	UINT CellIndex(UINT level, UINT x, UINT y, UINT z) const;
+	void GetCellCoords(UINT cell, UINT& level, UINT& x, UINT& y, UINT& z) const;
+
+	// Only link the object into or out of the list of its cell.
+	void Link(UINT object, UINT cell);
+	void Unlink(UINT object);
+
+	// Keep the subtree counts of a cell and its ancestors in step.  A move
+	// only touches the two paths below the cell where they meet.
+	void AddToSubtreeCounts(UINT cell);
+	void RemoveFromSubtreeCounts(UINT cell);
+	void MoveSubtreeCounts(UINT from, UINT to);
+
+	// Loose bounds of a cell; the root is unbounded.
+	void GetCellBounds(UINT level, UINT x, UINT y, UINT z, XMFLOAT3& boundsMin, XMFLOAT3& boundsMax) const;
+
+	void SelectCell(const FrustumQuery& frustum, UINT level, UINT x, UINT y, UINT z, bool inside,
+		std::vector<UINT>& objects) const;
+	void IntersectCell(const BVHRay& ray, const IntersectFunc& intersect, UINT level, UINT x, UINT y, UINT z,
+		UINT* pObject, float* pDist) const;
+
+	static const UINT InvalidCell = 0xffffffff;
+
+private:
+	XMFLOAT3 m_Center;
+	float m_HalfSize;
+	UINT m_Depth;
+
+	// Index of the first cell of each level; level d holds 8^d cells.
+	std::vector<UINT> m_LevelOffsets;
+	std::vector<Cell> m_Cells;
+
+	std::vector<Object> m_Objects;
+	std::vector<UINT> m_FreeObjects;
+	UINT m_ObjectCount;
+};
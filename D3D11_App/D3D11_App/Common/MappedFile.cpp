@@ -0,0 +1,142 @@
+#include "MappedFile.h"
+
+MappedFile::MappedFile()
+	: m_File(INVALID_HANDLE_VALUE)
+	, m_Mapping(nullptr)
+	, m_Data(nullptr)
+	, m_Size(0)
+{
+
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::wstring& path, bool requireView)
+{
+	Close();
+
+	m_File = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_File == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_File, &size) || size.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	m_Mapping = CreateFileMappingW(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_Mapping == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	m_Data = (const BYTE*)MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+	if (m_Data == nullptr && requireView)
+	{
+		Close();
+		return false;
+	}
+
+	m_Size = (UINT64)size.QuadPart;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_Data)
+	{
+		UnmapViewOfFile(m_Data);
+		m_Data = nullptr;
+	}
+	if (m_Mapping)
+	{
+		CloseHandle(m_Mapping);
+		m_Mapping = nullptr;
+	}
+	if (m_File != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_File);
+		m_File = INVALID_HANDLE_VALUE;
+	}
+	m_Size = 0;
+}
+
+bool MappedFile::IsOpen() const
+{
+	return m_Mapping != nullptr;
+}
+
+const BYTE* MappedFile::GetData() const
+{
+	return m_Data;
+}
+
+UINT64 MappedFile::GetSize() const
+{
+	return m_Size;
+}
+
+MappedRange::MappedRange()
+	: m_View(nullptr)
+	, m_Data(nullptr)
+{
+
+}
+
+MappedRange::~MappedRange()
+{
+	Unmap();
+}
+
+bool MappedRange::Map(const MappedFile& file, UINT64 offset, UINT64 size)
+{
+	Unmap();
+
+	if (file.m_Mapping == nullptr || size == 0 || offset > file.m_Size || size > file.m_Size - offset)
+	{
+		return false;
+	}
+
+	// Views have to start on a multiple of the allocation granularity.
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	UINT64 start = offset - offset % info.dwAllocationGranularity;
+	UINT64 viewSize = offset - start + size;
+	if (viewSize > (SIZE_T)-1)
+	{
+		return false;
+	}
+
+	m_View = MapViewOfFile(file.m_Mapping, FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start, (SIZE_T)viewSize);
+	if (m_View == nullptr)
+	{
+		return false;
+	}
+
+	m_Data = (const BYTE*)m_View + (offset - start);
+	return true;
+}
+
+void MappedRange::Unmap()
+{
+	if (m_View)
+	{
+		UnmapViewOfFile(m_View);
+		m_View = nullptr;
+	}
+	m_Data = nullptr;
+}
+
+const BYTE* MappedRange::GetData() const
+{
+	return m_Data;
+}
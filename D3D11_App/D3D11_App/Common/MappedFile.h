@@ -0,0 +1,67 @@
+#pragma once
+
+#include <Windows.h>
+#include <string>
+
+// Read only view of a whole file.  The pages are loaded by the OS as they are
+// touched, so opening a large file costs nothing until its data is read.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	/// Maps the file at path, closing any file mapped before.  Returns false
+	/// if it does not exist or cannot be mapped; empty files cannot be mapped
+	/// either.  With requireView false, a file too large for the address
+	/// space, as files of more than a few hundred MB can be in a 32-bit
+	/// process, is still opened without a view: GetData returns null and
+	/// parts of the file are mapped through MappedRange instead.
+	bool Open(const std::wstring& path, bool requireView = true);
+	void Close();
+
+	bool IsOpen() const;
+
+	// The whole file, or null if it was opened without a view.
+	const BYTE* GetData() const;
+	UINT64 GetSize() const;
+
+private:
+	MappedFile(const MappedFile& rhs);
+	MappedFile& operator=(const MappedFile& rhs);
+
+private:
+	friend class MappedRange;
+
+	HANDLE m_File;
+	HANDLE m_Mapping;
+	const BYTE* m_Data;
+	UINT64 m_Size;
+};
+
+// Read only view of part of a mapped file, for files opened without a view
+// of the whole.  Views of different ranges of one file may be mapped from
+// several threads at once.
+class MappedRange
+{
+public:
+	MappedRange();
+	~MappedRange();
+
+	/// Maps size bytes of the file from offset, unmapping any range mapped
+	/// before.  Returns false if the range lies past the end of the file or
+	/// there is no room left for it in the address space.
+	bool Map(const MappedFile& file, UINT64 offset, UINT64 size);
+	void Unmap();
+
+	// The first byte of the range, or null if none is mapped.
+	const BYTE* GetData() const;
+
+private:
+	MappedRange(const MappedRange& rhs);
+	MappedRange& operator=(const MappedRange& rhs);
+
+private:
+	const void* m_View;
+	const BYTE* m_Data;
+};
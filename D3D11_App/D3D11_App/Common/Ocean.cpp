@@ -0,0 +1,388 @@
+#include "Ocean.h"
+#include "ThreadPool.h"
+#include "MathHelper.h"
+#include <cmath>
+#include <random>
+
+namespace
+{
+	const float Gravity = 9.81f;
+
+	// Rows of the transform handed to a thread.
+	const UINT BandRows = 16;
+
+	// Grids of fewer points are updated on the calling thread.
+	const UINT ParallelThreshold = 1 << 14;
+}
+
+Ocean::Ocean()
+	: size_(0)
+	, row_count_(0)
+	, col_count_(0)
+	, time_(0.f)
+{
+	ZeroMemory(&info_, sizeof(info_));
+}
+
+UINT Ocean::RowCount() const
+{
+	return row_count_;
+}
+
+UINT Ocean::ColumnCount() const
+{
+	return col_count_;
+}
+
+UINT Ocean::VertexCount() const
+{
+	return row_count_ * col_count_;
+}
+
+UINT Ocean::TriangleCount() const
+{
+	return 2 * size_ * size_;
+}
+
+float Ocean::Width() const
+{
+	return info_.PatchSize;
+}
+
+float Ocean::Depth() const
+{
+	return info_.PatchSize;
+}
+
+float Ocean::Time() const
+{
+	return time_;
+}
+
+void Ocean::Init(const InitInfo& info)
+{
+	info_ = info;
+	size_ = info.Size;
+
+	float windLength = sqrtf(info.WindDirection.x * info.WindDirection.x + info.WindDirection.y * info.WindDirection.y);
+	info_.WindDirection.x /= windLength;
+	info_.WindDirection.y /= windLength;
+	row_count_ = size_ + 1;
+	col_count_ = size_ + 1;
+	time_ = 0.f;
+
+	fft_.Init(size_);
+
+	const UINT n = size_;
+	const UINT count = n * n;
+	const float dx = info.PatchSize / n;
+	const float half = .5f * info.PatchSize;
+
+	column_x_.resize(col_count_);
+	column_u_.resize(col_count_);
+	row_z_.resize(row_count_);
+	row_v_.resize(row_count_);
+	for (UINT j = 0; j < col_count_; ++j)
+	{
+		column_x_[j] = -half + j * dx;
+		column_u_[j] = 0.5f + column_x_[j] / Width();
+	}
+	for (UINT i = 0; i < row_count_; ++i)
+	{
+		row_z_[i] = half - i * dx;
+		row_v_[i] = 0.5f - row_z_[i] / Depth();
+	}
+
+	// Frequencies past the middle of a transform are negative.  Rows run
+	// down -z, so their wave numbers change sign.
+	wave_x_.resize(n);
+	wave_z_.resize(n);
+	for (UINT j = 0; j < n; ++j)
+	{
+		int f = j < n / 2 ? (int)j : (int)j - (int)n;
+		wave_x_[j] = MathHelper::Pi * 2.f * f / info.PatchSize;
+		wave_z_[j] = -wave_x_[j];
+	}
+
+	h0_re_.resize(count);
+	h0_im_.resize(count);
+	omega_.resize(count);
+
+	std::mt19937 random(info.Seed);
+	std::normal_distribution<float> gaussian(0.f, 1.f);
+	for (UINT i = 0; i < n; ++i)
+	{
+		for (UINT j = 0; j < n; ++j)
+		{
+			float kx = wave_x_[j];
+			float kz = wave_z_[i];
+			float k = sqrtf(kx * kx + kz * kz);
+
+			// Draw both parts even at k = 0, so that the draws don't depend
+			// on where the zeros fall.
+			float xr = gaussian(random);
+			float xi = gaussian(random);
+			float amplitude = sqrtf(.5f * Spectrum(kx, kz));
+
+			// The Nyquist row and column have no conjugate pairs to keep the
+			// slopes and displacements real, so they're left out.
+			if (i == n / 2 || j == n / 2)
+			{
+				amplitude = 0.f;
+			}
+			h0_re_[i * n + j] = xr * amplitude;
+			h0_im_[i * n + j] = xi * amplitude;
+			omega_[i * n + j] = sqrtf(Gravity * k);
+		}
+	}
+
+	// One wave along the wind, at the wave number on the grid nearest the
+	// peak of a fully developed sea, g / U^2, and never at the Nyquist
+	// frequency.  Half of it is in h0(k) and half comes in as the conjugate,
+	// h(-k).
+	if (info.Spectrum == SpectrumSingleWave)
+	{
+		float peak = Gravity / (info.WindSpeed * info.WindSpeed);
+		float dk = MathHelper::Pi * 2.f / info.PatchSize;
+		int limit = (int)n / 2 - 1;
+		int fx = MathHelper::Clamp((int)floorf(info_.WindDirection.x * peak / dk + .5f), -limit, limit);
+		int fz = MathHelper::Clamp((int)floorf(info_.WindDirection.y * peak / dk + .5f), -limit, limit);
+		if (fx == 0 && fz == 0)
+		{
+			fx = 1;
+		}
+
+		UINT col = (UINT)(fx + (int)n) & (n - 1);
+		UINT row = (UINT)(-fz + (int)n) & (n - 1);
+		h0_re_[row * n + col] = .5f * info.Amplitude;
+	}
+
+	for (UINT p = 0; p < FieldPairCount; ++p)
+	{
+		field_re_[p].resize(count);
+		field_im_[p].resize(count);
+	}
+
+	height_.assign(count, 0.f);
+	displacement_x_.assign(count, 0.f);
+	displacement_z_.assign(count, 0.f);
+	normal_x_.assign(count, 0.f);
+	normal_y_.assign(count, 1.f);
+	normal_z_.assign(count, 0.f);
+	tangent_x_.assign(count, 1.f);
+	tangent_y_.assign(count, 0.f);
+	foam_.assign(count, 0.f);
+}
+
+float Ocean::Spectrum(float kx, float kz) const
+{
+	// The single wave is put in by Init.
+	float k2 = kx * kx + kz * kz;
+	if (k2 == 0.f || info_.Spectrum == SpectrumSingleWave)
+	{
+		return 0.f;
+	}
+
+	float k = sqrtf(k2);
+	float cosTheta = (kx * info_.WindDirection.x + kz * info_.WindDirection.y) / k;
+	float dk = MathHelper::Pi * 2.f / info_.PatchSize;
+
+	if (info_.Spectrum == SpectrumPhillips)
+	{
+		// Largest waves the wind makes, and a cut below a thousandth of them.
+		float l = info_.WindSpeed * info_.WindSpeed / Gravity;
+		float small = l * .001f;
+		return info_.Amplitude * expf(-1.f / (k2 * l * l)) / (k2 * k2) * cosTheta * cosTheta *
+			expf(-k2 * small * small);
+	}
+
+	// JONSWAP over frequency, turned into a density over wave numbers and
+	// spread over directions by cos^2, towards the wind only.
+	if (cosTheta <= 0.f)
+	{
+		return 0.f;
+	}
+
+	float u = info_.WindSpeed;
+	float fetch = info_.Fetch;
+	float omega = sqrtf(Gravity * k);
+	float alpha = .076f * powf(u * u / (fetch * Gravity), .22f);
+	float peak = 22.f * powf(Gravity * Gravity / (u * fetch), 1.f / 3.f);
+	float sigma = omega <= peak ? .07f : .09f;
+	float r = expf(-(omega - peak) * (omega - peak) / (2.f * sigma * sigma * peak * peak));
+	float s = alpha * Gravity * Gravity / powf(omega, 5.f) * expf(-1.25f * powf(peak / omega, 4.f)) * powf(3.3f, r);
+
+	// dw/dk = g / 2w, and 1 / k for the area of a ring of wave numbers.
+	// The variance of a wave number is shared between the waves h(k) sums,
+	// those of k and -k, so each gets half.
+	float spreading = 2.f / MathHelper::Pi * cosTheta * cosTheta;
+	return .5f * s * Gravity / (2.f * omega) * spreading / k * dk * dk;
+}
+
+void Ocean::Update(float dt, ThreadPool* pool)
+{
+	time_ += dt;
+
+	const UINT n = size_;
+	const bool parallel = pool != nullptr && pool->ThreadCount() > 1 && n * n >= ParallelThreshold;
+
+	auto buildSpectra = [this](UINT begin, UINT end) { BuildSpectra(begin, end); };
+	auto buildSurface = [this](UINT begin, UINT end) { BuildSurface(begin, end); };
+
+	if (parallel)
+	{
+		pool->ParallelFor(n, BandRows, buildSpectra);
+	}
+	else
+	{
+		buildSpectra(0, n);
+	}
+
+	for (UINT p = 0; p < FieldPairCount; ++p)
+	{
+		fft_.Transform2D(&field_re_[p][0], &field_im_[p][0], true, parallel ? pool : nullptr);
+	}
+
+	if (parallel)
+	{
+		pool->ParallelFor(n, BandRows, buildSurface);
+	}
+	else
+	{
+		buildSurface(0, n);
+	}
+}
+
+void Ocean::BuildSpectra(UINT begin, UINT end)
+{
+	const UINT n = size_;
+	for (UINT i = begin; i < end; ++i)
+	{
+		// The conjugate pairs of row i are in row -i.
+		const UINT mirrorRow = (n - i) & (n - 1);
+		for (UINT j = 0; j < n; ++j)
+		{
+			const UINT s = i * n + j;
+			const UINT mirror = mirrorRow * n + ((n - j) & (n - 1));
+
+			// h(k, t) = h0(k) e^(iwt) + conj(h0(-k)) e^(-iwt)
+			float c = cosf(omega_[s] * time_);
+			float sn = sinf(omega_[s] * time_);
+			float hr = (h0_re_[s] + h0_re_[mirror]) * c - (h0_im_[s] + h0_im_[mirror]) * sn;
+			float hi = (h0_re_[s] - h0_re_[mirror]) * sn + (h0_im_[s] - h0_im_[mirror]) * c;
+
+			float kx = wave_x_[j];
+			float kz = wave_z_[i];
+			float k = sqrtf(kx * kx + kz * kz);
+			float invK = k > 0.f ? 1.f / k : 0.f;
+
+			// Each pair of real fields a and b goes in as a + ib; a field of
+			// i c h is (-c hi, c hr), and one of c h is (c hr, c hi).  The
+			// slopes point uphill, and so do the displacements, towards the
+			// crests.
+			//   heights h and slopes along x, i kx h
+			//   slopes along z, i kz h, and displacements along x, i kx / k h
+			//   displacements along z, i kz / k h, and d/dx of those along x, -kx^2 / k h
+			//   d/dz of those along z, -kz^2 / k h, and d/dz of those along x, -kx kz / k h
+			auto pack = [&](UINT p, float ar, float ai, float br, float bi)
+			{
+				field_re_[p][s] = ar - bi;
+				field_im_[p][s] = ai + br;
+			};
+			pack(0, hr, hi, -kx * hi, kx * hr);
+			pack(1, -kz * hi, kz * hr, -kx * invK * hi, kx * invK * hr);
+			pack(2, -kz * invK * hi, kz * invK * hr, -kx * kx * invK * hr, -kx * kx * invK * hi);
+			pack(3, -kz * kz * invK * hr, -kz * kz * invK * hi, -kx * kz * invK * hr, -kx * kz * invK * hi);
+		}
+	}
+}
+
+void Ocean::BuildSurface(UINT begin, UINT end)
+{
+	const UINT n = size_;
+	const float lambda = info_.Choppiness;
+	const float foamThreshold = info_.FoamThreshold;
+	for (UINT s = begin * n; s < end * n; ++s)
+	{
+		float sx = field_im_[0][s];
+		float sz = field_re_[1][s];
+		height_[s] = field_re_[0][s];
+		displacement_x_[s] = lambda * field_im_[1][s];
+		displacement_z_[s] = lambda * field_re_[2][s];
+
+		XMVECTOR normal = XMVector3Normalize(XMVectorSet(-sx, 1.f, -sz, 0.f));
+		XMVECTOR tangent = XMVector3Normalize(XMVectorSet(1.f, sx, 0.f, 0.f));
+		normal_x_[s] = XMVectorGetX(normal);
+		normal_y_[s] = XMVectorGetY(normal);
+		normal_z_[s] = XMVectorGetZ(normal);
+		tangent_x_[s] = XMVectorGetX(tangent);
+		tangent_y_[s] = XMVectorGetY(tangent);
+
+		// The displaced grid bunches up where the Jacobian drops below one
+		// and folds over where it goes negative.
+		float jxx = 1.f + lambda * field_im_[2][s];
+		float jzz = 1.f + lambda * field_re_[3][s];
+		float jxz = lambda * field_im_[3][s];
+		float jacobian = jxx * jzz - jxz * jxz;
+		foam_[s] = foamThreshold > 0.f ? MathHelper::Clamp((foamThreshold - jacobian) / foamThreshold, 0.f, 1.f) : 0.f;
+	}
+}
+
+void Ocean::WriteVertices(void* dest, UINT stride, Waves::VertexLayout layout, ThreadPool* pool) const
+{
+	auto writeRows = [=](UINT begin, UINT end)
+	{
+		for (UINT i = begin; i < end; ++i)
+		{
+			BYTE* rowDest = (BYTE*)dest + (size_t)i * col_count_ * stride;
+			switch (layout)
+			{
+			case Waves::LayoutPosition:
+				WriteRow<Waves::LayoutPosition>(i, rowDest, stride);
+				break;
+			case Waves::LayoutPositionNormal:
+				WriteRow<Waves::LayoutPositionNormal>(i, rowDest, stride);
+				break;
+			default:
+				WriteRow<Waves::LayoutPositionNormalTex>(i, rowDest, stride);
+				break;
+			}
+		}
+	};
+
+	if (pool != nullptr && pool->ThreadCount() > 1 && VertexCount() >= ParallelThreshold)
+	{
+		pool->ParallelFor(row_count_, BandRows, writeRows);
+	}
+	else
+	{
+		writeRows(0, row_count_);
+	}
+}
+
+template<Waves::VertexLayout Layout>
+void Ocean::WriteRow(UINT row, BYTE* dest, UINT stride) const
+{
+	const UINT offset = (row & (size_ - 1)) * size_;
+	const float z = row_z_[row];
+	const float v = row_v_[row];
+	for (UINT j = 0; j < col_count_; ++j)
+	{
+		const UINT s = offset + (j & (size_ - 1));
+		float* vertex = (float*)(dest + j * stride);
+		vertex[0] = column_x_[j] + displacement_x_[s];
+		vertex[1] = height_[s];
+		vertex[2] = z + displacement_z_[s];
+		if (Layout != Waves::LayoutPosition)
+		{
+			vertex[3] = normal_x_[s];
+			vertex[4] = normal_y_[s];
+			vertex[5] = normal_z_[s];
+		}
+		if (Layout == Waves::LayoutPositionNormalTex)
+		{
+			vertex[6] = column_u_[j];
+			vertex[7] = v;
+		}
+	}
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "Waves.h"
+#include "FFT.h"
+
+// A tileable patch of deep ocean, by Tessendorf's method: a spectrum of
+// wave heights drawn once from a wind driven spectrum, advanced in time
+// analytically, and brought back to the grid by inverse FFTs each update.
+// Big patches take no more steps than small ones and any time step works.
+//
+// The grid has a point more than the transform along each side, repeating
+// the first row and column, so that patches laid side by side meet.  Points
+// are displaced horizontally towards the crests by the choppiness, and foam
+// marks where the displaced surface bunches up or folds over.
+//
+// The accessors are those of Waves, so that a demo can draw either one.
+class Ocean
+{
+public:
+	enum SpectrumType
+	{
+		SpectrumPhillips,
+		SpectrumJONSWAP,
+
+		// A lone wave along the wind, as long as the waves a fully developed
+		// sea peaks at, and of height Amplitude.
+		SpectrumSingleWave
+	};
+
+	struct InitInfo
+	{
+		// Transform size along a side, a power of two.
+		UINT Size;
+
+		// Metres along a side of the patch.
+		float PatchSize;
+
+		float WindSpeed;
+		XMFLOAT2 WindDirection;
+
+		SpectrumType Spectrum;
+
+		// Scales the Phillips spectrum; metres from the mean to the crests
+		// of the single wave.
+		float Amplitude;
+
+		// Metres of water the wind has blown over, for JONSWAP.
+		float Fetch;
+
+		// How far points move towards the crests; zero leaves them on the
+		// grid.
+		float Choppiness;
+
+		// Foam starts where the Jacobian of the displacement falls below
+		// this and is full where the surface folds over, at zero.
+		float FoamThreshold;
+
+		UINT Seed;
+	};
+
+	Ocean();
+
+	void Init(const InitInfo& info);
+
+	UINT RowCount() const;
+	UINT ColumnCount() const;
+	UINT VertexCount() const;
+	UINT TriangleCount() const;
+	float Width() const;
+	float Depth() const;
+
+	// Returns the displaced surface at the ith grid point.
+	XMFLOAT3 operator[] (int i) const
+	{
+		UINT s = Sample(i);
+		return XMFLOAT3(column_x_[i % col_count_] + displacement_x_[s], height_[s],
+			row_z_[i / col_count_] + displacement_z_[s]);
+	}
+
+	XMFLOAT3 Normal(int i) const
+	{
+		UINT s = Sample(i);
+		return XMFLOAT3(normal_x_[s], normal_y_[s], normal_z_[s]);
+	}
+
+	// Returns the unit tangent vector at the ith grid point in the local x-axis direction.
+	XMFLOAT3 TangentX(int i) const
+	{
+		UINT s = Sample(i);
+		return XMFLOAT3(tangent_x_[s], tangent_y_[s], 0.f);
+	}
+
+	// Returns the foam at the ith grid point, in [0, 1].
+	float Foam(int i) const
+	{
+		return foam_[Sample(i)];
+	}
+
+	// Writes the grid the way Waves::WriteVertices does.
+	void WriteVertices(void* dest, UINT stride, Waves::VertexLayout layout, ThreadPool* pool = nullptr) const;
+
+	// Advances the surface by dt.  The spectra of the heights, slopes,
+	// displacements and their derivatives are set up for the new time and
+	// transformed back two real fields to a complex transform, the rows and
+	// columns of each across the threads of the pool.
+	void Update(float dt, ThreadPool* pool = nullptr);
+
+	float Time() const;
+
+private:
+	Ocean(const Ocean& rhs);
+	Ocean& operator=(const Ocean& rhs);
+
+	// The transformed sample at the ith grid point; the last row and column
+	// repeat the first.
+	UINT Sample(int i) const
+	{
+		UINT row = (i / col_count_) & (size_ - 1);
+		UINT col = (i % col_count_) & (size_ - 1);
+		return row * size_ + col;
+	}
+
+	float Spectrum(float kx, float kz) const;
+
+	// The packed spectra and surface of rows [begin, end) of the transform.
+	void BuildSpectra(UINT begin, UINT end);
+	void BuildSurface(UINT begin, UINT end);
+
+	template<Waves::VertexLayout Layout>
+	void WriteRow(UINT row, BYTE* dest, UINT stride) const;
+
+	// Pairs of real fields transformed together.
+	static const UINT FieldPairCount = 4;
+
+private:
+	InitInfo info_;
+	UINT size_;
+	UINT row_count_;
+	UINT col_count_;
+	float time_;
+
+	FFT fft_;
+
+	// Wave numbers of the transform columns and rows.
+	std::vector<float> wave_x_;
+	std::vector<float> wave_z_;
+
+	// The heights at time zero and their angular frequencies.
+	std::vector<float> h0_re_;
+	std::vector<float> h0_im_;
+	std::vector<float> omega_;
+
+	std::vector<float> field_re_[FieldPairCount];
+	std::vector<float> field_im_[FieldPairCount];
+
+	std::vector<float> column_x_;
+	std::vector<float> row_z_;
+	std::vector<float> column_u_;
+	std::vector<float> row_v_;
+
+	std::vector<float> height_;
+	std::vector<float> displacement_x_;
+	std::vector<float> displacement_z_;
+	std::vector<float> normal_x_;
+	std::vector<float> normal_y_;
+	std::vector<float> normal_z_;
+	std::vector<float> tangent_x_;
+	std::vector<float> tangent_y_;
+	std::vector<float> foam_;
+};
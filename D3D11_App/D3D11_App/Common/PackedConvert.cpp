@@ -0,0 +1,509 @@
+#include "PackedConvert.h"
+#include <intrin.h>
+#include <immintrin.h>
+
+using PackedConvert::HALF;
+
+namespace
+{
+	// Values per block handed to a thread.
+	const UINT BlockSize = 16384;
+
+	UINT AsUint(float f)
+	{
+		UINT u;
+		memcpy(&u, &f, sizeof(u));
+		return u;
+	}
+
+	float AsFloat(UINT u)
+	{
+		float f;
+		memcpy(&f, &u, sizeof(f));
+		return f;
+	}
+
+	//
+	// One value at a time.  The vector code below does the same steps four
+	// lanes at a time, so that both give the same bits.
+	//
+
+	HALF FloatToHalfScalar(float value)
+	{
+		UINT u = AsUint(value);
+		UINT sign = u & 0x80000000u;
+		u ^= sign;
+
+		UINT result;
+		if (u >= (127 + 16) << 23)
+		{
+			// Too large for a half, infinite or NaN.
+			result = u > 0x7f800000u ? 0x7e00u : 0x7c00u;
+		}
+		else if (u < (127 - 14) << 23)
+		{
+			// A denormal half or zero: adding a power of two lines the ten
+			// bits of mantissa left up at the bottom of the float, rounded to
+			// nearest even by the addition.
+			const UINT magic = ((127 - 15) + (23 - 10) + 1) << 23;
+			result = AsUint(AsFloat(u) + AsFloat(magic)) - magic;
+		}
+		else
+		{
+			// Rebias the exponent and round the 13 bits dropped to nearest
+			// even.
+			UINT odd = (u >> 13) & 1;
+			u += ((15 - 127) << 23) + 0xfff + odd;
+			result = u >> 13;
+		}
+
+		return (HALF)(result | (sign >> 16));
+	}
+
+	float HalfToFloatScalar(HALF value)
+	{
+		const UINT shiftedExponent = 0x7c00u << 13;
+
+		UINT u = (value & 0x7fffu) << 13;
+		UINT exponent = u & shiftedExponent;
+		u += (127 - 15) << 23;
+
+		if (exponent == shiftedExponent)
+		{
+			// Infinity or NaN.
+			u += (128 - 16) << 23;
+		}
+		else if (exponent == 0)
+		{
+			// Zero or denormal: renormalize through a float subtraction.
+			u += 1 << 23;
+			u = AsUint(AsFloat(u) - AsFloat(113 << 23));
+		}
+
+		return AsFloat(u | ((UINT)(value & 0x8000u) << 16));
+	}
+
+	float SaturateUnorm(float value)
+	{
+		value = value > 0.0f ? value : 0.0f;
+		return value < 1.0f ? value : 1.0f;
+	}
+
+	float SaturateSnorm(float value)
+	{
+		value = value == value ? value : 0.0f;
+		value = value > -1.0f ? value : -1.0f;
+		return value < 1.0f ? value : 1.0f;
+	}
+
+	int RoundUnorm(float value, float scale)
+	{
+		return (int)(SaturateUnorm(value) * scale + 0.5f);
+	}
+
+	int RoundSnorm(float value, float scale)
+	{
+		float scaled = SaturateSnorm(value) * scale;
+		return (int)(scaled + (scaled < 0.0f ? -0.5f : 0.5f));
+	}
+
+#if defined(_XM_SSE_INTRINSICS_)
+	__m128i FloatToHalfSSE2(__m128 f)
+	{
+		const __m128i maxHalf = _mm_set1_epi32((127 + 16) << 23);
+		const __m128i minNormal = _mm_set1_epi32((127 - 14) << 23);
+		const __m128i denormalMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+		const __m128i normalBias = _mm_set1_epi32(((15 - 127) << 23) + 0xfff);
+
+		__m128 sign = _mm_and_ps(f, _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000u)));
+		__m128 absF = _mm_xor_ps(f, sign);
+		__m128i u = _mm_castps_si128(absF);
+
+		__m128i isNaN = _mm_castps_si128(_mm_cmpunord_ps(absF, absF));
+		__m128i isFinite = _mm_cmpgt_epi32(maxHalf, u);
+		__m128i isDenormal = _mm_cmpgt_epi32(minNormal, u);
+		__m128i special = _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(isNaN, _mm_set1_epi32(0x200)));
+
+		__m128i denormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absF, _mm_castsi128_ps(denormalMagic))), denormalMagic);
+
+		__m128i odd = _mm_and_si128(_mm_srli_epi32(u, 13), _mm_set1_epi32(1));
+		__m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(u, normalBias), odd), 13);
+
+		__m128i finite = _mm_or_si128(_mm_and_si128(isDenormal, denormal), _mm_andnot_si128(isDenormal, normal));
+		__m128i result = _mm_or_si128(_mm_and_si128(isFinite, finite), _mm_andnot_si128(isFinite, special));
+
+		// The sign lands on bit 15 with the bits above set, which keeps the
+		// lanes within the range _mm_packs_epi32 passes through.
+		return _mm_or_si128(result, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+	}
+
+	// h holds a half in the low 16 bits of every lane.
+	__m128 HalfToFloatSSE2(__m128i h)
+	{
+		__m128i magnitude = _mm_and_si128(h, _mm_set1_epi32(0x7fff));
+		__m128i sign = _mm_slli_epi32(_mm_xor_si128(h, magnitude), 16);
+
+		// Scaling by 2^112 rebiases the exponent and normalizes denormals.
+		__m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(magnitude, 13)),
+			_mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+
+		__m128i isInfNaN = _mm_cmpgt_epi32(magnitude, _mm_set1_epi32(0x7bff));
+		__m128i infNaNExponent = _mm_and_si128(isInfNaN, _mm_set1_epi32(255 << 23));
+
+		return _mm_or_ps(scaled, _mm_castsi128_ps(_mm_or_si128(sign, infNaNExponent)));
+	}
+
+	__m128i RoundUnormSSE2(__m128 f, __m128 scale)
+	{
+		// _mm_max_ps returns its second operand for NaNs.
+		__m128 v = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+		return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), _mm_set1_ps(0.5f)));
+	}
+
+	__m128i RoundSnormSSE2(__m128 f, __m128 scale)
+	{
+		__m128 v = _mm_and_ps(f, _mm_cmpord_ps(f, f));
+		v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+
+		__m128 scaled = _mm_mul_ps(v, scale);
+		__m128 half = _mm_or_ps(_mm_set1_ps(0.5f), _mm_and_ps(scaled, _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000u))));
+		return _mm_cvttps_epi32(_mm_add_ps(scaled, half));
+	}
+
+	__m128 LoadFloats(const float* p)
+	{
+		return _mm_loadu_ps(p);
+	}
+#endif
+
+	bool DetectF16C()
+	{
+#if defined(_XM_SSE_INTRINSICS_)
+		int info[4];
+		__cpuid(info, 1);
+
+		// F16C is VEX encoded, so the OS has to save the AVX registers too.
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		bool f16c = (info[2] & (1 << 29)) != 0;
+		return osxsave && avx && f16c && (_xgetbv(0) & 6) == 6;
+#else
+		return false;
+#endif
+	}
+
+	//
+	// Conversions of a range, vectors first and the rest one at a time.
+	//
+
+	void FloatToHalfRange(const float* src, HALF* dest, UINT count)
+	{
+		UINT i = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+		if (PackedConvert::HasF16C())
+		{
+			for (; i + 8 <= count; i += 8)
+			{
+				__m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+				_mm_storeu_si128((__m128i*)(dest + i), halves);
+			}
+			_mm256_zeroupper();
+		}
+		else
+		{
+			for (; i + 8 <= count; i += 8)
+			{
+				__m128i lo = FloatToHalfSSE2(LoadFloats(src + i));
+				__m128i hi = FloatToHalfSSE2(LoadFloats(src + i + 4));
+				_mm_storeu_si128((__m128i*)(dest + i), _mm_packs_epi32(lo, hi));
+			}
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			dest[i] = FloatToHalfScalar(src[i]);
+		}
+	}
+
+	void HalfToFloatRange(const HALF* src, float* dest, UINT count)
+	{
+		UINT i = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+		if (PackedConvert::HasF16C())
+		{
+			for (; i + 8 <= count; i += 8)
+			{
+				__m128i halves = _mm_loadu_si128((const __m128i*)(src + i));
+				_mm256_storeu_ps(dest + i, _mm256_cvtph_ps(halves));
+			}
+			_mm256_zeroupper();
+		}
+		else
+		{
+			for (; i + 8 <= count; i += 8)
+			{
+				__m128i halves = _mm_loadu_si128((const __m128i*)(src + i));
+				__m128i zero = _mm_setzero_si128();
+				_mm_storeu_ps(dest + i, HalfToFloatSSE2(_mm_unpacklo_epi16(halves, zero)));
+				_mm_storeu_ps(dest + i + 4, HalfToFloatSSE2(_mm_unpackhi_epi16(halves, zero)));
+			}
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			dest[i] = HalfToFloatScalar(src[i]);
+		}
+	}
+
+	void FloatToUnorm8Range(const float* src, BYTE* dest, UINT count)
+	{
+		UINT i = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+		__m128 scale = _mm_set1_ps(255.0f);
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i a = RoundUnormSSE2(LoadFloats(src + i), scale);
+			__m128i b = RoundUnormSSE2(LoadFloats(src + i + 4), scale);
+			__m128i c = RoundUnormSSE2(LoadFloats(src + i + 8), scale);
+			__m128i d = RoundUnormSSE2(LoadFloats(src + i + 12), scale);
+			_mm_storeu_si128((__m128i*)(dest + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			dest[i] = (BYTE)RoundUnorm(src[i], 255.0f);
+		}
+	}
+
+	void FloatToUnorm16Range(const float* src, USHORT* dest, UINT count)
+	{
+		UINT i = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+		// SSE2 only packs to signed words, so the values are moved down by
+		// 32768 and back up by flipping the top bit.
+		__m128 scale = _mm_set1_ps(65535.0f);
+		__m128i bias = _mm_set1_epi32(32768);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i a = _mm_sub_epi32(RoundUnormSSE2(LoadFloats(src + i), scale), bias);
+			__m128i b = _mm_sub_epi32(RoundUnormSSE2(LoadFloats(src + i + 4), scale), bias);
+			__m128i packed = _mm_xor_si128(_mm_packs_epi32(a, b), _mm_set1_epi16((short)0x8000));
+			_mm_storeu_si128((__m128i*)(dest + i), packed);
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			dest[i] = (USHORT)RoundUnorm(src[i], 65535.0f);
+		}
+	}
+
+	void FloatToSnorm8Range(const float* src, signed char* dest, UINT count)
+	{
+		UINT i = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+		__m128 scale = _mm_set1_ps(127.0f);
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i a = RoundSnormSSE2(LoadFloats(src + i), scale);
+			__m128i b = RoundSnormSSE2(LoadFloats(src + i + 4), scale);
+			__m128i c = RoundSnormSSE2(LoadFloats(src + i + 8), scale);
+			__m128i d = RoundSnormSSE2(LoadFloats(src + i + 12), scale);
+			_mm_storeu_si128((__m128i*)(dest + i), _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			dest[i] = (signed char)RoundSnorm(src[i], 127.0f);
+		}
+	}
+
+	void FloatToSnorm16Range(const float* src, short* dest, UINT count)
+	{
+		UINT i = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+		__m128 scale = _mm_set1_ps(32767.0f);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i a = RoundSnormSSE2(LoadFloats(src + i), scale);
+			__m128i b = RoundSnormSSE2(LoadFloats(src + i + 4), scale);
+			_mm_storeu_si128((__m128i*)(dest + i), _mm_packs_epi32(a, b));
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			dest[i] = (short)RoundSnorm(src[i], 32767.0f);
+		}
+	}
+
+	void Unorm8ToFloatRange(const BYTE* src, float* dest, UINT count)
+	{
+		UINT i = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+		__m128 scale = _mm_set1_ps(255.0f);
+		__m128i zero = _mm_setzero_si128();
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i bytes = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i lo = _mm_unpacklo_epi8(bytes, zero);
+			__m128i hi = _mm_unpackhi_epi8(bytes, zero);
+			_mm_storeu_ps(dest + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+			_mm_storeu_ps(dest + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+			_mm_storeu_ps(dest + i + 8, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+			_mm_storeu_ps(dest + i + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			dest[i] = src[i] / 255.0f;
+		}
+	}
+
+	void Unorm16ToFloatRange(const USHORT* src, float* dest, UINT count)
+	{
+		UINT i = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+		__m128 scale = _mm_set1_ps(65535.0f);
+		__m128i zero = _mm_setzero_si128();
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i words = _mm_loadu_si128((const __m128i*)(src + i));
+			_mm_storeu_ps(dest + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero)), scale));
+			_mm_storeu_ps(dest + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero)), scale));
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			dest[i] = src[i] / 65535.0f;
+		}
+	}
+
+	void Snorm8ToFloatRange(const signed char* src, float* dest, UINT count)
+	{
+		UINT i = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+		__m128 scale = _mm_set1_ps(127.0f);
+		__m128 minusOne = _mm_set1_ps(-1.0f);
+		for (; i + 16 <= count; i += 16)
+		{
+			// Sign extend by moving every byte to the top of a lane and
+			// shifting it back down.
+			__m128i bytes = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i lo = _mm_unpacklo_epi8(bytes, bytes);
+			__m128i hi = _mm_unpackhi_epi8(bytes, bytes);
+			__m128i ints[4] =
+			{
+				_mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 24),
+				_mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 24),
+				_mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 24),
+				_mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 24)
+			};
+			for (UINT k = 0; k < 4; ++k)
+			{
+				_mm_storeu_ps(dest + i + 4 * k, _mm_max_ps(_mm_div_ps(_mm_cvtepi32_ps(ints[k]), scale), minusOne));
+			}
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			dest[i] = MathHelper::Max(src[i] / 127.0f, -1.0f);
+		}
+	}
+
+	void Snorm16ToFloatRange(const short* src, float* dest, UINT count)
+	{
+		UINT i = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+		__m128 scale = _mm_set1_ps(32767.0f);
+		__m128 minusOne = _mm_set1_ps(-1.0f);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i words = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16);
+			__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16);
+			_mm_storeu_ps(dest + i, _mm_max_ps(_mm_div_ps(_mm_cvtepi32_ps(lo), scale), minusOne));
+			_mm_storeu_ps(dest + i + 4, _mm_max_ps(_mm_div_ps(_mm_cvtepi32_ps(hi), scale), minusOne));
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			dest[i] = MathHelper::Max(src[i] / 32767.0f, -1.0f);
+		}
+	}
+
+	// Runs a range conversion over the whole buffer, or over blocks of it
+	// across the pool for large buffers.
+	template<class Src, class Dest>
+	void ConvertBlocks(const Src* src, Dest* dest, UINT count, ThreadPool* pool,
+		void (*convert)(const Src*, Dest*, UINT))
+	{
+		if (pool == nullptr || pool->ThreadCount() == 1 || count < PackedConvert::ParallelThreshold)
+		{
+			convert(src, dest, count);
+			return;
+		}
+
+		UINT blockCount = (count + BlockSize - 1) / BlockSize;
+		pool->ParallelFor(blockCount, 1, [=](UINT begin, UINT end)
+		{
+			UINT first = begin * BlockSize;
+			UINT last = MathHelper::Min(end * BlockSize, count);
+			convert(src + first, dest + first, last - first);
+		});
+	}
+}
+
+void PackedConvert::FloatToHalf(const float* src, HALF* dest, UINT count, ThreadPool* pool)
+{
+	ConvertBlocks(src, dest, count, pool, FloatToHalfRange);
+}
+
+void PackedConvert::HalfToFloat(const HALF* src, float* dest, UINT count, ThreadPool* pool)
+{
+	ConvertBlocks(src, dest, count, pool, HalfToFloatRange);
+}
+
+void PackedConvert::FloatToUnorm8(const float* src, BYTE* dest, UINT count, ThreadPool* pool)
+{
+	ConvertBlocks(src, dest, count, pool, FloatToUnorm8Range);
+}
+
+void PackedConvert::FloatToUnorm16(const float* src, USHORT* dest, UINT count, ThreadPool* pool)
+{
+	ConvertBlocks(src, dest, count, pool, FloatToUnorm16Range);
+}
+
+void PackedConvert::FloatToSnorm8(const float* src, signed char* dest, UINT count, ThreadPool* pool)
+{
+	ConvertBlocks(src, dest, count, pool, FloatToSnorm8Range);
+}
+
+void PackedConvert::FloatToSnorm16(const float* src, short* dest, UINT count, ThreadPool* pool)
+{
+	ConvertBlocks(src, dest, count, pool, FloatToSnorm16Range);
+}
+
+void PackedConvert::Unorm8ToFloat(const BYTE* src, float* dest, UINT count, ThreadPool* pool)
+{
+	ConvertBlocks(src, dest, count, pool, Unorm8ToFloatRange);
+}
+
+void PackedConvert::Unorm16ToFloat(const USHORT* src, float* dest, UINT count, ThreadPool* pool)
+{
+	ConvertBlocks(src, dest, count, pool, Unorm16ToFloatRange);
+}
+
+void PackedConvert::Snorm8ToFloat(const signed char* src, float* dest, UINT count, ThreadPool* pool)
+{
+	ConvertBlocks(src, dest, count, pool, Snorm8ToFloatRange);
+}
+
+void PackedConvert::Snorm16ToFloat(const short* src, float* dest, UINT count, ThreadPool* pool)
+{
+	ConvertBlocks(src, dest, count, pool, Snorm16ToFloatRange);
+}
+
+bool PackedConvert::HasF16C()
+{
+	static const bool hasF16C = DetectF16C();
+	return hasF16C;
+}
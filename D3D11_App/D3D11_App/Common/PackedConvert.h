@@ -0,0 +1,47 @@
+#pragma once
+
+#include "d3dUtil.h"
+#include "ThreadPool.h"
+#include <DirectXPackedVector.h>
+
+// Bulk conversions between floats and the packed formats of textures and
+// vertex data: half floats, and 8-bit and 16-bit UNORM and SNORM integers.
+//
+// Half conversions use the F16C instructions where the processor has them
+// and SSE2 otherwise; the others use SSE2.  The values left at the end of a
+// buffer, and every value in builds without intrinsics, go through scalar
+// code that gives the same results, NaN payloads aside.  Buffers of
+// ParallelThreshold values or more are split into blocks across the threads
+// of a pool when one is given.
+namespace PackedConvert
+{
+	typedef DirectX::PackedVector::HALF HALF;
+
+	const UINT ParallelThreshold = 1 << 16;
+
+	/// Rounds to the nearest half, ties to even.  Values beyond the range of
+	/// halves become infinities and NaNs stay NaNs.
+	void FloatToHalf(const float* src, HALF* dest, UINT count, ThreadPool* pool = nullptr);
+	void HalfToFloat(const HALF* src, float* dest, UINT count, ThreadPool* pool = nullptr);
+
+	/// Clamps to [0, 1], NaNs to 0, and rounds the value times 255 or 65535
+	/// to the nearest integer, halves up.
+	void FloatToUnorm8(const float* src, BYTE* dest, UINT count, ThreadPool* pool = nullptr);
+	void FloatToUnorm16(const float* src, USHORT* dest, UINT count, ThreadPool* pool = nullptr);
+
+	/// Clamps to [-1, 1], NaNs to 0, and rounds the value times 127 or 32767
+	/// to the nearest integer, halves away from zero.
+	void FloatToSnorm8(const float* src, signed char* dest, UINT count, ThreadPool* pool = nullptr);
+	void FloatToSnorm16(const float* src, short* dest, UINT count, ThreadPool* pool = nullptr);
+
+	// Divide by 255 or 65535.
+	void Unorm8ToFloat(const BYTE* src, float* dest, UINT count, ThreadPool* pool = nullptr);
+	void Unorm16ToFloat(const USHORT* src, float* dest, UINT count, ThreadPool* pool = nullptr);
+
+	// Divide by 127 or 32767; the most negative value becomes -1 as well.
+	void Snorm8ToFloat(const signed char* src, float* dest, UINT count, ThreadPool* pool = nullptr);
+	void Snorm16ToFloat(const short* src, float* dest, UINT count, ThreadPool* pool = nullptr);
+
+	// True if the half conversions run on F16C.
+	bool HasF16C();
+}
@@ -0,0 +1,348 @@
+#include "TerrainBaker.h"
+#include "DDSWriter.h"
+#include "MathHelper.h"
+#include "PackedConvert.h"
+
+namespace
+{
+	// Texel rows a thread bakes at a time.
+	const UINT BandRows = 16;
+
+	// A row of tiles of the heightmap copied out of the cache, TileCells + 1
+	// rows of the full width.
+	struct TileRow
+	{
+		std::vector<float> Samples;
+		UINT Index;
+	};
+
+	// Rules of the blend map with the fades turned into slopes of the ramps.
+	struct BlendRule
+	{
+		float MinHeight;
+		float MaxHeight;
+		float InvHeightFade;
+		float MinSlope;
+		float MaxSlope;
+		float InvSlopeFade;
+	};
+
+	// What every texel row of a bake reads.
+	struct BakeContext
+	{
+		UINT SampleWidth;
+		UINT SampleHeight;
+		UINT Step;
+		float TexelSpacing;
+
+		// Height of the lowest sample and one over the height range.
+		float MinHeight;
+		float InvHeightRange;
+
+		BlendRule Rules[4];
+		bool Tangents;
+
+		// Every row of the heightmap, of which only those around the current
+		// row of tiles are set.
+		const float* const* Rows;
+
+		TerrainMaps* Maps;
+	};
+
+	// Per thread rows of samples and of unpacked texels, padded to whole
+	// groups of four.
+	struct BakeScratch
+	{
+		std::vector<float> Left;
+		std::vector<float> Right;
+		std::vector<float> Up;
+		std::vector<float> Down;
+		std::vector<float> Center;
+
+		std::vector<float> Normals;
+		std::vector<float> Tangents;
+		std::vector<float> Blend;
+
+		explicit BakeScratch(UINT paddedWidth)
+			: Left(paddedWidth)
+			, Right(paddedWidth)
+			, Up(paddedWidth)
+			, Down(paddedWidth)
+			, Center(paddedWidth)
+			, Normals(4 * paddedWidth)
+			, Tangents(4 * paddedWidth)
+			, Blend(4 * paddedWidth)
+		{
+
+		}
+	};
+
+	XMVECTOR LoadFloat4(const float* p)
+	{
+		return XMLoadFloat4((const XMFLOAT4*)p);
+	}
+
+	// Stores four texels given as vectors of their x, y, z and w.
+	void StoreTexels(float* p, FXMVECTOR x, FXMVECTOR y, FXMVECTOR z, GXMVECTOR w)
+	{
+		XMMATRIX texels = XMMatrixTranspose(XMMATRIX(x, y, z, w));
+		XMStoreFloat4((XMFLOAT4*)p, texels.r[0]);
+		XMStoreFloat4((XMFLOAT4*)p + 1, texels.r[1]);
+		XMStoreFloat4((XMFLOAT4*)p + 2, texels.r[2]);
+		XMStoreFloat4((XMFLOAT4*)p + 3, texels.r[3]);
+	}
+
+	// 1 between lo and hi, falling to 0 over a fade past them.
+	XMVECTOR Coverage(FXMVECTOR x, float lo, float hi, float invFade)
+	{
+		XMVECTOR inside = XMVectorMin(XMVectorSubtract(x, XMVectorReplicate(lo)),
+			XMVectorSubtract(XMVectorReplicate(hi), x));
+		return XMVectorSaturate(XMVectorMultiplyAdd(inside, XMVectorReplicate(invFade), XMVectorSplatOne()));
+	}
+
+	// Bakes texel row i.
+	void BakeRow(const BakeContext& c, UINT i, BakeScratch& s)
+	{
+		UINT width = c.Maps->Width;
+		int lastRow = (int)c.SampleHeight - 1;
+		int lastCol = (int)c.SampleWidth - 1;
+		int r = (int)(i * c.Step);
+		int step = (int)c.Step;
+
+		const float* up = c.Rows[MathHelper::Max(r - step, 0)];
+		const float* center = c.Rows[r];
+		const float* down = c.Rows[MathHelper::Min(r + step, lastRow)];
+
+		// Neighbours past the edges are clamped to them.
+		for (UINT j = 0; j < width; ++j)
+		{
+			int col = (int)j * step;
+			s.Left[j] = center[MathHelper::Max(col - step, 0)];
+			s.Right[j] = center[MathHelper::Min(col + step, lastCol)];
+			s.Up[j] = up[col];
+			s.Down[j] = down[col];
+			s.Center[j] = center[col];
+		}
+
+		// The tangent (2d, hx, 0) and bitangent (0, hz, -2d) of the effect
+		// cross to the normal (-hx, 2d, hz) with d the texel spacing.
+		XMVECTOR twoD = XMVectorReplicate(2.0f * c.TexelSpacing);
+		XMVECTOR twoDSq = XMVectorMultiply(twoD, twoD);
+		XMVECTOR minHeight = XMVectorReplicate(c.MinHeight);
+		XMVECTOR invHeightRange = XMVectorReplicate(c.InvHeightRange);
+		XMVECTOR zero = XMVectorZero();
+		XMVECTOR one = XMVectorSplatOne();
+
+		for (UINT j = 0; j < width; j += 4)
+		{
+			XMVECTOR hx = XMVectorSubtract(LoadFloat4(&s.Right[j]), LoadFloat4(&s.Left[j]));
+			XMVECTOR hz = XMVectorSubtract(LoadFloat4(&s.Down[j]), LoadFloat4(&s.Up[j]));
+
+			XMVECTOR hxSq = XMVectorMultiply(hx, hx);
+			XMVECTOR invLength = XMVectorReciprocalSqrt(XMVectorMultiplyAdd(hz, hz, XMVectorAdd(hxSq, twoDSq)));
+			XMVECTOR ny = XMVectorMultiply(twoD, invLength);
+			StoreTexels(&s.Normals[4 * j], XMVectorNegate(XMVectorMultiply(hx, invLength)), ny,
+				XMVectorMultiply(hz, invLength), zero);
+
+			if (c.Tangents)
+			{
+				XMVECTOR invTangentLength = XMVectorReciprocalSqrt(XMVectorAdd(hxSq, twoDSq));
+				StoreTexels(&s.Tangents[4 * j], XMVectorMultiply(twoD, invTangentLength),
+					XMVectorMultiply(hx, invTangentLength), zero, one);
+			}
+
+			XMVECTOR height = XMVectorMultiply(XMVectorSubtract(LoadFloat4(&s.Center[j]), minHeight), invHeightRange);
+			XMVECTOR slope = XMVectorSubtract(one, ny);
+
+			XMVECTOR weights[4];
+			for (UINT k = 0; k < 4; ++k)
+			{
+				const BlendRule& rule = c.Rules[k];
+				weights[k] = XMVectorMultiply(
+					Coverage(height, rule.MinHeight, rule.MaxHeight, rule.InvHeightFade),
+					Coverage(slope, rule.MinSlope, rule.MaxSlope, rule.InvSlopeFade));
+			}
+			StoreTexels(&s.Blend[4 * j], weights[0], weights[1], weights[2], weights[3]);
+		}
+
+		UINT* normals = &c.Maps->Normals[i * width];
+		PackedConvert::FloatToSnorm8(&s.Normals[0], (signed char*)normals, 4 * width);
+		if (c.Tangents)
+		{
+			UINT* tangents = &c.Maps->Tangents[i * width];
+			PackedConvert::FloatToSnorm8(&s.Tangents[0], (signed char*)tangents, 4 * width);
+		}
+		PackedConvert::FloatToUnorm8(&s.Blend[0], (BYTE*)&c.Maps->Blend[i * width], 4 * width);
+	}
+
+	// Copies row of tiles ty out of the heightmap, reading the tiles not
+	// resident across the threads of the pool.
+	void ReadTileRow(TiledHeightmap& heightmap, UINT ty, TileRow& tileRow, ThreadPool* pool)
+	{
+		const UINT tileSamples = TiledHeightmap::TileCells + 1;
+		UINT width = heightmap.GetWidth();
+		UINT rows = MathHelper::Min(tileSamples, heightmap.GetHeight() - ty * TiledHeightmap::TileCells);
+
+		heightmap.PageRect(0, ty, heightmap.GetTilesX() - 1, ty, pool);
+		tileRow.Samples.resize(tileSamples * width);
+		tileRow.Index = ty;
+		for (UINT tx = 0; tx < heightmap.GetTilesX(); ++tx)
+		{
+			const float* tile = heightmap.GetTile(tx, ty);
+			UINT col0 = tx * TiledHeightmap::TileCells;
+			UINT cols = MathHelper::Min(tileSamples, width - col0);
+			for (UINT y = 0; y < rows; ++y)
+			{
+				memcpy(&tileRow.Samples[y * width + col0], &tile[y * tileSamples], cols * sizeof(float));
+			}
+		}
+	}
+}
+
+bool TerrainBaker::Bake(TiledHeightmap& heightmap, float cellSpacing, const TerrainBakeSettings& settings,
+	TerrainMaps& maps, ThreadPool* pool)
+{
+	if (!heightmap.IsOpen() || settings.Step == 0 || settings.Step > TiledHeightmap::TileCells)
+	{
+		return false;
+	}
+
+	UINT sampleWidth = heightmap.GetWidth();
+	UINT sampleHeight = heightmap.GetHeight();
+	UINT tilesY = heightmap.GetTilesY();
+
+	maps.Width = (sampleWidth - 1) / settings.Step + 1;
+	maps.Height = (sampleHeight - 1) / settings.Step + 1;
+	maps.Normals.assign(maps.Width * maps.Height, 0);
+	maps.Tangents.assign(settings.Tangents ? maps.Width * maps.Height : 0, 0);
+	maps.Blend.assign(maps.Width * maps.Height, 0);
+
+	// The height range comes from the index, without reading a tile.
+	float minHeight = MathHelper::Infinity;
+	float maxHeight = -MathHelper::Infinity;
+	for (UINT ty = 0; ty < tilesY; ++ty)
+	{
+		for (UINT tx = 0; tx < heightmap.GetTilesX(); ++tx)
+		{
+			XMFLOAT2 bounds = heightmap.GetTileBounds(tx, ty);
+			minHeight = MathHelper::Min(minHeight, bounds.x);
+			maxHeight = MathHelper::Max(maxHeight, bounds.y);
+		}
+	}
+
+	std::vector<const float*> rows(sampleHeight, nullptr);
+
+	BakeContext c;
+	c.SampleWidth = sampleWidth;
+	c.SampleHeight = sampleHeight;
+	c.Step = settings.Step;
+	c.TexelSpacing = cellSpacing * settings.Step;
+	c.MinHeight = minHeight;
+	c.InvHeightRange = maxHeight > minHeight ? 1.0f / (maxHeight - minHeight) : 0.0f;
+	c.Tangents = settings.Tangents;
+	c.Rows = &rows[0];
+	c.Maps = &maps;
+	for (UINT k = 0; k < 4; ++k)
+	{
+		const TerrainBlendLayer& layer = settings.BlendLayers[k];
+		c.Rules[k].MinHeight = layer.MinHeight;
+		c.Rules[k].MaxHeight = layer.MaxHeight;
+		c.Rules[k].InvHeightFade = 1.0f / MathHelper::Max(layer.HeightFade, 1e-6f);
+		c.Rules[k].MinSlope = layer.MinSlope;
+		c.Rules[k].MaxSlope = layer.MaxSlope;
+		c.Rules[k].InvSlopeFade = 1.0f / MathHelper::Max(layer.SlopeFade, 1e-6f);
+	}
+
+	UINT paddedWidth = (maps.Width + 3) & ~3u;
+	BakeScratch mainScratch(paddedWidth);
+
+	// The rows of tiles above, at and below the one baked.  A step of at most
+	// TileCells never reaches further.
+	TileRow tileRows[3];
+	TileRow* prev = &tileRows[0];
+	TileRow* cur = &tileRows[1];
+	TileRow* next = &tileRows[2];
+	ReadTileRow(heightmap, 0, *cur, pool);
+
+	UINT firstTexelRow = 0;
+	for (UINT ty = 0; ty < tilesY; ++ty)
+	{
+		if (ty + 1 < tilesY)
+		{
+			ReadTileRow(heightmap, ty + 1, *next, pool);
+		}
+
+		// Point every row within a step of this row of tiles at its samples.
+		UINT tileRow0 = ty * TiledHeightmap::TileCells;
+		UINT rowBegin = tileRow0 >= settings.Step ? tileRow0 - settings.Step : 0;
+		UINT rowEnd = MathHelper::Min(tileRow0 + TiledHeightmap::TileCells + settings.Step + 1, sampleHeight);
+		for (UINT r = rowBegin; r < rowEnd; ++r)
+		{
+			const TileRow* source = r < tileRow0 ? prev : r <= tileRow0 + TiledHeightmap::TileCells ? cur : next;
+			rows[r] = &source->Samples[(r - source->Index * TiledHeightmap::TileCells) * sampleWidth];
+		}
+
+		// Texel rows whose samples lie in this row of tiles, the last row of
+		// samples going with the last row of tiles.
+		UINT sampleEnd = ty + 1 < tilesY ? tileRow0 + TiledHeightmap::TileCells : sampleHeight;
+		UINT texelEnd = MathHelper::Min((sampleEnd + settings.Step - 1) / settings.Step, maps.Height);
+		UINT texelCount = texelEnd - firstTexelRow;
+		UINT texelBegin = firstTexelRow;
+
+		auto bakeBand = [&c, texelBegin, paddedWidth](UINT begin, UINT end)
+		{
+			BakeScratch scratch(paddedWidth);
+			for (UINT i = begin; i < end; ++i)
+			{
+				BakeRow(c, texelBegin + i, scratch);
+			}
+		};
+
+		if (pool != nullptr && pool->ThreadCount() > 1)
+		{
+			pool->ParallelFor(texelCount, BandRows, bakeBand);
+		}
+		else
+		{
+			for (UINT i = 0; i < texelCount; ++i)
+			{
+				BakeRow(c, texelBegin + i, mainScratch);
+			}
+		}
+
+		firstTexelRow = texelEnd;
+
+		TileRow* oldest = prev;
+		prev = cur;
+		cur = next;
+		next = oldest;
+	}
+
+	return true;
+}
+
+bool TerrainBaker::SaveDDS(const TerrainMaps& maps, const std::wstring& normalPath, const std::wstring& tangentPath,
+	const std::wstring& blendPath)
+{
+	UINT rowPitch = maps.Width * sizeof(UINT);
+
+	if (!normalPath.empty() && !maps.Normals.empty() &&
+		!DDSWriter::SaveTexture2D(normalPath, maps.Width, maps.Height, DXGI_FORMAT_R8G8B8A8_SNORM, &maps.Normals[0], rowPitch))
+	{
+		return false;
+	}
+
+	if (!tangentPath.empty() && !maps.Tangents.empty() &&
+		!DDSWriter::SaveTexture2D(tangentPath, maps.Width, maps.Height, DXGI_FORMAT_R8G8B8A8_SNORM, &maps.Tangents[0], rowPitch))
+	{
+		return false;
+	}
+
+	if (!blendPath.empty() && !maps.Blend.empty() &&
+		!DDSWriter::SaveTexture2D(blendPath, maps.Width, maps.Height, DXGI_FORMAT_R8G8B8A8_UNORM, &maps.Blend[0], rowPitch))
+	{
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "d3dUtil.h"
+#include "TiledHeightmap.h"
+
+// Rule for one channel of a terrain blend map.  The layer covers the ground
+// between two heights and two slopes and fades out over the given distances
+// past them.  Heights run from 0 at the lowest sample of the heightmap to 1
+// at the highest; the slope is 1 - normal.y, 0 on flat ground and 1 on a
+// vertical face.
+struct TerrainBlendLayer
+{
+	float MinHeight;
+	float MaxHeight;
+	float HeightFade;
+
+	float MinSlope;
+	float MaxSlope;
+	float SlopeFade;
+
+	TerrainBlendLayer()
+		: MinHeight(0.0f)
+		, MaxHeight(1.0f)
+		, HeightFade(0.1f)
+		, MinSlope(0.0f)
+		, MaxSlope(1.0f)
+		, SlopeFade(0.1f)
+	{
+
+	}
+
+	TerrainBlendLayer(float minHeight, float maxHeight, float minSlope, float maxSlope)
+		: MinHeight(minHeight)
+		, MaxHeight(maxHeight)
+		, HeightFade(0.1f)
+		, MinSlope(minSlope)
+		, MaxSlope(maxSlope)
+		, SlopeFade(0.1f)
+	{
+
+	}
+};
+
+struct TerrainBakeSettings
+{
+	// Heightmap samples per texel, from 1 to TiledHeightmap::TileCells.  The
+	// normals are the central differences over a texel either way, like the
+	// terrain effect takes them from a heightmap texture of the same size.
+	UINT Step;
+
+	// Bake the tangent map as well as the normal map.
+	bool Tangents;
+
+	// Rules for the r, g, b and a channels of the blend map, which the
+	// terrain effect lerps over the first layer in that order.  The defaults
+	// suit the five layers of the demo: dark dirt in the lowlands, stone on
+	// the steep slopes, light dirt on flat ground halfway up and snow on the
+	// flat tops.
+	TerrainBlendLayer BlendLayers[4];
+
+	TerrainBakeSettings()
+		: Step(1)
+		, Tangents(true)
+	{
+		BlendLayers[0] = TerrainBlendLayer(0.0f, 0.25f, 0.0f, 1.0f);
+		BlendLayers[1] = TerrainBlendLayer(0.0f, 1.0f, 0.3f, 1.0f);
+		BlendLayers[2] = TerrainBlendLayer(0.45f, 0.65f, 0.0f, 0.15f);
+		BlendLayers[3] = TerrainBlendLayer(0.8f, 1.0f, 0.0f, 0.25f);
+	}
+};
+
+// Maps baked from a heightmap, with a texel for every Step samples each way,
+// row by row.  Normals hold a unit normal in xyz and 0 in w, as
+// R8G8B8A8_SNORM texels; tangents hold the unit tangent along +x in xyz and
+// 1 in w, in the same format; the blend map holds the weights of the four
+// rules as R8G8B8A8_UNORM texels.
+struct TerrainMaps
+{
+	UINT Width;
+	UINT Height;
+
+	std::vector<UINT> Normals;
+	std::vector<UINT> Tangents;
+	std::vector<UINT> Blend;
+
+	TerrainMaps()
+		: Width(0)
+		, Height(0)
+	{
+
+	}
+};
+
+// Offline baking of the data the terrain effect would otherwise work out per
+// pixel.  The heightmap is paged in one row of tiles at a time, so maps of
+// any size bake in the memory of three rows of tiles plus the output.  The
+// texel rows of each row of tiles are baked four texels at a time across the
+// threads of a pool.
+namespace TerrainBaker
+{
+	/// Bakes the maps of a heightmap whose samples are cellSpacing apart.
+	/// Returns false if the heightmap is not open or the step is out of
+	/// range.
+	bool Bake(TiledHeightmap& heightmap, float cellSpacing, const TerrainBakeSettings& settings,
+		TerrainMaps& maps, ThreadPool* pool = nullptr);
+
+	/// Writes the maps as DDS files, skipping those with an empty path or
+	/// left out of the bake.  Returns false if a file cannot be written.
+	bool SaveDDS(const TerrainMaps& maps, const std::wstring& normalPath, const std::wstring& tangentPath,
+		const std::wstring& blendPath);
+}
@@ -0,0 +1,530 @@
+#include "TextureBenchmarks.h"
+#include "Benchmark.h"
+#include "DDSFile.h"
+#include "DDSTextureLoader.h"
+#include "PackedConvert.h"
+#include "TextureLoader.h"
+#include "ThreadPool.h"
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+	// Values that went through the vector path of a conversion and differ from
+	// the same values converted one at a time, through the scalar path.
+	template<class Src, class Dest>
+	UINT CountPathMismatches(const Src* src, const Dest* converted, UINT count,
+		void (*convert)(const Src*, Dest*, UINT, ThreadPool*))
+	{
+		UINT mismatches = 0;
+		for (UINT i = 0; i < count; ++i)
+		{
+			Dest one;
+			convert(&src[i], &one, 1, nullptr);
+			if (memcmp(&one, &converted[i], sizeof(Dest)) != 0)
+			{
+				++mismatches;
+			}
+		}
+		return mismatches;
+	}
+
+	// Sum of every byte of every subresource, to read the pixels the way an
+	// upload would.
+	UINT64 SumPixels(const DDSFile& dds)
+	{
+		UINT64 sum = 0;
+		for (UINT i = 0; i < dds.GetSubresourceCount(); ++i)
+		{
+			const DDSFile::Subresource& subresource = dds.GetSubresources()[i];
+			UINT64 size = (UINT64)subresource.SlicePitch * subresource.Depth;
+			for (UINT64 j = 0; j < size; ++j)
+			{
+				sum += subresource.Data[j];
+			}
+		}
+		return sum;
+	}
+
+	// Whether two parses of the same file came out the same, subresources at the
+	// same offsets into the file.
+	bool IsSameLayout(const DDSFile& a, const DDSFile& b)
+	{
+		if (a.GetDimension() != b.GetDimension() || a.GetFormat() != b.GetFormat() ||
+			a.GetWidth() != b.GetWidth() || a.GetHeight() != b.GetHeight() || a.GetDepth() != b.GetDepth() ||
+			a.GetArraySize() != b.GetArraySize() || a.GetMipCount() != b.GetMipCount() ||
+			a.IsCubeMap() != b.IsCubeMap() || a.GetAlphaMode() != b.GetAlphaMode() ||
+			a.GetSubresourceCount() != b.GetSubresourceCount())
+		{
+			return false;
+		}
+
+		for (UINT i = 0; i < a.GetSubresourceCount(); ++i)
+		{
+			const DDSFile::Subresource& x = a.GetSubresources()[i];
+			const DDSFile::Subresource& y = b.GetSubresources()[i];
+			if (x.Data - a.GetSubresources()[0].Data != y.Data - b.GetSubresources()[0].Data ||
+				x.RowPitch != y.RowPitch || x.SlicePitch != y.SlicePitch ||
+				x.Width != y.Width || x.Height != y.Height || x.Depth != y.Depth)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Paths of every DDS file in Textures.
+	void FindTextureFiles(std::vector<std::wstring>& paths)
+	{
+		paths.clear();
+		WIN32_FIND_DATAW found;
+		HANDLE find = FindFirstFileW(L"Textures/*.dds", &found);
+		if (find == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+		do
+		{
+			paths.push_back(std::wstring(L"Textures/") + found.cFileName);
+		} while (FindNextFileW(find, &found));
+		FindClose(find);
+	}
+
+	// Whether two views were made of the same kind of texture.
+	bool IsSameTexture(ID3D11ShaderResourceView* a, ID3D11ShaderResourceView* b)
+	{
+		if (a == nullptr || b == nullptr)
+		{
+			return a == b;
+		}
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC aDesc;
+		D3D11_SHADER_RESOURCE_VIEW_DESC bDesc;
+		a->GetDesc(&aDesc);
+		b->GetDesc(&bDesc);
+		return memcmp(&aDesc, &bDesc, sizeof(aDesc)) == 0;
+	}
+}
+
+void TextureBenchmarks::RunPackedConvert()
+{
+	// Heights and unit vector components, what the terrain and the bakers
+	// pack.
+	const UINT count = 1 << 24;
+	std::vector<float> src(count);
+	for (UINT i = 0; i < count; ++i)
+	{
+		src[i] = i % 2 == 0 ? MathHelper::RandF(-1000.0f, 1000.0f) : MathHelper::RandF(-1.0f, 1.0f);
+	}
+
+	std::vector<PackedConvert::HALF> halves(count);
+	std::vector<PackedConvert::HALF> oldHalves(count);
+	std::vector<float> floats(count);
+	std::vector<float> oldFloats(count);
+	std::vector<BYTE> bytes(count);
+	std::vector<BYTE> oldBytes(count);
+	std::vector<USHORT> words(count);
+	std::vector<signed char> signedBytes(count);
+	std::vector<short> signedWords(count);
+
+	ThreadPool pool;
+	auto rate = [count](double seconds)
+	{
+		return count / seconds / 1e6;
+	};
+
+	//
+	// Half floats and 8-bit UNORM against the loops they replace.
+	//
+	double start = Benchmark::Now();
+	for (UINT i = 0; i < count; ++i)
+	{
+		oldHalves[i] = DirectX::PackedVector::XMConvertFloatToHalf(src[i]);
+	}
+	double oldToHalfTime = Benchmark::Now() - start;
+
+	start = Benchmark::Now();
+	PackedConvert::FloatToHalf(&src[0], &halves[0], count);
+	double toHalfTime = Benchmark::Now() - start;
+
+	start = Benchmark::Now();
+	PackedConvert::FloatToHalf(&src[0], &halves[0], count, &pool);
+	double toHalfPoolTime = Benchmark::Now() - start;
+
+	UINT toHalfMismatches = 0;
+	for (UINT i = 0; i < count; ++i)
+	{
+		toHalfMismatches += halves[i] != oldHalves[i];
+	}
+
+	start = Benchmark::Now();
+	for (UINT i = 0; i < count; ++i)
+	{
+		oldFloats[i] = DirectX::PackedVector::XMConvertHalfToFloat(halves[i]);
+	}
+	double oldFromHalfTime = Benchmark::Now() - start;
+
+	start = Benchmark::Now();
+	PackedConvert::HalfToFloat(&halves[0], &floats[0], count);
+	double fromHalfTime = Benchmark::Now() - start;
+
+	start = Benchmark::Now();
+	PackedConvert::HalfToFloat(&halves[0], &floats[0], count, &pool);
+	double fromHalfPoolTime = Benchmark::Now() - start;
+
+	UINT fromHalfMismatches = 0;
+	for (UINT i = 0; i < count; ++i)
+	{
+		fromHalfMismatches += floats[i] != oldFloats[i];
+	}
+
+	// The loop the lightmap baker saved its texels with.
+	start = Benchmark::Now();
+	for (UINT i = 0; i < count; ++i)
+	{
+		oldBytes[i] = (BYTE)(MathHelper::Clamp(src[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+	double oldToUnorm8Time = Benchmark::Now() - start;
+
+	start = Benchmark::Now();
+	PackedConvert::FloatToUnorm8(&src[0], &bytes[0], count);
+	double toUnorm8Time = Benchmark::Now() - start;
+
+	start = Benchmark::Now();
+	PackedConvert::FloatToUnorm8(&src[0], &bytes[0], count, &pool);
+	double toUnorm8PoolTime = Benchmark::Now() - start;
+
+	UINT toUnorm8Mismatches = 0;
+	for (UINT i = 0; i < count; ++i)
+	{
+		toUnorm8Mismatches += bytes[i] != oldBytes[i];
+	}
+
+	std::wostringstream outs;
+	outs << L"Packed conversions: " << count << L" values, halves on " << (PackedConvert::HasF16C() ? L"F16C" : L"SSE2") <<
+		L", float->half: XMConvertFloatToHalf " << rate(oldToHalfTime) << L"M/s, bulk " << rate(toHalfTime) << L"M/s (" <<
+		oldToHalfTime / toHalfTime << L"x), on " << pool.ThreadCount() << L" threads " << rate(toHalfPoolTime) << L"M/s, " <<
+		toHalfMismatches << L" mismatches" <<
+		L", half->float: XMConvertHalfToFloat " << rate(oldFromHalfTime) << L"M/s, bulk " << rate(fromHalfTime) << L"M/s (" <<
+		oldFromHalfTime / fromHalfTime << L"x), on " << pool.ThreadCount() << L" threads " << rate(fromHalfPoolTime) << L"M/s, " <<
+		fromHalfMismatches << L" mismatches" <<
+		L", float->unorm8: loop " << rate(oldToUnorm8Time) << L"M/s, bulk " << rate(toUnorm8Time) << L"M/s (" <<
+		oldToUnorm8Time / toUnorm8Time << L"x), on " << pool.ThreadCount() << L" threads " << rate(toUnorm8PoolTime) << L"M/s, " <<
+		toUnorm8Mismatches << L" mismatches";
+	Benchmark::Report(outs.str());
+
+	//
+	// The other formats, and every path checked against the scalar one on
+	// the first million values.
+	//
+	const UINT checkCount = 1 << 20;
+	UINT pathMismatches =
+		CountPathMismatches(&src[0], &halves[0], checkCount, PackedConvert::FloatToHalf) +
+		CountPathMismatches(&halves[0], &floats[0], checkCount, PackedConvert::HalfToFloat) +
+		CountPathMismatches(&src[0], &bytes[0], checkCount, PackedConvert::FloatToUnorm8);
+
+	outs.str(L"");
+	outs << L"Packed conversions:";
+
+	start = Benchmark::Now();
+	PackedConvert::FloatToUnorm16(&src[0], &words[0], count);
+	outs << L" float->unorm16 " << rate(Benchmark::Now() - start) << L"M/s";
+	pathMismatches += CountPathMismatches(&src[0], &words[0], checkCount, PackedConvert::FloatToUnorm16);
+
+	start = Benchmark::Now();
+	PackedConvert::FloatToSnorm8(&src[0], &signedBytes[0], count);
+	outs << L", float->snorm8 " << rate(Benchmark::Now() - start) << L"M/s";
+	pathMismatches += CountPathMismatches(&src[0], &signedBytes[0], checkCount, PackedConvert::FloatToSnorm8);
+
+	start = Benchmark::Now();
+	PackedConvert::FloatToSnorm16(&src[0], &signedWords[0], count);
+	outs << L", float->snorm16 " << rate(Benchmark::Now() - start) << L"M/s";
+	pathMismatches += CountPathMismatches(&src[0], &signedWords[0], checkCount, PackedConvert::FloatToSnorm16);
+
+	start = Benchmark::Now();
+	PackedConvert::Unorm8ToFloat(&bytes[0], &floats[0], count);
+	outs << L", unorm8->float " << rate(Benchmark::Now() - start) << L"M/s";
+	pathMismatches += CountPathMismatches(&bytes[0], &floats[0], checkCount, PackedConvert::Unorm8ToFloat);
+
+	start = Benchmark::Now();
+	PackedConvert::Unorm16ToFloat(&words[0], &floats[0], count);
+	outs << L", unorm16->float " << rate(Benchmark::Now() - start) << L"M/s";
+	pathMismatches += CountPathMismatches(&words[0], &floats[0], checkCount, PackedConvert::Unorm16ToFloat);
+
+	start = Benchmark::Now();
+	PackedConvert::Snorm8ToFloat(&signedBytes[0], &floats[0], count);
+	outs << L", snorm8->float " << rate(Benchmark::Now() - start) << L"M/s";
+	pathMismatches += CountPathMismatches(&signedBytes[0], &floats[0], checkCount, PackedConvert::Snorm8ToFloat);
+
+	start = Benchmark::Now();
+	PackedConvert::Snorm16ToFloat(&signedWords[0], &floats[0], count);
+	outs << L", snorm16->float " << rate(Benchmark::Now() - start) << L"M/s";
+	pathMismatches += CountPathMismatches(&signedWords[0], &floats[0], checkCount, PackedConvert::Snorm16ToFloat);
+
+	// Every half but the NaNs, and every integer of the normalized formats
+	// but the most negative ones, come back as they were.
+	UINT roundTripErrors = 0;
+	for (UINT i = 0; i < 65536; ++i)
+	{
+		halves[i] = (PackedConvert::HALF)i;
+		words[i] = (USHORT)i;
+		signedWords[i] = (short)MathHelper::Max((int)i - 32768, -32767);
+		bytes[i] = (BYTE)i;
+		signedBytes[i] = (signed char)MathHelper::Max((int)(i % 256) - 128, -127);
+	}
+
+	PackedConvert::HalfToFloat(&halves[0], &floats[0], 65536);
+	PackedConvert::FloatToHalf(&floats[0], &oldHalves[0], 65536);
+	for (UINT i = 0; i < 65536; ++i)
+	{
+		bool isNaN = (i & 0x7c00) == 0x7c00 && (i & 0x3ff) != 0;
+		roundTripErrors += !isNaN && oldHalves[i] != halves[i];
+	}
+
+	std::vector<USHORT> wordsBack(65536);
+	PackedConvert::Unorm16ToFloat(&words[0], &floats[0], 65536);
+	PackedConvert::FloatToUnorm16(&floats[0], &wordsBack[0], 65536);
+	std::vector<short> signedWordsBack(65536);
+	PackedConvert::Snorm16ToFloat(&signedWords[0], &floats[0], 65536);
+	PackedConvert::FloatToSnorm16(&floats[0], &signedWordsBack[0], 65536);
+	std::vector<BYTE> bytesBack(256);
+	PackedConvert::Unorm8ToFloat(&bytes[0], &floats[0], 256);
+	PackedConvert::FloatToUnorm8(&floats[0], &bytesBack[0], 256);
+	std::vector<signed char> signedBytesBack(256);
+	PackedConvert::Snorm8ToFloat(&signedBytes[0], &floats[0], 256);
+	PackedConvert::FloatToSnorm8(&floats[0], &signedBytesBack[0], 256);
+	for (UINT i = 0; i < 65536; ++i)
+	{
+		roundTripErrors += wordsBack[i] != words[i];
+		roundTripErrors += signedWordsBack[i] != signedWords[i];
+	}
+	for (UINT i = 0; i < 256; ++i)
+	{
+		roundTripErrors += bytesBack[i] != bytes[i];
+		roundTripErrors += signedBytesBack[i] != signedBytes[i];
+	}
+
+	outs << L", " << pathMismatches << L" vector/scalar mismatches, " << roundTripErrors << L" round trip errors";
+	Benchmark::Report(outs.str());
+}
+
+void TextureBenchmarks::RunDDSParse()
+{
+	//
+	// Every DDS file in Textures, without a device: read into a heap buffer
+	// and parsed there, the way the texture loader used to, against mapped
+	// and parsed in place.  The pixels are then read once through the
+	// subresources, as an upload would.
+	//
+	std::vector<std::wstring> paths;
+	FindTextureFiles(paths);
+	if (paths.empty())
+	{
+		Benchmark::Report(L"DDS parsing: no DDS files in Textures.");
+		return;
+	}
+
+	const UINT passCount = 10;
+	UINT parsed = 0;
+	UINT failed = 0;
+	UINT mismatches = 0;
+	UINT64 fileBytes = 0;
+	UINT64 subresourceCount = 0;
+	double copyParseTime = 0.0;
+	double copyReadTime = 0.0;
+	double mapParseTime = 0.0;
+	double mapReadTime = 0.0;
+	std::vector<BYTE> buffer;
+	for (UINT pass = 0; pass < passCount; ++pass)
+	{
+		for (size_t i = 0; i < paths.size(); ++i)
+		{
+			double start = Benchmark::Now();
+			std::ifstream fin(paths[i], std::ios_base::binary | std::ios_base::ate);
+			UINT64 size = fin ? (UINT64)fin.tellg() : 0;
+			buffer.resize((size_t)MathHelper::Max(size, (UINT64)1));
+			fin.seekg(0);
+			fin.read((char*)&buffer[0], size);
+			DDSFile copied;
+			HRESULT copyResult = copied.Parse(&buffer[0], size);
+			double parseEnd = Benchmark::Now();
+			UINT64 copySum = SumPixels(copied);
+			double readEnd = Benchmark::Now();
+			copyParseTime += parseEnd - start;
+			copyReadTime += readEnd - start;
+
+			start = Benchmark::Now();
+			DDSFile mapped;
+			HRESULT mapResult = mapped.Open(paths[i]);
+			parseEnd = Benchmark::Now();
+			UINT64 mapSum = SumPixels(mapped);
+			readEnd = Benchmark::Now();
+			mapParseTime += parseEnd - start;
+			mapReadTime += readEnd - start;
+
+			if (pass == 0)
+			{
+				if (SUCCEEDED(mapResult))
+				{
+					++parsed;
+					fileBytes += size;
+					subresourceCount += mapped.GetSubresourceCount();
+				}
+				else
+				{
+					++failed;
+				}
+				if (copyResult != mapResult || copySum != mapSum || !IsSameLayout(copied, mapped))
+				{
+					++mismatches;
+				}
+			}
+		}
+	}
+
+	std::wostringstream outs;
+	outs << L"DDS parsing: " << parsed << L" files in Textures (" << fileBytes / (1024.0 * 1024.0) << L" MB, " <<
+		subresourceCount << L" subresources), " << failed << L" failed, read and parsed " <<
+		copyParseTime * 1000.0 / passCount << L" ms, mapped and parsed " << mapParseTime * 1000.0 / passCount <<
+		L" ms (" << copyParseTime / mapParseTime << L"x); with the pixels read once, " <<
+		copyReadTime * 1000.0 / passCount << L" ms against " << mapReadTime * 1000.0 / passCount << L" ms (" <<
+		copyReadTime / mapReadTime << L"x), " << mismatches << L" mismatches";
+	Benchmark::Report(outs.str());
+}
+
+void TextureBenchmarks::RunTextureLoading()
+{
+	//
+	// Every DDS file in Textures created on a device, one after another on
+	// this thread the way the demos start up, against queued on the texture
+	// loader: how long until the first frame could be drawn, with
+	// placeholders, how long until every texture is in, and how many frames
+	// of the per-frame budget that took.
+	//
+	std::vector<std::wstring> paths;
+	FindTextureFiles(paths);
+	if (paths.empty())
+	{
+		Benchmark::Report(L"Texture loading: no DDS files in Textures.");
+		return;
+	}
+
+	ID3D11Device* device = nullptr;
+	ID3D11DeviceContext* context = nullptr;
+	D3D_DRIVER_TYPE driverType = D3D_DRIVER_TYPE_HARDWARE;
+	HRESULT hr = D3D11CreateDevice(nullptr, driverType, 0, 0, nullptr, 0, D3D11_SDK_VERSION,
+		&device, nullptr, &context);
+	if (FAILED(hr))
+	{
+		driverType = D3D_DRIVER_TYPE_WARP;
+		hr = D3D11CreateDevice(nullptr, driverType, 0, 0, nullptr, 0, D3D11_SDK_VERSION,
+			&device, nullptr, &context);
+	}
+	if (FAILED(hr))
+	{
+		Benchmark::Report(L"Texture loading: no device.");
+		return;
+	}
+
+	const UINT passCount = 5;
+	const double frameBudget = 0.002;
+	std::vector<ID3D11ShaderResourceView*> serialViews(paths.size(), nullptr);
+	UINT failed = 0;
+	UINT mismatches = 0;
+	UINT frameCount = 0;
+	double serialTime = 0.0;
+	double queueTime = 0.0;
+	double finishTime = 0.0;
+	double framedTime = 0.0;
+	double worstFinalize = 0.0;
+
+	// The first serial pass only brings the files into the cache.
+	for (UINT pass = 0; pass <= passCount; ++pass)
+	{
+		double start = Benchmark::Now();
+		for (size_t i = 0; i < paths.size(); ++i)
+		{
+			ReleaseCOM(serialViews[i]);
+			DirectX::CreateDDSTextureFromFile(device, paths[i].c_str(), nullptr, &serialViews[i]);
+		}
+		if (pass > 0)
+		{
+			serialTime += Benchmark::Now() - start;
+		}
+	}
+
+	for (UINT pass = 0; pass < passCount; ++pass)
+	{
+		// Everything finished at once, as a loading screen would.
+		TextureLoader loader;
+		std::vector<TextureLoader::Handle> handles(paths.size());
+		double start = Benchmark::Now();
+		loader.Init(device);
+		for (size_t i = 0; i < paths.size(); ++i)
+		{
+			handles[i] = loader.Load(paths[i]);
+		}
+		double queueEnd = Benchmark::Now();
+		loader.FinishAll();
+		double finishEnd = Benchmark::Now();
+		queueTime += queueEnd - start;
+		finishTime += finishEnd - start;
+
+		if (pass == 0)
+		{
+			for (size_t i = 0; i < paths.size(); ++i)
+			{
+				bool ready = loader.GetState(handles[i]) == TextureLoader::StateReady;
+				if (!ready)
+				{
+					++failed;
+				}
+				if (ready != (serialViews[i] != nullptr) ||
+					(ready && !IsSameTexture(loader.GetView(handles[i]), serialViews[i])))
+				{
+					++mismatches;
+				}
+			}
+		}
+
+		// Finished a frame's budget at a time, as the demos do.
+		loader.Init(device);
+		start = Benchmark::Now();
+		for (size_t i = 0; i < paths.size(); ++i)
+		{
+			loader.Load(paths[i]);
+		}
+		while (loader.PendingCount() > 0)
+		{
+			double finalizeStart = Benchmark::Now();
+			if (loader.Finalize(frameBudget) > 0)
+			{
+				worstFinalize = MathHelper::Max(worstFinalize, Benchmark::Now() - finalizeStart);
+				++frameCount;
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+		framedTime += Benchmark::Now() - start;
+	}
+
+	for (size_t i = 0; i < serialViews.size(); ++i)
+	{
+		ReleaseCOM(serialViews[i]);
+	}
+	ReleaseCOM(context);
+	ReleaseCOM(device);
+
+	std::wostringstream outs;
+	outs << L"Texture loading: " << paths.size() << L" files in Textures on a " <<
+		(driverType == D3D_DRIVER_TYPE_HARDWARE ? L"hardware" : L"WARP") << L" device, " << failed <<
+		L" failed, serial " << serialTime * 1000.0 / passCount << L" ms, on " << ThreadPool::HardwareThreadCount() <<
+		L" threads queued in " << queueTime * 1000.0 / passCount << L" ms and all in " <<
+		finishTime * 1000.0 / passCount << L" ms (" << serialTime / finishTime << L"x); at " <<
+		frameBudget * 1000.0 << L" ms a frame all in " << framedTime * 1000.0 / passCount << L" ms over " <<
+		(double)frameCount / passCount << L" frames, worst frame " << worstFinalize * 1000.0 << L" ms, " <<
+		mismatches << L" mismatches";
+	Benchmark::Report(outs.str());
+}
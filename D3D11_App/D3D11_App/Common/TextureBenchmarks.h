@@ -0,0 +1,17 @@
+#pragma once
+
+// Benchmarks of the Common code that gets textures onto the GPU, run by the
+// demos that load textures when launched with "-bench".
+namespace TextureBenchmarks
+{
+	// The bulk conversions of PackedConvert against the loops they replace.
+	void RunPackedConvert();
+
+	// Every DDS file in Textures read and parsed against mapped and parsed in
+	// place.
+	void RunDDSParse();
+
+	// The same files created one after another against queued on
+	// TextureLoader, finished all at once and a frame's budget at a time.
+	void RunTextureLoading();
+}
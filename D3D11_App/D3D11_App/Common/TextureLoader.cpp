@@ -0,0 +1,343 @@
+#include "TextureLoader.h"
+#include "Benchmark.h"
+#include "DDSTextureLoader.h"
+#include "ThreadPool.h"
+
+namespace
+{
+	// Reads a byte of every page of the pixels, so that the file is paged in
+	// on the loading thread rather than while its texture is created.
+	void TouchPages(const DDSFile& file)
+	{
+		const UINT64 PageSize = 4096;
+
+		volatile BYTE sink = 0;
+		for (UINT i = 0; i < file.GetSubresourceCount(); ++i)
+		{
+			const DDSFile::Subresource& subresource = file.GetSubresources()[i];
+			UINT64 size = (UINT64)subresource.SlicePitch * subresource.Depth;
+			for (UINT64 j = 0; j < size; j += PageSize)
+			{
+				sink += subresource.Data[j];
+			}
+		}
+	}
+}
+
+TextureLoader::TextureLoader()
+	: m_Device(nullptr)
+	, m_PendingCount(0)
+	, m_QueueCapacity(DefaultQueueCapacity)
+	, m_Quit(false)
+{
+	for (ID3D11ShaderResourceView*& placeholder : m_Placeholders)
+	{
+		placeholder = nullptr;
+	}
+}
+
+TextureLoader::~TextureLoader()
+{
+	Shutdown();
+}
+
+bool TextureLoader::Init(ID3D11Device* device, UINT threadCount, UINT queueCapacity)
+{
+	Shutdown();
+
+	m_Device = device;
+	if (FAILED(CreatePlaceholders()))
+	{
+		Shutdown();
+		return false;
+	}
+
+	m_Pool.reset(new ThreadPool(threadCount));
+	m_QueueCapacity = MathHelper::Max(queueCapacity, 1u);
+	m_Quit = false;
+
+	m_Thread = std::thread(&TextureLoader::LoaderMain, this);
+	return true;
+}
+
+void TextureLoader::Shutdown()
+{
+	if (m_Thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Quit = true;
+		}
+		m_RequestReady.notify_all();
+		m_QueueSpace.notify_all();
+		m_Thread.join();
+	}
+	m_Pool.reset();
+
+	m_Requests.clear();
+	m_Parsed.clear();
+
+	for (Texture& texture : m_Textures)
+	{
+		ReleaseCOM(texture.View);
+	}
+	m_Textures.clear();
+	m_Handles.clear();
+	m_PendingCount = 0;
+
+	for (ID3D11ShaderResourceView*& placeholder : m_Placeholders)
+	{
+		ReleaseCOM(placeholder);
+	}
+	m_Device = nullptr;
+}
+
+TextureLoader::Handle TextureLoader::Load(const std::wstring& path, Placeholder placeholder)
+{
+	std::map<std::wstring, Handle>::const_iterator found = m_Handles.find(path);
+	if (found != m_Handles.end())
+	{
+		return found->second;
+	}
+
+	Handle handle = (Handle)m_Textures.size();
+	Texture texture;
+	texture.Path = path;
+	texture.PlaceholderKind = placeholder;
+	texture.TextureState = StatePending;
+	texture.Result = S_OK;
+	texture.View = nullptr;
+	m_Textures.push_back(texture);
+	m_Handles[path] = handle;
+	++m_PendingCount;
+
+	Request request;
+	request.TextureHandle = handle;
+	request.Path = path;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Requests.push_back(request);
+	}
+	m_RequestReady.notify_one();
+
+	return handle;
+}
+
+UINT TextureLoader::Finalize(double budget)
+{
+	double start = Benchmark::Now();
+	UINT finished = 0;
+	while (FinalizeOne())
+	{
+		++finished;
+		if (Benchmark::Now() - start >= budget)
+		{
+			break;
+		}
+	}
+	return finished;
+}
+
+void TextureLoader::FinishAll()
+{
+	while (m_PendingCount > 0)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_ParsedReady.wait(lock, [this]()
+			{
+				return !m_Parsed.empty();
+			});
+		}
+
+		while (FinalizeOne())
+		{
+		}
+	}
+}
+
+ID3D11ShaderResourceView* TextureLoader::GetView(Handle handle) const
+{
+	const Texture& texture = m_Textures[handle];
+	return texture.View ? texture.View : m_Placeholders[texture.PlaceholderKind];
+}
+
+TextureLoader::State TextureLoader::GetState(Handle handle) const
+{
+	return m_Textures[handle].TextureState;
+}
+
+HRESULT TextureLoader::GetResult(Handle handle) const
+{
+	return m_Textures[handle].Result;
+}
+
+UINT TextureLoader::PendingCount() const
+{
+	return m_PendingCount;
+}
+
+void TextureLoader::LoaderMain()
+{
+	std::vector<Request> batch;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_RequestReady.wait(lock, [this]()
+			{
+				return m_Quit || !m_Requests.empty();
+			});
+			if (m_Quit)
+			{
+				return;
+			}
+
+			batch.swap(m_Requests);
+		}
+
+		// One file per range, so that a large file doesn't hold up the
+		// small ones queued behind it on the same thread.
+		m_Pool->ParallelFor((UINT)batch.size(), 1, [this, &batch](UINT begin, UINT end)
+		{
+			for (UINT i = begin; i < end; ++i)
+			{
+				LoadFile(batch[i]);
+			}
+		});
+		batch.clear();
+	}
+}
+
+void TextureLoader::LoadFile(const Request& request)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_Quit)
+		{
+			return;
+		}
+	}
+
+	Parsed parsed;
+	parsed.TextureHandle = request.TextureHandle;
+	parsed.File.reset(new DDSFile());
+	parsed.Result = parsed.File->Open(request.Path);
+	if (SUCCEEDED(parsed.Result))
+	{
+		TouchPages(*parsed.File);
+	}
+	else
+	{
+		parsed.File.reset();
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_QueueSpace.wait(lock, [this]()
+		{
+			return m_Quit || m_Parsed.size() < m_QueueCapacity;
+		});
+		if (m_Quit)
+		{
+			return;
+		}
+
+		m_Parsed.push_back(std::move(parsed));
+	}
+	m_ParsedReady.notify_one();
+}
+
+bool TextureLoader::FinalizeOne()
+{
+	Parsed parsed;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_Parsed.empty())
+		{
+			return false;
+		}
+
+		parsed = std::move(m_Parsed.front());
+		m_Parsed.pop_front();
+	}
+	m_QueueSpace.notify_one();
+
+	Texture& texture = m_Textures[parsed.TextureHandle];
+	HRESULT hr = parsed.Result;
+	if (SUCCEEDED(hr))
+	{
+		hr = DirectX::CreateDDSTextureFromDDSFile(m_Device, *parsed.File, nullptr, &texture.View);
+	}
+	texture.Result = hr;
+	texture.TextureState = SUCCEEDED(hr) ? StateReady : StateFailed;
+	--m_PendingCount;
+
+	// Unmaps the file.
+	parsed.File.reset();
+	return true;
+}
+
+HRESULT TextureLoader::CreatePlaceholders()
+{
+	// One texel each, as R8G8B8A8: mid grey, a normal of (0, 0, 1) and a
+	// mid grey cube.
+	const UINT colors[] = { 0xff808080, 0xffff8080, 0xff808080 };
+
+	for (UINT i = 0; i < ARRAYSIZE(m_Placeholders); ++i)
+	{
+		bool cube = i == PlaceholderCube;
+
+		D3D11_TEXTURE2D_DESC desc;
+		desc.Width = 1;
+		desc.Height = 1;
+		desc.MipLevels = 1;
+		desc.ArraySize = cube ? 6 : 1;
+		desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		desc.SampleDesc.Count = 1;
+		desc.SampleDesc.Quality = 0;
+		desc.Usage = D3D11_USAGE_IMMUTABLE;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = cube ? D3D11_RESOURCE_MISC_TEXTURECUBE : 0;
+
+		D3D11_SUBRESOURCE_DATA data[6];
+		for (D3D11_SUBRESOURCE_DATA& face : data)
+		{
+			face.pSysMem = &colors[i];
+			face.SysMemPitch = sizeof(UINT);
+			face.SysMemSlicePitch = sizeof(UINT);
+		}
+
+		ID3D11Texture2D* texture = nullptr;
+		HRESULT hr = m_Device->CreateTexture2D(&desc, data, &texture);
+		if (FAILED(hr))
+		{
+			return hr;
+		}
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc;
+		viewDesc.Format = desc.Format;
+		if (cube)
+		{
+			viewDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE;
+			viewDesc.TextureCube.MostDetailedMip = 0;
+			viewDesc.TextureCube.MipLevels = 1;
+		}
+		else
+		{
+			viewDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+			viewDesc.Texture2D.MostDetailedMip = 0;
+			viewDesc.Texture2D.MipLevels = 1;
+		}
+
+		hr = m_Device->CreateShaderResourceView(texture, &viewDesc, &m_Placeholders[i]);
+		ReleaseCOM(texture);
+		if (FAILED(hr))
+		{
+			return hr;
+		}
+	}
+
+	return S_OK;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "d3dUtil.h"
+#include "DDSFile.h"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool;
+
+// Loads DDS textures in the background.  Load only queues the file and
+// returns a handle; a loading thread hands the queued files out in batches
+// to the threads of its pool, which map, parse and page in each one.  The
+// parsed files wait in a queue of bounded length, so that no more than that
+// many are held in memory, until the render thread creates their textures
+// in Finalize, as many as fit in the time it is given each frame.  Until
+// then, and for good if the file cannot be loaded, the handle stands for a
+// 1x1 placeholder of the kind asked for.
+//
+// Everything but the loading itself happens on the thread calling Init,
+// which has to be the one using the immediate context.
+class TextureLoader
+{
+public:
+	typedef UINT Handle;
+
+	// What to show before a texture is loaded: a mid grey texture, a flat
+	// normal map pointing up the z axis, or a mid grey cube map.
+	enum Placeholder
+	{
+		PlaceholderDiffuse,
+		PlaceholderNormal,
+		PlaceholderCube
+	};
+
+	enum State
+	{
+		StatePending,
+		StateReady,
+		StateFailed
+	};
+
+	TextureLoader();
+	~TextureLoader();
+
+	// Creates the placeholders and starts the loading threads.  Zero threads
+	// uses one per hardware thread.
+	bool Init(ID3D11Device* device, UINT threadCount = 0, UINT queueCapacity = DefaultQueueCapacity);
+
+	// Stops the loading threads once their current files are done and
+	// releases every texture.
+	void Shutdown();
+
+	// Queues a DDS file for loading.  A file queued before gets the handle
+	// it got then.
+	Handle Load(const std::wstring& path, Placeholder placeholder = PlaceholderDiffuse);
+
+	// Creates the textures of the parsed files waiting in the queue until
+	// it is empty or budget seconds have passed; at least one texture is
+	// created if one is waiting.  Returns the number of handles finished.
+	UINT Finalize(double budget);
+
+	// Waits for every queued file and creates its texture.
+	void FinishAll();
+
+	// The view of the texture, or the placeholder until it is ready.
+	ID3D11ShaderResourceView* GetView(Handle handle) const;
+	State GetState(Handle handle) const;
+
+	// Why a failed texture could not be loaded.
+	HRESULT GetResult(Handle handle) const;
+
+	// Handles not finished yet.
+	UINT PendingCount() const;
+
+	static const UINT DefaultQueueCapacity = 8;
+
+private:
+	TextureLoader(const TextureLoader& rhs);
+	TextureLoader& operator=(const TextureLoader& rhs);
+
+	struct Texture
+	{
+		std::wstring Path;
+		Placeholder PlaceholderKind;
+		State TextureState;
+		HRESULT Result;
+		ID3D11ShaderResourceView* View;
+	};
+
+	struct Request
+	{
+		Handle TextureHandle;
+		std::wstring Path;
+	};
+
+	// A file mapped and parsed on a loading thread, or why it couldn't be.
+	struct Parsed
+	{
+		Handle TextureHandle;
+		HRESULT Result;
+		std::unique_ptr<DDSFile> File;
+	};
+
+	void LoaderMain();
+
+	// Runs on the threads of the pool.  Waits while the queue is full.
+	void LoadFile(const Request& request);
+
+	// Creates the texture of the file at the front of the queue, if any.
+	bool FinalizeOne();
+	HRESULT CreatePlaceholders();
+
+private:
+	ID3D11Device* m_Device;
+	std::unique_ptr<ThreadPool> m_Pool;
+	ID3D11ShaderResourceView* m_Placeholders[3];
+
+	// Used only by the render thread.
+	std::vector<Texture> m_Textures;
+	std::map<std::wstring, Handle> m_Handles;
+	UINT m_PendingCount;
+
+	std::thread m_Thread;
+	std::mutex m_Mutex;
+	std::condition_variable m_RequestReady;
+	std::condition_variable m_ParsedReady;
+	std::condition_variable m_QueueSpace;
+	std::vector<Request> m_Requests;
+	std::deque<Parsed> m_Parsed;
+	UINT m_QueueCapacity;
+	bool m_Quit;
+};
@@ -0,0 +1,177 @@
+#include "ThreadPool.h"
+#include "MathHelper.h"
+
+ThreadPool::ThreadPool(UINT threadCount)
+	: m_Body(nullptr)
+	, m_Generation(0)
+	, m_Remaining(0)
+	, m_Quit(false)
+{
+	if (threadCount == 0)
+	{
+		threadCount = HardwareThreadCount();
+	}
+
+	for (UINT i = 0; i < threadCount; ++i)
+	{
+		m_Queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+	}
+
+	for (UINT i = 1; i < threadCount; ++i)
+	{
+		m_Threads.push_back(std::thread(&ThreadPool::WorkerMain, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Quit = true;
+	}
+	m_WorkReady.notify_all();
+
+	for (UINT i = 0; i < m_Threads.size(); ++i)
+	{
+		m_Threads[i].join();
+	}
+}
+
+UINT ThreadPool::ThreadCount() const
+{
+	return (UINT)m_Queues.size();
+}
+
+void ThreadPool::ParallelFor(UINT count, UINT grainSize, const RangeFunc& body)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	grainSize = grainSize > 0 ? grainSize : 1;
+	UINT rangeCount = (count + grainSize - 1) / grainSize;
+
+	// Without helpers there is nothing to distribute.
+	if (m_Threads.empty() || rangeCount == 1)
+	{
+		for (UINT begin = 0; begin < count; begin += grainSize)
+		{
+			body(begin, MathHelper::Min(begin + grainSize, count));
+		}
+		return;
+	}
+
+	// Publish the body before any range becomes visible; a worker still
+	// looking for work from the previous loop may pick one up right away.
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Body = &body;
+		m_Remaining = rangeCount;
+	}
+
+	// Give every thread a contiguous share of the ranges to start with.
+	UINT queueCount = (UINT)m_Queues.size();
+	for (UINT q = 0; q < queueCount; ++q)
+	{
+		UINT first = (UINT)((UINT64)rangeCount * q / queueCount);
+		UINT last = (UINT)((UINT64)rangeCount * (q + 1) / queueCount);
+
+		std::lock_guard<std::mutex> lock(m_Queues[q]->Mutex);
+		for (UINT r = first; r < last; ++r)
+		{
+			Range range;
+			range.Begin = r * grainSize;
+			range.End = MathHelper::Min(range.Begin + grainSize, count);
+			m_Queues[q]->Ranges.push_back(range);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		++m_Generation;
+	}
+	m_WorkReady.notify_all();
+
+	while (RunOne(0))
+	{
+	}
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_WorkDone.wait(lock, [this] { return m_Remaining == 0; });
+	m_Body = nullptr;
+}
+
+UINT ThreadPool::HardwareThreadCount()
+{
+	UINT count = std::thread::hardware_concurrency();
+	return count > 0 ? count : 1;
+}
+
+void ThreadPool::WorkerMain(UINT worker)
+{
+	UINT generation = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_WorkReady.wait(lock, [&] { return m_Quit || m_Generation != generation; });
+			if (m_Quit)
+			{
+				return;
+			}
+			generation = m_Generation;
+		}
+
+		while (RunOne(worker))
+		{
+		}
+	}
+}
+
+bool ThreadPool::RunOne(UINT worker)
+{
+	UINT queueCount = (UINT)m_Queues.size();
+
+	Range range;
+	bool found = false;
+	for (UINT i = 0; i < queueCount && !found; ++i)
+	{
+		// The owner takes ranges from the front, thieves from the back.
+		UINT q = (worker + i) % queueCount;
+		WorkQueue& queue = *m_Queues[q];
+
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		if (queue.Ranges.empty())
+		{
+			continue;
+		}
+
+		if (i == 0)
+		{
+			range = queue.Ranges.front();
+			queue.Ranges.pop_front();
+		}
+		else
+		{
+			range = queue.Ranges.back();
+			queue.Ranges.pop_back();
+		}
+		found = true;
+	}
+
+	if (!found)
+	{
+		return false;
+	}
+
+	(*m_Body)(range.Begin, range.End);
+
+	if (--m_Remaining == 0)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_WorkDone.notify_all();
+	}
+
+	return true;
+}
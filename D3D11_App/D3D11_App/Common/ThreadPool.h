@@ -0,0 +1,68 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data parallel loops.  Every thread owns a
+// queue of index ranges; it works through its own queue first and then steals
+// from the others, so uneven ranges still keep all threads busy.
+class ThreadPool
+{
+public:
+	typedef std::function<void(UINT begin, UINT end)> RangeFunc;
+
+	// The thread count includes the calling thread, which takes part in every
+	// loop.  Zero uses one thread per hardware thread.
+	explicit ThreadPool(UINT threadCount = 0);
+	~ThreadPool();
+
+	UINT ThreadCount() const;
+
+	/// Calls body on ranges of at most grainSize indices covering [0, count)
+	/// and returns once all of them are done.  Loops must not be nested or
+	/// started from more than one thread at a time.
+	void ParallelFor(UINT count, UINT grainSize, const RangeFunc& body);
+
+	static UINT HardwareThreadCount();
+
+private:
+	struct Range
+	{
+		UINT Begin;
+		UINT End;
+	};
+
+	struct WorkQueue
+	{
+		std::mutex Mutex;
+		std::deque<Range> Ranges;
+	};
+
+	void WorkerMain(UINT worker);
+
+	// Runs one range from the worker's own queue or one stolen from another.
+	// Returns false once every queue is empty.
+	bool RunOne(UINT worker);
+
+private:
+	std::vector<std::thread> m_Threads;
+
+	// Queue 0 belongs to the thread calling ParallelFor.
+	std::vector<std::unique_ptr<WorkQueue>> m_Queues;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_WorkReady;
+	std::condition_variable m_WorkDone;
+
+	const RangeFunc* m_Body;
+	UINT m_Generation;
+	std::atomic<UINT> m_Remaining;
+	bool m_Quit;
+};
@@ -0,0 +1,1024 @@
+#include "TiledHeightmap.h"
+#include <algorithm>
+#include <intrin.h>
+
+namespace
+{
+	const UINT FileMagic = 0x504d4854; // "THMP"
+	const UINT FileVersion = 2;
+
+	// Float tiles start on page boundaries so that reading one touches no
+	// page of another.  Compressed tiles are packed one after the other.
+	const UINT TileAlignment = 4096;
+	const UINT IndexAlignment = 16;
+
+	// A compressed row starts with its Rice parameter.  A residual whose
+	// quotient would be EscapeQuotient or more is written as that quotient
+	// followed by all 32 bits of the residual.
+	const UINT RiceParamBits = 5;
+	const UINT MaxRiceParam = 31;
+	const UINT EscapeQuotient = 24;
+
+	const UINT TileSamples = TiledHeightmap::TileCells + 1;
+
+	// Marks the ends of the slot list and tiles that are not resident.
+	const UINT NoSlot = 0xffffffff;
+
+	UINT64 AlignUp(UINT64 value, UINT64 alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	bool WriteBytes(HANDLE file, const void* data, UINT64 size)
+	{
+		const BYTE* bytes = (const BYTE*)data;
+		while (size > 0)
+		{
+			DWORD chunk = (DWORD)MathHelper::Min<UINT64>(size, 1 << 30);
+			DWORD written = 0;
+			if (!WriteFile(file, bytes, chunk, &written, nullptr) || written != chunk)
+			{
+				return false;
+			}
+			bytes += chunk;
+			size -= chunk;
+		}
+		return true;
+	}
+
+	// Signed residuals folded into unsigned ones, small magnitudes first.
+	UINT ZigZag(int v)
+	{
+		return ((UINT)v << 1) ^ (UINT)(v >> 31);
+	}
+
+	int UnZigZag(UINT u)
+	{
+		return (int)(u >> 1) ^ -(int)(u & 1);
+	}
+
+	// The height a compressed sample decodes to.  Write rounds the heights
+	// with the same expression, so that decoding gives them back exactly.
+	float StepHeight(int steps, float base, float step)
+	{
+		return base + (float)steps * step;
+	}
+
+	int CountSteps(float h, float base, float step)
+	{
+		double steps = floor(((double)h - base) / step + 0.5);
+		return (int)MathHelper::Clamp(steps, -(double)TiledHeightmap::MaxStepCount, (double)TiledHeightmap::MaxStepCount);
+	}
+
+	// Bits, least significant first.
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(std::vector<BYTE>& out)
+			: m_Out(out)
+			, m_Bits(0)
+			, m_Count(0)
+		{
+
+		}
+
+		// value must fit in count bits, and count be 32 at most.
+		void Write(UINT value, UINT count)
+		{
+			m_Bits |= (UINT64)value << m_Count;
+			m_Count += count;
+			while (m_Count >= 8)
+			{
+				m_Out.push_back((BYTE)m_Bits);
+				m_Bits >>= 8;
+				m_Count -= 8;
+			}
+		}
+
+		void Flush()
+		{
+			if (m_Count > 0)
+			{
+				m_Out.push_back((BYTE)m_Bits);
+				m_Bits = 0;
+				m_Count = 0;
+			}
+		}
+
+	private:
+		std::vector<BYTE>& m_Out;
+		UINT64 m_Bits;
+		UINT m_Count;
+	};
+
+	class BitReader
+	{
+	public:
+		BitReader(const BYTE* data, UINT size)
+			: m_Next(data)
+			, m_End(data + size)
+			, m_Bits(0)
+			, m_Count(0)
+		{
+
+		}
+
+		// Makes at least 56 bits available.  Bits past the end of the data
+		// read as zero.
+		void Refill()
+		{
+			if (m_End - m_Next >= 8)
+			{
+				// Loads eight bytes and keeps the whole ones that fit; the
+				// bits of the next byte loaded above them are loaded again
+				// into the same place by the next refill.
+				UINT64 bytes;
+				memcpy(&bytes, m_Next, sizeof(bytes));
+				m_Bits |= bytes << m_Count;
+				m_Next += (63 - m_Count) >> 3;
+				m_Count |= 56;
+			}
+			else
+			{
+				while (m_Count <= 56)
+				{
+					UINT64 byte = m_Next < m_End ? *m_Next++ : 0;
+					m_Bits |= byte << m_Count;
+					m_Count += 8;
+				}
+			}
+		}
+
+		// Zero bits before the next one bit, 64 if there is none.
+		UINT CountZeros() const
+		{
+			unsigned long index;
+			return _BitScanForward64(&index, m_Bits) ? (UINT)index : 64;
+		}
+
+		UINT64 Peek() const
+		{
+			return m_Bits;
+		}
+
+		// count must be 32 at most and no more than the bits available.
+		UINT Read(UINT count)
+		{
+			UINT value = (UINT)(m_Bits & ((1ull << count) - 1));
+			Skip(count);
+			return value;
+		}
+
+		void Skip(UINT count)
+		{
+			m_Bits >>= count;
+			m_Count -= count;
+		}
+
+	private:
+		const BYTE* m_Next;
+		const BYTE* m_End;
+		UINT64 m_Bits;
+		UINT m_Count;
+	};
+
+	// Bits Rice coding residuals with parameter k takes.
+	UINT64 CalcRiceBits(const UINT* residuals, UINT count, UINT k)
+	{
+		UINT64 bits = 0;
+		for (UINT i = 0; i < count; ++i)
+		{
+			UINT quotient = residuals[i] >> k;
+			bits += quotient < EscapeQuotient ? quotient + 1 + k : EscapeQuotient + 1 + 32;
+		}
+		return bits;
+	}
+
+	// Compresses the steps of the samples of a tile: every row is turned
+	// into residuals against the row above and Rice coded with the parameter
+	// that makes it smallest.
+	void EncodeTile(const int* steps, std::vector<BYTE>& out)
+	{
+		out.clear();
+		BitWriter writer(out);
+
+		UINT residuals[TileSamples];
+		for (UINT y = 0; y < TileSamples; ++y)
+		{
+			const int* row = steps + y * TileSamples;
+			if (y == 0)
+			{
+				residuals[0] = ZigZag(row[0]);
+				for (UINT x = 1; x < TileSamples; ++x)
+				{
+					residuals[x] = ZigZag(row[x] - row[x - 1]);
+				}
+			}
+			else
+			{
+				const int* above = row - TileSamples;
+				residuals[0] = ZigZag(row[0] - above[0]);
+				for (UINT x = 1; x < TileSamples; ++x)
+				{
+					residuals[x] = ZigZag((row[x] - row[x - 1]) - (above[x] - above[x - 1]));
+				}
+			}
+
+			// The parameter near log2 of the mean residual, or its neighbours.
+			UINT64 sum = 0;
+			for (UINT x = 0; x < TileSamples; ++x)
+			{
+				sum += residuals[x];
+			}
+			UINT k = 0;
+			while (k < MaxRiceParam && ((UINT64)TileSamples << (k + 1)) <= sum)
+			{
+				++k;
+			}
+
+			UINT bestK = k;
+			UINT64 bestBits = CalcRiceBits(residuals, TileSamples, k);
+			UINT neighbours[2] = { k > 0 ? k - 1 : k, MathHelper::Min(k + 1, MaxRiceParam) };
+			for (UINT i = 0; i < 2; ++i)
+			{
+				UINT64 bits = CalcRiceBits(residuals, TileSamples, neighbours[i]);
+				if (bits < bestBits)
+				{
+					bestK = neighbours[i];
+					bestBits = bits;
+				}
+			}
+
+			writer.Write(bestK, RiceParamBits);
+			for (UINT x = 0; x < TileSamples; ++x)
+			{
+				UINT quotient = residuals[x] >> bestK;
+				if (quotient < EscapeQuotient)
+				{
+					writer.Write(1u << quotient, quotient + 1);
+					if (bestK > 0)
+					{
+						writer.Write(residuals[x] & ((1u << bestK) - 1), bestK);
+					}
+				}
+				else
+				{
+					writer.Write(1u << EscapeQuotient, EscapeQuotient + 1);
+					writer.Write(residuals[x], 32);
+				}
+			}
+		}
+
+		writer.Flush();
+	}
+
+	// Decodes what EncodeTile wrote into the heights of the samples.  Corrupt
+	// data decodes to wrong heights but never reads or writes out of bounds.
+	void DecodeTile(const BYTE* data, UINT size, float base, float step, float* samples)
+	{
+		BitReader reader(data, size);
+
+		int rows[2][TileSamples];
+		int deltas[TileSamples];
+		for (UINT y = 0; y < TileSamples; ++y)
+		{
+			reader.Refill();
+			UINT k = reader.Read(RiceParamBits);
+			UINT remainderMask = (1u << k) - 1;
+
+			// The residuals of the row first, then the steps from them.
+			for (UINT x = 0; x < TileSamples; ++x)
+			{
+				reader.Refill();
+				UINT quotient = reader.CountZeros();
+				UINT residual;
+				if (quotient < EscapeQuotient)
+				{
+					UINT remainder = (UINT)(reader.Peek() >> (quotient + 1)) & remainderMask;
+					residual = (quotient << k) | remainder;
+					reader.Skip(quotient + 1 + k);
+				}
+				else
+				{
+					reader.Skip(EscapeQuotient + 1);
+					reader.Refill();
+					residual = reader.Read(32);
+				}
+				deltas[x] = UnZigZag(residual);
+			}
+
+			// The first row sums its deltas; the others sum their differences
+			// to the row above.
+			int* row = rows[y & 1];
+			const int* above = rows[(y & 1) ^ 1];
+			float* dest = samples + y * TileSamples;
+			int sum = 0;
+			if (y == 0)
+			{
+				for (UINT x = 0; x < TileSamples; ++x)
+				{
+					sum += deltas[x];
+					row[x] = sum;
+				}
+			}
+			else
+			{
+				for (UINT x = 0; x < TileSamples; ++x)
+				{
+					sum += deltas[x];
+					row[x] = above[x] + sum;
+				}
+			}
+
+			for (UINT x = 0; x < TileSamples; ++x)
+			{
+				dest[x] = StepHeight(row[x], base, step);
+			}
+		}
+	}
+
+	struct TileDistance
+	{
+		float Distance;
+		UINT Tile;
+
+		bool operator<(const TileDistance& rhs) const
+		{
+			return Distance < rhs.Distance;
+		}
+	};
+}
+
+TiledHeightmap::TiledHeightmap()
+	: m_Header(nullptr)
+	, m_Index(nullptr)
+	, m_PatchBounds(nullptr)
+	, m_SlotCapacity(0)
+	, m_Head(NoSlot)
+	, m_Tail(NoSlot)
+	, m_PageInCount(0)
+{
+
+}
+
+bool TiledHeightmap::Write(const std::wstring& path, UINT width, UINT height, UINT patchCells,
+	UINT64 key, const RowFunc& readRow, float heightBase, float heightStep)
+{
+	if (width < 2 || height < 2 || patchCells == 0 || TileCells % patchCells != 0 || !(heightStep >= 0.0f))
+	{
+		return false;
+	}
+	bool compressed = heightStep > 0.0f;
+
+	Header header;
+	header.Magic = FileMagic;
+	header.Version = FileVersion;
+	header.Key = key;
+	header.Width = width;
+	header.Height = height;
+	header.TileCells = TileCells;
+	header.TilesX = (width - 2) / TileCells + 1;
+	header.TilesY = (height - 2) / TileCells + 1;
+	header.PatchCells = patchCells;
+	header.PatchesX = (width - 2) / patchCells + 1;
+	header.PatchesY = (height - 2) / patchCells + 1;
+	header.HeightBase = compressed ? heightBase : 0.0f;
+	header.HeightStep = heightStep;
+
+	// The offsets are filled in once the tiles are written, and the header
+	// written again.
+	header.IndexOffset = 0;
+	header.PatchBoundsOffset = 0;
+
+	UINT tileCount = header.TilesX * header.TilesY;
+	UINT64 tileSize = (UINT64)TileSamples * TileSamples * sizeof(float);
+	UINT64 tileStride = AlignUp(tileSize, TileAlignment);
+	UINT64 dataOffset = AlignUp(sizeof(Header), TileAlignment);
+
+	std::wstring tempPath = path + L".tmp";
+	HANDLE file = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	std::vector<BYTE> headerBlock((size_t)dataOffset, 0);
+	memcpy(&headerBlock[0], &header, sizeof(header));
+	bool ok = WriteBytes(file, &headerBlock[0], dataOffset);
+
+	// One row of tiles: rows [ty * TileCells, ty * TileCells + TileCells] of
+	// the heightmap, with the rows and columns past its edge repeating the last.
+	std::vector<float> band((size_t)TileSamples * width);
+	std::vector<float> tile((size_t)TileSamples * TileSamples);
+	std::vector<BYTE> tilePadding((size_t)(tileStride - tileSize), 0);
+
+	// Compressed files keep the steps of the rounded heights beside them.
+	std::vector<int> stepBand(compressed ? band.size() : 0);
+	std::vector<int> tileSteps(compressed ? tile.size() : 0);
+	std::vector<BYTE> encoded;
+	UINT64 offset = dataOffset;
+
+	std::vector<TileEntry> index(tileCount);
+	std::vector<XMFLOAT2> patchBounds(header.PatchesX * header.PatchesY);
+
+	UINT rowsRead = 0;
+	for (UINT ty = 0; ok && ty < header.TilesY; ++ty)
+	{
+		UINT firstRow = ty * TileCells;
+
+		// The first row was the last of the previous band.
+		UINT bandRow = 0;
+		if (ty > 0)
+		{
+			std::copy(band.end() - width, band.end(), band.begin());
+			if (compressed)
+			{
+				std::copy(stepBand.end() - width, stepBand.end(), stepBand.begin());
+			}
+			bandRow = 1;
+		}
+		for (; bandRow < TileSamples; ++bandRow)
+		{
+			float* dest = &band[bandRow * width];
+			if (firstRow + bandRow < height)
+			{
+				readRow(rowsRead++, dest);
+				if (compressed)
+				{
+					int* steps = &stepBand[bandRow * width];
+					for (UINT x = 0; x < width; ++x)
+					{
+						steps[x] = CountSteps(dest[x], heightBase, heightStep);
+						dest[x] = StepHeight(steps[x], heightBase, heightStep);
+					}
+				}
+			}
+			else
+			{
+				std::copy(dest - width, dest, dest);
+				if (compressed)
+				{
+					int* steps = &stepBand[bandRow * width];
+					std::copy(steps - width, steps, steps);
+				}
+			}
+		}
+
+		for (UINT tx = 0; ok && tx < header.TilesX; ++tx)
+		{
+			UINT firstCol = tx * TileCells;
+
+			float minY = +MathHelper::Infinity;
+			float maxY = -MathHelper::Infinity;
+			for (UINT y = 0; y < TileSamples; ++y)
+			{
+				const float* src = &band[y * width];
+				float* dest = &tile[y * TileSamples];
+				for (UINT x = 0; x < TileSamples; ++x)
+				{
+					float h = src[MathHelper::Min(firstCol + x, width - 1)];
+					dest[x] = h;
+					minY = MathHelper::Min(minY, h);
+					maxY = MathHelper::Max(maxY, h);
+				}
+			}
+
+			TileEntry& entry = index[ty * header.TilesX + tx];
+			entry.Offset = offset;
+			entry.MinY = minY;
+			entry.MaxY = maxY;
+			entry.Reserved = 0;
+
+			if (compressed)
+			{
+				for (UINT y = 0; y < TileSamples; ++y)
+				{
+					const int* src = &stepBand[y * width];
+					int* dest = &tileSteps[y * TileSamples];
+					for (UINT x = 0; x < TileSamples; ++x)
+					{
+						dest[x] = src[MathHelper::Min(firstCol + x, width - 1)];
+					}
+				}
+
+				EncodeTile(&tileSteps[0], encoded);
+				entry.Size = (UINT)encoded.size();
+				offset += encoded.size();
+				ok = WriteBytes(file, &encoded[0], encoded.size());
+			}
+			else
+			{
+				entry.Size = (UINT)tileSize;
+				offset += tileStride;
+				ok = WriteBytes(file, &tile[0], tileSize);
+				if (ok && !tilePadding.empty())
+				{
+					ok = WriteBytes(file, &tilePadding[0], tilePadding.size());
+				}
+			}
+		}
+
+		// Patches never straddle two bands, as patchCells divides TileCells.
+		UINT patchesPerTile = TileCells / patchCells;
+		for (UINT pi = ty * patchesPerTile; pi < (ty + 1) * patchesPerTile && pi < header.PatchesY; ++pi)
+		{
+			UINT y0 = pi * patchCells - firstRow;
+			UINT y1 = MathHelper::Min((pi + 1) * patchCells, height - 1) - firstRow;
+
+			for (UINT pj = 0; pj < header.PatchesX; ++pj)
+			{
+				UINT x0 = pj * patchCells;
+				UINT x1 = MathHelper::Min((pj + 1) * patchCells, width - 1);
+
+				float minY = +MathHelper::Infinity;
+				float maxY = -MathHelper::Infinity;
+				for (UINT y = y0; y <= y1; ++y)
+				{
+					const float* src = &band[y * width];
+					for (UINT x = x0; x <= x1; ++x)
+					{
+						minY = MathHelper::Min(minY, src[x]);
+						maxY = MathHelper::Max(maxY, src[x]);
+					}
+				}
+				patchBounds[pi * header.PatchesX + pj] = XMFLOAT2(minY, maxY);
+			}
+		}
+	}
+
+	if (ok)
+	{
+		header.IndexOffset = AlignUp(offset, IndexAlignment);
+		header.PatchBoundsOffset = header.IndexOffset + tileCount * sizeof(TileEntry);
+
+		BYTE indexPadding[IndexAlignment] = {};
+		LARGE_INTEGER start = {};
+		ok = WriteBytes(file, indexPadding, header.IndexOffset - offset) &&
+			WriteBytes(file, &index[0], index.size() * sizeof(TileEntry)) &&
+			WriteBytes(file, &patchBounds[0], patchBounds.size() * sizeof(XMFLOAT2)) &&
+			SetFilePointerEx(file, start, nullptr, FILE_BEGIN) &&
+			WriteBytes(file, &header, sizeof(header));
+	}
+	CloseHandle(file);
+
+	if (!ok || !MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileW(tempPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool TiledHeightmap::Open(const std::wstring& path, UINT64 memoryBudget)
+{
+	Close();
+
+	if (!m_File.Open(path, false) || m_File.GetSize() < sizeof(Header))
+	{
+		Close();
+		return false;
+	}
+
+	const BYTE* data = m_File.GetData();
+	UINT64 size = m_File.GetSize();
+	if (data == nullptr && !m_HeaderRange.Map(m_File, 0, sizeof(Header)))
+	{
+		Close();
+		return false;
+	}
+
+	const Header* header = (const Header*)(data ? data : m_HeaderRange.GetData());
+	if (header->Magic != FileMagic || header->Version != FileVersion ||
+		!(header->HeightStep >= 0.0f) ||
+		header->TileCells != TileCells || header->Width < 2 || header->Height < 2 ||
+		header->TilesX != (header->Width - 2) / TileCells + 1 ||
+		header->TilesY != (header->Height - 2) / TileCells + 1 ||
+		header->PatchCells == 0 || TileCells % header->PatchCells != 0 ||
+		header->PatchesX != (header->Width - 2) / header->PatchCells + 1 ||
+		header->PatchesY != (header->Height - 2) / header->PatchCells + 1)
+	{
+		Close();
+		return false;
+	}
+
+	UINT tileCount = header->TilesX * header->TilesY;
+	UINT64 patchCount = (UINT64)header->PatchesX * header->PatchesY;
+
+	// The offsets and counts come from the file, so each table is checked
+	// against the space left for it rather than summed, which could wrap.
+	if (header->IndexOffset > header->PatchBoundsOffset || header->PatchBoundsOffset > size ||
+		tileCount > (header->PatchBoundsOffset - header->IndexOffset) / sizeof(TileEntry) ||
+		patchCount > (size - header->PatchBoundsOffset) / sizeof(XMFLOAT2))
+	{
+		Close();
+		return false;
+	}
+
+	UINT64 tableSize = header->PatchBoundsOffset + patchCount * sizeof(XMFLOAT2) - header->IndexOffset;
+	if (data == nullptr && !m_TableRange.Map(m_File, header->IndexOffset, tableSize))
+	{
+		Close();
+		return false;
+	}
+
+	const BYTE* tables = data ? data + header->IndexOffset : m_TableRange.GetData();
+	const TileEntry* index = (const TileEntry*)tables;
+	UINT64 tileSize = (UINT64)TileSamples * TileSamples * sizeof(float);
+	bool compressed = header->HeightStep > 0.0f;
+	for (UINT i = 0; i < tileCount; ++i)
+	{
+		if ((!compressed && index[i].Size != tileSize) || index[i].Offset < sizeof(Header) ||
+			index[i].Offset > header->IndexOffset || index[i].Size > header->IndexOffset - index[i].Offset)
+		{
+			Close();
+			return false;
+		}
+	}
+
+	m_Header = header;
+	m_Index = index;
+	m_PatchBounds = (const XMFLOAT2*)(tables + (header->PatchBoundsOffset - header->IndexOffset));
+
+	// A few slots at least, so that the tiles around one cell never evict each other.
+	m_SlotCapacity = (UINT)MathHelper::Clamp<UINT64>(memoryBudget / tileSize, 4, tileCount);
+	m_Slots.reserve(m_SlotCapacity);
+	m_TileSlots.assign(tileCount, NoSlot);
+
+	return true;
+}
+
+void TiledHeightmap::Close()
+{
+	m_HeaderRange.Unmap();
+	m_TableRange.Unmap();
+	m_File.Close();
+	m_Header = nullptr;
+	m_Index = nullptr;
+	m_PatchBounds = nullptr;
+
+	m_Slots.clear();
+	m_SlotCapacity = 0;
+	m_TileSlots.clear();
+	m_Head = NoSlot;
+	m_Tail = NoSlot;
+	m_PageInCount = 0;
+}
+
+bool TiledHeightmap::IsOpen() const
+{
+	return m_Header != nullptr;
+}
+
+UINT64 TiledHeightmap::GetKey() const
+{
+	return m_Header->Key;
+}
+
+bool TiledHeightmap::IsCompressed() const
+{
+	return m_Header->HeightStep > 0.0f;
+}
+
+float TiledHeightmap::GetHeightBase() const
+{
+	return m_Header->HeightBase;
+}
+
+float TiledHeightmap::GetHeightStep() const
+{
+	return m_Header->HeightStep;
+}
+
+UINT64 TiledHeightmap::GetFileSize() const
+{
+	return m_File.GetSize();
+}
+
+UINT64 TiledHeightmap::GetTileDataSize() const
+{
+	UINT64 size = 0;
+	for (UINT i = 0; i < m_Header->TilesX * m_Header->TilesY; ++i)
+	{
+		size += m_Index[i].Size;
+	}
+	return size;
+}
+
+UINT TiledHeightmap::GetWidth() const
+{
+	return m_Header->Width;
+}
+
+UINT TiledHeightmap::GetHeight() const
+{
+	return m_Header->Height;
+}
+
+UINT TiledHeightmap::GetTilesX() const
+{
+	return m_Header->TilesX;
+}
+
+UINT TiledHeightmap::GetTilesY() const
+{
+	return m_Header->TilesY;
+}
+
+UINT TiledHeightmap::GetPatchCells() const
+{
+	return m_Header->PatchCells;
+}
+
+UINT TiledHeightmap::GetPatchesX() const
+{
+	return m_Header->PatchesX;
+}
+
+UINT TiledHeightmap::GetPatchesY() const
+{
+	return m_Header->PatchesY;
+}
+
+XMFLOAT2 TiledHeightmap::GetPatchBounds(UINT i, UINT j) const
+{
+	return m_PatchBounds[i * m_Header->PatchesX + j];
+}
+
+XMFLOAT2 TiledHeightmap::GetTileBounds(UINT tx, UINT ty) const
+{
+	const TileEntry& entry = m_Index[ty * m_Header->TilesX + tx];
+	return XMFLOAT2(entry.MinY, entry.MaxY);
+}
+
+const float* TiledHeightmap::GetTile(UINT tx, UINT ty)
+{
+	UINT tile = ty * m_Header->TilesX + tx;
+
+	UINT slot = m_TileSlots[tile];
+	if (slot == NoSlot)
+	{
+		slot = PageIn(tile);
+	}
+	else
+	{
+		Touch(slot);
+	}
+
+	return &m_Slots[slot].Samples[0];
+}
+
+float TiledHeightmap::GetSample(int row, int col)
+{
+	row = MathHelper::Clamp(row, 0, (int)m_Header->Height - 1);
+	col = MathHelper::Clamp(col, 0, (int)m_Header->Width - 1);
+
+	// The last sample of the map belongs to the last tile only.
+	UINT ty = MathHelper::Min((UINT)row / TileCells, m_Header->TilesY - 1);
+	UINT tx = MathHelper::Min((UINT)col / TileCells, m_Header->TilesX - 1);
+
+	const float* tile = GetTile(tx, ty);
+	return tile[(row - ty * TileCells) * TileSamples + (col - tx * TileCells)];
+}
+
+void TiledHeightmap::GetCellCorners(UINT row, UINT col, float corners[4])
+{
+	UINT ty = MathHelper::Min(row / TileCells, m_Header->TilesY - 1);
+	UINT tx = MathHelper::Min(col / TileCells, m_Header->TilesX - 1);
+
+	const float* tile = GetTile(tx, ty);
+	const float* src = tile + (row - ty * TileCells) * TileSamples + (col - tx * TileCells);
+	corners[0] = src[0];
+	corners[1] = src[1];
+	corners[2] = src[TileSamples];
+	corners[3] = src[TileSamples + 1];
+}
+
+UINT TiledHeightmap::PageAround(float row, float col, float radius, ThreadPool* pool)
+{
+	int ty0 = MathHelper::Max((int)floorf((row - radius) / TileCells), 0);
+	int ty1 = MathHelper::Min((int)floorf((row + radius) / TileCells), (int)m_Header->TilesY - 1);
+	int tx0 = MathHelper::Max((int)floorf((col - radius) / TileCells), 0);
+	int tx1 = MathHelper::Min((int)floorf((col + radius) / TileCells), (int)m_Header->TilesX - 1);
+
+	std::vector<TileDistance> tiles;
+	for (int ty = ty0; ty <= ty1; ++ty)
+	{
+		for (int tx = tx0; tx <= tx1; ++tx)
+		{
+			// Distance from the point to the nearest sample of the tile.
+			float dy = MathHelper::Max(MathHelper::Max(ty * (float)TileCells - row, row - (ty + 1) * (float)TileCells), 0.0f);
+			float dx = MathHelper::Max(MathHelper::Max(tx * (float)TileCells - col, col - (tx + 1) * (float)TileCells), 0.0f);
+
+			float distance = sqrtf(dx * dx + dy * dy);
+			if (distance <= radius)
+			{
+				TileDistance td = { distance, ty * m_Header->TilesX + tx };
+				tiles.push_back(td);
+			}
+		}
+	}
+
+	std::sort(tiles.begin(), tiles.end());
+	if (tiles.size() > m_SlotCapacity)
+	{
+		tiles.resize(m_SlotCapacity);
+	}
+
+	// Farthest first, so that the nearest tiles end up most recently used.
+	std::vector<UINT> order(tiles.size());
+	for (size_t i = 0; i < tiles.size(); ++i)
+	{
+		order[i] = tiles[tiles.size() - 1 - i].Tile;
+	}
+
+	return PageTiles(order.empty() ? nullptr : &order[0], (UINT)order.size(), pool);
+}
+
+UINT TiledHeightmap::PageRect(UINT tx0, UINT ty0, UINT tx1, UINT ty1, ThreadPool* pool)
+{
+	tx1 = MathHelper::Min(tx1, m_Header->TilesX - 1);
+	ty1 = MathHelper::Min(ty1, m_Header->TilesY - 1);
+
+	std::vector<UINT> tiles;
+	for (UINT ty = ty0; ty <= ty1 && tiles.size() < m_SlotCapacity; ++ty)
+	{
+		for (UINT tx = tx0; tx <= tx1 && tiles.size() < m_SlotCapacity; ++tx)
+		{
+			tiles.push_back(ty * m_Header->TilesX + tx);
+		}
+	}
+
+	return PageTiles(tiles.empty() ? nullptr : &tiles[0], (UINT)tiles.size(), pool);
+}
+
+UINT TiledHeightmap::GetCacheCapacity() const
+{
+	return m_SlotCapacity;
+}
+
+UINT TiledHeightmap::GetResidentTileCount() const
+{
+	return (UINT)m_Slots.size();
+}
+
+UINT64 TiledHeightmap::GetPageInCount() const
+{
+	return m_PageInCount;
+}
+
+void TiledHeightmap::Touch(UINT slot)
+{
+	if (slot == m_Head)
+	{
+		return;
+	}
+
+	Unlink(slot);
+
+	m_Slots[slot].Prev = NoSlot;
+	m_Slots[slot].Next = m_Head;
+	if (m_Head != NoSlot)
+	{
+		m_Slots[m_Head].Prev = slot;
+	}
+	m_Head = slot;
+	if (m_Tail == NoSlot)
+	{
+		m_Tail = slot;
+	}
+}
+
+void TiledHeightmap::Unlink(UINT slot)
+{
+	Slot& s = m_Slots[slot];
+	if (s.Prev != NoSlot)
+	{
+		m_Slots[s.Prev].Next = s.Next;
+	}
+	else if (m_Head == slot)
+	{
+		m_Head = s.Next;
+	}
+
+	if (s.Next != NoSlot)
+	{
+		m_Slots[s.Next].Prev = s.Prev;
+	}
+	else if (m_Tail == slot)
+	{
+		m_Tail = s.Prev;
+	}
+
+	s.Prev = NoSlot;
+	s.Next = NoSlot;
+}
+
+UINT TiledHeightmap::PageIn(UINT tile)
+{
+	UINT slot = AcquireSlot(tile);
+	ReadTile(tile, &m_Slots[slot].Samples[0]);
+	++m_PageInCount;
+
+	return slot;
+}
+
+UINT TiledHeightmap::AcquireSlot(UINT tile)
+{
+	UINT slot;
+	if (m_Slots.size() < m_SlotCapacity)
+	{
+		slot = (UINT)m_Slots.size();
+
+		Slot s;
+		s.Samples.resize((size_t)TileSamples * TileSamples);
+		s.Tile = NoSlot;
+		s.Prev = NoSlot;
+		s.Next = NoSlot;
+		m_Slots.push_back(s);
+	}
+	else
+	{
+		// Evict the least recently used tile.
+		slot = m_Tail;
+		m_TileSlots[m_Slots[slot].Tile] = NoSlot;
+	}
+
+	m_Slots[slot].Tile = tile;
+	m_TileSlots[tile] = slot;
+
+	Touch(slot);
+	return slot;
+}
+
+void TiledHeightmap::ReadTile(UINT tile, float* samples) const
+{
+	const TileEntry& entry = m_Index[tile];
+
+	MappedRange range;
+	const BYTE* data = m_File.GetData();
+	if (data != nullptr)
+	{
+		data += entry.Offset;
+	}
+	else if (range.Map(m_File, entry.Offset, entry.Size))
+	{
+		data = range.GetData();
+	}
+	else
+	{
+		std::fill(samples, samples + TileSamples * TileSamples, entry.MinY);
+		return;
+	}
+
+	if (IsCompressed())
+	{
+		DecodeTile(data, entry.Size, m_Header->HeightBase, m_Header->HeightStep, samples);
+	}
+	else
+	{
+		memcpy(samples, data, entry.Size);
+	}
+}
+
+UINT TiledHeightmap::PageTiles(const UINT* tiles, UINT count, ThreadPool* pool)
+{
+	// Slots are taken one tile at a time; the cache holds every tile given,
+	// so no tile of the list evicts another.
+	std::vector<UINT> slots;
+	for (UINT i = 0; i < count; ++i)
+	{
+		UINT slot = m_TileSlots[tiles[i]];
+		if (slot == NoSlot)
+		{
+			slots.push_back(AcquireSlot(tiles[i]));
+		}
+		else
+		{
+			Touch(slot);
+		}
+	}
+
+	auto read = [this, &slots](UINT begin, UINT end)
+	{
+		for (UINT i = begin; i < end; ++i)
+		{
+			Slot& s = m_Slots[slots[i]];
+			ReadTile(s.Tile, &s.Samples[0]);
+		}
+	};
+
+	UINT pagedIn = (UINT)slots.size();
+	if (pool != nullptr && pagedIn > 1)
+	{
+		pool->ParallelFor(pagedIn, 1, read);
+	}
+	else
+	{
+		read(0, pagedIn);
+	}
+	m_PageInCount += pagedIn;
+
+	return pagedIn;
+}
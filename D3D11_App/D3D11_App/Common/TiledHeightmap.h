@@ -0,0 +1,200 @@
+#pragma once
+
+#include "d3dUtil.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include <functional>
+
+// Heightmap stored on disk as square tiles of TileCells x TileCells cells.
+// Neighbouring tiles share their border samples, so every cell lies inside
+// one tile.  The file starts with a header, holds the tiles row by row, and
+// ends with an index giving the offset and height range of every tile and a
+// table with the height range of every patch.
+//
+// Tiles hold either the heights as floats or, compressed, the heights rounded
+// to base + n * step.  A compressed tile stores n for every sample as the
+// difference from the sample to its left, minus the same difference in the
+// row above, which is close to zero on smooth ground.  Those residuals are
+// Rice coded with a parameter chosen per row, and most samples take a few
+// bits instead of 32.
+//
+// The file is mapped and tiles are copied out of it on first use into a
+// cache holding as many tiles as the memory budget allows; the least
+// recently used tile is dropped when the cache is full.  A file too large to
+// map at once, as a map of 16k x 16k samples is in a 32-bit process, has its
+// header and index mapped on their own and every tile mapped just while it
+// is read.  A TiledHeightmap is not safe to use from more than one thread at
+// a time.
+class TiledHeightmap
+{
+public:
+	// Called for every row, in order, while a file is written.  Fills samples
+	// with the width heights of the row.
+	typedef std::function<void(UINT row, float* samples)> RowFunc;
+
+	static const UINT TileCells = 256;
+
+	// Largest number of steps a compressed height lies from the base.
+	static const int MaxStepCount = 1 << 28;
+
+	TiledHeightmap();
+
+	/// Writes a width x height heightmap to path, reading it one row at a
+	/// time so that only one row of tiles is ever held in memory.  Patch
+	/// bounds are kept for patches of patchCells cells, which must divide
+	/// TileCells.  key is stored for the caller to identify the source.
+	/// With a heightStep above zero the tiles are compressed: every height
+	/// is rounded to the nearest heightBase + n * heightStep, with n within
+	/// +-MaxStepCount, and the tile and patch bounds are those of the
+	/// rounded heights.
+	static bool Write(const std::wstring& path, UINT width, UINT height, UINT patchCells,
+		UINT64 key, const RowFunc& readRow, float heightBase = 0.0f, float heightStep = 0.0f);
+
+	/// Maps the file and checks its header and index.  No tile is read until
+	/// it is asked for.  Returns false if the file is missing or corrupt.
+	bool Open(const std::wstring& path, UINT64 memoryBudget);
+	void Close();
+
+	bool IsOpen() const;
+	UINT64 GetKey() const;
+
+	// Compressed files round heights to GetHeightBase() + n * GetHeightStep().
+	bool IsCompressed() const;
+	float GetHeightBase() const;
+	float GetHeightStep() const;
+
+	// Size of the file and of the tiles in it, in bytes.
+	UINT64 GetFileSize() const;
+	UINT64 GetTileDataSize() const;
+
+	// Size of the heightmap in samples.
+	UINT GetWidth() const;
+	UINT GetHeight() const;
+
+	UINT GetTilesX() const;
+	UINT GetTilesY() const;
+
+	UINT GetPatchCells() const;
+	UINT GetPatchesX() const;
+	UINT GetPatchesY() const;
+
+	// Min and max height of a patch or tile, read from the index without
+	// paging the tile in.
+	XMFLOAT2 GetPatchBounds(UINT i, UINT j) const;
+	XMFLOAT2 GetTileBounds(UINT tx, UINT ty) const;
+
+	/// Returns the (TileCells + 1)^2 samples of a tile, paging it in if it is
+	/// not resident.  The pointer stays valid until another tile is paged in.
+	const float* GetTile(UINT tx, UINT ty);
+
+	// Height of sample (row, col), which is clamped to the heightmap.
+	float GetSample(int row, int col);
+
+	/// Heights at the corners of cell (row, col) in the order (row, col),
+	/// (row, col + 1), (row + 1, col), (row + 1, col + 1).  The cell must lie
+	/// inside the heightmap.
+	void GetCellCorners(UINT row, UINT col, float corners[4]);
+
+	/// Pages in the tiles within radius samples of (row, col), nearest first,
+	/// and marks them as recently used so that they outlive the tiles further
+	/// away.  Stops when the cache is full.  Returns the number of tiles read.
+	/// With a pool, the tiles read are decoded across its threads.
+	UINT PageAround(float row, float col, float radius, ThreadPool* pool = nullptr);
+
+	/// Pages in tiles [tx0, tx1] x [ty0, ty1] row by row, as many as the cache
+	/// holds, decoding them across the threads of the pool if there is one.
+	/// Returns the number of tiles read.
+	UINT PageRect(UINT tx0, UINT ty0, UINT tx1, UINT ty1, ThreadPool* pool = nullptr);
+
+	UINT GetCacheCapacity() const;
+	UINT GetResidentTileCount() const;
+
+	// Number of tiles copied out of the file since it was opened.
+	UINT64 GetPageInCount() const;
+
+private:
+	TiledHeightmap(const TiledHeightmap& rhs);
+	TiledHeightmap& operator=(const TiledHeightmap& rhs);
+
+	struct Header
+	{
+		UINT Magic;
+		UINT Version;
+		UINT64 Key;
+		UINT Width;
+		UINT Height;
+		UINT TileCells;
+		UINT TilesX;
+		UINT TilesY;
+		UINT PatchCells;
+		UINT PatchesX;
+		UINT PatchesY;
+
+		// Zero step for float tiles.
+		float HeightBase;
+		float HeightStep;
+
+		UINT64 IndexOffset;
+		UINT64 PatchBoundsOffset;
+	};
+
+	struct TileEntry
+	{
+		UINT64 Offset;
+		UINT Size;
+		float MinY;
+		float MaxY;
+		UINT Reserved;
+	};
+
+	// Cache slots form a doubly linked list from most to least recently used.
+	struct Slot
+	{
+		std::vector<float> Samples;
+		UINT Tile;
+		UINT Prev;
+		UINT Next;
+	};
+
+	// Moves a slot to the front of the list.
+	void Touch(UINT slot);
+	void Unlink(UINT slot);
+	UINT PageIn(UINT tile);
+
+	// Takes a free slot, or the least recently used one, for a tile that is
+	// not resident and moves it to the front of the list.  The samples are
+	// left to ReadTile.
+	UINT AcquireSlot(UINT tile);
+
+	// Copies or decodes a tile out of the file.  Safe to call for different
+	// slots from several threads.  A tile that cannot be mapped reads as
+	// flat at its minimum height.
+	void ReadTile(UINT tile, float* samples) const;
+
+	// Pages in the tiles given, last one most recently used, reading the ones
+	// not resident across the threads of the pool.  There must be no more
+	// tiles than cache slots.
+	UINT PageTiles(const UINT* tiles, UINT count, ThreadPool* pool);
+
+private:
+	MappedFile m_File;
+
+	// The header and the index and patch bounds that follow the tiles, when
+	// the file has no view of the whole.
+	MappedRange m_HeaderRange;
+	MappedRange m_TableRange;
+
+	const Header* m_Header;
+	const TileEntry* m_Index;
+	const XMFLOAT2* m_PatchBounds;
+
+	std::vector<Slot> m_Slots;
+	UINT m_SlotCapacity;
+
+	// Resident slot of every tile, or NoSlot.
+	std::vector<UINT> m_TileSlots;
+
+	UINT m_Head;
+	UINT m_Tail;
+	UINT64 m_PageInCount;
+};
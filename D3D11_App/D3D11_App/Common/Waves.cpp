@@ -1,7 +1,254 @@
 #include "Waves.h"
+#include "ThreadPool.h"
+#include "MathHelper.h"
 #include <algorithm>
 #include <vector>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <intrin.h>
+#include <immintrin.h>
+
+namespace
+{
+	// Rows of a band handed to a thread.
+	const UINT BandRows = 32;
+
+	// Rows and columns of a tile that sleeps or wakes as a whole.
+	const UINT TileRows = 32;
+	const UINT TileCols = 32;
+
+	// Arrays are aligned for AVX loads.
+	const size_t Alignment = 32;
+
+	float* AllocFloats(UINT count)
+	{
+		return (float*)_aligned_malloc(count * sizeof(float), Alignment);
+	}
+
+	bool DetectAVX()
+	{
+#if defined(_XM_SSE_INTRINSICS_)
+		int info[4];
+		__cpuid(info, 1);
+
+		// The OS has to save the AVX registers too.
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+		return false;
+#endif
+	}
+
+	bool HasAVX()
+	{
+		static const bool hasAVX = DetectAVX();
+		return hasAVX;
+	}
+
+	// Flushes denormals to zero while in scope.  The tails of waves dying
+	// out in a tile run through denormals, which are many times slower.
+	class FlushDenormals
+	{
+	public:
+		FlushDenormals()
+		{
+#if defined(_XM_SSE_INTRINSICS_)
+			m_Saved = _mm_getcsr();
+			_mm_setcsr(m_Saved | _MM_FLUSH_ZERO_ON | _MM_DENORMALS_ZERO_ON);
+#endif
+		}
+
+		~FlushDenormals()
+		{
+#if defined(_XM_SSE_INTRINSICS_)
+			_mm_setcsr(m_Saved);
+#endif
+		}
+
+	private:
+		unsigned int m_Saved;
+	};
+
+	// The largest magnitude among a[j] and b[j] for j in [begin, end), and
+	// amplitude.
+	float MaxMagnitude(const float* a, const float* b, UINT begin, UINT end, float amplitude)
+	{
+		UINT j = begin;
+#if defined(_XM_SSE_INTRINSICS_)
+		const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		__m128 m = _mm_set1_ps(amplitude);
+		for (; j + 4 <= end; j += 4)
+		{
+			m = _mm_max_ps(m, _mm_and_ps(_mm_loadu_ps(a + j), magnitude));
+			m = _mm_max_ps(m, _mm_and_ps(_mm_loadu_ps(b + j), magnitude));
+		}
+		m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+		m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+		amplitude = _mm_cvtss_f32(m);
+#endif
+		for (; j < end; ++j)
+		{
+			amplitude = std::max(amplitude, std::max(fabsf(a[j]), fabsf(b[j])));
+		}
+		return amplitude;
+	}
+
+	//
+	// One row of the solution, the points j in [begin, end) at a time.  The
+	// vector code does the same operations in the same order, so that all of
+	// them give the same bits.
+	//
+
+	struct StepConstants
+	{
+		float K1;
+		float K2;
+		float K3;
+	};
+
+	// Rows up and down are the rows of the current solution around curr.
+	// next may be prev: every point is read before it is written.
+	void StepRange(const StepConstants& k, const float* prev, const float* up, const float* curr, const float* down,
+		float* next, UINT begin, UINT end)
+	{
+		for (UINT j = begin; j < end; ++j)
+		{
+			next[j] = k.K1 * prev[j] + k.K2 * curr[j] +
+				k.K3 * (down[j] + up[j] + curr[j + 1] + curr[j - 1]);
+		}
+	}
+
+	// Normalizes (x, y, z) the way XMVector3Normalize does.
+	void FrameRange(const float* up, const float* h, const float* down, float twoDx, float* nx, float* ny, float* nz,
+		float* tx, float* ty, UINT begin, UINT end)
+	{
+		for (UINT j = begin; j < end; ++j)
+		{
+			float left = h[j - 1];
+			float right = h[j + 1];
+			float top = up[j];
+			float bottom = down[j];
+
+			float x = -right + left;
+			float z = bottom - top;
+			float length = sqrtf(x * x + twoDx * twoDx + z * z);
+			nx[j] = x / length;
+			ny[j] = twoDx / length;
+			nz[j] = z / length;
+
+			float slope = right - left;
+			float tangentLength = sqrtf(twoDx * twoDx + slope * slope + 0.f);
+			tx[j] = twoDx / tangentLength;
+			ty[j] = slope / tangentLength;
+		}
+	}
+
+#if defined(_XM_SSE_INTRINSICS_)
+	UINT StepRangeSSE(const StepConstants& k, const float* prev, const float* up, const float* curr,
+		const float* down, float* next, UINT begin, UINT end)
+	{
+		__m128 k1 = _mm_set1_ps(k.K1);
+		__m128 k2 = _mm_set1_ps(k.K2);
+		__m128 k3 = _mm_set1_ps(k.K3);
+
+		UINT j = begin;
+		for (; j + 4 <= end; j += 4)
+		{
+			__m128 sum = _mm_add_ps(_mm_loadu_ps(down + j), _mm_loadu_ps(up + j));
+			sum = _mm_add_ps(sum, _mm_loadu_ps(curr + j + 1));
+			sum = _mm_add_ps(sum, _mm_loadu_ps(curr + j - 1));
+
+			__m128 h = _mm_add_ps(_mm_mul_ps(k1, _mm_loadu_ps(prev + j)), _mm_mul_ps(k2, _mm_loadu_ps(curr + j)));
+			_mm_storeu_ps(next + j, _mm_add_ps(h, _mm_mul_ps(k3, sum)));
+		}
+		return j;
+	}
+
+	UINT FrameRangeSSE(const float* up, const float* h, const float* down, float twoDx, float* nx, float* ny,
+		float* nz, float* tx, float* ty, UINT begin, UINT end)
+	{
+		__m128 y = _mm_set1_ps(twoDx);
+		__m128 yy = _mm_mul_ps(y, y);
+
+		UINT j = begin;
+		for (; j + 4 <= end; j += 4)
+		{
+			__m128 left = _mm_loadu_ps(h + j - 1);
+			__m128 right = _mm_loadu_ps(h + j + 1);
+			__m128 top = _mm_loadu_ps(up + j);
+			__m128 bottom = _mm_loadu_ps(down + j);
+
+			__m128 x = _mm_sub_ps(left, right);
+			__m128 z = _mm_sub_ps(bottom, top);
+			__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), yy), _mm_mul_ps(z, z)));
+			_mm_storeu_ps(nx + j, _mm_div_ps(x, length));
+			_mm_storeu_ps(ny + j, _mm_div_ps(y, length));
+			_mm_storeu_ps(nz + j, _mm_div_ps(z, length));
+
+			__m128 slope = _mm_sub_ps(right, left);
+			__m128 tangentLength = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(yy, _mm_mul_ps(slope, slope)), _mm_setzero_ps()));
+			_mm_storeu_ps(tx + j, _mm_div_ps(y, tangentLength));
+			_mm_storeu_ps(ty + j, _mm_div_ps(slope, tangentLength));
+		}
+		return j;
+	}
+
+	UINT StepRangeAVX(const StepConstants& k, const float* prev, const float* up, const float* curr,
+		const float* down, float* next, UINT begin, UINT end)
+	{
+		__m256 k1 = _mm256_set1_ps(k.K1);
+		__m256 k2 = _mm256_set1_ps(k.K2);
+		__m256 k3 = _mm256_set1_ps(k.K3);
+
+		UINT j = begin;
+		for (; j + 8 <= end; j += 8)
+		{
+			__m256 sum = _mm256_add_ps(_mm256_loadu_ps(down + j), _mm256_loadu_ps(up + j));
+			sum = _mm256_add_ps(sum, _mm256_loadu_ps(curr + j + 1));
+			sum = _mm256_add_ps(sum, _mm256_loadu_ps(curr + j - 1));
+
+			__m256 h = _mm256_add_ps(_mm256_mul_ps(k1, _mm256_loadu_ps(prev + j)),
+				_mm256_mul_ps(k2, _mm256_loadu_ps(curr + j)));
+			_mm256_storeu_ps(next + j, _mm256_add_ps(h, _mm256_mul_ps(k3, sum)));
+		}
+		_mm256_zeroupper();
+		return j;
+	}
+
+	UINT FrameRangeAVX(const float* up, const float* h, const float* down, float twoDx, float* nx, float* ny,
+		float* nz, float* tx, float* ty, UINT begin, UINT end)
+	{
+		__m256 y = _mm256_set1_ps(twoDx);
+		__m256 yy = _mm256_mul_ps(y, y);
+
+		UINT j = begin;
+		for (; j + 8 <= end; j += 8)
+		{
+			__m256 left = _mm256_loadu_ps(h + j - 1);
+			__m256 right = _mm256_loadu_ps(h + j + 1);
+			__m256 top = _mm256_loadu_ps(up + j);
+			__m256 bottom = _mm256_loadu_ps(down + j);
+
+			__m256 x = _mm256_sub_ps(left, right);
+			__m256 z = _mm256_sub_ps(bottom, top);
+			__m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), yy), _mm256_mul_ps(z, z)));
+			_mm256_storeu_ps(nx + j, _mm256_div_ps(x, length));
+			_mm256_storeu_ps(ny + j, _mm256_div_ps(y, length));
+			_mm256_storeu_ps(nz + j, _mm256_div_ps(z, length));
+
+			__m256 slope = _mm256_sub_ps(right, left);
+			__m256 tangentLength = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(yy, _mm256_mul_ps(slope, slope)),
+				_mm256_setzero_ps()));
+			_mm256_storeu_ps(tx + j, _mm256_div_ps(y, tangentLength));
+			_mm256_storeu_ps(ty + j, _mm256_div_ps(slope, tangentLength));
+		}
+		_mm256_zeroupper();
+		return j;
+	}
+#endif
+}
 
 Waves::Waves()
 	: row_count_(0)
@@ -13,21 +260,28 @@ Waves::Waves()
 	, k3_(0.f)
 	, time_delta_(0.f)
 	, time_step_(0.f)
+	, max_sub_steps_(DefaultMaxSubSteps)
 	, spatial_step_(0.f)
 	, prev_solution_(nullptr)
 	, curr_solution_(nullptr)
-	, normals_(nullptr)
-	, tangentX_(nullptr)
+	, column_x_(nullptr)
+	, row_z_(nullptr)
+	, column_u_(nullptr)
+	, row_v_(nullptr)
+	, normal_x_(nullptr)
+	, normal_y_(nullptr)
+	, normal_z_(nullptr)
+	, tangent_x_(nullptr)
+	, tangent_y_(nullptr)
+	, sleep_threshold_(0.f)
+	, tile_col_count_(0)
 {
 
 }
 
 Waves::~Waves()
 {
-	delete[] prev_solution_;
-	delete[] curr_solution_;
-	delete[] normals_;
-	delete[] tangentX_;
+	Release();
 }
 
 UINT Waves::RowCount() const
@@ -60,6 +314,22 @@ float Waves::Depth() const
 	return row_count_ * spatial_step_;
 }
 
+const float* Waves::Heights() const
+{
+	return curr_solution_;
+}
+
+void Waves::Release()
+{
+	float** arrays[] = { &prev_solution_, &curr_solution_, &column_x_, &row_z_, &column_u_, &row_v_, &normal_x_,
+		&normal_y_, &normal_z_, &tangent_x_, &tangent_y_ };
+	for (float** a : arrays)
+	{
+		_aligned_free(*a);
+		*a = nullptr;
+	}
+}
+
 void Waves::Init(UINT rows, UINT cols, float dx, float dt, float speed, float damping)
 {
 	row_count_ = rows;
@@ -77,92 +347,515 @@ void Waves::Init(UINT rows, UINT cols, float dx, float dt, float speed, float da
 	k2_ = (4.f - 8.f * e) / d;
 	k3_ = (2.f * e) / d;
 
-	delete[] prev_solution_;
-	delete[] curr_solution_;
-	delete[] normals_;
-	delete[] tangentX_;
+	Release();
 
-	prev_solution_ = new XMFLOAT3[vertex_count_];
-	curr_solution_ = new XMFLOAT3[vertex_count_];
-	normals_ = new XMFLOAT3[vertex_count_];
-	tangentX_ = new XMFLOAT3[vertex_count_];
+	prev_solution_ = AllocFloats(vertex_count_);
+	curr_solution_ = AllocFloats(vertex_count_);
+	column_x_ = AllocFloats(cols);
+	row_z_ = AllocFloats(rows);
+	column_u_ = AllocFloats(cols);
+	row_v_ = AllocFloats(rows);
+	normal_x_ = AllocFloats(vertex_count_);
+	normal_y_ = AllocFloats(vertex_count_);
+	normal_z_ = AllocFloats(vertex_count_);
+	tangent_x_ = AllocFloats(vertex_count_);
+	tangent_y_ = AllocFloats(vertex_count_);
 
 	// Generate grid vertices in system memory.
 	float width_half = (cols - 1) * dx * .5f;
 	float depth_half = (rows - 1) * dx * .5f;
 	for (UINT i = 0; i < rows; ++i)
 	{
-		float z = depth_half - i * dx;
-		for (UINT j = 0; j < cols; ++j)
-		{
-			float x = -width_half + j * dx;
-			prev_solution_[i*cols + j] = XMFLOAT3(x, 0.0f, z);
-			curr_solution_[i*cols + j] = XMFLOAT3(x, 0.0f, z);
-			normals_[i*cols + j] = XMFLOAT3(0.f, 1.f, 0.f);
-			tangentX_[i*cols + j] = XMFLOAT3(1.f, 0.f, 0.f);
-		}
+		row_z_[i] = depth_half - i * dx;
+		row_v_[i] = 0.5f - row_z_[i] / Depth();
+	}
+	for (UINT j = 0; j < cols; ++j)
+	{
+		column_x_[j] = -width_half + j * dx;
+		column_u_[j] = 0.5f + column_x_[j] / Width();
 	}
+
+	std::fill(prev_solution_, prev_solution_ + vertex_count_, 0.f);
+	std::fill(curr_solution_, curr_solution_ + vertex_count_, 0.f);
+	std::fill(normal_x_, normal_x_ + vertex_count_, 0.f);
+	std::fill(normal_y_, normal_y_ + vertex_count_, 1.f);
+	std::fill(normal_z_, normal_z_ + vertex_count_, 0.f);
+	std::fill(tangent_x_, tangent_x_ + vertex_count_, 1.f);
+	std::fill(tangent_y_, tangent_y_ + vertex_count_, 0.f);
+
+	// The grid starts flat, with every tile asleep.
+	tile_col_count_ = (cols + TileCols - 1) / TileCols;
+	const UINT tileCount = tile_col_count_ * ((rows + TileRows - 1) / TileRows);
+	tile_awake_.assign(tileCount, 0);
+	tile_stepped_.assign(tileCount, 0);
+	tile_amplitude_.assign(tileCount, 0.f);
+	step_tiles_.clear();
+	step_tiles_.reserve(tileCount);
 }
 
-void Waves::Update(float dt)
+UINT Waves::Update(float dt, ThreadPool* pool)
 {
 	// Accumulate time.
 	time_delta_ += dt;
 
-	// Only update the simulation at the specified time step.
+	if (row_count_ < 3 || col_count_ < 3)
+	{
+		return 0;
+	}
+
+	// Only update the simulation at the specified time step, catching up
+	// with several steps after a long frame.
+	UINT steps = 0;
+	while (time_delta_ >= time_step_ && steps < max_sub_steps_)
+	{
+		Step(pool);
+		time_delta_ -= time_step_;
+		++steps;
+	}
+
+	// Past the cap, keep only the fraction of a step.
 	if (time_delta_ >= time_step_)
 	{
-		// Only update interior points; we use zero boundary conditions.
-		for (int i = 1; i < row_count_ - 1; ++i)
+		time_delta_ = fmodf(time_delta_, time_step_);
+	}
+
+	return steps;
+}
+
+void Waves::Step(ThreadPool* pool)
+{
+	if (sleep_threshold_ > 0.f)
+	{
+		StepAwakeTiles(pool);
+		return;
+	}
+
+	// Only update interior points; we use zero boundary conditions.  The
+	// rows are stepped in bands; a band computes the normals of its rows as
+	// soon as the rows around them are done, except for its first and last
+	// rows, whose neighbours belong to other bands and are done afterwards.
+	const UINT interior = row_count_ - 2;
+	const UINT bandCount = (interior + BandRows - 1) / BandRows;
+	auto bandFirst = [=](UINT band) { return 1 + band * BandRows; };
+	auto bandLast = [=](UINT band) { return std::min(1 + (band + 1) * BandRows, row_count_ - 1); };
+
+	auto stepBands = [&](UINT begin, UINT end)
+	{
+		for (UINT band = begin; band < end; ++band)
+		{
+			StepRows(bandFirst(band), bandLast(band));
+		}
+	};
+
+	auto frameBandEdges = [&](UINT begin, UINT end)
+	{
+		for (UINT band = begin; band < end; ++band)
+		{
+			UINT first = bandFirst(band);
+			UINT last = bandLast(band);
+			if (!IsFramedInBand(first, first, last))
+			{
+				ComputeFrames(prev_solution_, first, 1, col_count_ - 1);
+			}
+			if (last - 1 != first && !IsFramedInBand(last - 1, first, last))
+			{
+				ComputeFrames(prev_solution_, last - 1, 1, col_count_ - 1);
+			}
+		}
+	};
+
+	if (pool != nullptr && pool->ThreadCount() > 1 && vertex_count_ >= ParallelThreshold)
+	{
+		pool->ParallelFor(bandCount, 1, stepBands);
+		pool->ParallelFor(bandCount, 1, frameBandEdges);
+	}
+	else
+	{
+		stepBands(0, bandCount);
+		frameBandEdges(0, bandCount);
+	}
+
+	// We just overwrote the previous buffer with the new data, so
+	// this data needs to become the current solution and the old
+	// current solution becomes the new previous solution.
+	std::swap(prev_solution_, curr_solution_);
+}
+
+void Waves::SetMaxSubSteps(UINT count)
+{
+	max_sub_steps_ = MathHelper::Max(count, 1u);
+}
+
+float Waves::TimeStep() const
+{
+	return time_step_;
+}
+
+void Waves::CopySolution(const Waves& source)
+{
+	assert(source.row_count_ == row_count_ && source.col_count_ == col_count_);
+
+	const size_t size = vertex_count_ * sizeof(float);
+	memcpy(curr_solution_, source.curr_solution_, size);
+	memcpy(normal_x_, source.normal_x_, size);
+	memcpy(normal_y_, source.normal_y_, size);
+	memcpy(normal_z_, source.normal_z_, size);
+	memcpy(tangent_x_, source.tangent_x_, size);
+	memcpy(tangent_y_, source.tangent_y_, size);
+}
+
+void Waves::SetSleepThreshold(float amplitude)
+{
+	sleep_threshold_ = amplitude;
+
+	// The tiles settle again on their own.
+	std::fill(tile_awake_.begin(), tile_awake_.end(), (BYTE)1);
+}
+
+UINT Waves::AwakeTileCount() const
+{
+	return (UINT)std::count(tile_awake_.begin(), tile_awake_.end(), (BYTE)1);
+}
+
+void Waves::StepAwakeTiles(ThreadPool* pool)
+{
+	// Step the awake tiles and a halo of one tile around them, into which
+	// their waves spread.  The tiles left out are asleep: flat and still, so
+	// stepping them would change nothing.
+	const UINT tileRows = (UINT)tile_amplitude_.size() / tile_col_count_;
+	std::fill(tile_stepped_.begin(), tile_stepped_.end(), (BYTE)0);
+	for (UINT ti = 0; ti < tileRows; ++ti)
+	{
+		for (UINT tj = 0; tj < tile_col_count_; ++tj)
 		{
-			for (int j = 1; j < col_count_ - 1; ++j)
+			if (!tile_awake_[ti * tile_col_count_ + tj])
+			{
+				continue;
+			}
+
+			for (UINT ni = ti > 0 ? ti - 1 : 0; ni <= MathHelper::Min(ti + 1, tileRows - 1); ++ni)
 			{
-				// After this update we will be discarding the old previous
-				// buffer, so overwrite that buffer with the new update.
-				// Note how we can do this inplace (read/write to same element) 
-				// because we won't need prev_ij again and the assignment happens last.
-
-				// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
-				// Moreover, our +z axis goes "down"; this is just to 
-				// keep consistent with our row indices going down.
-				prev_solution_[i*col_count_ + j].y =
-					k1_ * prev_solution_[i*col_count_ + j].y +
-					k2_ * curr_solution_[i*col_count_ + j].y +
-					k3_ * (curr_solution_[(i + 1)*col_count_ + j].y +
-						curr_solution_[(i - 1)*col_count_ + j].y +
-						curr_solution_[i*col_count_ + j + 1].y +
-						curr_solution_[i*col_count_ + j - 1].y);
+				for (UINT nj = tj > 0 ? tj - 1 : 0; nj <= MathHelper::Min(tj + 1, tile_col_count_ - 1); ++nj)
+				{
+					tile_stepped_[ni * tile_col_count_ + nj] = 1;
+				}
 			}
 		}
+	}
 
-		// We just overwrote the previous buffer with the new data, so
-		// this data needs to become the current solution and the old
-		// current solution becomes the new previous solution.
-		std::swap(prev_solution_, curr_solution_);
+	// Tiles next to each other in a row are stepped together, a row of
+	// points at a time.
+	step_tiles_.clear();
+	step_runs_.clear();
+	for (UINT ti = 0; ti < tileRows; ++ti)
+	{
+		for (UINT tj = 0; tj < tile_col_count_; ++tj)
+		{
+			UINT tile = ti * tile_col_count_ + tj;
+			if (!tile_stepped_[tile])
+			{
+				continue;
+			}
 
-		time_delta_ = 0.f;	// reset time;
+			step_tiles_.push_back(tile);
+			if (tj > 0 && tile_stepped_[tile - 1])
+			{
+				++step_runs_.back().TileCount;
+			}
+			else
+			{
+				TileRun run = { tile, 1 };
+				step_runs_.push_back(run);
+			}
+		}
+	}
 
-		// Compute normals using finite difference scheme.
-		for (int i = 1; i < row_count_ - 1; ++i)
+	// The interior points of a run of tiles.
+	auto runRect = [=](const TileRun& run, UINT& i0, UINT& i1, UINT& j0, UINT& j1)
+	{
+		UINT ti = run.FirstTile / tile_col_count_;
+		UINT tj = run.FirstTile % tile_col_count_;
+		i0 = MathHelper::Max(ti * TileRows, 1u);
+		i1 = MathHelper::Min((ti + 1) * TileRows, row_count_ - 1);
+		j0 = MathHelper::Max(tj * TileCols, 1u);
+		j1 = MathHelper::Min((tj + run.TileCount) * TileCols, col_count_ - 1);
+	};
+
+	auto stepRuns = [&](UINT begin, UINT end)
+	{
+		FlushDenormals flush;
+		for (UINT r = begin; r < end; ++r)
+		{
+			UINT i0, i1, j0, j1;
+			runRect(step_runs_[r], i0, i1, j0, j1);
+			for (UINT i = i0; i < i1; ++i)
+			{
+				StepSpan(i, j0, j1);
+			}
+		}
+	};
+
+	// Once every tile has its new heights, the normals and tangents and how
+	// far each tile is from still: the largest height, old or new.
+	auto frameRuns = [&](UINT begin, UINT end)
+	{
+		FlushDenormals flush;
+		for (UINT r = begin; r < end; ++r)
 		{
-			for (int j = 1; j < col_count_ - 1; ++j)
+			const TileRun& run = step_runs_[r];
+			UINT i0, i1, j0, j1;
+			runRect(run, i0, i1, j0, j1);
+			float* amplitude = &tile_amplitude_[run.FirstTile];
+			std::fill(amplitude, amplitude + run.TileCount, 0.f);
+			for (UINT i = i0; i < i1; ++i)
 			{
-				float left = curr_solution_[i*col_count_ + j - 1].y;
-				float right = curr_solution_[i*col_count_ + j + 1].y;
-				float top = curr_solution_[(i - 1)*col_count_ + j].y;
-				float bottom = curr_solution_[(i + 1)*col_count_ + j].y;
-				normals_[i*col_count_ + j].x = -right + left;
-				normals_[i*col_count_ + j].y = 2.f * spatial_step_;
-				normals_[i*col_count_ + j].z = bottom - top;
-
-				XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&normals_[i*col_count_ + j]));
-				XMStoreFloat3(&normals_[i*col_count_ + j], n);
-
-				tangentX_[i*col_count_ + j] = XMFLOAT3(2.f * spatial_step_, right - left, 0.f);
-				XMVECTOR T = XMVector3Normalize(XMLoadFloat3(&tangentX_[i*col_count_ + j]));
-				XMStoreFloat3(&tangentX_[i*col_count_ + j], T);
+				ComputeFrames(prev_solution_, i, j0, j1);
+
+				const UINT offset = i * col_count_;
+				for (UINT t = 0; t < run.TileCount; ++t)
+				{
+					UINT tileBegin = MathHelper::Max(j0, (run.FirstTile % tile_col_count_ + t) * TileCols);
+					UINT tileEnd = MathHelper::Min(j1, tileBegin - tileBegin % TileCols + TileCols);
+					amplitude[t] = MaxMagnitude(prev_solution_ + offset, curr_solution_ + offset, tileBegin, tileEnd,
+						amplitude[t]);
+				}
 			}
 		}
+	};
+
+	const UINT count = (UINT)step_runs_.size();
+	if (pool != nullptr && pool->ThreadCount() > 1 && step_tiles_.size() * TileRows * TileCols >= ParallelThreshold)
+	{
+		pool->ParallelFor(count, 1, stepRuns);
+		pool->ParallelFor(count, 1, frameRuns);
+	}
+	else
+	{
+		stepRuns(0, count);
+		frameRuns(0, count);
+	}
+
+	std::swap(prev_solution_, curr_solution_);
+
+	for (UINT tile : step_tiles_)
+	{
+		tile_awake_[tile] = tile_amplitude_[tile] > sleep_threshold_;
+	}
+
+	// A tile that has settled goes to sleep once no tile next to it is awake
+	// to send it waves; it's flattened to stay out of the steps.
+	for (UINT tile : step_tiles_)
+	{
+		if (tile_awake_[tile])
+		{
+			continue;
+		}
+
+		UINT ti = tile / tile_col_count_;
+		UINT tj = tile % tile_col_count_;
+		bool awakeNext = false;
+		for (UINT ni = ti > 0 ? ti - 1 : 0; ni <= MathHelper::Min(ti + 1, tileRows - 1); ++ni)
+		{
+			for (UINT nj = tj > 0 ? tj - 1 : 0; nj <= MathHelper::Min(tj + 1, tile_col_count_ - 1); ++nj)
+			{
+				awakeNext = awakeNext || tile_awake_[ni * tile_col_count_ + nj];
+			}
+		}
+		if (awakeNext)
+		{
+			continue;
+		}
+
+		UINT i0, i1, j0, j1;
+		TileRun run = { tile, 1 };
+		runRect(run, i0, i1, j0, j1);
+		for (UINT i = i0; i < i1; ++i)
+		{
+			const UINT offset = i * col_count_;
+			std::fill(prev_solution_ + offset + j0, prev_solution_ + offset + j1, 0.f);
+			std::fill(curr_solution_ + offset + j0, curr_solution_ + offset + j1, 0.f);
+			std::fill(normal_x_ + offset + j0, normal_x_ + offset + j1, 0.f);
+			std::fill(normal_y_ + offset + j0, normal_y_ + offset + j1, 1.f);
+			std::fill(normal_z_ + offset + j0, normal_z_ + offset + j1, 0.f);
+			std::fill(tangent_x_ + offset + j0, tangent_x_ + offset + j1, 1.f);
+			std::fill(tangent_y_ + offset + j0, tangent_y_ + offset + j1, 0.f);
+		}
+	}
+}
+
+void Waves::StepRows(UINT first, UINT last)
+{
+	for (UINT i = first; i < last; ++i)
+	{
+		StepSpan(i, 1, col_count_ - 1);
+
+		// The row above now has its new neighbours on both sides.
+		if (i > first && IsFramedInBand(i - 1, first, last))
+		{
+			ComputeFrames(prev_solution_, i - 1, 1, col_count_ - 1);
+		}
+	}
+
+	if (IsFramedInBand(last - 1, first, last))
+	{
+		ComputeFrames(prev_solution_, last - 1, 1, col_count_ - 1);
+	}
+}
+
+void Waves::StepSpan(UINT row, UINT begin, UINT end)
+{
+	const StepConstants k = { k1_, k2_, k3_ };
+	const UINT cols = col_count_;
+
+	// After this update we will be discarding the old previous
+	// buffer, so overwrite that buffer with the new update.
+	// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
+	// Moreover, our +z axis goes "down"; this is just to
+	// keep consistent with our row indices going down.
+	const float* prev = prev_solution_ + row * cols;
+	const float* curr = curr_solution_ + row * cols;
+	float* next = prev_solution_ + row * cols;
+
+	UINT j = begin;
+#if defined(_XM_SSE_INTRINSICS_)
+	j = HasAVX() ? StepRangeAVX(k, prev, curr - cols, curr, curr + cols, next, j, end) :
+		StepRangeSSE(k, prev, curr - cols, curr, curr + cols, next, j, end);
+#endif
+	StepRange(k, prev, curr - cols, curr, curr + cols, next, j, end);
+}
+
+bool Waves::IsFramedInBand(UINT row, UINT first, UINT last) const
+{
+	// The boundary rows never change.
+	bool above = row - 1 >= first || row - 1 == 0;
+	bool below = row + 1 < last || row + 1 == row_count_ - 1;
+	return above && below;
+}
+
+void Waves::ComputeFrames(const float* heights, UINT row, UINT begin, UINT end)
+{
+	// Compute normals using finite difference scheme.
+	const UINT cols = col_count_;
+	const UINT offset = row * cols;
+	const float* h = heights + offset;
+	const float twoDx = 2.f * spatial_step_;
+	float* nx = normal_x_ + offset;
+	float* ny = normal_y_ + offset;
+	float* nz = normal_z_ + offset;
+	float* tx = tangent_x_ + offset;
+	float* ty = tangent_y_ + offset;
+
+	UINT j = begin;
+#if defined(_XM_SSE_INTRINSICS_)
+	j = HasAVX() ? FrameRangeAVX(h - cols, h, h + cols, twoDx, nx, ny, nz, tx, ty, j, end) :
+		FrameRangeSSE(h - cols, h, h + cols, twoDx, nx, ny, nz, tx, ty, j, end);
+#endif
+	FrameRange(h - cols, h, h + cols, twoDx, nx, ny, nz, tx, ty, j, end);
+}
+
+void Waves::WriteVertices(void* dest, UINT stride, VertexLayout layout, ThreadPool* pool) const
+{
+	auto writeRows = [=](UINT begin, UINT end)
+	{
+		for (UINT i = begin; i < end; ++i)
+		{
+			BYTE* rowDest = (BYTE*)dest + (size_t)i * col_count_ * stride;
+			switch (layout)
+			{
+			case LayoutPosition:
+				WriteRow<LayoutPosition>(i, rowDest, stride);
+				break;
+			case LayoutPositionNormal:
+				WriteRow<LayoutPositionNormal>(i, rowDest, stride);
+				break;
+			default:
+				WriteRow<LayoutPositionNormalTex>(i, rowDest, stride);
+				break;
+			}
+		}
+	};
+
+	if (pool != nullptr && pool->ThreadCount() > 1 && vertex_count_ >= ParallelThreshold)
+	{
+		pool->ParallelFor(row_count_, BandRows, writeRows);
+	}
+	else
+	{
+		writeRows(0, row_count_);
+	}
+}
+
+template<Waves::VertexLayout Layout>
+void Waves::WriteRow(UINT row, BYTE* dest, UINT stride) const
+{
+	const UINT cols = col_count_;
+	const UINT offset = row * cols;
+	const float* y = curr_solution_ + offset;
+	const float* nx = normal_x_ + offset;
+	const float* ny = normal_y_ + offset;
+	const float* nz = normal_z_ + offset;
+	const float z = row_z_[row];
+	const float v = row_v_[row];
+
+	UINT j = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+	// Four vertices at a time, turned from columns into rows, so that a
+	// vertex takes one or two stores.  Writes into a mapped buffer go out in
+	// order, a whole vertex at a time.
+	if (Layout != LayoutPosition)
+	{
+		__m128 zs = _mm_set1_ps(z);
+		__m128 vs = _mm_set1_ps(v);
+		for (; j + 4 <= cols; j += 4)
+		{
+			__m128 a0 = _mm_loadu_ps(column_x_ + j);
+			__m128 a1 = _mm_loadu_ps(y + j);
+			__m128 a2 = zs;
+			__m128 a3 = _mm_loadu_ps(nx + j);
+			_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+
+			__m128 b0 = _mm_loadu_ps(ny + j);
+			__m128 b1 = _mm_loadu_ps(nz + j);
+			__m128 b2 = _mm_loadu_ps(column_u_ + j);
+			__m128 b3 = vs;
+			_MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+
+			const __m128 a[4] = { a0, a1, a2, a3 };
+			const __m128 b[4] = { b0, b1, b2, b3 };
+			for (int k = 0; k < 4; ++k)
+			{
+				float* vertex = (float*)(dest + (j + k) * stride);
+				_mm_storeu_ps(vertex, a[k]);
+				if (Layout == LayoutPositionNormalTex)
+				{
+					_mm_storeu_ps(vertex + 4, b[k]);
+				}
+				else
+				{
+					_mm_storel_pi((__m64*)(vertex + 4), b[k]);
+				}
+			}
+		}
+	}
+#endif
+
+	for (; j < cols; ++j)
+	{
+		float* vertex = (float*)(dest + j * stride);
+		vertex[0] = column_x_[j];
+		vertex[1] = y[j];
+		vertex[2] = z;
+		if (Layout != LayoutPosition)
+		{
+			vertex[3] = nx[j];
+			vertex[4] = ny[j];
+			vertex[5] = nz[j];
+		}
+		if (Layout == LayoutPositionNormalTex)
+		{
+			vertex[6] = column_u_[j];
+			vertex[7] = v;
+		}
 	}
 }
 
@@ -175,9 +868,18 @@ void Waves::Disturb(UINT rowth, UINT colth, float magnitude)
 	float mag_half = 0.5f * magnitude;
 
 	// Disturb the ijth vertex height and its neighbors.
-	curr_solution_[rowth*col_count_ + colth].y += magnitude;
-	curr_solution_[rowth*col_count_ + colth + 1].y += mag_half;
-	curr_solution_[rowth*col_count_ + colth - 1].y += mag_half;
-	curr_solution_[(rowth + 1)*col_count_ + colth].y += mag_half;
-	curr_solution_[(rowth - 1)*col_count_ + colth].y += mag_half;
-}
\ No newline at end of file
+	curr_solution_[rowth*col_count_ + colth] += magnitude;
+	curr_solution_[rowth*col_count_ + colth + 1] += mag_half;
+	curr_solution_[rowth*col_count_ + colth - 1] += mag_half;
+	curr_solution_[(rowth + 1)*col_count_ + colth] += mag_half;
+	curr_solution_[(rowth - 1)*col_count_ + colth] += mag_half;
+
+	// Wake the tiles the disturbance touches.
+	for (UINT i = rowth - 1; i <= rowth + 1; i += 2)
+	{
+		for (UINT j = colth - 1; j <= colth + 1; j += 2)
+		{
+			tile_awake_[(i / TileRows) * tile_col_count_ + j / TileCols] = 1;
+		}
+	}
+}
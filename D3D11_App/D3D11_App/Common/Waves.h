@@ -2,9 +2,15 @@
 
 #include <windows.h>
 #include <DirectXMath.h>
+#include <vector>
 
 using namespace DirectX;
 
+class ThreadPool;
+
+// Finite difference solution of the wave equation on a grid.  Heights,
+// normals and tangents are kept in separate aligned arrays of floats, row by
+// row; the x and z of the grid points never change after Init.
 class Waves
 {
 public:
@@ -19,27 +25,101 @@ public:
 	float Depth() const;
 
 	// Returns the solution at the ith grid point.
-	const XMFLOAT3& operator[] (int i) const
+	XMFLOAT3 operator[] (int i) const
 	{
-		return curr_solution_[i];
+		return XMFLOAT3(column_x_[i % col_count_], curr_solution_[i], row_z_[i / col_count_]);
 	}
 
 	// Returns the solution normal at the ith grid point.
-	const XMFLOAT3& Normal(int i) const
+	XMFLOAT3 Normal(int i) const
 	{
-		return normals_[i];
+		return XMFLOAT3(normal_x_[i], normal_y_[i], normal_z_[i]);
 	}
 
 	// Returns the unit tangent vector at the ith grid point in the local x-axis direction.
-	const XMFLOAT3& TangentX(int i) const
+	XMFLOAT3 TangentX(int i) const
 	{
-		return tangentX_[i];
+		return XMFLOAT3(tangent_x_[i], tangent_y_[i], 0.f);
 	}
 
+	// Returns the heights of the solution, row by row.
+	const float* Heights() const;
+
+	// What WriteVertices writes of a vertex, packed from its start: the
+	// position, the normal and the texture coordinates, as XMFLOAT3, XMFLOAT3
+	// and XMFLOAT2.
+	enum VertexLayout
+	{
+		LayoutPosition,
+		LayoutPositionNormal,
+		LayoutPositionNormalTex
+	};
+
+	// Writes the solution at every grid point, row by row, as vertices of
+	// the layout stride bytes apart, straight into a mapped vertex buffer
+	// or any other destination.  Bytes of a vertex past the layout are left
+	// alone.  The texture coordinates are derived from the position the way
+	// the demos did: 0.5 + x / Width() and 0.5 - z / Depth().  Rows are
+	// split across the threads of the pool on grids of ParallelThreshold
+	// points or more.
+	void WriteVertices(void* dest, UINT stride, VertexLayout layout, ThreadPool* pool = nullptr) const;
+
 	void Init(UINT rows, UINT cols, float dx, float dt, float speed, float damping);
-	void Update(float dt);
+
+	// Advances the solution by as many fixed time steps as the accumulated
+	// time holds, at most the sub-step cap; time left over past the cap is
+	// dropped so that slow frames don't pile up work for the next ones.
+	// Returns the number of steps taken.  The new heights and the normals and
+	// tangents are computed in one sweep over the rows, eight or four points
+	// at a time, and on grids of ParallelThreshold points or more the rows
+	// are split into bands across the threads of the pool.
+	UINT Update(float dt, ThreadPool* pool = nullptr);
 	void Disturb(UINT rowth, UINT colth, float magnitude);
 
+	void SetMaxSubSteps(UINT count);
+
+	// With a threshold above zero, the grid is stepped in tiles, and only
+	// the tiles that are awake and the tiles around them are stepped.  A
+	// tile wakes when disturbed and falls asleep, flattened, once no height
+	// in it has gone past the threshold over a step and no tile next to it
+	// is awake.  Zero steps the whole grid.
+	void SetSleepThreshold(float amplitude);
+	UINT AwakeTileCount() const;
+	float TimeStep() const;
+
+	// Copies the heights, normals and tangents of a grid initialized the
+	// same way.
+	void CopySolution(const Waves& source);
+
+	static const UINT ParallelThreshold = 1 << 16;
+	static const UINT DefaultMaxSubSteps = 4;
+
+private:
+	Waves(const Waves& rhs);
+	Waves& operator=(const Waves& rhs);
+
+	void Release();
+
+	// One time step of the whole grid.
+	void Step(ThreadPool* pool);
+	void StepAwakeTiles(ThreadPool* pool);
+
+	// Steps the points [begin, end) of an interior row.
+	void StepSpan(UINT row, UINT begin, UINT end);
+
+	// Steps interior rows [first, last), writing the new heights over the
+	// previous solution, and computes the normals and tangents of the rows
+	// whose neighbours are all done by then.
+	void StepRows(UINT first, UINT last);
+
+	// Normals and tangents of a row of the new solution once the rows
+	// around it have been stepped.
+	bool IsFramedInBand(UINT row, UINT first, UINT last) const;
+	void ComputeFrames(const float* heights, UINT row, UINT begin, UINT end);
+
+	template<VertexLayout Layout>
+	void WriteRow(UINT row, BYTE* dest, UINT stride) const;
+
 private:
 	UINT row_count_;
 	UINT col_count_;
@@ -53,10 +133,34 @@ private:
 
 	float time_delta_;
 	float time_step_;
+	UINT max_sub_steps_;
 	float spatial_step_;
 
-	XMFLOAT3* prev_solution_;
-	XMFLOAT3* curr_solution_;
-	XMFLOAT3* normals_;
-	XMFLOAT3* tangentX_;
-};
\ No newline at end of file
+	float* prev_solution_;
+	float* curr_solution_;
+	float* column_x_;
+	float* row_z_;
+	float* column_u_;
+	float* row_v_;
+	float* normal_x_;
+	float* normal_y_;
+	float* normal_z_;
+	float* tangent_x_;
+	float* tangent_y_;
+
+	// Tiles next to each other in a row of tiles.
+	struct TileRun
+	{
+		UINT FirstTile;
+		UINT TileCount;
+	};
+
+	// Tiles row by row, and the tiles stepped in the current step.
+	float sleep_threshold_;
+	UINT tile_col_count_;
+	std::vector<BYTE> tile_awake_;
+	std::vector<BYTE> tile_stepped_;
+	std::vector<float> tile_amplitude_;
+	std::vector<UINT> step_tiles_;
+	std::vector<TileRun> step_runs_;
+};
@@ -0,0 +1,166 @@
+#include "WavesSimulator.h"
+
+WavesSimulator::WavesSimulator()
+	: m_Pool(nullptr)
+	, m_Front(0)
+	, m_Back(1)
+	, m_Middle(2)
+	, m_PendingTime(0.f)
+	, m_MaxSubSteps(Waves::DefaultMaxSubSteps)
+	, m_Quit(false)
+	, m_StepCount(0)
+{
+
+}
+
+WavesSimulator::~WavesSimulator()
+{
+	Shutdown();
+}
+
+void WavesSimulator::Init(UINT rows, UINT cols, float dx, float dt, float speed, float damping, bool threaded,
+	ThreadPool* pool)
+{
+	Shutdown();
+
+	m_Pool = pool;
+	m_Waves.Init(rows, cols, dx, dt, speed, damping);
+	m_Waves.SetMaxSubSteps(m_MaxSubSteps);
+	m_StepCount = 0;
+
+	if (!threaded)
+	{
+		return;
+	}
+
+	for (Waves& frame : m_Frames)
+	{
+		frame.Init(rows, cols, dx, dt, speed, damping);
+	}
+	m_Front = 0;
+	m_Back = 1;
+	m_Middle = 2;
+	m_PendingTime = 0.f;
+	m_PendingDisturbances.clear();
+	m_Quit = false;
+
+	m_Thread = std::thread(&WavesSimulator::WorkerMain, this);
+}
+
+void WavesSimulator::Shutdown()
+{
+	if (!m_Thread.joinable())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Quit = true;
+	}
+	m_WorkReady.notify_one();
+	m_Thread.join();
+}
+
+void WavesSimulator::SetMaxSubSteps(UINT count)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_MaxSubSteps = count;
+	if (!IsThreaded())
+	{
+		m_Waves.SetMaxSubSteps(count);
+	}
+}
+
+void WavesSimulator::Disturb(UINT rowth, UINT colth, float magnitude)
+{
+	if (!IsThreaded())
+	{
+		m_Waves.Disturb(rowth, colth, magnitude);
+		return;
+	}
+
+	Disturbance disturbance = { rowth, colth, magnitude };
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_PendingDisturbances.push_back(disturbance);
+}
+
+void WavesSimulator::Update(float dt)
+{
+	if (!IsThreaded())
+	{
+		m_StepCount += m_Waves.Update(dt, m_Pool);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_PendingTime += dt;
+	}
+	m_WorkReady.notify_one();
+
+	// Take the newest solution, leaving ours for the worker to fill next.
+	if (m_Middle.load() & FreshBit)
+	{
+		m_Front = m_Middle.exchange(m_Front) & ~FreshBit;
+	}
+}
+
+const Waves& WavesSimulator::Solution() const
+{
+	return IsThreaded() ? m_Frames[m_Front] : m_Waves;
+}
+
+bool WavesSimulator::IsThreaded() const
+{
+	return m_Thread.joinable();
+}
+
+UINT WavesSimulator::StepCount() const
+{
+	return m_StepCount;
+}
+
+void WavesSimulator::WorkerMain()
+{
+	std::vector<Disturbance> disturbances;
+	for (;;)
+	{
+		float time;
+		UINT maxSubSteps;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_WorkReady.wait(lock, [this]()
+			{
+				return m_Quit || m_PendingTime > 0.f || !m_PendingDisturbances.empty();
+			});
+			if (m_Quit)
+			{
+				return;
+			}
+
+			time = m_PendingTime;
+			m_PendingTime = 0.f;
+			maxSubSteps = m_MaxSubSteps;
+			disturbances.swap(m_PendingDisturbances);
+		}
+
+		for (const Disturbance& d : disturbances)
+		{
+			m_Waves.Disturb(d.Row, d.Column, d.Magnitude);
+		}
+
+		m_Waves.SetMaxSubSteps(maxSubSteps);
+		UINT steps = m_Waves.Update(time, m_Pool);
+		m_StepCount += steps;
+
+		if (steps > 0 || !disturbances.empty())
+		{
+			// Publish the new solution, taking the one in the middle back
+			// unless the render thread has swapped it for its own.
+			m_Frames[m_Back].CopySolution(m_Waves);
+			m_Back = m_Middle.exchange(m_Back | FreshBit) & ~FreshBit;
+		}
+		disturbances.clear();
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Waves.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs a Waves grid at its fixed time step, either on the calling thread or
+// on a worker thread of its own.
+//
+// On the worker, the solution is published into one of three copies of the
+// grid: the worker fills one, the newest finished one waits in the middle,
+// and the render thread reads the third.  Update hands the frame time and
+// the queued disturbances to the worker and, if a newer solution is waiting,
+// swaps it for the one it was reading, so the render thread never waits for
+// a step.
+class WavesSimulator
+{
+public:
+	WavesSimulator();
+	~WavesSimulator();
+
+	// Starts the worker thread if threaded is set.  The pool, if any, is used
+	// only by the thread doing the steps, so with a worker it must not be
+	// used by other threads.
+	void Init(UINT rows, UINT cols, float dx, float dt, float speed, float damping, bool threaded,
+		ThreadPool* pool = nullptr);
+
+	// Ends the worker thread, if any, after its current steps.
+	void Shutdown();
+
+	void SetMaxSubSteps(UINT count);
+
+	// Queued for the worker and applied before its next steps.
+	void Disturb(UINT rowth, UINT colth, float magnitude);
+
+	// Advances the simulation by dt.  Without a worker, steps the grid right
+	// here; with one, passes dt on and picks up the newest solution.
+	void Update(float dt);
+
+	// The solution the render thread is reading, left alone until the next
+	// Update.
+	const Waves& Solution() const;
+
+	bool IsThreaded() const;
+
+	// Steps taken so far.
+	UINT StepCount() const;
+
+private:
+	WavesSimulator(const WavesSimulator& rhs);
+	WavesSimulator& operator=(const WavesSimulator& rhs);
+
+	struct Disturbance
+	{
+		UINT Row;
+		UINT Column;
+		float Magnitude;
+	};
+
+	void WorkerMain();
+
+private:
+	// The bit set on the middle copy while the render thread hasn't taken it.
+	static const UINT FreshBit = 4;
+
+	Waves m_Waves;
+	Waves m_Frames[3];
+	ThreadPool* m_Pool;
+
+	// The copy the render thread reads, the one the worker writes, and the
+	// one in between with FreshBit.
+	UINT m_Front;
+	UINT m_Back;
+	std::atomic<UINT> m_Middle;
+
+	std::thread m_Thread;
+	std::mutex m_Mutex;
+	std::condition_variable m_WorkReady;
+	float m_PendingTime;
+	UINT m_MaxSubSteps;
+	std::vector<Disturbance> m_PendingDisturbances;
+	bool m_Quit;
+
+	std::atomic<UINT> m_StepCount;
+};
@@ -27,6 +27,16 @@ cbuffer cbPerFrame
     float2 gTexScale = 50.0f;
 
     float4 gWorldFrustumPlanes[6];
+
+    // LOD grid: quads along a node side, the terrain width and depth, and
+    // per level the distance morphing starts at and one over its length.
+    float gLodGridCells;
+    float2 gTerrainSize;
+    float4 gLodMorph[16];
+
+    // Sample the normals baked offline instead of working them out from
+    // the heightmap.
+    bool gUseNormalMap;
 }
 
 cbuffer cbPerObject
@@ -41,6 +51,7 @@ cbuffer cbPerObject
 Texture2DArray gLayerMapArray;
 Texture2D gBlendMap;
 Texture2D gHeightMap;
+Texture2D gNormalMap;
 
 SamplerState samLinear
 {
@@ -259,26 +270,87 @@ DomainOut DS(PatchTess patchTess,
 }
 
 
+struct LodVertexIn
+{
+    float2 GridPos : POSITION;
+
+    // Corner of the node at the smallest x and largest z, the side of a
+    // node of the level and the level.
+    float4 Node : NODE;
+};
+
+float3 LodGridToWorld(float2 gridPos, float4 node)
+{
+    float spacing = node.z / gLodGridCells;
+    float3 posW = float3(node.x + gridPos.x * spacing, 0.0f, node.y - gridPos.y * spacing);
+
+    // Quarter nodes on the far edges of maps that are not a power of two
+    // across reach past the terrain.
+    float2 halfSize = 0.5f * gTerrainSize;
+    posW.xz = clamp(posW.xz, -halfSize, halfSize);
+
+    return posW;
+}
+
+float2 LodTex(float3 posW)
+{
+    return float2(0.5f + posW.x / gTerrainSize.x, 0.5f - posW.z / gTerrainSize.y);
+}
+
+// Replaces the tessellation stages when the LOD grid is drawn; the output
+// feeds the same pixel shader.
+DomainOut LodVS(LodVertexIn vin)
+{
+    DomainOut vout;
+
+    float3 posW = LodGridToWorld(vin.GridPos, vin.Node);
+    posW.y = gHeightMap.SampleLevel(samLinear, LodTex(posW), 0).r;
+
+    // Slide the odd vertices onto their even neighbours towards the end of
+    // the range of the level, where the grid meets that of the next level.
+    float4 morph = gLodMorph[(int)vin.Node.w];
+    float k = saturate((distance(posW, gEyePosW) - morph.x) * morph.y);
+    float2 gridPos = vin.GridPos - frac(0.5f * vin.GridPos) * 2.0f * k;
+
+    vout.PosW = LodGridToWorld(gridPos, vin.Node);
+    vout.Tex = LodTex(vout.PosW);
+    vout.TiledTex = vout.Tex * gTexScale;
+    vout.PosW.y = gHeightMap.SampleLevel(samLinear, vout.Tex, 0).r;
+
+    vout.PosH = mul(float4(vout.PosW, 1.0f), gViewProj);
+
+    return vout;
+}
+
 float4 PS(DomainOut pin,
             uniform int gLightCount,
             uniform bool gFogEnabled) : SV_Target
 {
-    //
-	// Estimate normal and tangent using central differences.
-	//
-    float2 leftTex = pin.Tex + float2(-gTexelCellSpaceU, 0.0f);
-    float2 rightTex = pin.Tex + float2(gTexelCellSpaceU, 0.0f);
-    float2 bottomTex = pin.Tex + float2(0.0f, gTexelCellSpaceV);
-    float2 topTex = pin.Tex + float2(0.0f, -gTexelCellSpaceV);
-
-    float leftY = gHeightMap.SampleLevel(samLinear, leftTex, 0).r;
-    float rightY = gHeightMap.SampleLevel(samLinear, rightTex, 0).r;
-    float bottomY = gHeightMap.SampleLevel(samLinear, bottomTex, 0).r;
-    float topY = gHeightMap.SampleLevel(samLinear, topTex, 0).r;
-
-    float3 tangent = normalize(float3(2.0f * gWorldCellSpace, rightY - leftY, 0.0f));
-    float3 bitan = normalize(float3(0.0f, bottomY - topY, -2.0f * gWorldCellSpace));
-    float3 normalW = cross(tangent, bitan);
+    float3 normalW;
+    if (gUseNormalMap)
+    {
+        // Baked with the same central differences as below.
+        normalW = normalize(gNormalMap.Sample(samLinear, pin.Tex).xyz);
+    }
+    else
+    {
+        //
+        // Estimate normal and tangent using central differences.
+        //
+        float2 leftTex = pin.Tex + float2(-gTexelCellSpaceU, 0.0f);
+        float2 rightTex = pin.Tex + float2(gTexelCellSpaceU, 0.0f);
+        float2 bottomTex = pin.Tex + float2(0.0f, gTexelCellSpaceV);
+        float2 topTex = pin.Tex + float2(0.0f, -gTexelCellSpaceV);
+
+        float leftY = gHeightMap.SampleLevel(samLinear, leftTex, 0).r;
+        float rightY = gHeightMap.SampleLevel(samLinear, rightTex, 0).r;
+        float bottomY = gHeightMap.SampleLevel(samLinear, bottomTex, 0).r;
+        float topY = gHeightMap.SampleLevel(samLinear, topTex, 0).r;
+
+        float3 tangent = normalize(float3(2.0f * gWorldCellSpace, rightY - leftY, 0.0f));
+        float3 bitan = normalize(float3(0.0f, bottomY - topY, -2.0f * gWorldCellSpace));
+        normalW = cross(tangent, bitan);
+    }
 
     // The toEye vector is used in lighting.
     float3 toEye = gEyePosW - pin.PosW;
@@ -424,3 +496,75 @@ technique11 Light3Fog
         SetPixelShader(CompileShader(ps_5_0, PS(3, true)));
     }
 }
+
+technique11 Light1Lod
+{
+    pass P0
+    {
+        SetVertexShader(CompileShader(vs_5_0, LodVS()));
+        SetHullShader(NULL);
+        SetDomainShader(NULL);
+        SetGeometryShader(NULL);
+        SetPixelShader(CompileShader(ps_5_0, PS(1, false)));
+    }
+}
+
+technique11 Light1LodFog
+{
+    pass P0
+    {
+        SetVertexShader(CompileShader(vs_5_0, LodVS()));
+        SetHullShader(NULL);
+        SetDomainShader(NULL);
+        SetGeometryShader(NULL);
+        SetPixelShader(CompileShader(ps_5_0, PS(1, true)));
+    }
+}
+
+technique11 Light2Lod
+{
+    pass P0
+    {
+        SetVertexShader(CompileShader(vs_5_0, LodVS()));
+        SetHullShader(NULL);
+        SetDomainShader(NULL);
+        SetGeometryShader(NULL);
+        SetPixelShader(CompileShader(ps_5_0, PS(2, false)));
+    }
+}
+
+technique11 Light2LodFog
+{
+    pass P0
+    {
+        SetVertexShader(CompileShader(vs_5_0, LodVS()));
+        SetHullShader(NULL);
+        SetDomainShader(NULL);
+        SetGeometryShader(NULL);
+        SetPixelShader(CompileShader(ps_5_0, PS(2, true)));
+    }
+}
+
+technique11 Light3Lod
+{
+    pass P0
+    {
+        SetVertexShader(CompileShader(vs_5_0, LodVS()));
+        SetHullShader(NULL);
+        SetDomainShader(NULL);
+        SetGeometryShader(NULL);
+        SetPixelShader(CompileShader(ps_5_0, PS(3, false)));
+    }
+}
+
+technique11 Light3LodFog
+{
+    pass P0
+    {
+        SetVertexShader(CompileShader(vs_5_0, LodVS()));
+        SetHullShader(NULL);
+        SetDomainShader(NULL);
+        SetGeometryShader(NULL);
+        SetPixelShader(CompileShader(ps_5_0, PS(3, true)));
+    }
+}